@@ -0,0 +1,402 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2012 johannes hanika.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * darktable-bench: runs the export pixelpipe on one image a couple of times and
+ * writes wall times, the time spent in every module, the peak memory and what the
+ * tiling code decided as json. the input is either an image file or a generated
+ * float image. opencl is off, the library lives in memory and config and cache go
+ * to a fresh directory, so the numbers only depend on the build and the machine.
+ */
+
+#include "common/darktable.h"
+#include "common/film.h"
+#include "common/image.h"
+#include "common/image_cache.h"
+#include "common/mipmap_cache.h"
+#include "common/exif.h"
+#include "control/conf.h"
+#include "develop/develop.h"
+#include "develop/imageop.h"
+#include "develop/pixelpipe.h"
+
+#include <glib/gstdio.h>
+#include <sys/resource.h>
+#include <math.h>
+#include <inttypes.h>
+#include <libintl.h>
+
+static void
+usage(const char* progname)
+{
+  fprintf(stderr, "usage: %s [<input file>] [--xmp <xmp file>] [--synthetic <width>x<height>] [--runs <n>] [--warmup <n>] "
+          "[--width <max width>] [--height <max height>] [--memory-limit <MB>] [-t <threads>] [-d <debug>] [--trace <trace file>] [--output <json file>]\n", progname);
+  fprintf(stderr, "without an input file, a synthetic float image of 4000x3000 pixels is used.\n");
+}
+
+// a float image with structure on several scales, highlights above 1 and a bit of noise, as pfm.
+// the same size gives the same pixels on every machine.
+static int
+write_synthetic(const char *filename, const int width, const int height)
+{
+  FILE *f = fopen(filename, "wb");
+  if(!f) return 1;
+  fprintf(f, "PF\n%d %d\n-1.0\n", width, height);
+  float *line = (float *)malloc(sizeof(float)*3*width);
+  uint32_t seed = 1;
+  int err = 0;
+  for(int j=0; j<height && !err; j++)
+  {
+    const float y = j/(float)height;
+    for(int i=0; i<width; i++)
+    {
+      const float x = i/(float)width;
+      const float v = 0.4f + 0.25f*sinf(13.0f*x)*cosf(7.0f*y) + 0.15f*sinf(97.0f*x*y)
+                      + (((i/64) + (j/64)) & 1 ? 0.05f : -0.05f);
+      // a bright disc, to have something to recover
+      const float d = (x-0.7f)*(x-0.7f) + (y-0.3f)*(y-0.3f);
+      const float hi = d < 0.01f ? 4.0f*(0.01f - d)/0.01f : 0.0f;
+      for(int c=0; c<3; c++)
+      {
+        seed = seed*1664525u + 1013904223u;
+        line[3*i+c] = fmaxf(v*(0.6f + 0.2f*c) + hi + 0.02f*(seed/4294967296.0f - 0.5f), 0.0f);
+      }
+    }
+    err = fwrite(line, sizeof(float)*3, width, f) != (size_t)width;
+  }
+  free(line);
+  err |= fclose(f) != 0;
+  return err;
+}
+
+static void
+remove_tree(const char *path)
+{
+  GDir *dir = g_dir_open(path, 0, NULL);
+  if(dir)
+  {
+    const gchar *name;
+    while((name = g_dir_read_name(dir)))
+    {
+      gchar *child = g_build_filename(path, name, NULL);
+      if(g_file_test(child, G_FILE_TEST_IS_DIR) && !g_file_test(child, G_FILE_TEST_IS_SYMLINK)) remove_tree(child);
+      else g_unlink(child);
+      g_free(child);
+    }
+    g_dir_close(dir);
+  }
+  g_rmdir(path);
+}
+
+static void
+json_string(FILE *f, const char *s)
+{
+  fputc('"', f);
+  for(; *s; s++)
+  {
+    if(*s == '"' || *s == '\\') fprintf(f, "\\%c", *s);
+    else if((unsigned char)*s < 0x20) fprintf(f, "\\u%04x", *s);
+    else fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+  const double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *arg[])
+{
+  bindtextdomain (GETTEXT_PACKAGE, DARKTABLE_LOCALEDIR);
+  bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
+  textdomain (GETTEXT_PACKAGE);
+
+  gtk_init (&argc, &arg);
+
+  // parse command line arguments
+
+  char *image_filename = NULL;
+  char *xmp_filename = NULL;
+  char *output_filename = NULL;
+  char *threads = NULL, *debug = NULL, *trace = NULL;
+  int synthetic_width = 4000, synthetic_height = 3000;
+  int runs = 5, warmup = 1;
+  int width = 0, height = 0, memory_limit = -1;
+
+  for(int k=1; k<argc; k++)
+  {
+    if(arg[k][0] == '-')
+    {
+      if(!strcmp(arg[k], "--help"))
+      {
+        usage(arg[0]);
+        exit(1);
+      }
+      else if(k+1 >= argc)
+      {
+        usage(arg[0]);
+        exit(1);
+      }
+      else if(!strcmp(arg[k], "--xmp"))
+        xmp_filename = arg[++k];
+      else if(!strcmp(arg[k], "--synthetic"))
+      {
+        if(sscanf(arg[++k], "%dx%d", &synthetic_width, &synthetic_height) != 2 ||
+           synthetic_width < 16 || synthetic_height < 16)
+        {
+          usage(arg[0]);
+          exit(1);
+        }
+      }
+      else if(!strcmp(arg[k], "--runs"))
+        runs = MAX(atoi(arg[++k]), 1);
+      else if(!strcmp(arg[k], "--warmup"))
+        warmup = MAX(atoi(arg[++k]), 0);
+      else if(!strcmp(arg[k], "--width"))
+        width = MAX(atoi(arg[++k]), 0);
+      else if(!strcmp(arg[k], "--height"))
+        height = MAX(atoi(arg[++k]), 0);
+      else if(!strcmp(arg[k], "--memory-limit"))
+        memory_limit = MAX(atoi(arg[++k]), 0);
+      else if(!strcmp(arg[k], "--output"))
+        output_filename = arg[++k];
+      else if(!strcmp(arg[k], "-t"))
+        threads = arg[++k];
+      else if(!strcmp(arg[k], "-d"))
+        debug = arg[++k];
+      else if(!strcmp(arg[k], "--trace"))
+        trace = arg[++k];
+      else
+      {
+        usage(arg[0]);
+        exit(1);
+      }
+    }
+    else if(!image_filename)
+      image_filename = arg[k];
+    else
+    {
+      usage(arg[0]);
+      exit(1);
+    }
+  }
+
+  // config and cache of the user would make the results depend on the box they were taken on:
+  gchar *basedir = g_dir_make_tmp("darktable-bench-XXXXXX", NULL);
+  if(!basedir)
+  {
+    fprintf(stderr, "[darktable-bench] can't create a temporary directory\n");
+    exit(1);
+  }
+
+  char *m_arg[16];
+  int m_argc = 0;
+  m_arg[m_argc++] = "darktable-bench";
+  m_arg[m_argc++] = "--library";
+  m_arg[m_argc++] = ":memory:";
+  m_arg[m_argc++] = "--configdir";
+  m_arg[m_argc++] = basedir;
+  m_arg[m_argc++] = "--cachedir";
+  m_arg[m_argc++] = basedir;
+  m_arg[m_argc++] = "--disable-opencl";
+  if(threads)
+  {
+    m_arg[m_argc++] = "-t";
+    m_arg[m_argc++] = threads;
+  }
+  if(debug)
+  {
+    m_arg[m_argc++] = "-d";
+    m_arg[m_argc++] = debug;
+  }
+  if(trace)
+  {
+    m_arg[m_argc++] = "--trace";
+    m_arg[m_argc++] = trace;
+  }
+  m_arg[m_argc] = NULL;
+  // init dt without gui:
+  if(dt_init(m_argc, m_arg, 0))
+  {
+    remove_tree(basedir);
+    exit(1);
+  }
+  // nothing but the numbers goes out of here:
+  dt_conf_set_bool("write_sidecar_files", FALSE);
+  if(memory_limit >= 0) dt_conf_set_int("host_memory_limit", memory_limit);
+
+  gchar *synthetic_filename = NULL;
+  if(!image_filename)
+  {
+    synthetic_filename = g_strdup_printf("%s/synthetic-%dx%d.pfm", basedir, synthetic_width, synthetic_height);
+    if(write_synthetic(synthetic_filename, synthetic_width, synthetic_height))
+    {
+      fprintf(stderr, "[darktable-bench] can't write %s\n", synthetic_filename);
+      dt_cleanup();
+      remove_tree(basedir);
+      exit(1);
+    }
+    image_filename = synthetic_filename;
+  }
+
+  dt_film_t film;
+  gchar *directory = g_path_get_dirname(image_filename);
+  const int filmid = dt_film_new(&film, directory);
+  g_free(directory);
+  const int id = dt_image_import(filmid, image_filename, TRUE);
+  if(!id)
+  {
+    fprintf(stderr, "[darktable-bench] can't open file %s\n", image_filename);
+    dt_cleanup();
+    remove_tree(basedir);
+    exit(1);
+  }
+
+  // attach xmp, if requested:
+  if(xmp_filename)
+  {
+    const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, id);
+    dt_image_t *image = dt_image_cache_write_get(darktable.image_cache, cimg);
+    dt_exif_xmp_read(image, xmp_filename, 1);
+    // don't write new xmp:
+    dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+    dt_image_cache_read_release(darktable.image_cache, image);
+  }
+
+  // set up the pipe the way dt_imageio_export_with_flags() does:
+  double t_load = dt_get_wtime();
+  dt_develop_t dev;
+  dt_dev_init(&dev, 0);
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, id, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING);
+  t_load = dt_get_wtime() - t_load;
+  dt_dev_load_image(&dev, id);
+  dt_dev_pixelpipe_t pipe;
+  if(!buf.buf || !dt_dev_pixelpipe_init_export(&pipe, dev.image_storage.width, dev.image_storage.height))
+  {
+    fprintf(stderr, "[darktable-bench] can't load %s or set up the pipe for it\n", image_filename);
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    dt_dev_cleanup(&dev);
+    dt_cleanup();
+    remove_tree(basedir);
+    exit(1);
+  }
+  dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, 1.0);
+  dt_dev_pixelpipe_create_nodes(&pipe, &dev);
+  dt_dev_pixelpipe_synch_all(&pipe, &dev);
+  dt_dev_pixelpipe_get_dimensions(&pipe, &dev, pipe.iwidth, pipe.iheight, &pipe.processed_width, &pipe.processed_height);
+
+  const double scalex = width  > 0 ? fminf(width /(double)pipe.processed_width,  1.0) : 1.0;
+  const double scaley = height > 0 ? fminf(height/(double)pipe.processed_height, 1.0) : 1.0;
+  const double scale = fminf(scalex, scaley);
+  const int processed_width  = scale*pipe.processed_width  + .5f;
+  const int processed_height = scale*pipe.processed_height + .5f;
+
+  // every run starts from the input, nothing may come out of the cache:
+  double *wall = (double *)malloc(sizeof(double)*runs);
+  double user = 0.0;
+  int failed = 0;
+  for(int r=-warmup; r<runs; r++)
+  {
+    if(r == 0) dt_dev_pixelpipe_clear_stats(&pipe);
+    dt_dev_pixelpipe_flush_caches(&pipe);
+    dt_times_t start, end;
+    dt_get_times(&start);
+    failed |= dt_dev_pixelpipe_process(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+    dt_get_times(&end);
+    if(r >= 0)
+    {
+      wall[r] = end.clock - start.clock;
+      user += end.user - start.user;
+    }
+  }
+
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+
+  FILE *f = output_filename ? fopen(output_filename, "wb") : stdout;
+  if(!f)
+  {
+    fprintf(stderr, "[darktable-bench] can't write %s\n", output_filename);
+    f = stdout;
+  }
+  double sorted[runs], sum = 0.0;
+  for(int r=0; r<runs; r++) sum += (sorted[r] = wall[r]);
+  qsort(sorted, runs, sizeof(double), compare_double);
+
+  fprintf(f, "{\n  \"version\": ");
+  json_string(f, PACKAGE_VERSION);
+  fprintf(f, ",\n  \"input\": ");
+  if(synthetic_filename) fprintf(f, "\"synthetic\"");
+  else json_string(f, image_filename);
+  fprintf(f, ",\n  \"xmp\": ");
+  if(xmp_filename) json_string(f, xmp_filename);
+  else fprintf(f, "null");
+  fprintf(f, ",\n  \"threads\": %d,\n", darktable.num_openmp_threads);
+  fprintf(f, "  \"host_memory_limit_mb\": %d,\n", dt_conf_get_int("host_memory_limit"));
+  fprintf(f, "  \"input_size\": [%d, %d],\n", pipe.iwidth, pipe.iheight);
+  fprintf(f, "  \"output_size\": [%d, %d],\n", processed_width, processed_height);
+  fprintf(f, "  \"scale\": %g,\n", scale);
+  fprintf(f, "  \"load_s\": %.6f,\n", t_load);
+  fprintf(f, "  \"warmup\": %d,\n  \"runs\": %d,\n", warmup, runs);
+  fprintf(f, "  \"failed\": %s,\n", failed ? "true" : "false");
+  fprintf(f, "  \"wall_s\": [");
+  for(int r=0; r<runs; r++) fprintf(f, "%s%.6f", r ? ", " : "", wall[r]);
+  fprintf(f, "],\n");
+  fprintf(f, "  \"wall_min_s\": %.6f,\n  \"wall_median_s\": %.6f,\n  \"wall_mean_s\": %.6f,\n",
+          sorted[0], runs & 1 ? sorted[runs/2] : 0.5*(sorted[runs/2-1] + sorted[runs/2]), sum/runs);
+  fprintf(f, "  \"user_s\": %.6f,\n", user/runs);
+  // kilobytes on linux
+  fprintf(f, "  \"peak_rss_kb\": %ld,\n", ru.ru_maxrss);
+  fprintf(f, "  \"modules\": [");
+  int first = 1;
+  for(GList *nodes = pipe.nodes; nodes; nodes = g_list_next(nodes))
+  {
+    const dt_dev_pixelpipe_iop_t *piece = (const dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(!piece->enabled) continue;
+    const dt_dev_pixelpipe_iop_stats_t *s = &piece->stats;
+    fprintf(f, "%s\n    {\"op\": ", first ? "" : ",");
+    json_string(f, piece->module->op);
+    fprintf(f, ", \"instance\": ");
+    json_string(f, piece->module->multi_name);
+    fprintf(f, ", \"runs\": %d, \"wall_s\": %.6f, \"user_s\": %.6f, ", s->runs,
+            s->runs ? s->wall/s->runs : 0.0, s->runs ? s->user/s->runs : 0.0);
+    fprintf(f, "\"tiled_runs\": %d, \"tiles\": [%d, %d], \"tiling_factor\": %g, \"tiling_overhead\": %zu}",
+            s->tiled, s->tiles_x, s->tiles_y, s->tiling_factor, s->tiling_overhead);
+    first = 0;
+  }
+  fprintf(f, "\n  ]\n}\n");
+  if(f != stdout) fclose(f);
+
+  free(wall);
+  dt_dev_pixelpipe_cleanup(&pipe);
+  dt_dev_cleanup(&dev);
+  dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+  dt_cleanup();
+  remove_tree(basedir);
+  g_free(basedir);
+  g_free(synthetic_filename);
+  return failed;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
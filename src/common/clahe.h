@@ -0,0 +1,301 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2010 Henrik Andersson.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DT_COMMON_CLAHE_H
+#define DT_COMMON_CLAHE_H
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xmmintrin.h>
+
+// contrast limited adaptive histogram equalization on a lightness map in [0,1].
+// dt_clahe_exact slides a (2*rad+1)^2 window over every pixel, dt_clahe_tiled computes
+// one clipped cdf per tile of about that size and interpolates bilinearly between tile centers.
+
+#define DT_CLAHE_BINS 256
+// the tiled version never uses more tiles than this along the longer image side, to bound lut memory:
+#define DT_CLAHE_MAX_TILES 64
+
+#define DT_CLAHE_BIN(f) ((unsigned int)((f)*(float)DT_CLAHE_BINS + 0.5))
+
+/** clips hist (bins+1 entries) at limit and redistributes the excess over all bins. */
+static inline void
+dt_clahe_clip(int *hist, const int bins, const int limit)
+{
+  int ce = 0, ceb = 0;
+  do
+  {
+    ceb = ce;
+    ce = 0;
+    for(int b = 0; b <= bins; b++)
+    {
+      int d = hist[b] - limit;
+      if(d > 0)
+      {
+        ce += d;
+        hist[b] = limit;
+      }
+    }
+
+    int d = (ce / (float)(bins + 1));
+    int m = ce % (bins + 1);
+    for(int h = 0; h <= bins; h++)
+      hist[h] += d;
+
+    if(m != 0)
+    {
+      int s = bins / (float)m;
+      for(int h = 0; h <= bins; h += s)
+        ++hist[h];
+    }
+  }
+  while(ce != ceb);
+}
+
+static void
+dt_clahe_exact(
+  const float *const lum,  // lightness, width*height
+  float *const out,        // equalized lightness, width*height
+  const int width,
+  const int height,
+  const int rad,
+  const float slope)
+{
+  const int bins = DT_CLAHE_BINS;
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j=0; j<height; j++)
+  {
+    int yMin = fmax(0, j - rad);
+    int yMax = fmin(height, j + rad + 1);
+    int h = yMax - yMin;
+
+    int xMin0 = fmax(0, 0-rad);
+    int xMax0 = fmin(width - 1, rad);
+
+    int hist[DT_CLAHE_BINS+1];
+    int clippedhist[DT_CLAHE_BINS+1];
+
+    /* initially fill histogram */
+    memset(hist, 0, (bins+1)*sizeof(int));
+    for(int yi = yMin; yi < yMax; ++yi)
+      for(int xi = xMin0; xi < xMax0; ++xi)
+        ++hist[DT_CLAHE_BIN(lum[yi*width+xi])];
+
+    float *ld = out + (size_t)j*width;
+    for(int i=0; i<width; i++)
+    {
+      int v = DT_CLAHE_BIN(lum[j*width+i]);
+
+      int xMin = fmax(0, i - rad);
+      int xMax = i + rad + 1;
+      int w = fmin(width, xMax) - xMin;
+      int n = h * w;
+
+      int limit = (int)(slope * n / bins + 0.5f);
+
+      /* remove left behind values from histogram */
+      if(xMin > 0)
+      {
+        int xMin1 = xMin - 1;
+        for(int yi = yMin; yi < yMax; ++yi)
+          --hist[DT_CLAHE_BIN(lum[yi*width+xMin1])];
+      }
+
+      /* add newly included values to histogram */
+      if(xMax <= width)
+      {
+        int xMax1 = xMax - 1;
+        for(int yi = yMin; yi < yMax; ++yi)
+          ++hist[DT_CLAHE_BIN(lum[yi*width+xMax1])];
+      }
+
+      /* clip histogram and redistribute clipped entries */
+      memcpy(clippedhist, hist, (bins+1)*sizeof(int));
+      dt_clahe_clip(clippedhist, bins, limit);
+
+      /* build cdf of clipped histogram */
+      int hMin = bins;
+      for(int h = 0; h < hMin; h++)
+        if(clippedhist[h] != 0) hMin = h;
+
+      int cdf = 0;
+      for(int h = hMin; h <= v; h++)
+        cdf += clippedhist[h];
+
+      int cdfMax = cdf;
+      for(int h = v + 1; h <= bins; h++)
+        cdfMax += clippedhist[h];
+
+      int cdfMin = clippedhist[hMin];
+
+      *ld = (cdf - cdfMin) / (float)(cdfMax - cdfMin);
+      ld++;
+    }
+  }
+}
+
+static void
+dt_clahe_tiled(
+  const float *const lum,  // lightness, width*height
+  float *const out,        // equalized lightness, width*height
+  const int width,
+  const int height,
+  const int rad,
+  const float slope)
+{
+  const int bins = DT_CLAHE_BINS;
+  const int longest = width > height ? width : height;
+  int size = 2*rad+1;
+  if(size*DT_CLAHE_MAX_TILES < longest) size = (longest + DT_CLAHE_MAX_TILES - 1)/DT_CLAHE_MAX_TILES;
+  const int nx = (width  + size/2)/size > 1 ? (width  + size/2)/size : 1;
+  const int ny = (height + size/2)/size > 1 ? (height + size/2)/size : 1;
+  float *const lut = (float *)dt_alloc_align(64, sizeof(float)*nx*ny*(bins+1));
+
+  // one clipped, normalized cdf per tile:
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) schedule(dynamic)
+#endif
+  for(int t=0; t<nx*ny; t++)
+  {
+    const int tx = t % nx, ty = t / nx;
+    const int x0 = tx*width/nx, x1 = (tx+1)*width/nx;
+    const int y0 = ty*height/ny, y1 = (ty+1)*height/ny;
+    int hist[DT_CLAHE_BINS+1];
+    memset(hist, 0, (bins+1)*sizeof(int));
+    for(int j=y0; j<y1; j++)
+    {
+      const float *l = lum + (size_t)j*width;
+      for(int i=x0; i<x1; i++) ++hist[DT_CLAHE_BIN(l[i])];
+    }
+    const int n = (x1-x0)*(y1-y0);
+    const int limit = (int)(slope * n / bins + 0.5f);
+    dt_clahe_clip(hist, bins, limit);
+
+    int hMin = bins;
+    for(int h = 0; h < hMin; h++)
+      if(hist[h] != 0) hMin = h;
+    int cdfMax = 0;
+    for(int h = hMin; h <= bins; h++) cdfMax += hist[h];
+    const int cdfMin = hist[hMin];
+    const float norm = cdfMax > cdfMin ? 1.0f/(cdfMax - cdfMin) : 0.0f;
+
+    float *tl = lut + (size_t)t*(bins+1);
+    int cdf = 0;
+    for(int v = 0; v <= bins; v++)
+    {
+      if(v < hMin) tl[v] = 0.0f;
+      else
+      {
+        cdf += hist[v];
+        // a flat tile has nothing to equalize:
+        tl[v] = norm > 0.0f ? (cdf - cdfMin)*norm : v/(float)bins;
+      }
+    }
+  }
+
+  // interpolate between the four closest tile centers:
+  const float tw = width/(float)nx, th = height/(float)ny;
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j=0; j<height; j++)
+  {
+    const float fy = fminf(fmaxf((j + 0.5f)/th - 0.5f, 0.0f), ny - 1);
+    const int ty0 = (int)fy, ty1 = ty0 + 1 < ny ? ty0 + 1 : ty0;
+    const float wy = fy - ty0;
+    const float *const row0 = lut + (size_t)ty0*nx*(bins+1);
+    const float *const row1 = lut + (size_t)ty1*nx*(bins+1);
+    const float *l = lum + (size_t)j*width;
+    float *o = out + (size_t)j*width;
+    for(int i=0; i<width; i++)
+    {
+      const float fx = fminf(fmaxf((i + 0.5f)/tw - 0.5f, 0.0f), nx - 1);
+      const int tx0 = (int)fx, tx1 = tx0 + 1 < nx ? tx0 + 1 : tx0;
+      const float wx = fx - tx0;
+      const int v = DT_CLAHE_BIN(l[i]);
+      const float top = (1.0f-wx)*row0[tx0*(bins+1)+v] + wx*row0[tx1*(bins+1)+v];
+      const float bot = (1.0f-wx)*row1[tx0*(bins+1)+v] + wx*row1[tx1*(bins+1)+v];
+      o[i] = (1.0f-wy)*top + wy*bot;
+    }
+  }
+  free(lut);
+}
+
+/** replaces the hsl lightness of the rgba pixels by L, keeping hue and saturation.
+ * this is what rgb2hsl() followed by hsl2rgb() does, boiled down to out = L + (in - l)*f(L)/f(l)
+ * with f(x) = min(x, 1-x). alpha is passed through. */
+static void
+dt_clahe_apply(
+  const float *const in,
+  float *const out,
+  const float *const L,
+  const int width,
+  const int height)
+{
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j=0; j<height; j++)
+  {
+    const float *ir = in + (size_t)4*j*width;
+    float *orow = out + (size_t)4*j*width;
+    const float *lr = L + (size_t)j*width;
+    const __m128 half = _mm_set1_ps(0.5f), one = _mm_set1_ps(1.0f), zero = _mm_setzero_ps();
+    int i = 0;
+    for(; i+4<=width; i+=4)
+    {
+      __m128 r = _mm_load_ps(ir + 4*i), g = _mm_load_ps(ir + 4*i + 4);
+      __m128 b = _mm_load_ps(ir + 4*i + 8), a = _mm_load_ps(ir + 4*i + 12);
+      _MM_TRANSPOSE4_PS(r, g, b, a);
+      const __m128 mx = _mm_max_ps(r, _mm_max_ps(g, b));
+      const __m128 mn = _mm_min_ps(r, _mm_min_ps(g, b));
+      const __m128 l = _mm_mul_ps(_mm_add_ps(mx, mn), half);
+      const __m128 nl = _mm_loadu_ps(lr + i);
+      const __m128 fl = _mm_min_ps(l, _mm_sub_ps(one, l));
+      const __m128 fn = _mm_min_ps(nl, _mm_sub_ps(one, nl));
+      const __m128 k = _mm_and_ps(_mm_cmpneq_ps(fl, zero), _mm_div_ps(fn, fl));
+      r = _mm_add_ps(nl, _mm_mul_ps(_mm_sub_ps(r, l), k));
+      g = _mm_add_ps(nl, _mm_mul_ps(_mm_sub_ps(g, l), k));
+      b = _mm_add_ps(nl, _mm_mul_ps(_mm_sub_ps(b, l), k));
+      _MM_TRANSPOSE4_PS(r, g, b, a);
+      _mm_store_ps(orow + 4*i, r);
+      _mm_store_ps(orow + 4*i + 4, g);
+      _mm_store_ps(orow + 4*i + 8, b);
+      _mm_store_ps(orow + 4*i + 12, a);
+    }
+    for(; i<width; i++)
+    {
+      const float *p = ir + 4*i;
+      const float mx = fmaxf(p[0], fmaxf(p[1], p[2]));
+      const float mn = fminf(p[0], fminf(p[1], p[2]));
+      const float l = (mx + mn)*0.5f;
+      const float fl = fminf(l, 1.0f - l), fn = fminf(lr[i], 1.0f - lr[i]);
+      const float k = fl != 0.0f ? fn/fl : 0.0f;
+      for(int c=0; c<3; c++) orow[4*i+c] = lr[i] + (p[c] - l)*k;
+      orow[4*i+3] = p[3];
+    }
+  }
+}
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
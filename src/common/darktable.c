@@ -31,10 +31,12 @@
 #include "common/film.h"
 #include "common/image.h"
 #include "common/image_cache.h"
+#include "common/interpolation.h"
 #include "common/imageio_module.h"
 #include "common/mipmap_cache.h"
 #include "common/opencl.h"
 #include "common/points.h"
+#include "common/trace.h"
 #include "develop/imageop.h"
 #include "develop/blend.h"
 #include "libs/lib.h"
@@ -97,6 +99,7 @@ static int usage(const char *argv0)
   printf(" [--configdir <user config directory>]");
   printf(" [--cachedir <user config directory>]");
   printf(" [--localedir <locale directory>]");
+  printf(" [--trace <trace file>]");
   printf("\n");
   return 1;
 }
@@ -191,7 +194,9 @@ the console and post the backtrace log to mailing list with information about yo
   /* pass it further to the old handler*/
   _dt_sigill_old_handler(param);
 }
+#endif
 
+#if defined(__x86_64__) || defined(__i386__)
 #if defined(__i386__) && defined(__PIC__)
 #define cpuid(level, a, b, c, d) \
   __asm__ ("xchgl %%ebx, %1\n" \
@@ -208,7 +213,68 @@ the console and post the backtrace log to mailing list with information about yo
     )
 #endif
 
+#if defined(__i386__) && defined(__PIC__)
+#define cpuid_count(level, count, a, b, c, d) \
+  __asm__ ("xchgl %%ebx, %1\n" \
+        "cpuid\n" \
+        "xchgl  %%ebx, %1\n" \
+        : "=a" (a), "=r" (b), "=c" (c), "=d" (d)	\
+        : "0" (level), "2" (count) \
+      )
+#else
+#define cpuid_count(level, count, a, b, c, d) \
+  __asm__ ("cpuid"	\
+    : "=a" (a), "=b" (b), "=c" (c), "=d" (d) \
+    : "0" (level), "2" (count) \
+    )
+#endif
+
+/* fills darktable.cpu_flags. avx and up are only reported if the os also saves the
+   wider registers on context switch (osxsave + xcr0), otherwise the first ymm/zmm
+   instruction would fault. */
+static void _dt_detect_cpu(void)
+{
+  unsigned int ax, bx, cx, dx, max_level;
+  darktable.cpu_flags = 0;
+
+  cpuid(0x0, max_level, bx, cx, dx);
+  if(max_level < 1) return;
+
+  cpuid(0x1, ax, bx, cx, dx);
+  if((dx >> 25) & 1) darktable.cpu_flags |= DT_CPU_FLAG_SSE;
+  if((dx >> 26) & 1) darktable.cpu_flags |= DT_CPU_FLAG_SSE2;
+  if(cx & 1)         darktable.cpu_flags |= DT_CPU_FLAG_SSE3;
+  if((cx >> 19) & 1) darktable.cpu_flags |= DT_CPU_FLAG_SSE4_1;
+
+  // osxsave and avx
+  if(((cx >> 27) & 1) && ((cx >> 28) & 1))
+  {
+    unsigned int xcr0_lo, xcr0_hi;
+    __asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+    (void)xcr0_hi;
+    // sse and avx state
+    if((xcr0_lo & 0x6) == 0x6)
+    {
+      darktable.cpu_flags |= DT_CPU_FLAG_AVX;
+      if((cx >> 12) & 1) darktable.cpu_flags |= DT_CPU_FLAG_FMA;
+      if(max_level >= 7)
+      {
+        cpuid_count(0x7, 0x0, ax, bx, cx, dx);
+        if((bx >> 5) & 1) darktable.cpu_flags |= DT_CPU_FLAG_AVX2;
+        // opmask, upper zmm0-15 and zmm16-31 state
+        if(((bx >> 16) & 1) && (xcr0_lo & 0xe0) == 0xe0) darktable.cpu_flags |= DT_CPU_FLAG_AVX512F;
+      }
+    }
+  }
+}
+#else
+static void _dt_detect_cpu(void)
+{
+  darktable.cpu_flags = 0;
+}
+#endif
 
+#if 0
 static
 void dt_check_cpu(int argc,char **argv)
 {
@@ -428,6 +494,7 @@ int dt_init(int argc, char *argv[], const int init_gui)
   char *tmpdirFromCommand = NULL;
   char *configdirFromCommand = NULL;
   char *cachedirFromCommand = NULL;
+  char *tracefile_from_command = NULL;
 
   darktable.num_openmp_threads = 1;
 #ifdef _OPENMP
@@ -480,6 +547,10 @@ int dt_init(int argc, char *argv[], const int init_gui)
       {
         bindtextdomain (GETTEXT_PACKAGE, argv[++k]);
       }
+      else if(!strcmp(argv[k], "--trace"))
+      {
+        tracefile_from_command = argv[++k];
+      }
       else if(argv[k][1] == 'd' && argc > k+1)
       {
         if(!strcmp(argv[k+1], "all"))             darktable.unmuted = 0xffffffff;   // enable all debug information
@@ -510,6 +581,9 @@ int dt_init(int argc, char *argv[], const int init_gui)
     }
   }
 
+  // as early as possible, so the trace covers the startup, too:
+  dt_trace_init(tracefile_from_command);
+
   if(darktable.unmuted & DT_DEBUG_MEMORY)
   {
     fprintf(stderr, "[memory] at startup\n");
@@ -536,6 +610,17 @@ int dt_init(int argc, char *argv[], const int init_gui)
   // a signal handler.
   /* check cput caps */
   // dt_check_cpu(argc,argv);
+  // detection alone is fine though, the pixel code dispatches on these flags.
+  _dt_detect_cpu();
+  dt_print(DT_DEBUG_PERF, "[dt_init] simd extensions found:%s%s%s%s%s%s%s%s\n",
+           (darktable.cpu_flags & DT_CPU_FLAG_SSE)     ? " sse" : "",
+           (darktable.cpu_flags & DT_CPU_FLAG_SSE2)    ? " sse2" : "",
+           (darktable.cpu_flags & DT_CPU_FLAG_SSE3)    ? " sse3" : "",
+           (darktable.cpu_flags & DT_CPU_FLAG_SSE4_1)  ? " sse4.1" : "",
+           (darktable.cpu_flags & DT_CPU_FLAG_AVX)     ? " avx" : "",
+           (darktable.cpu_flags & DT_CPU_FLAG_FMA)     ? " fma" : "",
+           (darktable.cpu_flags & DT_CPU_FLAG_AVX2)    ? " avx2" : "",
+           (darktable.cpu_flags & DT_CPU_FLAG_AVX512F) ? " avx512f" : "");
 
 #ifdef HAVE_GEGL
   char geglpath[DT_MAX_PATH_LEN];
@@ -647,11 +732,14 @@ int dt_init(int argc, char *argv[], const int init_gui)
   memset(darktable.points, 0, sizeof(dt_points_t));
   dt_points_init(darktable.points, dt_get_num_threads());
 
+  dt_interpolation_init();
+
   // must come before mipmap_cache, because that one will need to access
   // image dimensions stored in here:
   darktable.image_cache = (dt_image_cache_t *)malloc(sizeof(dt_image_cache_t));
   memset(darktable.image_cache, 0, sizeof(dt_image_cache_t));
   dt_image_cache_init(darktable.image_cache);
+  dt_image_sidecar_init();
 
   darktable.mipmap_cache = (dt_mipmap_cache_t *)malloc(sizeof(dt_mipmap_cache_t));
   memset(darktable.mipmap_cache, 0, sizeof(dt_mipmap_cache_t));
@@ -734,6 +822,10 @@ int dt_init(int argc, char *argv[], const int init_gui)
   /* start the indexer background job */
   dt_control_start_indexer();
 
+  /* pick up files added to and removed from the folders of the film rolls */
+  if(init_gui && dt_conf_get_bool("watch_film_rolls"))
+    dt_film_watch_all();
+
   if(darktable.unmuted & DT_DEBUG_MEMORY)
   {
     fprintf(stderr, "[memory] after successful startup\n");
@@ -752,7 +844,13 @@ void dt_cleanup()
   {
     dt_control_write_config(darktable.control);
     dt_control_shutdown(darktable.control);
-
+  }
+  // after the jobs, which queue sidecar files too, and before the lib holding the background job display:
+  dt_image_sidecar_cleanup();
+  // the watcher hands work to the control, stop it before that goes away:
+  dt_fswatch_destroy(darktable.fswatch);
+  if(init_gui)
+  {
     dt_lib_cleanup(darktable.lib);
     free(darktable.lib);
   }
@@ -778,6 +876,7 @@ void dt_cleanup()
   free(darktable.conf);
   dt_points_cleanup(darktable.points);
   free(darktable.points);
+  dt_interpolation_cleanup();
   dt_iop_unload_modules_so();
   dt_opencl_cleanup(darktable.opencl);
   free(darktable.opencl);
@@ -785,7 +884,6 @@ void dt_cleanup()
   dt_camctl_destroy(darktable.camctl);
 #endif
   dt_pwstorage_destroy(darktable.pwstorage);
-  dt_fswatch_destroy(darktable.fswatch);
 
 #ifdef HAVE_GRAPHICSMAGICK
   DestroyMagick();
@@ -805,6 +903,7 @@ void dt_cleanup()
 #ifdef HAVE_GEGL
   gegl_exit();
 #endif
+  dt_trace_cleanup();
 }
 
 void dt_print(dt_debug_thread_t thread, const char *msg, ...)
@@ -149,6 +149,27 @@ dt_debug_thread_t;
 #define DT_CPU_FLAG_SSE		1
 #define DT_CPU_FLAG_SSE2		2
 #define DT_CPU_FLAG_SSE3		4
+#define DT_CPU_FLAG_SSE4_1		8
+#define DT_CPU_FLAG_AVX		16
+#define DT_CPU_FLAG_FMA		32
+#define DT_CPU_FLAG_AVX2		64
+#define DT_CPU_FLAG_AVX512F		128
+
+/* functions tagged with these may use the wider instruction sets even though the
+   rest of the file is built for sse2 only. they must only be called when the
+   corresponding bit in darktable.cpu_flags is set, see dt_cpu_dispatch(). the avx2
+   target includes fma (avx512f has it anyway), so the wide paths may differ from
+   the sse2 ones in the last bit where a mul+add is fused. */
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#define DT_HAVE_AVX2_TARGET 1
+#define DT_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5)
+#define DT_HAVE_AVX512_TARGET 1
+#define DT_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+#endif
 
 typedef struct darktable_t
 {
@@ -180,6 +201,7 @@ typedef struct darktable_t
   struct dt_imageio_t            *imageio;
   struct dt_opencl_t             *opencl;
   struct dt_blendop_t            *blendop;
+  struct dt_trace_t              *trace;
   dt_pthread_mutex_t db_insert;
   dt_pthread_mutex_t plugin_threadsafe;
   dt_pthread_mutex_t capabilities_threadsafe;
@@ -202,6 +224,16 @@ dt_times_t;
 extern darktable_t darktable;
 extern const char dt_supported_extensions[];
 
+/** pick the widest implementation the cpu can run. any of the wide ones may be NULL
+ * if it was not compiled in, the sse2 one is the fallback and must always be given.
+ * the avx2 one is only picked if the cpu has fma as well. */
+static inline void *dt_cpu_dispatch(void *sse2, void *avx2, void *avx512)
+{
+  if(avx512 && (darktable.cpu_flags & DT_CPU_FLAG_AVX512F)) return avx512;
+  if(avx2 && (darktable.cpu_flags & DT_CPU_FLAG_AVX2) && (darktable.cpu_flags & DT_CPU_FLAG_FMA)) return avx2;
+  return sse2;
+}
+
 int dt_init(int argc, char *argv[], const int init_gui);
 void dt_cleanup();
 void dt_print(dt_debug_thread_t thread, const char *msg, ...);
@@ -35,8 +35,17 @@ typedef struct dt_database_t
 
   /* ondisk DB */
   sqlite3 *handle;
+
+  /* prepared statements that are not in use, a GQueue per sql text */
+  GHashTable *statements;
+  /* nesting depth of dt_database_start_transaction() */
+  int transaction;
+  dt_pthread_mutex_t lock;
 } dt_database_t;
 
+/* at most that many idle statements are kept for the same sql */
+#define DT_DATABASE_MAX_IDLE_STATEMENTS 4
+
 
 /* migrates database from old place to new */
 static void _database_migrate_to_xdg_structure();
@@ -116,20 +125,109 @@ dt_database_t *dt_database_init(char *alternative)
   */
   sqlite3_exec(db->handle, "attach database ':memory:' as memory",NULL,NULL,NULL);
 
-  sqlite3_exec(db->handle, "PRAGMA synchronous = OFF", NULL, NULL, NULL);
-  sqlite3_exec(db->handle, "PRAGMA journal_mode = MEMORY", NULL, NULL, NULL);
+  if(dt_conf_get_bool("database_wal"))
+  {
+    /* write-ahead log, synced at every commit: slower, but a crash can't take the library with it. */
+    sqlite3_exec(db->handle, "PRAGMA journal_mode = WAL", NULL, NULL, NULL);
+    sqlite3_exec(db->handle, "PRAGMA synchronous = NORMAL", NULL, NULL, NULL);
+  }
+  else
+  {
+    sqlite3_exec(db->handle, "PRAGMA synchronous = OFF", NULL, NULL, NULL);
+    sqlite3_exec(db->handle, "PRAGMA journal_mode = MEMORY", NULL, NULL, NULL);
+  }
   sqlite3_exec(db->handle, "PRAGMA page_size = 32768", NULL, NULL, NULL);
 
+  db->statements = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  dt_pthread_mutex_init(&db->lock, NULL);
+
   g_free(dbname);
   return db;
 }
 
+static void _database_finalize_statements(gpointer key, gpointer value, gpointer user_data)
+{
+  GQueue *idle = (GQueue *)value;
+  sqlite3_stmt *stmt;
+  while((stmt = (sqlite3_stmt *)g_queue_pop_head(idle))) sqlite3_finalize(stmt);
+  g_queue_free(idle);
+}
+
 void dt_database_destroy(const dt_database_t *db)
 {
+  if(db->transaction) fprintf(stderr, "[database] closing with an open transaction\n");
+  g_hash_table_foreach(db->statements, _database_finalize_statements, NULL);
+  g_hash_table_destroy(db->statements);
+  dt_pthread_mutex_destroy(&((dt_database_t *)db)->lock);
   sqlite3_close(db->handle);
+  g_free(db->dbfilename);
   g_free((dt_database_t *)db);
 }
 
+sqlite3_stmt *dt_database_get_statement(const dt_database_t *db, const char *sql)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  sqlite3_stmt *stmt = NULL;
+  dt_pthread_mutex_lock(&d->lock);
+  GQueue *idle = (GQueue *)g_hash_table_lookup(d->statements, sql);
+  if(idle) stmt = (sqlite3_stmt *)g_queue_pop_head(idle);
+  dt_pthread_mutex_unlock(&d->lock);
+  // not prepared yet, or all of them are in use by other threads:
+  if(!stmt) DT_DEBUG_SQLITE3_PREPARE_V2(d->handle, sql, -1, &stmt, NULL);
+  return stmt;
+}
+
+void dt_database_release_statement(const dt_database_t *db, sqlite3_stmt *stmt)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  if(!stmt) return;
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+  const char *sql = sqlite3_sql(stmt);
+  dt_pthread_mutex_lock(&d->lock);
+  GQueue *idle = (GQueue *)g_hash_table_lookup(d->statements, sql);
+  if(!idle)
+  {
+    idle = g_queue_new();
+    g_hash_table_insert(d->statements, g_strdup(sql), idle);
+  }
+  if(g_queue_get_length(idle) < DT_DATABASE_MAX_IDLE_STATEMENTS)
+  {
+    g_queue_push_head(idle, stmt);
+    stmt = NULL;
+  }
+  dt_pthread_mutex_unlock(&d->lock);
+  if(stmt) sqlite3_finalize(stmt);
+}
+
+void dt_database_start_transaction(const dt_database_t *db)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  dt_pthread_mutex_lock(&d->lock);
+  if(d->transaction++ == 0)
+    DT_DEBUG_SQLITE3_EXEC(d->handle, "BEGIN TRANSACTION", NULL, NULL, NULL);
+  dt_pthread_mutex_unlock(&d->lock);
+}
+
+int dt_database_release_transaction(const dt_database_t *db)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  dt_pthread_mutex_lock(&d->lock);
+  int rc = SQLITE_OK;
+  if(--d->transaction == 0)
+  {
+    rc = sqlite3_exec(d->handle, "COMMIT TRANSACTION", NULL, NULL, NULL);
+    if(rc != SQLITE_OK)
+    {
+      // don't leave it open, or every later statement on this connection would silently join it.
+      fprintf(stderr, "[database] commit failed, rolling back: %s\n", sqlite3_errmsg(d->handle));
+      sqlite3_exec(d->handle, "ROLLBACK TRANSACTION", NULL, NULL, NULL);
+    }
+  }
+  dt_pthread_mutex_unlock(&d->lock);
+  return rc != SQLITE_OK;
+}
+
 sqlite3 *dt_database_get(const dt_database_t *db)
 {
   return db->handle;
@@ -31,6 +31,23 @@ struct sqlite3 *dt_database_get(const struct dt_database_t *);
 gboolean dt_database_is_new(const struct dt_database_t *db);
 /** Returns database path */
 const gchar *dt_database_get_path(const struct dt_database_t *db);
+
+/** returns a prepared statement for sql, reset and without bindings, from the cache if there is one.
+ *  use it for sql that runs over and over with different parameters (bind them, don't print
+ *  them into the sql text), and hand it back with dt_database_release_statement() instead of
+ *  finalizing it. a statement is never handed out to two threads at once. */
+struct sqlite3_stmt *dt_database_get_statement(const struct dt_database_t *db, const char *sql);
+/** resets stmt and puts it back into the cache. */
+void dt_database_release_statement(const struct dt_database_t *db, struct sqlite3_stmt *stmt);
+
+/** wraps what follows up to the matching dt_database_release_transaction() into one
+ *  transaction, for bulk changes which would otherwise commit every single statement.
+ *  nested calls join the outermost transaction. the connection is shared, so whatever
+ *  other threads write meanwhile goes into it as well. */
+void dt_database_start_transaction(const struct dt_database_t *db);
+/** commits the transaction when the outermost call is released. a failed commit is rolled
+ *  back, so the connection is never left inside a transaction; returns non-zero then. */
+int dt_database_release_transaction(const struct dt_database_t *db);
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -1648,6 +1648,32 @@ int dt_exif_xmp_attach (const int imgid, const char* filename)
   }
 }
 
+// the packet for the sidecar file of imgid, and what filename contains now (empty if it doesn't exist).
+// throws exiv2 exceptions if stuff goes wrong.
+static void
+dt_exif_xmp_packet(const int imgid, const char* filename, std::string &xmpPacket, std::string &oldPacket)
+{
+  Exiv2::XmpData xmpData;
+  if(g_file_test(filename, G_FILE_TEST_EXISTS))
+  {
+    Exiv2::DataBuf buf = Exiv2::readFile(filename);
+    oldPacket.assign(reinterpret_cast<char*>(buf.pData_), buf.size_);
+    Exiv2::XmpParser::decode(xmpData, oldPacket);
+    //because XmpSeq or XmpBag are added to the list, we first have
+    //to remove these so that we don't end up with a string of duplicates
+    dt_remove_known_keys(xmpData);
+  }
+
+  // initialize xmp data:
+  dt_exif_xmp_read_data(xmpData, imgid);
+
+  // serialize the xmp data
+  if (Exiv2::XmpParser::encode(xmpPacket, xmpData) != 0)
+  {
+    throw Exiv2::Error(1, "[xmp_write] failed to serialize xmp data");
+  }
+}
+
 // write xmp sidecar file:
 int dt_exif_xmp_write (const int imgid, const char* filename)
 {
@@ -1659,26 +1685,10 @@ int dt_exif_xmp_write (const int imgid, const char* filename)
 
   try
   {
-    Exiv2::XmpData xmpData;
-    std::string xmpPacket;
-    if(g_file_test(filename, G_FILE_TEST_EXISTS))
-    {
-      Exiv2::DataBuf buf = Exiv2::readFile(filename);
-      xmpPacket.assign(reinterpret_cast<char*>(buf.pData_), buf.size_);
-      Exiv2::XmpParser::decode(xmpData, xmpPacket);
-      //because XmpSeq or XmpBag are added to the list, we first have
-      //to remove these so that we don't end up with a string of duplicates
-      dt_remove_known_keys(xmpData);
-    }
-
-    // initialize xmp data:
-    dt_exif_xmp_read_data(xmpData, imgid);
-
-    // serialize the xmp data and output the xmp packet
-    if (Exiv2::XmpParser::encode(xmpPacket, xmpData) != 0)
-    {
-      throw Exiv2::Error(1, "[xmp_write] failed to serialize xmp data");
-    }
+    std::string xmpPacket, oldPacket;
+    dt_exif_xmp_packet(imgid, filename, xmpPacket, oldPacket);
+    // nothing changed, leave the file and its modification time alone:
+    if(xmpPacket == oldPacket) return 0;
     std::ofstream fout(filename);
     if(fout.is_open())
     {
@@ -1694,6 +1704,21 @@ int dt_exif_xmp_write (const int imgid, const char* filename)
   }
 }
 
+int dt_exif_xmp_changed (const int imgid, const char* filename)
+{
+  try
+  {
+    std::string xmpPacket, oldPacket;
+    dt_exif_xmp_packet(imgid, filename, xmpPacket, oldPacket);
+    return xmpPacket != oldPacket;
+  }
+  catch (Exiv2::AnyError& e)
+  {
+    std::cerr << "[xmp_changed] caught exiv2 exception '" << e << "'\n";
+    return 0;
+  }
+}
+
 void dt_exif_init()
 {
   // mute exiv2:
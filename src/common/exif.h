@@ -42,6 +42,9 @@ extern "C"
   /** write xmp sidecar file. */
   int dt_exif_xmp_write (const int imgid, const char* filename);
 
+  /** true if the sidecar file holds something else than dt_exif_xmp_write() would write. */
+  int dt_exif_xmp_changed (const int imgid, const char* filename);
+
   /** write xmp packet inside an image. */
   int dt_exif_xmp_attach (const int imgid, const char* filename);
 
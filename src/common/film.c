@@ -24,7 +24,11 @@
 #include "common/dtpthread.h"
 #include "common/collection.h"
 #include "common/image_cache.h"
+#include "common/mipmap_cache.h"
+#include "common/exif.h"
+#include "common/fswatch.h"
 #include "common/debug.h"
+#include "develop/develop.h"
 #include "views/view.h"
 
 #include <stdio.h>
@@ -224,6 +228,8 @@ int dt_film_new(dt_film_t *film, const char *directory)
     return 0;
   g_strlcpy(film->dirname,directory,sizeof(film->dirname));
   film->last_loaded = 0;
+  if(dt_conf_get_bool("watch_film_rolls"))
+    dt_fswatch_add(darktable.fswatch, DT_FSWATCH_FILMROLL, GINT_TO_POINTER(film->id));
   return film->id;
 }
 
@@ -484,8 +490,12 @@ void dt_film_import1(dt_film_t *film)
       dt_film_new(cfr, cdn);
     }
 
-    /* import image */
-    if(dt_image_import(cfr->id, (const gchar *)image->data, FALSE))
+    /* import image, its rows in one commit. not more than one image per transaction, the
+       connection is shared and other threads' writes would join it while we read files. */
+    dt_database_start_transaction(darktable.db);
+    const uint32_t imgid = dt_image_import(cfr->id, (const gchar *)image->data, FALSE);
+    dt_database_release_transaction(darktable.db);
+    if(imgid)
       dt_control_queue_redraw_center();
 
     fraction+=1.0/total;
@@ -555,6 +565,7 @@ int dt_film_is_empty(const int id)
 void dt_film_remove(const int id)
 {
   sqlite3_stmt *stmt;
+  dt_fswatch_remove(darktable.fswatch, DT_FSWATCH_FILMROLL, GINT_TO_POINTER(id));
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "update tagxtag set count = count - 1 where "
                               "(id2 in (select tagid from tagged_images where imgid in "
@@ -622,6 +633,183 @@ void dt_film_remove(const int id)
   dt_control_signal_raise(darktable.signals , DT_SIGNAL_FILMROLLS_CHANGED);
 }
 
+void dt_film_watch_all()
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select id from film_rolls", -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    dt_fswatch_add(darktable.fswatch, DT_FSWATCH_FILMROLL, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  sqlite3_finalize(stmt);
+}
+
+// flags all versions of the image file name in the film roll as removed, or clears the flag
+// if the file is back. returns how many there are, 0 if the file isn't in the film roll.
+static int _film_flag_removed(const int id, const char *name, const int removed)
+{
+  int count = 0;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "select id from images where film_id = ?1 and filename = ?2", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, name, -1, SQLITE_STATIC);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const int imgid = sqlite3_column_int(stmt, 0);
+    const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, imgid);
+    dt_image_t *img = dt_image_cache_write_get(darktable.image_cache, cimg);
+    if(removed) img->flags |= DT_IMAGE_REMOVE;
+    else        img->flags &= ~DT_IMAGE_REMOVE;
+    dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
+    dt_image_cache_read_release(darktable.image_cache, img);
+    // gone or overwritten, the thumbnail is out of date either way:
+    dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+    count++;
+  }
+  sqlite3_finalize(stmt);
+  return count;
+}
+
+// adds the image which is version `version' of file name in the film roll to ids, if there is one.
+// the version of an image is the number of images of the same file with smaller ids, see
+// dt_image_path_append_version().
+static GList *_film_find_version(const int id, const char *name, const int version, GList *ids)
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "select id from images where film_id = ?1 and filename = ?2 "
+                              "order by id limit 1 offset ?3", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, name, -1, SQLITE_STATIC);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, version);
+  if(sqlite3_step(stmt) == SQLITE_ROW)
+    ids = g_list_prepend(ids, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  sqlite3_finalize(stmt);
+  return ids;
+}
+
+// the images a sidecar file name can belong to: "IMG_1234_01.CR2.xmp" is either the first version
+// of IMG_1234_01.CR2 or the second one of IMG_1234.CR2.
+static GList *_film_find_xmp(const int id, const char *xmp)
+{
+  gchar *name = g_strndup(xmp, strlen(xmp) - strlen(".xmp"));
+  GList *ids = _film_find_version(id, name, 0, NULL);
+  const char *ext = strrchr(name, '.');
+  const char *digits = ext;
+  while(digits && digits > name && g_ascii_isdigit(digits[-1])) digits--;
+  if(digits && ext - digits >= 2 && digits - 1 > name && digits[-1] == '_')
+  {
+    gchar *orig = g_strdup_printf("%.*s%s", (int)(digits - 1 - name), name, ext);
+    ids = _film_find_version(id, orig, atoi(digits), ids);
+    g_free(orig);
+  }
+  g_free(name);
+  return ids;
+}
+
+// reads the sidecar files in xmps (names in folder, the one of the film roll) which were changed by someone else.
+static int _film_rescan_xmps(const int id, const char *folder, GHashTable *xmps)
+{
+  int changed = 0;
+  GHashTableIter iter;
+  gpointer key;
+  g_hash_table_iter_init(&iter, xmps);
+  while(g_hash_table_iter_next(&iter, &key, NULL))
+  {
+    const gchar *name = (const gchar *)key;
+    gchar *filename = g_build_filename(folder, name, NULL);
+    GList *ids = _film_find_xmp(id, name);
+    for(GList *i = ids; i; i = g_list_next(i))
+    {
+      const int imgid = GPOINTER_TO_INT(i->data);
+      // make sure the name is really the one of this version:
+      char xmpname[DT_MAX_PATH_LEN+8];
+      dt_image_full_path(imgid, xmpname, DT_MAX_PATH_LEN);
+      dt_image_path_append_version(imgid, xmpname, DT_MAX_PATH_LEN);
+      g_strlcat(xmpname, ".xmp", sizeof(xmpname));
+      gchar *base = g_path_get_basename(xmpname);
+      const int match = !strcmp(base, name);
+      g_free(base);
+      if(!match) continue;
+      // our own sidecar writes end up here too: skip what is about to be written over anyway, what we
+      // wrote last, what matches the database, and the image in the darkroom, which would write its
+      // history back.
+      if(dt_image_sidecar_pending(imgid) || dt_image_sidecar_own(imgid, filename) ||
+         (darktable.develop && dt_dev_is_current_image(darktable.develop, imgid)) ||
+         !dt_exif_xmp_changed(imgid, filename))
+        continue;
+      const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, imgid);
+      dt_image_t *img = dt_image_cache_write_get(darktable.image_cache, cimg);
+      (void)dt_exif_xmp_read(img, filename, 0);
+      // write through to db, but not to xmp.
+      dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
+      dt_image_cache_read_release(darktable.image_cache, img);
+      dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+      changed++;
+    }
+    g_list_free(ids);
+    g_free(filename);
+  }
+  return changed;
+}
+
+void dt_film_rescan(const int id, GHashTable *names)
+{
+  gchar *folder = NULL;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "select folder from film_rolls where id = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
+  if(sqlite3_step(stmt) == SQLITE_ROW)
+    folder = g_strdup((const gchar *)sqlite3_column_text(stmt, 0));
+  sqlite3_finalize(stmt);
+  // removed in the meantime
+  if(!folder) return;
+
+  int added = 0, removed = 0, changed = 0;
+  GHashTable *xmps = g_hash_table_new(g_str_hash, g_str_equal);
+  GHashTableIter iter;
+  gpointer key;
+  g_hash_table_iter_init(&iter, names);
+  while(g_hash_table_iter_next(&iter, &key, NULL))
+  {
+    // only the state of the file now matters, not what happened to it on the way.
+    const gchar *name = (const gchar *)key;
+    gchar *filename = g_build_filename(folder, name, NULL);
+    const int exists = g_file_test(filename, G_FILE_TEST_IS_REGULAR);
+    const char *c = name + strlen(name);
+    while(*c != '.' && c > name) c--;
+    if(!strcasecmp(c, ".xmp"))
+    {
+      if(exists) g_hash_table_insert(xmps, key, key);
+    }
+    else if(exists)
+    {
+      // known files were overwritten or came back, anything else is new:
+      if(_film_flag_removed(id, name, 0)) changed++;
+      else
+      {
+        // one transaction per image, as in dt_film_import1().
+        dt_database_start_transaction(darktable.db);
+        if(dt_image_import(id, filename, FALSE)) added++;
+        dt_database_release_transaction(darktable.db);
+      }
+    }
+    else
+      removed += _film_flag_removed(id, name, 1) > 0;
+    g_free(filename);
+  }
+  if(g_hash_table_size(xmps)) changed += _film_rescan_xmps(id, folder, xmps);
+  g_hash_table_destroy(xmps);
+
+  dt_print(DT_DEBUG_FSWATCH, "[film_rescan] %s: %d added, %d removed, %d changed\n", folder, added, removed, changed);
+  if(added || removed || changed)
+  {
+    dt_control_log(_("%s: %d images added, %d removed, %d changed"), folder, added, removed, changed);
+    dt_control_queue_redraw_center();
+  }
+  g_free(folder);
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
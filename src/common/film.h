@@ -65,6 +65,12 @@ int dt_film_new(dt_film_t *film,const char *directory);
 void dt_film_image_import(dt_film_t *film,const char *filename, gboolean override_ignore_jpegs);
 /** removes all empty film rolls. */
 void dt_film_remove_empty();
+/** watches the folders of all film rolls for changes, see dt_film_rescan(). */
+void dt_film_watch_all();
+/** brings the film roll up to date with the files called names (a set of file names in its
+ *  folder) which were changed on disk: imports new images, flags the ones that are gone as
+ *  removed and reads sidecar files that someone else wrote. */
+void dt_film_rescan(const int id, GHashTable *names);
 
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -20,9 +20,12 @@
 #endif
 
 #include "common/darktable.h"
+#include "common/debug.h"
 #include "common/dtpthread.h"
 #include "common/image.h"
 #include "common/fswatch.h"
+#include "control/control.h"
+#include "control/jobs/film_jobs.h"
 #include "develop/develop.h"
 
 #include <stdio.h>
@@ -30,8 +33,9 @@
 #include <errno.h>
 #include <glib.h>
 #include <strings.h>
-#if 0//def  HAVE_INOTIFY
+#ifdef HAVE_INOTIFY
 #include <sys/inotify.h>
+#include <poll.h>
 #endif
 
 
@@ -44,16 +48,15 @@ typedef struct _watch_t
 } _watch_t;
 
 
-#if 0// def  HAVE_INOTIFY
+#ifdef HAVE_INOTIFY
 
-typedef struct inotify_event_t
-{
-  uint32_t wd;       /* Watch descriptor */
-  uint32_t mask;     /* Mask of events */
-  uint32_t cookie;   /* Unique cookie associating related events (for rename(2)) */
-  uint32_t len;      /* Size of 'name' field */
-  char     name[];   /* Optional null-terminated name */
-} inotify_event_t;
+// room for a good number of events, names included
+#define DT_FSWATCH_BUFFER_SIZE 16384
+// how often the thread looks at its flags and the pending changes, in ms
+#define DT_FSWATCH_POLL 250
+// seconds without events in the film roll folders before the changes are handed to a job,
+// so copying a card into a folder ends up in a few rescans, not in one per file
+#define DT_FSWATCH_DEBOUNCE 1.0
 
 // Compare func for GList
 static gint _fswatch_items_by_data(const void* a,const void *b)
@@ -68,79 +71,133 @@ static gint _fswatch_items_by_descriptor(const void *a,const void *b)
   return result;
 }
 
+// called with the mutex held
+static void _fswatch_event(dt_fswatch_t *fswatch, const struct inotify_event *event)
+{
+  GList *gitem=g_list_find_custom(fswatch->items,&event->wd,&_fswatch_items_by_descriptor);
+  if( !gitem )
+  {
+    dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] Failed to found watch item for descriptor %d\n", event->wd );
+    return;
+  }
+
+  _watch_t *item = gitem->data;
+  item->events=item->events|event->mask;
+
+  switch( item->type )
+  {
+    case DT_FSWATCH_IMAGE:
+    {
+      if( (event->mask&IN_CLOSE) && (item->events&IN_MODIFY) ) // Check if file modified and closed...
+      {
+        //  Something wrote on image externally and closed it, lets tag item as dirty...
+        dt_image_t *img=(dt_image_t *)item->data;
+        img->force_reimport = 1;
+        if(darktable.develop->image==img)
+          dt_dev_raw_reload(darktable.develop);
+        item->events=0;
+      }
+      else if( (event->mask&IN_ATTRIB) && (item->events&IN_DELETE_SELF) && (item->events&IN_IGNORED))
+      {
+        // This pattern showed up when another file is replacing the orginal...
+        dt_image_t *img=(dt_image_t *)item->data;
+        img->force_reimport = 1;
+        if(darktable.develop->image==img)
+          dt_dev_raw_reload(darktable.develop);
+        item->events=0;
+      }
+    }
+    break;
+
+    case DT_FSWATCH_FILMROLL:
+    {
+      // only remember the name, what became of the file is looked at by the rescan.
+      if(event->len == 0 || event->name[0] == '.' || (event->mask & IN_ISDIR)) break;
+      GHashTable *names = g_hash_table_lookup(fswatch->changes, item->data);
+      if(!names)
+      {
+        names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        g_hash_table_insert(fswatch->changes, item->data, names);
+      }
+      gchar *name = g_strdup(event->name);
+      g_hash_table_insert(names, name, name);
+      fswatch->last_change = dt_get_wtime();
+      item->events=0;
+    }
+    break;
+
+    default:
+      dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] Unhandled object type %d for event descriptor %d\n", item->type, event->wd );
+      break;
+  }
+}
+
+// hands the changes in film roll folders to rescan jobs once nothing happened for a while.
+static void _fswatch_flush(dt_fswatch_t *fswatch)
+{
+  // the jobs need the control threads, which start after us:
+  if(!darktable.control || !darktable.control->running) return;
+  dt_pthread_mutex_lock(&fswatch->mutex);
+  if(g_hash_table_size(fswatch->changes) == 0 || dt_get_wtime() - fswatch->last_change < DT_FSWATCH_DEBOUNCE)
+  {
+    dt_pthread_mutex_unlock(&fswatch->mutex);
+    return;
+  }
+  GHashTable *changes = fswatch->changes;
+  fswatch->changes = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)g_hash_table_destroy);
+  dt_pthread_mutex_unlock(&fswatch->mutex);
+
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, changes);
+  while(g_hash_table_iter_next(&iter, &key, &value))
+  {
+    // the job owns the names from here on.
+    g_hash_table_iter_steal(&iter);
+    dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] %d changes in film roll %d\n", g_hash_table_size(value), GPOINTER_TO_INT(key));
+    dt_job_t j;
+    dt_film_rescan_init(&j, GPOINTER_TO_INT(key), (GHashTable *)value);
+    if(dt_control_add_job(darktable.control, &j)) g_hash_table_destroy(value);
+  }
+  g_hash_table_destroy(changes);
+}
 
 static void *_fswatch_thread(void *data)
 {
   dt_fswatch_t *fswatch=(dt_fswatch_t *)data;
-  uint32_t res=0;
-  uint32_t event_hdr_size=sizeof(inotify_event_t);
-  inotify_event_t *event_hdr=g_malloc(sizeof(inotify_event_t));
-  memset (event_hdr,0,event_hdr_size);
-  char *name=g_malloc(2048);
-  memset (name,0, 2048);
+  // g_malloc() aligns for any type, the events need that.
+  char *buffer = g_malloc(DT_FSWATCH_BUFFER_SIZE);
   dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] Starting thread of context %lx\n",(unsigned long int)data);
-  while(1)
+  while(fswatch->running)
   {
-    // Blocking read loop of event fd into event
-    if(read(fswatch->inotify_fd,event_hdr,event_hdr_size) != event_hdr_size)
+    // wait for events, but come back every now and then to see if we should stop:
+    struct pollfd pfd = { .fd = fswatch->inotify_fd, .events = POLLIN };
+    const int ready = poll(&pfd, 1, DT_FSWATCH_POLL);
+    if(ready < 0)
     {
       if(errno == EINTR) continue;
-      perror("[fswatch_thread] read inotify fd");
+      perror("[fswatch_thread] poll inotify fd");
       break;
     }
-
-    // Read name into buffer if any...
-    if( event_hdr->len > 0 )
-    {
-      res=read(fswatch->inotify_fd,name,event_hdr_size);
-      name[res]='\0';
-    }
-
-    dt_pthread_mutex_lock(&fswatch->mutex);
-    GList *gitem=g_list_find_custom(fswatch->items,&event_hdr->wd,&_fswatch_items_by_descriptor);
-    if( gitem )
+    if(ready > 0)
     {
-      _watch_t *item = gitem->data;
-      item->events=item->events|event_hdr->mask;
-
-      switch( item->type )
+      // a read returns whole events only
+      const ssize_t len = read(fswatch->inotify_fd, buffer, DT_FSWATCH_BUFFER_SIZE);
+      if(len < 0)
       {
-        case DT_FSWATCH_IMAGE:
-        {
-          if( (event_hdr->mask&IN_CLOSE) && (item->events&IN_MODIFY) ) // Check if file modified and closed...
-          {
-            //  Something wrote on image externally and closed it, lets tag item as dirty...
-            dt_image_t *img=(dt_image_t *)item->data;
-            img->force_reimport = 1;
-            if(darktable.develop->image==img)
-              dt_dev_raw_reload(darktable.develop);
-            item->events=0;
-          }
-          else if( (event_hdr->mask&IN_ATTRIB) && (item->events&IN_DELETE_SELF) && (item->events&IN_IGNORED))
-          {
-            // This pattern showed up when another file is replacing the orginal...
-            dt_image_t *img=(dt_image_t *)item->data;
-            img->force_reimport = 1;
-            if(darktable.develop->image==img)
-              dt_dev_raw_reload(darktable.develop);
-            item->events=0;
-          }
-        }
+        if(errno == EINTR) continue;
+        perror("[fswatch_thread] read inotify fd");
         break;
-
-        default:
-          dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] Unhandled object type %d for event descriptor %ld\n", item->type, event_hdr->wd );
-          break;
       }
+      dt_pthread_mutex_lock(&fswatch->mutex);
+      for(char *p = buffer; p < buffer + len; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len)
+        _fswatch_event(fswatch, (struct inotify_event *)p);
+      dt_pthread_mutex_unlock(&fswatch->mutex);
     }
-    else
-      dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] Failed to found watch item for descriptor %ld\n", event_hdr->wd );
-
-    dt_pthread_mutex_unlock(&fswatch->mutex);
+    _fswatch_flush(fswatch);
   }
   dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] terminating.\n");
-  g_free(event_hdr);
-  g_free(name);
+  g_free(buffer);
   return NULL;
 }
 
@@ -158,8 +215,10 @@ const dt_fswatch_t* dt_fswatch_new()
     return NULL;
   }
   fswatch->items=NULL;
+  fswatch->changes = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)g_hash_table_destroy);
+  // the thread is started with the first watch, without watched film rolls there is nothing to poll for.
+  fswatch->running = 0;
   dt_pthread_mutex_init(&fswatch->mutex, NULL);
-  pthread_create(&fswatch->thread, NULL, &_fswatch_thread, fswatch);
   dt_print(DT_DEBUG_FSWATCH,"[fswatch_new] Creating new context %lx\n",(unsigned long int)fswatch);
 
   return fswatch;
@@ -167,8 +226,16 @@ const dt_fswatch_t* dt_fswatch_new()
 
 void dt_fswatch_destroy(const dt_fswatch_t *fswatch)
 {
+  if(!fswatch) return;
   dt_print(DT_DEBUG_FSWATCH,"[fswatch_destroy] Destroying context %lx\n",(unsigned long int)fswatch);
   dt_fswatch_t *ctx=(dt_fswatch_t *)fswatch;
+  // changes which didn't make it into a job yet are dropped, the next import of the folder picks them up.
+  if(ctx->running)
+  {
+    ctx->running = 0;
+    pthread_join(ctx->thread, NULL);
+  }
+  close(ctx->inotify_fd);
   dt_pthread_mutex_destroy(&ctx->mutex);
   GList *item=g_list_first(fswatch->items);
   while(item)
@@ -177,6 +244,7 @@ void dt_fswatch_destroy(const dt_fswatch_t *fswatch)
     item=g_list_next(item);
   }
   g_list_free(fswatch->items);
+  g_hash_table_destroy(ctx->changes);
   g_free(ctx);
 }
 
@@ -186,6 +254,7 @@ void dt_fswatch_add(const dt_fswatch_t * fswatch,dt_fswatch_type_t type, void *d
   uint32_t mask=0;
   dt_fswatch_t *ctx=(dt_fswatch_t *)fswatch;
   filename[0] = '\0';
+  if(!fswatch) return;
 
   switch(type)
   {
@@ -195,6 +264,23 @@ void dt_fswatch_add(const dt_fswatch_t * fswatch,dt_fswatch_type_t type, void *d
       break;
     case DT_FSWATCH_CURVE_DIRECTORY:
       break;
+    case DT_FSWATCH_FILMROLL:
+    {
+      // files which are complete, and files which are gone:
+      mask=IN_CLOSE_WRITE|IN_MOVED_TO|IN_DELETE|IN_MOVED_FROM|IN_ONLYDIR;
+      sqlite3_stmt *stmt;
+      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                  "select folder from film_rolls where id = ?1", -1, &stmt, NULL);
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, GPOINTER_TO_INT(data));
+      if(sqlite3_step(stmt) == SQLITE_ROW)
+        g_strlcpy(filename, (const char *)sqlite3_column_text(stmt, 0), DT_MAX_PATH_LEN);
+      sqlite3_finalize(stmt);
+      // one watch per film roll is enough:
+      dt_pthread_mutex_lock(&ctx->mutex);
+      if(g_list_find_custom(fswatch->items,data,&_fswatch_items_by_data)) filename[0] = '\0';
+      dt_pthread_mutex_unlock(&ctx->mutex);
+    }
+    break;
     default:
       dt_print(DT_DEBUG_FSWATCH,"[fswatch_add] Unhandled object type %d\n",type);
       break;
@@ -206,8 +292,18 @@ void dt_fswatch_add(const dt_fswatch_t * fswatch,dt_fswatch_type_t type, void *d
     _watch_t *item = g_malloc(sizeof(_watch_t));
     item->type=type;
     item->data=data;
+    item->events=0;
     ctx->items=g_list_append(fswatch->items, item);
     item->descriptor=inotify_add_watch(fswatch->inotify_fd,filename,mask);
+    if(!ctx->running)
+    {
+      ctx->running = 1;
+      if(pthread_create(&ctx->thread, NULL, &_fswatch_thread, ctx))
+      {
+        fprintf(stderr, "[fswatch_add] could not start the watch thread\n");
+        ctx->running = 0;
+      }
+    }
     dt_pthread_mutex_unlock(&ctx->mutex);
     dt_print(DT_DEBUG_FSWATCH,"[fswatch_add] Watch on object %lx added on file %s\n",(unsigned long int)data,filename);
   }
@@ -219,6 +315,7 @@ void dt_fswatch_add(const dt_fswatch_t * fswatch,dt_fswatch_type_t type, void *d
 void dt_fswatch_remove(const dt_fswatch_t * fswatch,dt_fswatch_type_t type, void *data)
 {
   dt_fswatch_t *ctx=(dt_fswatch_t *)fswatch;
+  if(!fswatch) return;
   dt_pthread_mutex_lock(&ctx->mutex);
   dt_print(DT_DEBUG_FSWATCH,"[fswatch_remove] removing watch on object %lx\n",(unsigned long int)data);
   GList *gitem=g_list_find_custom(fswatch->items,data,&_fswatch_items_by_data);
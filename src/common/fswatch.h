@@ -29,6 +29,12 @@ typedef struct dt_fswatch_t
   dt_pthread_mutex_t mutex;
   pthread_t thread;
   GList *items;
+  /** set while the thread runs, it is started by the first dt_fswatch_add() */
+  int running;
+  /** names that changed in watched film roll folders: film id -> set of file names */
+  GHashTable *changes;
+  /** dt_get_wtime() of the last change, they are handed on once the folders are quiet */
+  double last_change;
 }
 dt_fswatch_t;
 
@@ -39,6 +45,8 @@ typedef enum dt_fswatch_type_t
   DT_FSWATCH_IMAGE = 0,
   /** watch is on directory for curves files << Just an test  */
   DT_FSWATCH_CURVE_DIRECTORY,
+  /** watch is on the folder of a film roll, data is the film id */
+  DT_FSWATCH_FILMROLL,
 }
 dt_fswatch_type_t;
 
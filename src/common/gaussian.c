@@ -26,6 +26,8 @@
 #define CLAMPF(a, mn, mx) ((a) < (mn) ? (mn) : ((a) > (mx) ? (mx) : (a)))
 #define MMCLAMPPS(a, mn, mx) (_mm_min_ps((mx), _mm_max_ps((a), (mn))))
 #define BLOCKSIZE 32
+// floats per row in a block of the vertical pass on the cpu
+#define GAUSS_BLOCK 64
 
 static 
 void compute_gauss_params(const float sigma, dt_gaussian_order_t order, float *a0, float *a1, float *a2, float *a3, 
@@ -152,328 +154,546 @@ error:
 }
 
 
-void
-dt_gaussian_blur(
-    dt_gaussian_t *g,
-    float    *in,
-    float    *out)
+// recursive filter coefficients, in the order compute_gauss_params() fills them
+typedef struct gauss_coef_t
 {
+  float a0, a1, a2, a3, b1, b2, coefp, coefn;
+}
+gauss_coef_t;
 
-  const int width = g->width;
-  const int height = g->height;
-  const int ch = g->channels;
+static void
+gauss_coef(const float sigma, const int order, gauss_coef_t *c)
+{
+  compute_gauss_params(sigma, order, &c->a0, &c->a1, &c->a2, &c->a3, &c->b1, &c->b2, &c->coefp, &c->coefn);
+}
 
-  float a0, a1, a2, a3, b1, b2, coefp, coefn;
+// floats per row the vertical pass takes in one go: blocks of adjacent columns are
+// filtered together, so every row is read a few cache lines at a time instead of
+// one pixel, and the recursions of the columns are independent of each other.
+static int
+gauss_block(const size_t stride)
+{
+  // but leave some blocks for every thread on small buffers
+  const size_t per_thread = (stride / (2*dt_get_num_threads())) & ~(size_t)3;
+  return MAX(4, MIN(GAUSS_BLOCK, per_thread));
+}
 
-  compute_gauss_params(g->sigma, g->order, &a0, &a1, &a2, &a3, &b1, &b2, &coefp, &coefn);
+// vertical pass over n <= GAUSS_BLOCK floats next to each other in every row, beginning at x0.
+// takes any number of channels, for the columns the vector version leaves over.
+static void
+gauss_vertical(const float *in, float *temp, const size_t stride, const int height, const size_t x0, const int n,
+               const int ch, const float *Labmin, const float *Labmax, const gauss_coef_t *c)
+{
+  float xp[GAUSS_BLOCK], yb[GAUSS_BLOCK], yp[GAUSS_BLOCK], xa[GAUSS_BLOCK];
+  float mn[GAUSS_BLOCK], mx[GAUSS_BLOCK];
 
-  float *temp = g->buf;
+  for(int k=0; k<n; k++)
+  {
+    mn[k] = Labmin[(x0+k)%ch];
+    mx[k] = Labmax[(x0+k)%ch];
+  }
 
-  float *Labmax = g->max;
-  float *Labmin = g->min;
+  // forward filter
+  for(int k=0; k<n; k++)
+  {
+    xp[k] = CLAMPF(in[x0+k], mn[k], mx[k]);
+    yb[k] = xp[k] * c->coefp;
+    yp[k] = yb[k];
+  }
 
-  // vertical blur column by column
-#ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(in,out,temp,Labmin,Labmax,a0,a1,a2,a3,b1,b2,coefp,coefn) schedule(static)
-#endif
-  for(int i=0; i<width; i++)
+  for(int j=0; j<height; j++)
   {
-    float xp[ch];
-    float yb[ch];
-    float yp[ch];
-    float xc[ch];
-    float yc[ch];
-    float xn[ch];
-    float xa[ch];
-    float yn[ch];
-    float ya[ch];
-
-    // forward filter
-    for(int k=0; k<ch; k++)
-    {
-      xp[k] = CLAMPF(in[i*ch+k], Labmin[k], Labmax[k]);
-      yb[k] = xp[k] * coefp;
-      yp[k] = yb[k];
-      xc[k] = yc[k] = xn[k] = xa[k] = yn[k] = ya[k] = 0.0f;
-    }
- 
-    for(int j=0; j<height; j++)
-    {
-      int offset = (i + j * width)*ch;
+    const float *row = in + j*stride + x0;
+    float *trow = temp + j*stride + x0;
 
-      for(int k=0; k<ch; k++)
-      {
-        xc[k] = CLAMPF(in[offset+k], Labmin[k], Labmax[k]);
-        yc[k] = (a0 * xc[k]) + (a1 * xp[k]) - (b1 * yp[k]) - (b2 * yb[k]);
+    for(int k=0; k<n; k++)
+    {
+      const float xc = CLAMPF(row[k], mn[k], mx[k]);
+      const float yc = (c->a0 * xc) + (c->a1 * xp[k]) - (c->b1 * yp[k]) - (c->b2 * yb[k]);
 
-        temp[offset+k] = yc[k];
+      trow[k] = yc;
 
-        xp[k] = xc[k];
-        yb[k] = yp[k];
-        yp[k] = yc[k];
-      }
+      xp[k] = xc;
+      yb[k] = yp[k];
+      yp[k] = yc;
     }
+  }
 
-    // backward filter
-    for(int k=0; k<ch; k++)
+  // backward filter, xp, yp and yb are reused as xn, yn and ya
+  float *xn = xp, *yn = yp, *ya = yb;
+  for(int k=0; k<n; k++)
+  {
+    xn[k] = CLAMPF(in[(height - 1)*stride + x0 + k], mn[k], mx[k]);
+    xa[k] = xn[k];
+    yn[k] = xn[k] * c->coefn;
+    ya[k] = yn[k];
+  }
+
+  for(int j=height - 1; j > -1; j--)
+  {
+    const float *row = in + j*stride + x0;
+    float *trow = temp + j*stride + x0;
+
+    for(int k=0; k<n; k++)
     {
-      xn[k] = CLAMPF(in[((height - 1) * width + i)*ch+k], Labmin[k], Labmax[k]);
+      const float xc = CLAMPF(row[k], mn[k], mx[k]);
+      const float yc = (c->a2 * xn[k]) + (c->a3 * xa[k]) - (c->b1 * yn[k]) - (c->b2 * ya[k]);
+
       xa[k] = xn[k];
-      yn[k] = xn[k] * coefn;
+      xn[k] = xc;
       ya[k] = yn[k];
+      yn[k] = yc;
+
+      trow[k] += yc;
     }
+  }
+}
 
-    for(int j=height - 1; j > -1; j--)
-    {
-      int offset = (i + j * width)*ch;
+// the same with nv vectors of 4 floats per row. one channel or four both fit into the lanes,
+// with their clamping bounds in Labmin and Labmax.
+static void
+gauss_vertical_sse(const float *in, float *temp, const size_t stride, const int height, const int nv,
+                   const __m128 Labmin, const __m128 Labmax, const gauss_coef_t *c)
+{
+  const __m128 a0 = _mm_set_ps1(c->a0);
+  const __m128 a1 = _mm_set_ps1(c->a1);
+  const __m128 a2 = _mm_set_ps1(c->a2);
+  const __m128 a3 = _mm_set_ps1(c->a3);
+  const __m128 b1 = _mm_set_ps1(c->b1);
+  const __m128 b2 = _mm_set_ps1(c->b2);
+  __m128 xp[GAUSS_BLOCK/4], yb[GAUSS_BLOCK/4], yp[GAUSS_BLOCK/4], xa[GAUSS_BLOCK/4];
+
+  // forward filter
+  for(int v=0; v<nv; v++)
+  {
+    xp[v] = MMCLAMPPS(_mm_loadu_ps(in + 4*v), Labmin, Labmax);
+    yb[v] = _mm_mul_ps(_mm_set_ps1(c->coefp), xp[v]);
+    yp[v] = yb[v];
+  }
 
-      for(int k=0; k<ch; k++)
-      {      
-        xc[k] = CLAMPF(in[offset+k], Labmin[k], Labmax[k]);
+  for(int j=0; j<height; j++)
+  {
+    const float *row = in + j*stride;
+    float *trow = temp + j*stride;
+
+    for(int v=0; v<nv; v++)
+    {
+      const __m128 xc = MMCLAMPPS(_mm_loadu_ps(row + 4*v), Labmin, Labmax);
 
-        yc[k] = (a2 * xn[k]) + (a3 * xa[k]) - (b1 * yn[k]) - (b2 * ya[k]);
+      const __m128 yc = _mm_add_ps(_mm_mul_ps(xc, a0),
+                        _mm_sub_ps(_mm_mul_ps(xp[v], a1),
+                        _mm_add_ps(_mm_mul_ps(yp[v], b1), _mm_mul_ps(yb[v], b2))));
 
-        xa[k] = xn[k]; 
-        xn[k] = xc[k]; 
-        ya[k] = yn[k]; 
-        yn[k] = yc[k];
+      _mm_storeu_ps(trow + 4*v, yc);
 
-        temp[offset+k] += yc[k];
-      }
+      xp[v] = xc;
+      yb[v] = yp[v];
+      yp[v] = yc;
     }
   }
 
-  // horizontal blur line by line
-#ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(out,temp,Labmin,Labmax,a0,a1,a2,a3,b1,b2,coefp,coefn) schedule(static)
-#endif
-  for(int j=0; j<height; j++)
+  // backward filter
+  __m128 *xn = xp, *yn = yp, *ya = yb;
+  for(int v=0; v<nv; v++)
   {
-    float xp[ch];
-    float yb[ch];
-    float yp[ch];
-    float xc[ch];
-    float yc[ch];
-    float xn[ch];
-    float xa[ch];
-    float yn[ch];
-    float ya[ch];
-
-    // forward filter
-    for(int k=0; k<ch; k++)
-    {
-      xp[k] = CLAMPF(temp[j*width*ch+k], Labmin[k], Labmax[k]);
-      yb[k] = xp[k] * coefp;
-      yp[k] = yb[k];
-      xc[k] = yc[k] = xn[k] = xa[k] = yn[k] = ya[k] = 0.0f;
-    }
- 
-    for(int i=0; i<width; i++)
+    xn[v] = MMCLAMPPS(_mm_loadu_ps(in + (height - 1)*stride + 4*v), Labmin, Labmax);
+    xa[v] = xn[v];
+    yn[v] = _mm_mul_ps(_mm_set_ps1(c->coefn), xn[v]);
+    ya[v] = yn[v];
+  }
+
+  for(int j=height - 1; j > -1; j--)
+  {
+    const float *row = in + j*stride;
+    float *trow = temp + j*stride;
+
+    for(int v=0; v<nv; v++)
     {
-      int offset = (i + j * width)*ch;
+      const __m128 xc = MMCLAMPPS(_mm_loadu_ps(row + 4*v), Labmin, Labmax);
 
-      for(int k=0; k<ch; k++)
-      {
-        xc[k] = CLAMPF(temp[offset+k], Labmin[k], Labmax[k]);
-        yc[k] = (a0 * xc[k]) + (a1 * xp[k]) - (b1 * yp[k]) - (b2 * yb[k]);
+      const __m128 yc = _mm_add_ps(_mm_mul_ps(xn[v], a2),
+                        _mm_sub_ps(_mm_mul_ps(xa[v], a3),
+                        _mm_add_ps(_mm_mul_ps(yn[v], b1), _mm_mul_ps(ya[v], b2))));
 
-        out[offset+k] = yc[k];
+      xa[v] = xn[v];
+      xn[v] = xc;
+      ya[v] = yn[v];
+      yn[v] = yc;
 
-        xp[k] = xc[k];
-        yb[k] = yp[k];
-        yp[k] = yc[k];
-      }
+      _mm_storeu_ps(trow + 4*v, _mm_add_ps(_mm_loadu_ps(trow + 4*v), yc));
     }
+  }
+}
+
+// horizontal pass over row j, any number of channels.
+static void
+gauss_horizontal(const float *temp, float *out, const int width, const int j, const int ch,
+                 const float *Labmin, const float *Labmax, const gauss_coef_t *c)
+{
+  float xp[ch];
+  float yb[ch];
+  float yp[ch];
+  float xn[ch];
+  float xa[ch];
+  float yn[ch];
+  float ya[ch];
+
+  const float *row = temp + (size_t)j*width*ch;
+  float *orow = out + (size_t)j*width*ch;
+
+  // forward filter
+  for(int k=0; k<ch; k++)
+  {
+    xp[k] = CLAMPF(row[k], Labmin[k], Labmax[k]);
+    yb[k] = xp[k] * c->coefp;
+    yp[k] = yb[k];
+  }
+
+  for(int i=0; i<width; i++)
+  {
+    const int offset = i*ch;
 
-    // backward filter
     for(int k=0; k<ch; k++)
     {
-      xn[k] = CLAMPF(temp[((j + 1)*width - 1)*ch + k], Labmin[k], Labmax[k]);
-      xa[k] = xn[k];
-      yn[k] = xn[k] * coefn;
-      ya[k] = yn[k];
+      const float xc = CLAMPF(row[offset+k], Labmin[k], Labmax[k]);
+      const float yc = (c->a0 * xc) + (c->a1 * xp[k]) - (c->b1 * yp[k]) - (c->b2 * yb[k]);
+
+      orow[offset+k] = yc;
+
+      xp[k] = xc;
+      yb[k] = yp[k];
+      yp[k] = yc;
     }
+  }
 
-    for(int i=width - 1; i > -1; i--)
-    {
-      int offset = (i + j * width)*ch;
+  // backward filter
+  for(int k=0; k<ch; k++)
+  {
+    xn[k] = CLAMPF(row[(width - 1)*ch + k], Labmin[k], Labmax[k]);
+    xa[k] = xn[k];
+    yn[k] = xn[k] * c->coefn;
+    ya[k] = yn[k];
+  }
 
-      for(int k=0; k<ch; k++)
-      {      
-        xc[k] = CLAMPF(temp[offset+k], Labmin[k], Labmax[k]);
+  for(int i=width - 1; i > -1; i--)
+  {
+    const int offset = i*ch;
 
-        yc[k] = (a2 * xn[k]) + (a3 * xa[k]) - (b1 * yn[k]) - (b2 * ya[k]);
+    for(int k=0; k<ch; k++)
+    {
+      const float xc = CLAMPF(row[offset+k], Labmin[k], Labmax[k]);
+      const float yc = (c->a2 * xn[k]) + (c->a3 * xa[k]) - (c->b1 * yn[k]) - (c->b2 * ya[k]);
 
-        xa[k] = xn[k]; 
-        xn[k] = xc[k]; 
-        ya[k] = yn[k]; 
-        yn[k] = yc[k];
+      xa[k] = xn[k];
+      xn[k] = xc;
+      ya[k] = yn[k];
+      yn[k] = yc;
 
-        out[offset+k] += yc[k];
-      }
+      orow[offset+k] += yc;
     }
   }
 }
 
+// horizontal pass over the four single channel rows j..j+3, one in every lane. blocks of
+// 4x4 pixels are transposed on the way in and out, so the rows are still read in order.
+static void
+gauss_horizontal_1c_sse(const float *temp, float *out, const int width, const int j,
+                        const float Labmin, const float Labmax, const gauss_coef_t *c)
+{
+  const __m128 mn = _mm_set_ps1(Labmin);
+  const __m128 mx = _mm_set_ps1(Labmax);
+  const __m128 a0 = _mm_set_ps1(c->a0);
+  const __m128 a1 = _mm_set_ps1(c->a1);
+  const __m128 a2 = _mm_set_ps1(c->a2);
+  const __m128 a3 = _mm_set_ps1(c->a3);
+  const __m128 b1 = _mm_set_ps1(c->b1);
+  const __m128 b2 = _mm_set_ps1(c->b2);
+  const float *r0 = temp + (size_t)j*width, *r1 = r0 + width, *r2 = r1 + width, *r3 = r2 + width;
+  float *o0 = out + (size_t)j*width, *o1 = o0 + width, *o2 = o1 + width, *o3 = o2 + width;
+  const int wd4 = width & ~3;
+
+  // forward filter
+  __m128 xp = MMCLAMPPS(_mm_set_ps(r3[0], r2[0], r1[0], r0[0]), mn, mx);
+  __m128 yb = _mm_mul_ps(_mm_set_ps1(c->coefp), xp);
+  __m128 yp = yb;
+
+  for(int i=0; i<width; i+=4)
+  {
+    __m128 x[4], y[4];
+    const int n = MIN(4, width - i);
+    if(i < wd4)
+    {
+      x[0] = _mm_loadu_ps(r0 + i);
+      x[1] = _mm_loadu_ps(r1 + i);
+      x[2] = _mm_loadu_ps(r2 + i);
+      x[3] = _mm_loadu_ps(r3 + i);
+      _MM_TRANSPOSE4_PS(x[0], x[1], x[2], x[3]);
+    }
+    else for(int q=0; q<n; q++) x[q] = _mm_set_ps(r3[i+q], r2[i+q], r1[i+q], r0[i+q]);
 
+    for(int q=0; q<n; q++)
+    {
+      const __m128 xc = MMCLAMPPS(x[q], mn, mx);
 
-void
-dt_gaussian_blur_4c(
-    dt_gaussian_t *g,
-    float    *in,
-    float    *out)
-{
+      y[q] = _mm_add_ps(_mm_mul_ps(xc, a0),
+             _mm_sub_ps(_mm_mul_ps(xp, a1),
+             _mm_add_ps(_mm_mul_ps(yp, b1), _mm_mul_ps(yb, b2))));
 
-  const int width = g->width;
-  const int height = g->height;
-  const int ch = 4;
+      xp = xc;
+      yb = yp;
+      yp = y[q];
+    }
 
-  assert(g->channels == 4);
+    if(i < wd4)
+    {
+      _MM_TRANSPOSE4_PS(y[0], y[1], y[2], y[3]);
+      _mm_storeu_ps(o0 + i, y[0]);
+      _mm_storeu_ps(o1 + i, y[1]);
+      _mm_storeu_ps(o2 + i, y[2]);
+      _mm_storeu_ps(o3 + i, y[3]);
+    }
+    else for(int q=0; q<n; q++)
+    {
+      float f[4] __attribute__((aligned(16)));
+      _mm_store_ps(f, y[q]);
+      o0[i+q] = f[0];
+      o1[i+q] = f[1];
+      o2[i+q] = f[2];
+      o3[i+q] = f[3];
+    }
+  }
 
-  float a0, a1, a2, a3, b1, b2, coefp, coefn;
+  // backward filter, starting with the columns left over on the right
+  __m128 xn = MMCLAMPPS(_mm_set_ps(r3[width-1], r2[width-1], r1[width-1], r0[width-1]), mn, mx);
+  __m128 xa = xn;
+  __m128 yn = _mm_mul_ps(_mm_set_ps1(c->coefn), xn);
+  __m128 ya = yn;
 
-  compute_gauss_params(g->sigma, g->order, &a0, &a1, &a2, &a3, &b1, &b2, &coefp, &coefn);
+  for(int i=wd4 < width ? wd4 : wd4 - 4; i >= 0; i-=4)
+  {
+    __m128 x[4], y[4];
+    const int n = MIN(4, width - i);
+    if(i < wd4)
+    {
+      x[0] = _mm_loadu_ps(r0 + i);
+      x[1] = _mm_loadu_ps(r1 + i);
+      x[2] = _mm_loadu_ps(r2 + i);
+      x[3] = _mm_loadu_ps(r3 + i);
+      _MM_TRANSPOSE4_PS(x[0], x[1], x[2], x[3]);
+    }
+    else for(int q=0; q<n; q++) x[q] = _mm_set_ps(r3[i+q], r2[i+q], r1[i+q], r0[i+q]);
 
-  const __m128 Labmax = _mm_set_ps(g->max[3], g->max[2], g->max[1], g->max[0]);
-  const __m128 Labmin = _mm_set_ps(g->min[3], g->min[2], g->min[1], g->min[0]);
+    for(int q=n-1; q>=0; q--)
+    {
+      const __m128 xc = MMCLAMPPS(x[q], mn, mx);
 
-  float *temp = g->buf;
+      y[q] = _mm_add_ps(_mm_mul_ps(xn, a2),
+             _mm_sub_ps(_mm_mul_ps(xa, a3),
+             _mm_add_ps(_mm_mul_ps(yn, b1), _mm_mul_ps(ya, b2))));
 
+      xa = xn;
+      xn = xc;
+      ya = yn;
+      yn = y[q];
+    }
+
+    if(i < wd4)
+    {
+      _MM_TRANSPOSE4_PS(y[0], y[1], y[2], y[3]);
+      _mm_storeu_ps(o0 + i, _mm_add_ps(_mm_loadu_ps(o0 + i), y[0]));
+      _mm_storeu_ps(o1 + i, _mm_add_ps(_mm_loadu_ps(o1 + i), y[1]));
+      _mm_storeu_ps(o2 + i, _mm_add_ps(_mm_loadu_ps(o2 + i), y[2]));
+      _mm_storeu_ps(o3 + i, _mm_add_ps(_mm_loadu_ps(o3 + i), y[3]));
+    }
+    else for(int q=0; q<n; q++)
+    {
+      float f[4] __attribute__((aligned(16)));
+      _mm_store_ps(f, y[q]);
+      o0[i+q] += f[0];
+      o1[i+q] += f[1];
+      o2[i+q] += f[2];
+      o3[i+q] += f[3];
+    }
+  }
+}
+
+// horizontal pass over the nr <= 4 rows of 4 channels from j on. the rows are
+// interleaved, so their recursions overlap instead of waiting on each other.
+static void
+gauss_horizontal_4c_sse(const float *temp, float *out, const int width, const int j, const int nr,
+                        const __m128 Labmin, const __m128 Labmax, const gauss_coef_t *c)
+{
+  const __m128 a0 = _mm_set_ps1(c->a0);
+  const __m128 a1 = _mm_set_ps1(c->a1);
+  const __m128 a2 = _mm_set_ps1(c->a2);
+  const __m128 a3 = _mm_set_ps1(c->a3);
+  const __m128 b1 = _mm_set_ps1(c->b1);
+  const __m128 b2 = _mm_set_ps1(c->b2);
+  const size_t stride = (size_t)4*width;
+  const float *row = temp + j*stride;
+  float *orow = out + j*stride;
+  __m128 xp[4], yb[4], yp[4], xa[4];
+
+  // forward filter
+  for(int r=0; r<nr; r++)
+  {
+    xp[r] = MMCLAMPPS(_mm_load_ps(row + r*stride), Labmin, Labmax);
+    yb[r] = _mm_mul_ps(_mm_set_ps1(c->coefp), xp[r]);
+    yp[r] = yb[r];
+  }
 
-  // vertical blur column by column
-#ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(in,out,temp,a0,a1,a2,a3,b1,b2,coefp,coefn) schedule(static)
-#endif
   for(int i=0; i<width; i++)
   {
-    __m128 xp = _mm_setzero_ps();
-    __m128 yb = _mm_setzero_ps();
-    __m128 yp = _mm_setzero_ps();
-    __m128 xc = _mm_setzero_ps();
-    __m128 yc = _mm_setzero_ps();
-    __m128 xn = _mm_setzero_ps();
-    __m128 xa = _mm_setzero_ps();
-    __m128 yn = _mm_setzero_ps();
-    __m128 ya = _mm_setzero_ps();
-
-    // forward filter
-    xp = MMCLAMPPS(_mm_load_ps(in+i*ch), Labmin, Labmax);
-    yb = _mm_mul_ps(_mm_set_ps1(coefp), xp);
-    yp = yb;
-
- 
-    for(int j=0; j<height; j++)
+    for(int r=0; r<nr; r++)
     {
-      int offset = (i + j * width)*ch;
+      const size_t offset = r*stride + 4*i;
+      const __m128 xc = MMCLAMPPS(_mm_load_ps(row + offset), Labmin, Labmax);
 
-      xc = MMCLAMPPS(_mm_load_ps(in+offset), Labmin, Labmax);
+      const __m128 yc = _mm_add_ps(_mm_mul_ps(xc, a0),
+                        _mm_sub_ps(_mm_mul_ps(xp[r], a1),
+                        _mm_add_ps(_mm_mul_ps(yp[r], b1), _mm_mul_ps(yb[r], b2))));
+
+      _mm_store_ps(orow + offset, yc);
+
+      xp[r] = xc;
+      yb[r] = yp[r];
+      yp[r] = yc;
+    }
+  }
 
+  // backward filter
+  __m128 *xn = xp, *yn = yp, *ya = yb;
+  for(int r=0; r<nr; r++)
+  {
+    xn[r] = MMCLAMPPS(_mm_load_ps(row + r*stride + 4*(width - 1)), Labmin, Labmax);
+    xa[r] = xn[r];
+    yn[r] = _mm_mul_ps(_mm_set_ps1(c->coefn), xn[r]);
+    ya[r] = yn[r];
+  }
 
-      yc = _mm_add_ps(_mm_mul_ps(xc, _mm_set_ps1(a0)),
-           _mm_sub_ps(_mm_mul_ps(xp, _mm_set_ps1(a1)),
-           _mm_add_ps(_mm_mul_ps(yp, _mm_set_ps1(b1)), _mm_mul_ps(yb, _mm_set_ps1(b2)))));
+  for(int i=width - 1; i > -1; i--)
+  {
+    for(int r=0; r<nr; r++)
+    {
+      const size_t offset = r*stride + 4*i;
+      const __m128 xc = MMCLAMPPS(_mm_load_ps(row + offset), Labmin, Labmax);
 
-      _mm_store_ps(temp+offset, yc);
+      const __m128 yc = _mm_add_ps(_mm_mul_ps(xn[r], a2),
+                        _mm_sub_ps(_mm_mul_ps(xa[r], a3),
+                        _mm_add_ps(_mm_mul_ps(yn[r], b1), _mm_mul_ps(ya[r], b2))));
 
-      xp = xc;
-      yb = yp;
-      yp = yc;
+      xa[r] = xn[r];
+      xn[r] = xc;
+      ya[r] = yn[r];
+      yn[r] = yc;
 
+      _mm_store_ps(orow + offset, _mm_add_ps(_mm_load_ps(orow + offset), yc));
     }
+  }
+}
 
-    // backward filter
-    xn = MMCLAMPPS(_mm_load_ps(in+((height - 1) * width + i)*ch), Labmin, Labmax);
-    xa = xn;
-    yn = _mm_mul_ps(_mm_set_ps1(coefn), xn);
-    ya = yn;
 
-    for(int j=height - 1; j > -1; j--)
-    {
-      int offset = (i + j * width)*ch;
+void
+dt_gaussian_blur(
+    dt_gaussian_t *g,
+    float    *in,
+    float    *out)
+{
+  if(g->channels == 4)
+  {
+    dt_gaussian_blur_4c(g, in, out);
+    return;
+  }
 
-      xc = MMCLAMPPS(_mm_load_ps(in+offset), Labmin, Labmax);
+  const int width = g->width;
+  const int height = g->height;
+  const int ch = g->channels;
+  const size_t stride = (size_t)width*ch;
 
-      yc = _mm_add_ps(_mm_mul_ps(xn, _mm_set_ps1(a2)),
-           _mm_sub_ps(_mm_mul_ps(xa, _mm_set_ps1(a3)),
-           _mm_add_ps(_mm_mul_ps(yn, _mm_set_ps1(b1)), _mm_mul_ps(ya, _mm_set_ps1(b2)))));
+  gauss_coef_t c;
+  gauss_coef(g->sigma, g->order, &c);
 
+  float *temp = g->buf;
 
-      xa = xn; 
-      xn = xc; 
-      ya = yn; 
-      yn = yc;
+  float *Labmax = g->max;
+  float *Labmin = g->min;
 
-      _mm_store_ps(temp+offset, _mm_add_ps(_mm_load_ps(temp+offset), yc));
-    }
+  // vertical blur in blocks of columns
+  const int block = gauss_block(stride);
+  const int blocks = (stride + block - 1)/block;
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(in,temp,Labmin,Labmax,c) schedule(static)
+#endif
+  for(int b=0; b<blocks; b++)
+  {
+    const size_t x0 = (size_t)b*block;
+    const int n = MIN(block, stride - x0);
+    // single channel: four columns in the lanes of a vector
+    const int nv = ch == 1 ? n/4 : 0;
+    if(nv)
+      gauss_vertical_sse(in + x0, temp + x0, stride, height, nv, _mm_set_ps1(Labmin[0]), _mm_set_ps1(Labmax[0]), &c);
+    if(n > 4*nv)
+      gauss_vertical(in, temp, stride, height, x0 + 4*nv, n - 4*nv, ch, Labmin, Labmax, &c);
   }
 
-  // horizontal blur line by line
+  // horizontal blur line by line, four at a time for a single channel
+  const int rows = ch == 1 ? 4 : 1;
 #ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(out,temp,a0,a1,a2,a3,b1,b2,coefp,coefn) schedule(static)
+  #pragma omp parallel for default(none) shared(out,temp,Labmin,Labmax,c) schedule(static)
 #endif
-  for(int j=0; j<height; j++)
+  for(int j=0; j<height; j+=rows)
   {
-    __m128 xp = _mm_setzero_ps();
-    __m128 yb = _mm_setzero_ps();
-    __m128 yp = _mm_setzero_ps();
-    __m128 xc = _mm_setzero_ps();
-    __m128 yc = _mm_setzero_ps();
-    __m128 xn = _mm_setzero_ps();
-    __m128 xa = _mm_setzero_ps();
-    __m128 yn = _mm_setzero_ps();
-    __m128 ya = _mm_setzero_ps();
-
-    // forward filter
-    xp = MMCLAMPPS(_mm_load_ps(temp+j*width*ch), Labmin, Labmax);
-    yb = _mm_mul_ps(_mm_set_ps1(coefp), xp);
-    yp = yb;
-
- 
-    for(int i=0; i<width; i++)
-    {
-      int offset = (i + j * width)*ch;
-
-      xc = MMCLAMPPS(_mm_load_ps(temp+offset), Labmin, Labmax);
-
-      yc = _mm_add_ps(_mm_mul_ps(xc, _mm_set_ps1(a0)),
-           _mm_sub_ps(_mm_mul_ps(xp, _mm_set_ps1(a1)),
-           _mm_add_ps(_mm_mul_ps(yp, _mm_set_ps1(b1)), _mm_mul_ps(yb, _mm_set_ps1(b2)))));
-
-      _mm_store_ps(out+offset, yc);
+    if(ch == 1 && j + 4 <= height)
+      gauss_horizontal_1c_sse(temp, out, width, j, Labmin[0], Labmax[0], &c);
+    else for(int r=j; r<MIN(j+rows, height); r++)
+      gauss_horizontal(temp, out, width, r, ch, Labmin, Labmax, &c);
+  }
+}
 
-      xp = xc;
-      yb = yp;
-      yp = yc;
-    }
 
-    // backward filter
-    xn = MMCLAMPPS(_mm_load_ps(temp+((j + 1)*width - 1)*ch), Labmin, Labmax);
-    xa = xn;
-    yn = _mm_mul_ps(_mm_set_ps1(coefn), xn);
-    ya = yn;
 
+void
+dt_gaussian_blur_4c(
+    dt_gaussian_t *g,
+    float    *in,
+    float    *out)
+{
 
-    for(int i=width - 1; i > -1; i--)
-    {
-      int offset = (i + j * width)*ch;
+  const int width = g->width;
+  const int height = g->height;
+  const int ch = 4;
+  const size_t stride = (size_t)width*ch;
 
-      xc = MMCLAMPPS(_mm_load_ps(temp+offset), Labmin, Labmax);
+  assert(g->channels == 4);
 
-      yc = _mm_add_ps(_mm_mul_ps(xn, _mm_set_ps1(a2)),
-           _mm_sub_ps(_mm_mul_ps(xa, _mm_set_ps1(a3)),
-           _mm_add_ps(_mm_mul_ps(yn, _mm_set_ps1(b1)), _mm_mul_ps(ya, _mm_set_ps1(b2)))));
+  gauss_coef_t c;
+  gauss_coef(g->sigma, g->order, &c);
 
+  const __m128 Labmax = _mm_set_ps(g->max[3], g->max[2], g->max[1], g->max[0]);
+  const __m128 Labmin = _mm_set_ps(g->min[3], g->min[2], g->min[1], g->min[0]);
 
-      xa = xn; 
-      xn = xc; 
-      ya = yn; 
-      yn = yc;
+  float *temp = g->buf;
 
-      _mm_store_ps(out+offset, _mm_add_ps(_mm_load_ps(out+offset), yc));
-    }
+  // vertical blur in blocks of pixels
+  const int block = gauss_block(stride);
+  const int blocks = (stride + block - 1)/block;
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(in,temp,c) schedule(static)
+#endif
+  for(int b=0; b<blocks; b++)
+  {
+    const size_t x0 = (size_t)b*block;
+    const int n = MIN(block, stride - x0);
+    gauss_vertical_sse(in + x0, temp + x0, stride, height, n/4, Labmin, Labmax, &c);
   }
-}
 
+  // horizontal blur, four lines at a time
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(out,temp,c) schedule(static)
+#endif
+  for(int j=0; j<height; j+=4)
+    gauss_horizontal_4c_sse(temp, out, width, j, MIN(4, height - j), Labmin, Labmax, &c);
+}
 
 void
 dt_gaussian_free(
@@ -0,0 +1,156 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2012 johannes hanika.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "common/darktable.h"
+#include "common/hdr_merge.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// rows per block: 64 rows of a 20 megapixel raw keep a block of input and both
+// accumulators within the l2 cache of one core.
+#define HDR_MERGE_BLOCK 64
+
+static float
+envelope(const float xx)
+{
+  const float x = CLAMPS(xx, 0.0f, 1.0f);
+  // const float alpha = 2.0f;
+  const float beta = 0.5f;
+  if(x < beta)
+  {
+    // return 1.0f-fabsf(x/beta-1.0f)^2
+    const float tmp = fabsf(x/beta-1.0f);
+    return 1.0f-tmp*tmp;
+  }
+  else
+  {
+    const float tmp1 = (1.0f-x)/(1.0f-beta);
+    const float tmp2 = tmp1*tmp1;
+    const float tmp3 = tmp2*tmp1;
+    return 3.0f*tmp2 - 2.0f*tmp3;
+  }
+}
+
+dt_hdr_merge_t *dt_hdr_merge_init(const int width, const int height)
+{
+  dt_hdr_merge_t *m = (dt_hdr_merge_t *)malloc(sizeof(dt_hdr_merge_t));
+  if(!m) return NULL;
+  m->width = width;
+  m->height = height;
+  m->whitelevel = 0.0f;
+  m->frames = 0;
+  // no need to clear these, the first frame overwrites them.
+  m->pixels = (float *)dt_alloc_align(64, sizeof(float)*width*height);
+  m->weight = (float *)dt_alloc_align(64, sizeof(float)*width*height);
+  if(!m->pixels || !m->weight)
+  {
+    dt_hdr_merge_cleanup(m);
+    return NULL;
+  }
+  return m;
+}
+
+void dt_hdr_merge_add(dt_hdr_merge_t *m, const uint16_t *in, float photoncnt, float cal)
+{
+  int wd = m->width, ht = m->height;
+  int blocks = (ht + HDR_MERGE_BLOCK - 1)/HDR_MERGE_BLOCK;
+  int first = m->frames == 0;
+  float *pixels = m->pixels;
+  float *weight = m->weight;
+
+  // stupid, but we don't know the real sensor saturation level:
+  uint16_t saturation = 0;
+#ifdef _OPENMP
+  #pragma omp parallel default(none) shared(in, wd, ht, blocks, saturation)
+#endif
+  {
+    uint16_t sat = 0;
+#ifdef _OPENMP
+    #pragma omp for schedule(static)
+#endif
+    for(int b=0; b<blocks; b++)
+    {
+      const size_t end = (size_t)wd*MIN(ht, (b+1)*HDR_MERGE_BLOCK);
+      for(size_t k=(size_t)wd*b*HDR_MERGE_BLOCK; k<end; k++)
+        sat = MAX(sat, in[k]);
+    }
+#ifdef _OPENMP
+    #pragma omp critical
+#endif
+    saturation = MAX(saturation, sat);
+  }
+  // seems to be around 64500--64700 for 5dm2
+  m->whitelevel = fmaxf(m->whitelevel, saturation*cal);
+  if(saturation == 0) saturation = 1;
+
+  // accumulate block by block, the first frame initializes the sums.
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) default(none) shared(in, pixels, weight, wd, ht, blocks, first, saturation, photoncnt, cal)
+#endif
+  for(int b=0; b<blocks; b++)
+  {
+    const size_t end = (size_t)wd*MIN(ht, (b+1)*HDR_MERGE_BLOCK);
+    for(size_t k=(size_t)wd*b*HDR_MERGE_BLOCK; k<end; k++)
+    {
+      const uint16_t v = in[k];
+      // weights based on siggraph 12 poster
+      // zijian zhu, zhengguo li, susanto rahardja, pasi fraenti
+      // 2d denoising factor for high dynamic range imaging
+      float w = envelope(v/(float)saturation) * photoncnt;
+      // in case we are black and drop to zero weight, give it something
+      // just so numerics don't collapse. blown out whites are handled below.
+      if(w < 1e-3f && v < saturation/3) w = 1e-3f;
+      pixels[k] = w * v * cal + (first ? 0.0f : pixels[k]);
+      weight[k] = w + (first ? 0.0f : weight[k]);
+    }
+  }
+  m->frames++;
+}
+
+float *dt_hdr_merge_finish(dt_hdr_merge_t *m)
+{
+  size_t npixels = (size_t)m->width*m->height;
+  float *pixels = m->pixels;
+  float *weight = m->weight;
+  float whitelevel = m->whitelevel;
+  // normalize by white level to make clipping at 1.0 work as expected:
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) default(none) shared(pixels, weight, npixels, whitelevel)
+#endif
+  for(size_t k=0; k<npixels; k++)
+  {
+    // in case w == 0, all pixels were overexposed (too dark would have been clamped to w >= eps above)
+    if(weight[k] < 1e-3f)
+      pixels[k] = 1.f; // mark as blown out.
+    else // normalize:
+      pixels[k] = fmaxf(0.0f, pixels[k]/(whitelevel*weight[k]));
+  }
+  return pixels;
+}
+
+void dt_hdr_merge_cleanup(dt_hdr_merge_t *m)
+{
+  if(!m) return;
+  free(m->pixels);
+  free(m->weight);
+  free(m);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,55 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2012 johannes hanika.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_COMMON_HDR_MERGE_H
+#define DT_COMMON_HDR_MERGE_H
+
+#include <stdint.h>
+
+/**
+ * weighted merge of bracketed raw frames into one float mosaic, as used by
+ * the merge hdr job. frames are added one at a time, so a caller only ever
+ * needs the accumulators and the raw it is currently adding in memory.
+ * all passes work on blocks of rows in parallel.
+ */
+typedef struct dt_hdr_merge_t
+{
+  int width, height;
+  float *pixels;       // sum of weight * radiance, the result after dt_hdr_merge_finish()
+  float *weight;       // sum of weights
+  float whitelevel;    // largest calibrated saturation of all frames
+  int frames;
+}
+dt_hdr_merge_t;
+
+/** allocates the accumulators for frames of width x height, NULL if out of memory. */
+dt_hdr_merge_t *dt_hdr_merge_init(const int width, const int height);
+
+/** adds one raw frame. cal scales raw values to radiance (1/exposure), photoncnt is about
+ * proportional to how many photons the frame caught and weights it against the others. */
+void dt_hdr_merge_add(dt_hdr_merge_t *m, const uint16_t *in, float photoncnt, float cal);
+
+/** normalizes the sum by weight and white level and returns the merged mosaic,
+ * which is owned by m until dt_hdr_merge_cleanup(). */
+float *dt_hdr_merge_finish(dt_hdr_merge_t *m);
+
+void dt_hdr_merge_cleanup(dt_hdr_merge_t *m);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,312 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2012 johannes hanika.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/darktable.h"
+#include "common/histogram.h"
+#include "control/control.h"
+#include "control/signal.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// maps [0,1] to a bin, nan ends up in the lowest one
+static inline int _histogram_bin(const float v, const int bins)
+{
+  return MIN((int)(fminf(fmaxf(v, 0.0f), 1.0f)*bins), bins-1);
+}
+
+void dt_histogram_rgb(const float *in, const int width, const int height, const int *box, float *hist, float *hist_max)
+{
+  const int x0 = CLAMP(box[0], 0, width), x1 = CLAMP(box[2]+1, x0, width);
+  const int y0 = CLAMP(box[1], 0, height), y1 = CLAMP(box[3]+1, y0, height);
+  const int nthreads = dt_get_num_threads();
+  const size_t stride = 4*DT_HISTOGRAM_BINS;
+
+  // one set of bins per thread, summed up afterwards. no atomics in the inner loop.
+  uint32_t *partial = (uint32_t *)dt_alloc_align(64, sizeof(uint32_t)*stride*nthreads);
+  memset(partial, 0, sizeof(uint32_t)*stride*nthreads);
+
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(in, partial) schedule(static)
+#endif
+  for(int j=y0; j<y1; j++)
+  {
+    uint32_t *h = partial + stride*dt_get_thread_num();
+    const float *p = in + 4*((size_t)j*width + x0);
+    for(int i=x0; i<x1; i++, p+=4)
+    {
+      const int r = _histogram_bin(p[0], DT_HISTOGRAM_BINS);
+      const int g = _histogram_bin(p[1], DT_HISTOGRAM_BINS);
+      const int b = _histogram_bin(p[2], DT_HISTOGRAM_BINS);
+      h[4*r+0]++;
+      h[4*g+1]++;
+      h[4*b+2]++;
+      h[4*MAX(MAX(r, g), b)+3]++;
+    }
+  }
+
+  for(size_t k=0; k<stride; k++)
+  {
+    uint32_t sum = 0;
+    for(int t=0; t<nthreads; t++) sum += partial[stride*t + k];
+    hist[k] = sum;
+  }
+  free(partial);
+
+  // don't count the darkest pixels
+  *hist_max = 0.0f;
+  for(int k=DT_HISTOGRAM_BINS/16; k<DT_HISTOGRAM_BINS; k++) *hist_max = fmaxf(*hist_max, hist[4*k+3]);
+}
+
+void dt_histogram_Lab_L(const float *in, const int width, const int height, float *hist, float *hist_max)
+{
+  const int nthreads = dt_get_num_threads();
+  uint32_t *partial = (uint32_t *)dt_alloc_align(64, sizeof(uint32_t)*DT_HISTOGRAM_BINS*nthreads);
+  memset(partial, 0, sizeof(uint32_t)*DT_HISTOGRAM_BINS*nthreads);
+
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(in, partial) schedule(static)
+#endif
+  for(int j=0; j<height; j++)
+  {
+    uint32_t *h = partial + DT_HISTOGRAM_BINS*dt_get_thread_num();
+    const float *p = in + 4*(size_t)j*width;
+    for(int i=0; i<width; i++, p+=4)
+      h[_histogram_bin(p[0]*(1.0f/100.0f), DT_HISTOGRAM_BINS)]++;
+  }
+
+  memset(hist, 0, sizeof(float)*4*DT_HISTOGRAM_BINS);
+  *hist_max = 0.0f;
+  for(int k=0; k<DT_HISTOGRAM_BINS; k++)
+  {
+    uint32_t sum = 0;
+    for(int t=0; t<nthreads; t++) sum += partial[DT_HISTOGRAM_BINS*t + k];
+    hist[4*k+3] = sum;
+    // don't count <= 0 pixels
+    if(k >= DT_HISTOGRAM_BINS/16) *hist_max = fmaxf(*hist_max, sum);
+  }
+  free(partial);
+}
+
+void dt_histogram_waveform(const float *in, const int width, const int height, uint32_t *wave, const int wave_width, uint32_t *wave_max)
+{
+  const size_t plane = (size_t)wave_width*DT_HISTOGRAM_WAVEFORM_HEIGHT;
+  memset(wave, 0, sizeof(uint32_t)*3*plane);
+
+  // every thread owns a range of output columns and walks down the rows of the matching
+  // input columns, so the bins are never shared.
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(in, wave) schedule(static)
+#endif
+  for(int c=0; c<wave_width; c++)
+  {
+    const int i0 = (int)((size_t)c*width/wave_width), i1 = (int)((size_t)(c+1)*width/wave_width);
+    for(int j=0; j<height; j++)
+    {
+      const float *p = in + 4*((size_t)j*width + i0);
+      for(int i=i0; i<i1; i++, p+=4)
+        for(int k=0; k<3; k++)
+        {
+          const int v = DT_HISTOGRAM_WAVEFORM_HEIGHT-1 - _histogram_bin(p[k], DT_HISTOGRAM_WAVEFORM_HEIGHT);
+          wave[k*plane + (size_t)v*wave_width + c]++;
+        }
+    }
+  }
+
+  *wave_max = 0;
+  for(size_t k=0; k<3*plane; k++) *wave_max = MAX(*wave_max, wave[k]);
+}
+
+void dt_histogram_vectorscope(const float *in, const int width, const int height, uint32_t *scope, uint32_t *scope_max)
+{
+  const int size = DT_HISTOGRAM_VECTORSCOPE_SIZE;
+  const int nthreads = dt_get_num_threads();
+  uint32_t *partial = (uint32_t *)dt_alloc_align(64, sizeof(uint32_t)*size*size*nthreads);
+  memset(partial, 0, sizeof(uint32_t)*size*size*nthreads);
+
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(in, partial) schedule(static)
+#endif
+  for(int j=0; j<height; j++)
+  {
+    uint32_t *h = partial + size*size*dt_get_thread_num();
+    const float *p = in + 4*(size_t)j*width;
+    for(int i=0; i<width; i++, p+=4)
+    {
+      const float Y  = 0.2126f*p[0] + 0.7152f*p[1] + 0.0722f*p[2];
+      const float Cb = (p[2] - Y)*(1.0f/1.8556f);
+      const float Cr = (p[0] - Y)*(1.0f/1.5748f);
+      const int x = _histogram_bin(Cb + 0.5f, size);
+      const int y = size-1 - _histogram_bin(Cr + 0.5f, size);
+      h[y*size + x]++;
+    }
+  }
+
+  *scope_max = 0;
+  for(int k=0; k<size*size; k++)
+  {
+    uint32_t sum = 0;
+    for(int t=0; t<nthreads; t++) sum += partial[size*size*t + k];
+    scope[k] = sum;
+    // the grey center would dominate everything else
+    if(k != (size/2)*size + size/2) *scope_max = MAX(*scope_max, sum);
+  }
+  free(partial);
+}
+
+static void *_histogram_scopes_work(void *ptr)
+{
+#ifdef _OPENMP // need to do this in every thread
+  omp_set_num_threads(darktable.num_openmp_threads);
+#endif
+  dt_histogram_scopes_t *s = (dt_histogram_scopes_t *)ptr;
+  float hist[4*DT_HISTOGRAM_BINS], hist_max;
+  uint32_t *wave = (uint32_t *)malloc(sizeof(s->waveform));
+  uint32_t *scope = (uint32_t *)malloc(sizeof(s->vectorscope));
+
+  while(1)
+  {
+    dt_pthread_mutex_lock(&s->lock);
+    while(!s->pending && !s->rerun && !s->shutdown)
+      dt_pthread_cond_wait(&s->cond, &s->lock);
+    if(s->shutdown)
+    {
+      dt_pthread_mutex_unlock(&s->lock);
+      break;
+    }
+    if(s->pending)
+    {
+      // take the submitted buffer, the pipe can fill the other one meanwhile
+      float *tmp = s->work;
+      const size_t tmp_size = s->work_size;
+      s->work = s->input;
+      s->work_size = s->input_size;
+      s->input = tmp;
+      s->input_size = tmp_size;
+      s->work_width = s->width;
+      s->work_height = s->height;
+      for(int k=0; k<4; k++) s->work_box[k] = s->box[k];
+      s->pending = 0;
+    }
+    s->rerun = 0;
+    const int width = s->work_width, height = s->work_height;
+    const int box[4] = { s->work_box[0], s->work_box[1], s->work_box[2], s->work_box[3] };
+    const dt_histogram_scope_t mode = s->scope;
+    dt_pthread_mutex_unlock(&s->lock);
+
+    // nothing has been submitted yet
+    if(!s->work || width <= 0 || height <= 0) continue;
+
+    const int wave_width = MIN(width, DT_HISTOGRAM_WAVEFORM_MAX_WIDTH);
+    uint32_t wave_max = 0, scope_max = 0;
+    dt_histogram_rgb(s->work, width, height, box, hist, &hist_max);
+    if(mode == DT_HISTOGRAM_SCOPE_WAVEFORM)
+      dt_histogram_waveform(s->work, width, height, wave, wave_width, &wave_max);
+    else if(mode == DT_HISTOGRAM_SCOPE_VECTORSCOPE)
+      dt_histogram_vectorscope(s->work, width, height, scope, &scope_max);
+
+    dt_pthread_mutex_lock(&s->lock);
+    memcpy(s->histogram, hist, sizeof(hist));
+    s->histogram_max = hist_max;
+    if(mode == DT_HISTOGRAM_SCOPE_WAVEFORM)
+    {
+      memcpy(s->waveform, wave, sizeof(uint32_t)*3*wave_width*DT_HISTOGRAM_WAVEFORM_HEIGHT);
+      s->waveform_width = wave_width;
+      s->waveform_max = wave_max;
+    }
+    else if(mode == DT_HISTOGRAM_SCOPE_VECTORSCOPE)
+    {
+      memcpy(s->vectorscope, scope, sizeof(s->vectorscope));
+      s->vectorscope_max = scope_max;
+    }
+    dt_pthread_mutex_unlock(&s->lock);
+
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_HISTOGRAM_UPDATED);
+  }
+
+  free(wave);
+  free(scope);
+  return NULL;
+}
+
+dt_histogram_scopes_t *dt_histogram_scopes_new()
+{
+  dt_histogram_scopes_t *s = (dt_histogram_scopes_t *)malloc(sizeof(dt_histogram_scopes_t));
+  memset(s, 0, sizeof(dt_histogram_scopes_t));
+  s->histogram_max = -1;
+  s->scope = DT_HISTOGRAM_SCOPE_HISTOGRAM;
+  dt_pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->cond, NULL);
+  pthread_create(&s->thread, NULL, _histogram_scopes_work, s);
+  return s;
+}
+
+void dt_histogram_scopes_free(dt_histogram_scopes_t *s)
+{
+  if(!s) return;
+  dt_pthread_mutex_lock(&s->lock);
+  s->shutdown = 1;
+  pthread_cond_signal(&s->cond);
+  dt_pthread_mutex_unlock(&s->lock);
+  pthread_join(s->thread, NULL);
+  pthread_cond_destroy(&s->cond);
+  dt_pthread_mutex_destroy(&s->lock);
+  free(s->input);
+  free(s->work);
+  free(s);
+}
+
+void dt_histogram_scopes_submit(dt_histogram_scopes_t *s, const float *in, const int width, const int height, const int *box)
+{
+  const size_t size = sizeof(float)*4*(size_t)width*height;
+  dt_pthread_mutex_lock(&s->lock);
+  if(s->input_size < size)
+  {
+    free(s->input);
+    s->input = (float *)dt_alloc_align(64, size);
+    s->input_size = s->input ? size : 0;
+  }
+  if(s->input)
+  {
+    memcpy(s->input, in, size);
+    s->width = width;
+    s->height = height;
+    for(int k=0; k<4; k++) s->box[k] = box[k];
+    s->pending = 1;
+    pthread_cond_signal(&s->cond);
+  }
+  dt_pthread_mutex_unlock(&s->lock);
+}
+
+void dt_histogram_scopes_set_scope(dt_histogram_scopes_t *s, const dt_histogram_scope_t scope)
+{
+  if(!s) return;
+  dt_pthread_mutex_lock(&s->lock);
+  if(s->scope != scope)
+  {
+    s->scope = scope;
+    s->rerun = 1;
+    pthread_cond_signal(&s->cond);
+  }
+  dt_pthread_mutex_unlock(&s->lock);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
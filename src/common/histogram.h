@@ -0,0 +1,103 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2012 johannes hanika.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DT_COMMON_HISTOGRAM_H
+#define DT_COMMON_HISTOGRAM_H
+
+#include "common/dtpthread.h"
+#include <inttypes.h>
+#include <stddef.h>
+
+/** number of bins of the display and pre tonecurve/levels histograms */
+#define DT_HISTOGRAM_BINS 256
+/** value resolution and maximum number of columns of the waveform */
+#define DT_HISTOGRAM_WAVEFORM_HEIGHT 128
+#define DT_HISTOGRAM_WAVEFORM_MAX_WIDTH 512
+/** the vectorscope is a square of this many bins */
+#define DT_HISTOGRAM_VECTORSCOPE_SIZE 128
+
+typedef enum dt_histogram_scope_t
+{
+  DT_HISTOGRAM_SCOPE_HISTOGRAM = 0,
+  DT_HISTOGRAM_SCOPE_WAVEFORM = 1,
+  DT_HISTOGRAM_SCOPE_VECTORSCOPE = 2,
+  DT_HISTOGRAM_SCOPE_LAST
+}
+dt_histogram_scope_t;
+
+/** r, g, b and max(r,g,b) histogram (4*DT_HISTOGRAM_BINS) of the float rgba buffer over the
+ * box x0,y0,x1,y1 (inclusive, clamped to the buffer). values are expected in [0,1]. hist_max is
+ * the largest count of the max(r,g,b) channel, ignoring the darkest sixteenth. */
+void dt_histogram_rgb(const float *in, const int width, const int height, const int *box, float *hist, float *hist_max);
+
+/** histogram of the L channel of a Lab buffer, written to channel 3 of hist (4*DT_HISTOGRAM_BINS). */
+void dt_histogram_Lab_L(const float *in, const int width, const int height, float *hist, float *hist_max);
+
+/** per column value distribution of r, g and b. wave is 3*wave_width*DT_HISTOGRAM_WAVEFORM_HEIGHT,
+ * planar per channel, row 0 is the top (value 1). */
+void dt_histogram_waveform(const float *in, const int width, const int height, uint32_t *wave, const int wave_width, uint32_t *wave_max);
+
+/** 2d histogram of the Cb/Cr plane (bt.709) in DT_HISTOGRAM_VECTORSCOPE_SIZE^2 bins, Cr up. */
+void dt_histogram_vectorscope(const float *in, const int width, const int height, uint32_t *scope, uint32_t *scope_max);
+
+/** asynchronous scopes for the darkroom. the preview pipe hands over a copy of its display
+ * referred float output and goes on, a worker thread computes the histogram and the currently
+ * shown scope and raises DT_SIGNAL_DEVELOP_HISTOGRAM_UPDATED when the results are in. */
+typedef struct dt_histogram_scopes_t
+{
+  dt_pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t thread;
+  int shutdown;
+
+  // what to compute besides the histogram
+  dt_histogram_scope_t scope;
+
+  // latest submitted buffer and the one being worked on, swapped by the worker
+  float *input, *work;
+  size_t input_size, work_size;
+  int width, height, box[4];
+  int work_width, work_height, work_box[4];
+  int pending;
+  // recompute from the last buffer, after the scope has changed
+  int rerun;
+
+  // results, only valid under the lock
+  float histogram[4*DT_HISTOGRAM_BINS];
+  float histogram_max;
+  uint32_t waveform[3*DT_HISTOGRAM_WAVEFORM_MAX_WIDTH*DT_HISTOGRAM_WAVEFORM_HEIGHT];
+  int waveform_width;
+  uint32_t waveform_max;
+  uint32_t vectorscope[DT_HISTOGRAM_VECTORSCOPE_SIZE*DT_HISTOGRAM_VECTORSCOPE_SIZE];
+  uint32_t vectorscope_max;
+}
+dt_histogram_scopes_t;
+
+/** allocates the scopes and starts the worker thread. */
+dt_histogram_scopes_t *dt_histogram_scopes_new();
+/** stops the worker and frees everything. */
+void dt_histogram_scopes_free(dt_histogram_scopes_t *s);
+/** copy the float rgba buffer and queue it, replacing an older one that hasn't been started yet. */
+void dt_histogram_scopes_submit(dt_histogram_scopes_t *s, const float *in, const int width, const int height, const int *box);
+/** switch the scope computed along with the histogram, and recompute it from the last buffer. */
+void dt_histogram_scopes_set_scope(dt_histogram_scopes_t *s, const dt_histogram_scope_t scope);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -67,6 +67,7 @@ void
 dt_history_delete_on_selection()
 {
   sqlite3_stmt *stmt;
+  dt_database_start_transaction(darktable.db);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select * from selected_images", -1, &stmt, NULL);
   while(sqlite3_step(stmt) == SQLITE_ROW)
   {
@@ -74,6 +75,7 @@ dt_history_delete_on_selection()
     dt_history_delete_on_image (imgid);
   }
   sqlite3_finalize(stmt);
+  dt_database_release_transaction(darktable.db);
 }
 
 int
@@ -209,6 +211,7 @@ dt_history_copy_and_paste_on_selection (int32_t imgid, gboolean merge)
 
   int res=0;
   sqlite3_stmt *stmt;
+  dt_database_start_transaction(darktable.db);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select * from selected_images where imgid != ?1", -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   if (sqlite3_step(stmt) == SQLITE_ROW)
@@ -227,6 +230,7 @@ dt_history_copy_and_paste_on_selection (int32_t imgid, gboolean merge)
   else res = 1;
 
   sqlite3_finalize(stmt);
+  dt_database_release_transaction(darktable.db);
   return res;
 }
 
@@ -318,6 +318,8 @@ int32_t dt_image_duplicate(const int32_t imgid)
 void dt_image_remove(const int32_t imgid)
 {
   sqlite3_stmt *stmt;
+  // no sidecar for an image which is gone
+  dt_image_sidecar_drop(imgid);
   const dt_image_t *img = dt_image_cache_read_get(darktable.image_cache, imgid);
   int old_group_id = img->group_id;
   dt_image_cache_read_release(darktable.image_cache, img);
@@ -374,13 +376,11 @@ void dt_image_remove(const int32_t imgid)
 int dt_image_altered(const uint32_t imgid)
 {
   int altered = 0;
-  sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "select num from history where imgid = ?1", -1, &stmt, NULL);
+  sqlite3_stmt *stmt = dt_database_get_statement(darktable.db, "select num from history where imgid = ?1");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   if(sqlite3_step(stmt) == SQLITE_ROW)
     altered = 1;
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
   if(altered) return 1;
 
   return altered;
@@ -631,12 +631,14 @@ int32_t dt_image_move(const int32_t imgid, const int32_t filmid)
         && (g_rename(oldimg, newimg) == 0))
     {
       // first move xmp files of image and duplicates
-      GList *dup_list = NULL;
+      GList *dup_list = NULL, *requeue = NULL;
       DT_DEBUG_SQLITE3_BIND_INT(duplicates_stmt, 1, imgid);
       while (sqlite3_step(duplicates_stmt) == SQLITE_ROW)
       {
         int32_t id = sqlite3_column_int(duplicates_stmt, 0);
         dup_list = g_list_append(dup_list, GINT_TO_POINTER(id));
+        // a queued write would go to the old path, do it once the database knows the new one
+        if(dt_image_sidecar_drop(id)) requeue = g_list_append(requeue, GINT_TO_POINTER(id));
         gchar oldxmp[512], newxmp[512];
         g_strlcpy(oldxmp, oldimg, 512);
         g_strlcpy(newxmp, newimg, 512);
@@ -665,6 +667,11 @@ int32_t dt_image_move(const int32_t imgid, const int32_t filmid)
         dup_list = g_list_delete_link(dup_list, dup_list);
       }
       g_list_free(dup_list);
+      while(requeue)
+      {
+        dt_image_write_sidecar_file(GPOINTER_TO_INT(requeue->data));
+        requeue = g_list_delete_link(requeue, requeue);
+      }
       result = 0;
     }
     else
@@ -794,18 +801,214 @@ int32_t dt_image_copy(const int32_t imgid, const int32_t filmid)
 // xmp stuff
 // *******************************************************
 
+// size and time of a sidecar file right after we wrote it, to tell our own writes from others.
+typedef struct dt_image_sidecar_stamp_t
+{
+  time_t mtime;
+  goffset size;
+}
+dt_image_sidecar_stamp_t;
+
+// sidecar files are written by a thread of their own, so that rating, tagging and editing
+// don't wait for exiv2 and the disk. every image is in the queue at most once: the xmp is
+// built from the database at the time it is written, so one write covers all the changes
+// requested before it.
+typedef struct dt_image_sidecar_writer_t
+{
+  pthread_t thread;
+  dt_pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  pthread_cond_t idle;  // signalled whenever the thread finished writing an image
+  GQueue *queue;        // image ids in the order they were requested
+  GHashTable *pending;  // the same ids, to drop requests for images which are queued already
+  int running;
+  int writing;          // the image the thread took off the queue, 0 if none
+  GHashTable *written;  // image id -> dt_image_sidecar_stamp_t of the last file the thread wrote
+  const guint *jid;     // background job shown while there is work
+  int done;             // written since the background job was created
+}
+dt_image_sidecar_writer_t;
+
+static dt_image_sidecar_writer_t _sidecar;
+
+// returns 0 and the stamp of the file if it was written, or didn't need to be.
+static int _image_write_sidecar_file(const int imgid, dt_image_sidecar_stamp_t *stamp)
+{
+  char filename[DT_MAX_PATH_LEN+8] = {0};
+  dt_image_full_path(imgid, filename, DT_MAX_PATH_LEN);
+  // the image could have been removed since the write was queued
+  if(!filename[0]) return 1;
+  dt_image_path_append_version(imgid, filename, DT_MAX_PATH_LEN);
+  char *c = filename + strlen(filename);
+  sprintf(c, ".xmp");
+  if(dt_exif_xmp_write(imgid, filename)) return 1;
+  GStatBuf st;
+  if(g_stat(filename, &st)) return 1;
+  stamp->mtime = st.st_mtime;
+  stamp->size = st.st_size;
+  return 0;
+}
+
+static void *_image_sidecar_writer(void *data)
+{
+  dt_pthread_mutex_lock(&_sidecar.mutex);
+  while(1)
+  {
+    while(_sidecar.running && g_queue_is_empty(_sidecar.queue))
+      dt_pthread_cond_wait(&_sidecar.cond, &_sidecar.mutex);
+    if(g_queue_is_empty(_sidecar.queue)) break; // only after cleanup asked us to stop
+
+    const int imgid = GPOINTER_TO_INT(g_queue_pop_head(_sidecar.queue));
+    // a request coming in while we write this one queues it again, its changes might be too late for us.
+    g_hash_table_remove(_sidecar.pending, GINT_TO_POINTER(imgid));
+    _sidecar.writing = imgid;
+    // the ui goes away with the control threads, don't touch it once they are gone.
+    const int gui = darktable.control->running;
+    if(gui && !_sidecar.jid)
+    {
+      _sidecar.done = 0;
+      _sidecar.jid = dt_control_backgroundjobs_create(darktable.control, 0, _("writing sidecar files"));
+    }
+    const double progress = _sidecar.done / (double)(_sidecar.done + g_queue_get_length(_sidecar.queue) + 1);
+    dt_pthread_mutex_unlock(&_sidecar.mutex);
+
+    if(gui) dt_control_backgroundjobs_progress(darktable.control, _sidecar.jid, progress);
+    dt_image_sidecar_stamp_t stamp;
+    const int failed = _image_write_sidecar_file(imgid, &stamp);
+
+    dt_pthread_mutex_lock(&_sidecar.mutex);
+    if(!failed)
+    {
+      dt_image_sidecar_stamp_t *copy = g_malloc(sizeof(dt_image_sidecar_stamp_t));
+      *copy = stamp;
+      g_hash_table_insert(_sidecar.written, GINT_TO_POINTER(imgid), copy);
+    }
+    _sidecar.writing = 0;
+    _sidecar.done++;
+    pthread_cond_broadcast(&_sidecar.idle);
+    if(g_queue_is_empty(_sidecar.queue) && _sidecar.jid && darktable.control->running)
+    {
+      dt_control_backgroundjobs_destroy(darktable.control, _sidecar.jid);
+      _sidecar.jid = NULL;
+    }
+  }
+  dt_pthread_mutex_unlock(&_sidecar.mutex);
+  return NULL;
+}
+
+void dt_image_sidecar_init()
+{
+  dt_pthread_mutex_init(&_sidecar.mutex, NULL);
+  pthread_cond_init(&_sidecar.cond, NULL);
+  pthread_cond_init(&_sidecar.idle, NULL);
+  _sidecar.queue = g_queue_new();
+  _sidecar.pending = g_hash_table_new(NULL, NULL);
+  _sidecar.written = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+  _sidecar.writing = 0;
+  _sidecar.jid = NULL;
+  _sidecar.running = 1;
+  if(pthread_create(&_sidecar.thread, NULL, _image_sidecar_writer, NULL))
+  {
+    // no thread, dt_image_write_sidecar_file() writes right away then.
+    fprintf(stderr, "[image] could not start the sidecar writer\n");
+    _sidecar.running = 0;
+  }
+}
+
+void dt_image_sidecar_cleanup()
+{
+  if(!_sidecar.queue) return;
+  dt_pthread_mutex_lock(&_sidecar.mutex);
+  const int running = _sidecar.running;
+  _sidecar.running = 0;
+  if(g_queue_get_length(_sidecar.queue))
+    dt_print(DT_DEBUG_CACHE, "[image] writing %d pending sidecar files\n", g_queue_get_length(_sidecar.queue));
+  dt_pthread_mutex_unlock(&_sidecar.mutex);
+  pthread_cond_broadcast(&_sidecar.cond);
+  // the thread empties the queue before it quits, nothing requested so far gets lost.
+  if(running) pthread_join(_sidecar.thread, NULL);
+
+  if(_sidecar.jid) dt_control_backgroundjobs_destroy(darktable.control, _sidecar.jid);
+  _sidecar.jid = NULL;
+  g_queue_free(_sidecar.queue);
+  _sidecar.queue = NULL;
+  g_hash_table_destroy(_sidecar.pending);
+  _sidecar.pending = NULL;
+  g_hash_table_destroy(_sidecar.written);
+  _sidecar.written = NULL;
+  pthread_cond_destroy(&_sidecar.cond);
+  pthread_cond_destroy(&_sidecar.idle);
+  dt_pthread_mutex_destroy(&_sidecar.mutex);
+}
+
+int dt_image_sidecar_queue_length()
+{
+  if(!_sidecar.queue) return 0;
+  dt_pthread_mutex_lock(&_sidecar.mutex);
+  const int length = g_queue_get_length(_sidecar.queue) + (_sidecar.writing != 0);
+  dt_pthread_mutex_unlock(&_sidecar.mutex);
+  return length;
+}
+
+int dt_image_sidecar_pending(const int imgid)
+{
+  if(!_sidecar.queue) return 0;
+  dt_pthread_mutex_lock(&_sidecar.mutex);
+  const int pending = _sidecar.writing == imgid || g_hash_table_lookup(_sidecar.pending, GINT_TO_POINTER(imgid));
+  dt_pthread_mutex_unlock(&_sidecar.mutex);
+  return pending;
+}
+
+int dt_image_sidecar_drop(const int imgid)
+{
+  if(!_sidecar.queue) return 0;
+  dt_pthread_mutex_lock(&_sidecar.mutex);
+  const int queued = g_hash_table_remove(_sidecar.pending, GINT_TO_POINTER(imgid));
+  if(queued) g_queue_remove(_sidecar.queue, GINT_TO_POINTER(imgid));
+  // a write in progress might have resolved the path already, let it finish:
+  while(_sidecar.writing == imgid)
+    dt_pthread_cond_wait(&_sidecar.idle, &_sidecar.mutex);
+  g_hash_table_remove(_sidecar.written, GINT_TO_POINTER(imgid));
+  dt_pthread_mutex_unlock(&_sidecar.mutex);
+  return queued;
+}
+
+int dt_image_sidecar_own(const int imgid, const char *filename)
+{
+  if(!_sidecar.queue) return 0;
+  GStatBuf st;
+  if(g_stat(filename, &st)) return 0;
+  dt_pthread_mutex_lock(&_sidecar.mutex);
+  const dt_image_sidecar_stamp_t *stamp = g_hash_table_lookup(_sidecar.written, GINT_TO_POINTER(imgid));
+  const int own = stamp && stamp->mtime == st.st_mtime && stamp->size == st.st_size;
+  dt_pthread_mutex_unlock(&_sidecar.mutex);
+  return own;
+}
+
 void dt_image_write_sidecar_file(int imgid)
 {
-  // TODO: compute hash and don't write if not needed!
   // write .xmp file
   if(imgid > 0 && dt_conf_get_bool("write_sidecar_files"))
   {
-    char filename[DT_MAX_PATH_LEN+8];
-    dt_image_full_path(imgid, filename, DT_MAX_PATH_LEN);
-    dt_image_path_append_version(imgid, filename, DT_MAX_PATH_LEN);
-    char *c = filename + strlen(filename);
-    sprintf(c, ".xmp");
-    dt_exif_xmp_write(imgid, filename);
+    if(_sidecar.queue)
+    {
+      dt_pthread_mutex_lock(&_sidecar.mutex);
+      if(_sidecar.running)
+      {
+        if(!g_hash_table_lookup(_sidecar.pending, GINT_TO_POINTER(imgid)))
+        {
+          g_hash_table_insert(_sidecar.pending, GINT_TO_POINTER(imgid), GINT_TO_POINTER(1));
+          g_queue_push_tail(_sidecar.queue, GINT_TO_POINTER(imgid));
+          pthread_cond_signal(&_sidecar.cond);
+        }
+        dt_pthread_mutex_unlock(&_sidecar.mutex);
+        return;
+      }
+      dt_pthread_mutex_unlock(&_sidecar.mutex);
+    }
+    // before init or after cleanup:
+    dt_image_sidecar_stamp_t stamp;
+    (void)_image_write_sidecar_file(imgid, &stamp);
   }
 }
 
@@ -317,6 +317,20 @@ int32_t dt_image_move(const int32_t imgid, const int32_t filmid);
  *  duplicate update database entries. */
 int32_t dt_image_copy(const int32_t imgid, const int32_t filmid);
 // xmp functions:
+/** starts the thread writing the sidecar files. */
+void dt_image_sidecar_init();
+/** writes everything still queued and stops the thread. */
+void dt_image_sidecar_cleanup();
+/** number of images waiting for their sidecar file. */
+int dt_image_sidecar_queue_length();
+/** true if the sidecar file of imgid is about to be written. */
+int dt_image_sidecar_pending(const int imgid);
+/** removes imgid from the queue and waits for a write of it in progress, call before touching its files.
+ * returns true if a write was queued. */
+int dt_image_sidecar_drop(const int imgid);
+/** true if the sidecar file filename of imgid is still the one the writer thread wrote last. */
+int dt_image_sidecar_own(const int imgid, const char *filename);
+/** queues writing the sidecar file of imgid, requests for an image which is queued already are dropped. */
 void dt_image_write_sidecar_file(int imgid);
 void dt_image_synch_xmp(const int selected);
 void dt_image_synch_all_xmp(const gchar *pathname);
@@ -55,6 +55,8 @@
 #include <string.h>
 #include <strings.h>
 #include <glib/gstdio.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
 
 // =================================================
 //   begin libraw wrapper functions:
@@ -487,6 +489,93 @@ void dt_imageio_to_fractional(float in, uint32_t *num, uint32_t *den)
   }
 }
 
+// 4x4 bayer matrix, offsets in (0,1) added before truncation when dithering
+static const float _dither_bayer[4][4] =
+{
+  {  0.5f/16.0f,  8.5f/16.0f,  2.5f/16.0f, 10.5f/16.0f },
+  { 12.5f/16.0f,  4.5f/16.0f, 14.5f/16.0f,  6.5f/16.0f },
+  {  3.5f/16.0f, 11.5f/16.0f,  1.5f/16.0f,  9.5f/16.0f },
+  { 15.5f/16.0f,  7.5f/16.0f, 13.5f/16.0f,  5.5f/16.0f }
+};
+
+void dt_imageio_flt_to_8(uint8_t *out, const float *in, const size_t begin, const size_t end, const int width, const int dither)
+{
+  const __m128 scale = _mm_set1_ps(0xff);
+  const __m128 max = _mm_set1_ps(0xff);
+  const __m128 zero = _mm_setzero_ps();
+  int x = begin % width, y = begin / width;
+  for(size_t k=begin; k<end; k++)
+  {
+    __m128 v = _mm_mul_ps(_mm_load_ps(in + 4*k), scale);
+    if(dither) v = _mm_add_ps(v, _mm_set1_ps(_dither_bayer[y&3][x&3]));
+    // max first, so NaN ends up as 0
+    const __m128i i = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(v, zero), max));
+    const __m128i i16 = _mm_packs_epi32(i, i);
+    const int i8 = _mm_cvtsi128_si32(_mm_packus_epi16(i16, i16));
+    memcpy(out + 4*k, &i8, sizeof(int));
+    if(++x == width)
+    {
+      x = 0;
+      y++;
+    }
+  }
+}
+
+void dt_imageio_flt_to_16(uint16_t *out, const float *in, const size_t begin, const size_t end, const int width, const int dither)
+{
+  const __m128 scale = _mm_set1_ps(0x10000);
+  const __m128 max = _mm_set1_ps(0xffff);
+  const __m128 zero = _mm_setzero_ps();
+  // sse2 has no unsigned 32 -> 16 bit pack, so shift to signed range and back
+  const __m128i offset = _mm_set1_epi32(0x8000);
+  const __m128i sign = _mm_set1_epi16((short)0x8000);
+  int x = begin % width, y = begin / width;
+  for(size_t k=begin; k<end; k++)
+  {
+    __m128 v = _mm_mul_ps(_mm_load_ps(in + 4*k), scale);
+    if(dither) v = _mm_add_ps(v, _mm_set1_ps(_dither_bayer[y&3][x&3]));
+    const __m128i i = _mm_sub_epi32(_mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(v, zero), max)), offset);
+    const __m128i i16 = _mm_xor_si128(_mm_packs_epi32(i, i), sign);
+    _mm_storel_epi64((__m128i *)(out + 4*k), i16);
+    if(++x == width)
+    {
+      x = 0;
+      y++;
+    }
+  }
+}
+
+void dt_imageio_flt_to_int_inplace(void *buf, const int width, const int height, const int bpp, const int dither)
+{
+  // the output of pixel k starts at byte k*bpp/2, its input at byte 16*k. so if all pixels
+  // in [0,m) are done, the ones in [m, m*f) with f = 32/bpp can be converted in parallel:
+  // their outputs only overwrite inputs of pixels before m. the first block is done serially.
+  const size_t npixels = (size_t)width*height;
+  const size_t f = 32 / bpp;
+  const size_t first = MIN(npixels, 4096);
+  const float *in = (const float *)buf;
+
+  if(bpp == 8) dt_imageio_flt_to_8((uint8_t *)buf, in, 0, first, width, dither);
+  else         dt_imageio_flt_to_16((uint16_t *)buf, in, 0, first, width, dither);
+
+  for(size_t m=first; m<npixels; m*=f)
+  {
+    const size_t end = MIN(npixels, m*f);
+    const size_t chunk = 1024;
+    const size_t nchunks = (end - m + chunk - 1)/chunk;
+#ifdef _OPENMP
+    #pragma omp parallel for default(none) shared(buf, in, m) schedule(static)
+#endif
+    for(size_t c=0; c<nchunks; c++)
+    {
+      const size_t b = m + c*chunk;
+      const size_t e = MIN(end, b + chunk);
+      if(bpp == 8) dt_imageio_flt_to_8((uint8_t *)buf, in, b, e, width, dither);
+      else         dt_imageio_flt_to_16((uint16_t *)buf, in, b, e, width, dither);
+    }
+  }
+}
+
 int dt_imageio_export(
   const uint32_t              imgid,
   const char                 *filename,
@@ -502,6 +591,38 @@ int dt_imageio_export(
                                         0, 0, high_quality, 0, NULL);
 }
 
+struct dt_imageio_export_context_t
+{
+  dt_develop_t dev;
+  dt_dev_pixelpipe_t pipe;
+  int dev_inited, pipe_inited;
+};
+
+// the context dt_imageio_export uses on this thread, if any.
+static __thread dt_imageio_export_context_t *_export_context = NULL;
+
+dt_imageio_export_context_t *dt_imageio_export_context_new()
+{
+  dt_imageio_export_context_t *ctx = (dt_imageio_export_context_t *)malloc(sizeof(dt_imageio_export_context_t));
+  memset(ctx, 0, sizeof(dt_imageio_export_context_t));
+  return ctx;
+}
+
+void dt_imageio_export_context_free(dt_imageio_export_context_t *ctx)
+{
+  if(!ctx) return;
+  if(_export_context == ctx) _export_context = NULL;
+  // nodes reference the modules of dev, so the pipe goes first:
+  if(ctx->pipe_inited) dt_dev_pixelpipe_cleanup(&ctx->pipe);
+  if(ctx->dev_inited) dt_dev_cleanup(&ctx->dev);
+  free(ctx);
+}
+
+void dt_imageio_export_context_set(dt_imageio_export_context_t *ctx)
+{
+  _export_context = ctx;
+}
+
 // internal function: to avoid exif blob reading + 8-bit byteorder flag + high-quality override
 int dt_imageio_export_with_flags(
   const uint32_t              imgid,
@@ -514,12 +635,37 @@ int dt_imageio_export_with_flags(
   const int32_t               thumbnail_export,
   const char                 *filter)
 {
-  dt_develop_t dev;
-  dt_dev_init(&dev, 0);
+  // filters switch pieces off behind the back of the context, so these get a private pipe:
+  dt_imageio_export_context_t *ctx = (thumbnail_export || filter) ? NULL : _export_context;
+  dt_develop_t dev_storage, *dev = &dev_storage;
+  dt_dev_pixelpipe_t pipe_storage, *pipe = &pipe_storage;
+  int nodes_changed = 1;
+  if(ctx)
+  {
+    dev  = &ctx->dev;
+    pipe = &ctx->pipe;
+    if(!ctx->dev_inited)
+    {
+      dt_dev_init(dev, 0);
+      ctx->dev_inited = 1;
+    }
+  }
+  else dt_dev_init(dev, 0);
   dt_mipmap_buffer_t buf;
-  dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING);
-  dt_dev_load_image(&dev, imgid);
-  const dt_image_t *img = &dev.image_storage;
+  dt_imageio_region_t *region = NULL;
+  if(thumbnail_export)
+    dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING);
+  else
+  {
+    // a cropped export doesn't need to decode the rest of the raw, unless it's in the cache already:
+    dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_TESTLOCK);
+    if(!buf.buf) region = dt_imageio_open_region(imgid);
+    if(!region && !buf.buf)
+      dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING);
+  }
+  if(ctx) nodes_changed = dt_dev_load_image_reuse(dev, imgid);
+  else dt_dev_load_image(dev, imgid);
+  const dt_image_t *img = &dev->image_storage;
   const int wd = img->width;
   const int ht = img->height;
 
@@ -527,34 +673,57 @@ int dt_imageio_export_with_flags(
 
   dt_times_t start;
   dt_get_times(&start);
-  dt_dev_pixelpipe_t pipe;
-  res = thumbnail_export ? dt_dev_pixelpipe_init_thumbnail(&pipe, wd, ht) : dt_dev_pixelpipe_init_export(&pipe, wd, ht);
+  if(ctx && ctx->pipe_inited) res = 1;
+  else
+  {
+    res = thumbnail_export ? dt_dev_pixelpipe_init_thumbnail(pipe, wd, ht) : dt_dev_pixelpipe_init_export(pipe, wd, ht);
+    if(ctx) ctx->pipe_inited = res;
+  }
   if(!res)
   {
     dt_control_log(_("failed to allocate memory for export, please lower the threads used for export or buy more memory."));
-    dt_dev_cleanup(&dev);
+    if(!ctx) dt_dev_cleanup(dev);
     dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    if(region) dt_imageio_region_free(region);
     return 1;
   }
 
-  if(!buf.buf)
+  if(!buf.buf && !region)
   {
     dt_control_log(_("image `%s' is not available!"), img->filename);
     dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
-    dt_dev_cleanup(&dev);
+    if(!ctx) dt_dev_cleanup(dev);
     return 1;
   }
 
-  dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, 1.0);
-  dt_dev_pixelpipe_create_nodes(&pipe, &dev);
-  dt_dev_pixelpipe_synch_all(&pipe, &dev);
-  dt_dev_pixelpipe_get_dimensions(&pipe, &dev, pipe.iwidth, pipe.iheight, &pipe.processed_width, &pipe.processed_height);
+  if(region)
+    dt_dev_pixelpipe_set_input_region(pipe, dev, region);
+  else
+    dt_dev_pixelpipe_set_input(pipe, dev, (float *)buf.buf, buf.width, buf.height, 1.0);
+  if(ctx)
+  {
+    // keep nodes and whatever commit_params computed for them, unless the modules changed:
+    if(nodes_changed || !pipe->nodes)
+    {
+      dt_dev_pixelpipe_cleanup_nodes(pipe);
+      dt_dev_pixelpipe_create_nodes(pipe, dev);
+    }
+    // the cache buffers stay, their contents belong to the previous image:
+    dt_dev_pixelpipe_flush_caches(pipe);
+    dt_dev_pixelpipe_synch_changed(pipe, dev);
+  }
+  else
+  {
+    dt_dev_pixelpipe_create_nodes(pipe, dev);
+    dt_dev_pixelpipe_synch_all(pipe, dev);
+  }
+  dt_dev_pixelpipe_get_dimensions(pipe, dev, pipe->iwidth, pipe->iheight, &pipe->processed_width, &pipe->processed_height);
   if(filter)
   {
     if(!strncmp(filter, "pre:", 4))
-      dt_dev_pixelpipe_disable_after(&pipe, filter+4);
+      dt_dev_pixelpipe_disable_after(pipe, filter+4);
     if(!strncmp(filter, "post:", 5))
-      dt_dev_pixelpipe_disable_before(&pipe, filter+5);
+      dt_dev_pixelpipe_disable_before(pipe, filter+5);
   }
   dt_show_times(&start, "[export] creating pixelpipe", NULL);
 
@@ -567,7 +736,7 @@ int dt_imageio_export_with_flags(
   }
   else if(!overprofile || !strcmp(overprofile, "image"))
   {
-    GList *modules = dev.iop;
+    GList *modules = dev->iop;
     dt_iop_module_t *colorout = NULL;
     while (modules)
     {
@@ -588,29 +757,29 @@ int dt_imageio_export_with_flags(
   g_free(overprofile);
 
   // get only once at the beginning, in case the user changes it on the way:
-  const gboolean high_quality_processing = ((format_params->max_width  == 0 || format_params->max_width  >= pipe.processed_width ) &&
-                                       (format_params->max_height == 0 || format_params->max_height >= pipe.processed_height)) ? FALSE :
+  const gboolean high_quality_processing = ((format_params->max_width  == 0 || format_params->max_width  >= pipe->processed_width ) &&
+                                       (format_params->max_height == 0 || format_params->max_height >= pipe->processed_height)) ? FALSE :
                                       high_quality;
   const int width  = high_quality_processing ? 0 : format_params->max_width;
   const int height = high_quality_processing ? 0 : format_params->max_height;
-  const double scalex = width  > 0 ? fminf(width /(double)pipe.processed_width,  1.0) : 1.0;
-  const double scaley = height > 0 ? fminf(height/(double)pipe.processed_height, 1.0) : 1.0;
+  const double scalex = width  > 0 ? fminf(width /(double)pipe->processed_width,  1.0) : 1.0;
+  const double scaley = height > 0 ? fminf(height/(double)pipe->processed_height, 1.0) : 1.0;
   const double scale = fminf(scalex, scaley);
-  int processed_width  = scale*pipe.processed_width  + .5f;
-  int processed_height = scale*pipe.processed_height + .5f;
+  int processed_width  = scale*pipe->processed_width  + .5f;
+  int processed_height = scale*pipe->processed_height + .5f;
   const int bpp = format->bpp(format_params);
 
   // downsampling done last, if high quality processing was requested:
-  uint8_t *outbuf = pipe.backbuf;
+  uint8_t *outbuf = pipe->backbuf;
   uint8_t *moutbuf = NULL; // keep track of alloc'ed memory
   if(high_quality_processing)
   {
-    dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
-    const double scalex = format_params->max_width  > 0 ? fminf(format_params->max_width /(double)pipe.processed_width,  1.0) : 1.0;
-    const double scaley = format_params->max_height > 0 ? fminf(format_params->max_height/(double)pipe.processed_height, 1.0) : 1.0;
+    dt_dev_pixelpipe_process_no_gamma(pipe, dev, 0, 0, processed_width, processed_height, scale);
+    const double scalex = format_params->max_width  > 0 ? fminf(format_params->max_width /(double)pipe->processed_width,  1.0) : 1.0;
+    const double scaley = format_params->max_height > 0 ? fminf(format_params->max_height/(double)pipe->processed_height, 1.0) : 1.0;
     const double scale = fminf(scalex, scaley);
-    processed_width  = scale*pipe.processed_width  + .5f;
-    processed_height = scale*pipe.processed_height + .5f;
+    processed_width  = scale*pipe->processed_width  + .5f;
+    processed_height = scale*pipe->processed_height + .5f;
     moutbuf = (uint8_t *)dt_alloc_align(64, sizeof(float)*processed_width*processed_height*4);
     outbuf = moutbuf;
     // now downscale into the new buffer:
@@ -618,43 +787,37 @@ int dt_imageio_export_with_flags(
     roi_in.x = roi_in.y = roi_out.x = roi_out.y = 0;
     roi_in.scale = 1.0;
     roi_out.scale = scale;
-    roi_in.width = pipe.processed_width;
-    roi_in.height = pipe.processed_height;
+    roi_in.width = pipe->processed_width;
+    roi_in.height = pipe->processed_height;
     roi_out.width = processed_width;
     roi_out.height = processed_height;
-    dt_iop_clip_and_zoom((float *)outbuf, (float *)pipe.backbuf, &roi_out, &roi_in, processed_width, pipe.processed_width);
+    dt_iop_clip_and_zoom((float *)outbuf, (float *)pipe->backbuf, &roi_out, &roi_in, processed_width, pipe->processed_width);
   }
   else
   {
     // do the processing (8-bit with special treatment, to make sure we can use openmp further down):
     if(bpp == 8)
-      dt_dev_pixelpipe_process(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+      dt_dev_pixelpipe_process(pipe, dev, 0, 0, processed_width, processed_height, scale);
     else
-      dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
-    outbuf = pipe.backbuf;
+      dt_dev_pixelpipe_process_no_gamma(pipe, dev, 0, 0, processed_width, processed_height, scale);
+    outbuf = pipe->backbuf;
   }
 
+  // dithering only applies to our own conversion, the 8-bit pipe output above is already quantized.
+  const int dither = dt_conf_get_bool("plugins/lighttable/export/dither");
+
   // downconversion to low-precision formats:
   if(bpp == 8 && !display_byteorder)
   {
     // ldr output: char
     if(high_quality_processing)
     {
-      const float *const inbuf = (float *)outbuf;
-      for(int k=0; k<processed_width*processed_height; k++)
-      {
-        // convert in place, this is unfortunately very serial..
-        const uint8_t r = CLAMP(inbuf[4*k+0]*0xff, 0, 0xff);
-        const uint8_t g = CLAMP(inbuf[4*k+1]*0xff, 0, 0xff);
-        const uint8_t b = CLAMP(inbuf[4*k+2]*0xff, 0, 0xff);
-        outbuf[4*k+0] = r;
-        outbuf[4*k+1] = g;
-        outbuf[4*k+2] = b;
-      }
+      // convert in place
+      dt_imageio_flt_to_int_inplace(outbuf, processed_width, processed_height, 8, dither);
     }
     else
     {
-      uint8_t *const buf8 = pipe.backbuf;
+      uint8_t *const buf8 = pipe->backbuf;
 #ifdef _OPENMP
       #pragma omp parallel for default(none) shared(processed_width, processed_height) schedule(static)
 #endif
@@ -669,15 +832,8 @@ int dt_imageio_export_with_flags(
   }
   else if(bpp == 16)
   {
-    // uint16_t per color channel
-    float    *buff  = (float *)   outbuf;
-    uint16_t *buf16 = (uint16_t *)outbuf;
-    for(int y=0; y<processed_height; y++) for(int x=0; x<processed_width ; x++)
-      {
-        // convert in place
-        const int k = x + processed_width*y;
-        for(int i=0; i<3; i++) buf16[4*k+i] = CLAMP(buff[4*k+i]*0x10000, 0, 0xffff);
-      }
+    // uint16_t per color channel, convert in place
+    dt_imageio_flt_to_int_inplace(outbuf, processed_width, processed_height, 16, dither);
   }
   // else output float, no further harm done to the pixels :)
 
@@ -699,9 +855,18 @@ int dt_imageio_export_with_flags(
     res = format->write_image (format_params, filename, outbuf, NULL, 0, imgid);
   }
 
-  dt_dev_pixelpipe_cleanup(&pipe);
-  dt_dev_cleanup(&dev);
+  if(!ctx)
+  {
+    dt_dev_pixelpipe_cleanup(pipe);
+    dt_dev_cleanup(dev);
+  }
   dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+  if(region)
+  {
+    // the pipe of the export context outlives this image
+    pipe->input_region = NULL;
+    dt_imageio_region_free(region);
+  }
   free(moutbuf);
   return res;
 }
@@ -761,6 +926,98 @@ dt_imageio_open(
   return ret;
 }
 
+dt_imageio_region_t *dt_imageio_region_new(const int width, const int height, const size_t bpp)
+{
+  dt_imageio_region_t *r = (dt_imageio_region_t *)malloc(sizeof(dt_imageio_region_t));
+  if(!r) return NULL;
+  memset(r, 0, sizeof(dt_imageio_region_t));
+  r->width = width;
+  r->height = height;
+  r->bpp = bpp;
+  r->blocks_x = (width  + DT_IMAGEIO_REGION_BLOCK - 1)/DT_IMAGEIO_REGION_BLOCK;
+  r->blocks_y = (height + DT_IMAGEIO_REGION_BLOCK - 1)/DT_IMAGEIO_REGION_BLOCK;
+  r->buf = dt_alloc_align(64, bpp*width*height);
+  r->done = (uint8_t *)malloc(r->blocks_x*r->blocks_y);
+  if(!r->buf || !r->done)
+  {
+    free(r->buf);
+    free(r->done);
+    free(r);
+    return NULL;
+  }
+  memset(r->done, 0, r->blocks_x*r->blocks_y);
+  dt_pthread_mutex_init(&r->lock, NULL);
+  return r;
+}
+
+void dt_imageio_region_free(dt_imageio_region_t *r)
+{
+  if(!r) return;
+  if(r->cleanup) r->cleanup(r);
+  dt_pthread_mutex_destroy(&r->lock);
+  free(r->buf);
+  free(r->done);
+  free(r);
+}
+
+dt_imageio_region_t *dt_imageio_open_region(const uint32_t imgid)
+{
+  dt_imageio_region_t *r = NULL;
+#ifdef HAVE_RAWSPEED
+  // same dance as the mipmap cache does for the full buffer:
+  dt_image_t buffered_image;
+  const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, imgid);
+  if(!cimg) return NULL;
+  buffered_image = *cimg;
+  dt_image_cache_read_release(darktable.image_cache, cimg);
+  char filename[DT_MAX_PATH_LEN];
+  dt_image_full_path(buffered_image.id, filename, DT_MAX_PATH_LEN);
+  if(!g_file_test(filename, G_FILE_TEST_IS_REGULAR) || dt_imageio_is_ldr(filename)) return NULL;
+
+  r = dt_imageio_open_rawspeed_region(&buffered_image, filename);
+  if(!r) return NULL;
+  buffered_image.flags &= ~DT_IMAGE_THUMBNAIL;
+
+  cimg = dt_image_cache_read_get(darktable.image_cache, imgid);
+  dt_image_t *img = dt_image_cache_write_get(darktable.image_cache, cimg);
+  *img = buffered_image;
+  // don't write xmp for this (we only changed db stuff):
+  dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
+  dt_image_cache_read_release(darktable.image_cache, img);
+#endif
+  return r;
+}
+
+int dt_imageio_region_decode(dt_imageio_region_t *r, const int x, const int y, const int width, const int height)
+{
+  const int x0 = CLAMP(x, 0, r->width),  x1 = CLAMP(x + width,  0, r->width);
+  const int y0 = CLAMP(y, 0, r->height), y1 = CLAMP(y + height, 0, r->height);
+  if(x1 <= x0 || y1 <= y0) return 0;
+  const int bs = DT_IMAGEIO_REGION_BLOCK;
+
+  dt_pthread_mutex_lock(&r->lock);
+  // bounding box of the blocks still missing. the loaders fill in whole rectangles and
+  // skip what they have decoded already, so that's cheaper than going block by block.
+  int bx0 = r->blocks_x, by0 = r->blocks_y, bx1 = -1, by1 = -1;
+  for(int by=y0/bs; by<=(y1-1)/bs; by++) for(int bx=x0/bs; bx<=(x1-1)/bs; bx++)
+  {
+    if(r->done[by*r->blocks_x + bx]) continue;
+    bx0 = MIN(bx0, bx);
+    by0 = MIN(by0, by);
+    bx1 = MAX(bx1, bx);
+    by1 = MAX(by1, by);
+  }
+  int err = 0;
+  if(bx1 >= 0)
+  {
+    const int rx = bx0*bs, ry = by0*bs;
+    err = r->decode(r, rx, ry, MIN((bx1+1)*bs, r->width) - rx, MIN((by1+1)*bs, r->height) - ry);
+    if(!err) for(int by=by0; by<=by1; by++) memset(r->done + by*r->blocks_x + bx0, 1, bx1-bx0+1);
+  }
+  dt_pthread_mutex_unlock(&r->lock);
+  return err;
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
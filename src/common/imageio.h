@@ -20,6 +20,7 @@
 
 #include <glib.h>
 #include <stdio.h>
+#include "common/dtpthread.h"
 #include "common/image.h"
 #include "common/mipmap_cache.h"
 
@@ -34,6 +35,40 @@ dt_imageio_retval_t dt_imageio_open_ldr(dt_image_t *img, const char *filename, d
 // try both, first libraw.
 dt_imageio_retval_t dt_imageio_open(dt_image_t *img, const char *filename, dt_mipmap_cache_allocator_t a);
 
+/** size of the blocks in which the decoded parts of a region buffer are tracked. */
+#define DT_IMAGEIO_REGION_BLOCK 256
+
+/**
+ * an image opened for decoding on demand, only the parts the pixelpipe actually reads.
+ * buf has the size and layout of the DT_MIPMAP_FULL buffer, but only the rectangles
+ * passed to dt_imageio_region_decode() hold valid pixels.
+ */
+typedef struct dt_imageio_region_t
+{
+  dt_pthread_mutex_t lock;
+  void *buf;
+  int width, height;
+  size_t bpp;
+  // which blocks of DT_IMAGEIO_REGION_BLOCK^2 pixels of buf are filled in already
+  int blocks_x, blocks_y;
+  uint8_t *done;
+  // loader specific
+  void *data;
+  // fill in the rectangle of buf (inside the image), called with lock held. returns non-zero on error.
+  int  (*decode)(struct dt_imageio_region_t *r, const int x, const int y, const int width, const int height);
+  void (*cleanup)(struct dt_imageio_region_t *r);
+}
+dt_imageio_region_t;
+
+/** opens the image for decoding on demand and updates the image cache like loading the full
+ * buffer would. returns NULL if the file format can't do that, use DT_MIPMAP_FULL then. */
+dt_imageio_region_t *dt_imageio_open_region(const uint32_t imgid);
+/** makes sure the rectangle of buf (clamped to the image) is decoded. returns non-zero on error. */
+int dt_imageio_region_decode(dt_imageio_region_t *r, const int x, const int y, const int width, const int height);
+void dt_imageio_region_free(dt_imageio_region_t *r);
+/** for the loaders: allocates the region and its buffer, NULL if out of memory. */
+dt_imageio_region_t *dt_imageio_region_new(const int width, const int height, const size_t bpp);
+
 struct dt_imageio_module_format_t;
 struct dt_imageio_module_data_t;
 int
@@ -56,6 +91,14 @@ dt_imageio_export_with_flags(
   const int32_t                      thumbnail_export,
   const char                        *filter);
 
+/** keeps a develop and pipe with nodes and cache buffers alive across exports of several
+ * images on one thread, so that only changed params have to be committed again. */
+typedef struct dt_imageio_export_context_t dt_imageio_export_context_t;
+dt_imageio_export_context_t *dt_imageio_export_context_new();
+void dt_imageio_export_context_free(dt_imageio_export_context_t *ctx);
+/** makes subsequent exports on the calling thread use ctx, NULL restores the default of one pipe per image. */
+void dt_imageio_export_context_set(dt_imageio_export_context_t *ctx);
+
 int dt_imageio_write_pos(int i, int j, int wd, int ht, float fwd, float fht, int orientation);
 
 // general, efficient buffer flipping function using memcopies
@@ -73,6 +116,15 @@ dt_imageio_flip_buffers(
 
 void dt_imageio_flip_buffers_ui16_to_float(float *out, const uint16_t *in, const float black, const float white, const int ch, const int wd, const int ht, const int fwd, const int fht, const int stride, const int orientation);
 void dt_imageio_flip_buffers_ui8_to_float(float *out, const uint8_t *in, const float black, const float white, const int ch, const int wd, const int ht, const int fwd, const int fht, const int stride, const int orientation);
+
+// convert a range of pixels from float rgba to 8 resp. 16 bits per channel. begin and end are
+// pixel indices into a buffer with the given width, used for the ordered dither pattern.
+// out may alias in (the output of each pixel is never behind its input).
+void dt_imageio_flt_to_8(uint8_t *out, const float *in, const size_t begin, const size_t end, const int width, const int dither);
+void dt_imageio_flt_to_16(uint16_t *out, const float *in, const size_t begin, const size_t end, const int width, const int dither);
+
+// multithreaded in place conversion of a whole float rgba buffer to 8 or 16 bits per channel.
+void dt_imageio_flt_to_int_inplace(void *buf, const int width, const int height, const int bpp, const int dither);
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
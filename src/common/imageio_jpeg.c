@@ -46,18 +46,20 @@ void dt_imageio_jpeg_error_exit (j_common_ptr cinfo)
 }
 
 // destination functions
-void dt_imageio_jpeg_init_destination(j_compress_ptr cinfo) {}
+void dt_imageio_jpeg_init_destination(j_compress_ptr cinfo) { (void)cinfo; }
 boolean dt_imageio_jpeg_empty_output_buffer(j_compress_ptr cinfo)
 {
+  (void)cinfo;
   fprintf(stderr, "[imageio_jpeg] output buffer full!\n");
   return FALSE;
 }
-void dt_imageio_jpeg_term_destination(j_compress_ptr cinfo) {}
+void dt_imageio_jpeg_term_destination(j_compress_ptr cinfo) { (void)cinfo; }
 
 // source functions
-void dt_imageio_jpeg_init_source(j_decompress_ptr cinfo) {}
+void dt_imageio_jpeg_init_source(j_decompress_ptr cinfo) { (void)cinfo; }
 boolean dt_imageio_jpeg_fill_input_buffer(j_decompress_ptr cinfo)
 {
+  (void)cinfo;
   return 1;
 }
 void dt_imageio_jpeg_skip_input_data(j_decompress_ptr cinfo, long num_bytes)
@@ -67,7 +69,7 @@ void dt_imageio_jpeg_skip_input_data(j_decompress_ptr cinfo, long num_bytes)
   cinfo->src->bytes_in_buffer = i;
   cinfo->src->next_input_byte += num_bytes;
 }
-void dt_imageio_jpeg_term_source(j_decompress_ptr cinfo) {}
+void dt_imageio_jpeg_term_source(j_decompress_ptr cinfo) { (void)cinfo; }
 
 
 int dt_imageio_jpeg_decompress_header(const void *in, size_t length, dt_imageio_jpeg_t *jpg)
@@ -98,6 +100,29 @@ int dt_imageio_jpeg_decompress_header(const void *in, size_t length, dt_imageio_
   return 0;
 }
 
+void dt_imageio_jpeg_scale_to(dt_imageio_jpeg_t *jpg, const int width, const int height)
+{
+  // 1/8 is the smallest scale of the idct every libjpeg supports. the scaled image covers the box
+  // as long as one of its sides is at least as long as the box's.
+  struct dt_imageio_jpeg_error_mgr jerr;
+  jpg->dinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
+  if (setjmp(jerr.setjmp_buffer))
+  {
+    // decode at full size then.
+    jpg->dinfo.scale_denom = 1;
+    return;
+  }
+  int denom = 8;
+  while(denom > 1 && (int)jpg->dinfo.image_width < denom*width && (int)jpg->dinfo.image_height < denom*height)
+    denom /= 2;
+  jpg->dinfo.scale_num = 1;
+  jpg->dinfo.scale_denom = denom;
+  jpeg_calc_output_dimensions(&(jpg->dinfo));
+  jpg->width  = jpg->dinfo.output_width;
+  jpg->height = jpg->dinfo.output_height;
+}
+
 int dt_imageio_jpeg_decompress(dt_imageio_jpeg_t *jpg, uint8_t *out)
 {
   struct dt_imageio_jpeg_error_mgr jerr;
@@ -111,14 +136,14 @@ int dt_imageio_jpeg_decompress(dt_imageio_jpeg_t *jpg, uint8_t *out)
   JSAMPROW row_pointer[1];
   row_pointer[0] = (uint8_t *)malloc(jpg->dinfo.output_width*jpg->dinfo.num_components);
   uint8_t *tmp = out;
-  while(jpg->dinfo.output_scanline < jpg->dinfo.image_height)
+  while(jpg->dinfo.output_scanline < jpg->dinfo.output_height)
   {
     if(jpeg_read_scanlines(&(jpg->dinfo), row_pointer, 1) != 1)
     {
       free(row_pointer[0]);
       return 1;
     }
-    for(unsigned int i=0; i<jpg->dinfo.image_width; i++) for(int k=0; k<3; k++)
+    for(unsigned int i=0; i<jpg->dinfo.output_width; i++) for(int k=0; k<3; k++)
         tmp[4*i+k] = row_pointer[0][3*i+k];
     tmp += 4*jpg->width;
   }
@@ -516,7 +541,7 @@ int dt_imageio_jpeg_read(dt_imageio_jpeg_t *jpg, uint8_t *out)
   JSAMPROW row_pointer[1];
   row_pointer[0] = (uint8_t *)malloc(jpg->dinfo.output_width*jpg->dinfo.num_components);
   uint8_t *tmp = out;
-  while(jpg->dinfo.output_scanline < jpg->dinfo.image_height)
+  while(jpg->dinfo.output_scanline < jpg->dinfo.output_height)
   {
     if(jpeg_read_scanlines(&(jpg->dinfo), row_pointer, 1) != 1)
     {
@@ -526,10 +551,10 @@ int dt_imageio_jpeg_read(dt_imageio_jpeg_t *jpg, uint8_t *out)
       return 1;
     }
     if(jpg->dinfo.num_components < 3)
-      for(unsigned int i=0; i<jpg->dinfo.image_width; i++) for(int k=0; k<3; k++)
+      for(unsigned int i=0; i<jpg->dinfo.output_width; i++) for(int k=0; k<3; k++)
           tmp[4*i+k] = row_pointer[0][jpg->dinfo.num_components*i+0];
     else
-      for(unsigned int i=0; i<jpg->dinfo.image_width; i++) for(int k=0; k<3; k++)
+      for(unsigned int i=0; i<jpg->dinfo.output_width; i++) for(int k=0; k<3; k++)
           tmp[4*i+k] = row_pointer[0][3*i+k];
     tmp += 4*jpg->width;
   }
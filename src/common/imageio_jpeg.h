@@ -44,6 +44,10 @@ dt_imageio_jpeg_t;
 
 /** reads the header and fills width/height in jpg struct. */
 int dt_imageio_jpeg_decompress_header(const void *in, size_t length, dt_imageio_jpeg_t *jpg);
+/** makes the decompression use the smallest scale of the idct (1/8, 1/4, 1/2 or 1) that still covers
+ * a box of width x height and updates width/height in jpg to the size of the output.
+ * call after reading the header, before decompressing. */
+void dt_imageio_jpeg_scale_to(dt_imageio_jpeg_t *jpg, const int width, const int height);
 /** reads the whole image to the out buffer, which has to be large enough. */
 int dt_imageio_jpeg_decompress(dt_imageio_jpeg_t *jpg, uint8_t *out);
 /** compresses in to out buffer with given quality (0..100). out buffer must be large enough. returns actual data length. */
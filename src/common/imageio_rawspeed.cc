@@ -28,6 +28,7 @@
 #include "rawspeed/RawSpeed/RawParser.h"
 #include "rawspeed/RawSpeed/CameraMetaData.h"
 #include "rawspeed/RawSpeed/ColorFilterArray.h"
+#include "rawspeed/RawSpeed/DngDecoder.h"
 
 extern "C"
 {
@@ -55,6 +56,25 @@ using namespace RawSpeed;
 dt_imageio_retval_t dt_imageio_open_rawspeed_sraw(dt_image_t *img, RawImage r, dt_mipmap_cache_allocator_t a);
 static CameraMetaData *meta = NULL;
 
+/* Load rawspeed cameras.xml meta file once */
+static void
+_load_meta()
+{
+  if(meta == NULL)
+  {
+    dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+    if(meta == NULL)
+    {
+      char datadir[1024], camfile[1024];
+      dt_loc_get_datadir(datadir, 1024);
+      snprintf(camfile, 1024, "%s/rawspeed/cameras.xml", datadir);
+      // never cleaned up (only when dt closes)
+      meta = new CameraMetaData(camfile);
+    }
+    dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+  }
+}
+
 #if 0
 static void
 scale_black_white(uint16_t *const buf, const uint16_t black, const uint16_t white, const int width, const int height, const int stride)
@@ -93,20 +113,7 @@ dt_imageio_open_rawspeed(
 
   try
   {
-    /* Load rawspeed cameras.xml meta file once */
-    if(meta == NULL)
-    {
-      dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
-      if(meta == NULL)
-      {
-        char datadir[1024], camfile[1024];
-        dt_loc_get_datadir(datadir, 1024);
-        snprintf(camfile, 1024, "%s/rawspeed/cameras.xml", datadir);
-        // never cleaned up (only when dt closes)
-        meta = new CameraMetaData(camfile);
-      }
-      dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
-    }
+    _load_meta();
 
     m = auto_ptr<FileMap>(f.readFile());
 
@@ -169,6 +176,178 @@ dt_imageio_open_rawspeed(
   return DT_IMAGEIO_OK;
 }
 
+// a dng with independently compressed tiles or strips, decoded as the pipe asks for the pixels.
+typedef struct dt_imageio_rawspeed_region_t
+{
+  FileMap *map;
+  RawDecoder *decoder;
+  int orientation;
+  // false if scaleBlackWhite() would leave the values alone
+  int scale;
+}
+dt_imageio_rawspeed_region_t;
+
+static void
+_region_cleanup(dt_imageio_region_t *r)
+{
+  dt_imageio_rawspeed_region_t *d = (dt_imageio_rawspeed_region_t *)r->data;
+  if(!d) return;
+  delete d->decoder;
+  delete d->map;
+  delete d;
+  r->data = NULL;
+}
+
+static int
+_region_decode(dt_imageio_region_t *r, const int x, const int y, const int width, const int height)
+{
+  dt_imageio_rawspeed_region_t *d = (dt_imageio_rawspeed_region_t *)r->data;
+  const int o = d->orientation;
+  RawImage raw = d->decoder->mRaw;
+  const int rw = raw->dim.x, rh = raw->dim.y;
+
+  // the rectangle in raw coordinates, undoing the flip of dt_imageio_flip_buffers()
+  int rx, ry, rwd, rht;
+  if(o & 4)
+  {
+    rx  = (o & 1) ? rw - y - height : y;
+    ry  = (o & 2) ? rh - x - width  : x;
+    rwd = height;
+    rht = width;
+  }
+  else
+  {
+    rx  = (o & 1) ? rw - x - width  : x;
+    ry  = (o & 2) ? rh - y - height : y;
+    rwd = width;
+    rht = height;
+  }
+
+  try
+  {
+    d->decoder->decodeRegion(iRectangle2D(rx, ry, rwd, rht));
+  }
+  catch (...)
+  {
+    return 1;
+  }
+
+  // scale with the same dither as a full decode, so the pixels don't depend on which way they were
+  // loaded. the raw keeps the unscaled values, so doing this twice is harmless.
+  uint16_t *in = (uint16_t *)raw->getData();
+  int pitch = raw->pitch/sizeof(uint16_t);
+  int ox = 0, oy = 0;
+  uint16_t *scaled = NULL;
+  if(d->scale)
+  {
+    scaled = (uint16_t *)malloc(sizeof(uint16_t)*rwd*rht);
+    if(!scaled) return 1;
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) default(none) shared(raw, scaled, rx, ry, rwd, rht)
+#endif
+    for(int j=0; j<rht; j++)
+      raw->scaleValuesRegion(iRectangle2D(rx, ry + j, rwd, 1), scaled + (size_t)rwd*j, rwd);
+    in = scaled;
+    pitch = rwd;
+    ox = rx;
+    oy = ry;
+  }
+  uint16_t *out = (uint16_t *)r->buf;
+  const int bw = r->width;
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) default(none) shared(in, out, pitch, ox, oy)
+#endif
+  for(int j=y; j<y+height; j++)
+  {
+    for(int i=x; i<x+width; i++)
+    {
+      int ri, rj;
+      if(o & 4)
+      {
+        rj = (o & 2) ? rh - 1 - i : i;
+        ri = (o & 1) ? rw - 1 - j : j;
+      }
+      else
+      {
+        ri = (o & 1) ? rw - 1 - i : i;
+        rj = (o & 2) ? rh - 1 - j : j;
+      }
+      out[(size_t)j*bw + i] = in[(size_t)(rj - oy)*pitch + ri - ox];
+    }
+  }
+  free(scaled);
+  return 0;
+}
+
+dt_imageio_region_t *
+dt_imageio_open_rawspeed_region(dt_image_t *img, const char *filename)
+{
+  if(!img->exif_inited)
+    (void) dt_exif_read(img, filename);
+
+  char filen[1024];
+  snprintf(filen, 1024, "%s", filename);
+  FileReader f(filen);
+
+  dt_imageio_rawspeed_region_t *d = new dt_imageio_rawspeed_region_t;
+  d->map = NULL;
+  d->decoder = NULL;
+  dt_imageio_region_t *region = NULL;
+
+  try
+  {
+    _load_meta();
+
+    d->map = f.readFile();
+    RawParser t(d->map);
+    d->decoder = t.getDecoder();
+
+    // only dng knows how to decode parts of the image, don't decode anything else twice.
+    if(!d->decoder || !dynamic_cast<DngDecoder *>(d->decoder))
+      throw 1;
+
+    d->decoder->failOnUnknown = true;
+    d->decoder->checkSupport(meta);
+    d->decoder->decodeLazily = true;
+    d->decoder->decodeRaw();
+    d->decoder->decodeMetaData(meta);
+    RawImage r = d->decoder->mRaw;
+
+    if(!d->decoder->isDecodedLazily() || r->getDataType() != TYPE_USHORT16 || r->getCpp() != 1 || !r->cfa.getDcrawFilter())
+      throw 1;
+
+    // the same test scaleBlackWhite() skips with:
+    d->scale = !(r->blackAreas.size() == 0 && r->blackLevel == 0 && r->whitePoint == 65535 && r->blackLevelSeparate[0] < 0);
+    r->calculateBlackLevels();
+
+    img->bpp = r->getBpp();
+    img->filters = r->cfa.getDcrawFilter();
+    img->flags &= ~DT_IMAGE_LDR;
+    img->flags |= DT_IMAGE_RAW;
+
+    // also include used override in orient:
+    d->orientation = dt_image_orientation(img);
+    img->width  = (d->orientation & 4) ? r->dim.y : r->dim.x;
+    img->height = (d->orientation & 4) ? r->dim.x : r->dim.y;
+
+    region = dt_imageio_region_new(img->width, img->height, img->bpp);
+    if(!region)
+      throw 1;
+  }
+  catch (...)
+  {
+    delete d->decoder;
+    delete d->map;
+    delete d;
+    return NULL;
+  }
+
+  region->data = d;
+  region->decode = _region_decode;
+  region->cleanup = _region_cleanup;
+  return region;
+}
+
 dt_imageio_retval_t
 dt_imageio_open_rawspeed_sraw(dt_image_t *img, RawImage r, dt_mipmap_cache_allocator_t a)
 {
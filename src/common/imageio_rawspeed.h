@@ -27,6 +27,7 @@ extern "C"
 #include "common/mipmap_cache.h"
 
   dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filename, dt_mipmap_cache_allocator_t a);
+  struct dt_imageio_region_t *dt_imageio_open_rawspeed_region(dt_image_t *img, const char *filename);
 
 #ifdef __cplusplus
 }
@@ -1077,6 +1077,7 @@ dt_interpolation_new(
  * @param pindex [out] Array of sample indexes to be used for applying each kernel tap
  * arrays of informations
  * @param pmeta [out] Array of int triplets (length, kernel, index) telling where to start for an arbitrary out position meta[3*out]
+ * @param psize [out] Size in bytes of the allocation all arrays live in
  * @return 0 for success, !0 for failure
  */
 static int
@@ -1090,12 +1091,14 @@ prepare_resampling_plan(
   int** plength,
   float** pkernel,
   int** pindex,
-  int** pmeta)
+  int** pmeta,
+  size_t* psize)
 {
   // Safe return values
   *plength = NULL;
   *pkernel = NULL;
   *pindex = NULL;
+  *psize = 0;
   if (pmeta)
   {
     *pmeta = NULL;
@@ -1265,9 +1268,182 @@ prepare_resampling_plan(
   {
     *pmeta = meta;
   }
+  *psize = totalreq;
   return 0;
 }
 
+/* --------------------------------------------------------------------------
+ * Resampling plan cache
+ * ------------------------------------------------------------------------*/
+
+// The darkroom, the filmstrip and exports resample to the same geometry over
+// and over again, so the 1D plans are kept around for the next call.
+#define PLAN_CACHE_ENTRIES 16
+#define PLAN_CACHE_MAX_SIZE (64<<20)
+
+typedef struct resampling_plan_t
+{
+  // what the plan was prepared for. in_x0 does not go into the plan.
+  enum dt_interpolation_type id;
+  int in, out, out_x0;
+  float scale;
+  int has_meta;
+
+  // the plan itself, length is the start of the one allocation
+  int *length;
+  float *kernel;
+  int *index;
+  int *meta;
+  size_t size;
+
+  int users;      // resamplings using it right now
+  int cached;     // still in the cache, or to be freed by its last user
+  uint64_t used;  // lru stamp
+}
+resampling_plan_t;
+
+static struct
+{
+  dt_pthread_mutex_t lock;
+  int initialized;
+  resampling_plan_t *plan[PLAN_CACHE_ENTRIES];
+  size_t size;
+  uint64_t stamp;
+  uint64_t hits, misses;
+}
+plan_cache;
+
+void
+dt_interpolation_init()
+{
+  memset(&plan_cache, 0, sizeof(plan_cache));
+  dt_pthread_mutex_init(&plan_cache.lock, NULL);
+  plan_cache.initialized = 1;
+}
+
+void
+dt_interpolation_cleanup()
+{
+  if (!plan_cache.initialized) return;
+  dt_print(DT_DEBUG_PERF, "[resample] plan cache: %"PRIu64" hits, %"PRIu64" misses\n", plan_cache.hits, plan_cache.misses);
+  for (int k=0; k<PLAN_CACHE_ENTRIES; k++)
+  {
+    if (!plan_cache.plan[k]) continue;
+    free(plan_cache.plan[k]->length);
+    free(plan_cache.plan[k]);
+  }
+  dt_pthread_mutex_destroy(&plan_cache.lock);
+  plan_cache.initialized = 0;
+}
+
+static void
+release_resampling_plan(
+  resampling_plan_t *plan)
+{
+  if (!plan) return;
+  int drop = 0;
+  if (plan_cache.initialized) dt_pthread_mutex_lock(&plan_cache.lock);
+  plan->users--;
+  drop = !plan->cached && plan->users == 0;
+  if (plan_cache.initialized) dt_pthread_mutex_unlock(&plan_cache.lock);
+  if (drop)
+  {
+    free(plan->length);
+    free(plan);
+  }
+}
+
+/** Returns the 1D resampling plan for the given geometry, out of the cache
+ * if it has been prepared before. Release it with release_resampling_plan()
+ * when done.
+ * @return the plan, NULL on failure
+ */
+static resampling_plan_t *
+get_resampling_plan(
+  const struct dt_interpolation* itor,
+  int in,
+  const int in_x0,
+  int out,
+  const int out_x0,
+  float scale,
+  const int has_meta)
+{
+  resampling_plan_t *plan = NULL;
+  if (plan_cache.initialized)
+  {
+    dt_pthread_mutex_lock(&plan_cache.lock);
+    for (int k=0; k<PLAN_CACHE_ENTRIES; k++)
+    {
+      resampling_plan_t *p = plan_cache.plan[k];
+      // a plan with meta data does for one without, too
+      if (p && p->id == itor->id && p->in == in && p->out == out && p->out_x0 == out_x0
+          && p->scale == scale && p->has_meta >= has_meta)
+      {
+        p->users++;
+        p->used = ++plan_cache.stamp;
+        plan_cache.hits++;
+        plan = p;
+        break;
+      }
+    }
+    if (!plan) plan_cache.misses++;
+    dt_pthread_mutex_unlock(&plan_cache.lock);
+    if (plan) return plan;
+    dt_print(DT_DEBUG_PERF, "[resample] plan cache miss for %d -> %d@%d scale %f (%"PRIu64" hits, %"PRIu64" misses)\n",
+             in, out, out_x0, scale, plan_cache.hits, plan_cache.misses);
+  }
+
+  // prepare it outside the lock, other resamplings may go on meanwhile
+  plan = (resampling_plan_t *)malloc(sizeof(resampling_plan_t));
+  if (!plan) return NULL;
+  plan->id = itor->id;
+  plan->in = in;
+  plan->out = out;
+  plan->out_x0 = out_x0;
+  plan->scale = scale;
+  plan->has_meta = has_meta;
+  plan->users = 1;
+  plan->cached = 0;
+  if (prepare_resampling_plan(itor, in, in_x0, out, out_x0, scale, &plan->length, &plan->kernel, &plan->index,
+                              has_meta ? &plan->meta : NULL, &plan->size))
+  {
+    free(plan);
+    return NULL;
+  }
+  if (!has_meta) plan->meta = NULL;
+  if (!plan_cache.initialized || plan->size > PLAN_CACHE_MAX_SIZE) return plan;
+
+  // make room by dropping the least recently used plans nobody is using.
+  // if that is not enough, the plan is freed after this one use.
+  dt_pthread_mutex_lock(&plan_cache.lock);
+  while (1)
+  {
+    int empty = -1, lru = -1;
+    for (int k=0; k<PLAN_CACHE_ENTRIES; k++)
+    {
+      resampling_plan_t *p = plan_cache.plan[k];
+      if (!p) empty = k;
+      else if (p->users == 0 && (lru < 0 || p->used < plan_cache.plan[lru]->used)) lru = k;
+    }
+    if (empty >= 0 && plan_cache.size + plan->size <= PLAN_CACHE_MAX_SIZE)
+    {
+      plan->cached = 1;
+      plan->used = ++plan_cache.stamp;
+      plan_cache.plan[empty] = plan;
+      plan_cache.size += plan->size;
+      break;
+    }
+    if (lru < 0) break;
+    resampling_plan_t *p = plan_cache.plan[lru];
+    plan_cache.plan[lru] = NULL;
+    plan_cache.size -= p->size;
+    free(p->length);
+    free(p);
+  }
+  dt_pthread_mutex_unlock(&plan_cache.lock);
+  return plan;
+}
+
 void
 dt_interpolation_resample(
   const struct dt_interpolation* itor,
@@ -1285,8 +1461,8 @@ dt_interpolation_resample(
   int* vlength = NULL;
   float* vkernel = NULL;
   int* vmeta = NULL;
-
-  int r;
+  resampling_plan_t *hplan = NULL;
+  resampling_plan_t *vplan = NULL;
 
   debug_info(
     "resampling %p (%dx%d@%dx%d scale %f) -> %p (%dx%d@%dx%d scale %f)\n",
@@ -1325,18 +1501,25 @@ dt_interpolation_resample(
   int64_t ts_plan = getts();
 #endif
 
-  // Prepare resampling plans once and for all
-  r = prepare_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale, &hlength, &hkernel, &hindex, NULL);
-  if (r)
+  // Prepare resampling plans once and for all, or take them from the cache
+  hplan = get_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale, 0);
+  if (!hplan)
   {
     goto exit;
   }
+  hlength = hplan->length;
+  hkernel = hplan->kernel;
+  hindex = hplan->index;
 
-  r = prepare_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale, &vlength, &vkernel, &vindex, &vmeta);
-  if (r)
+  vplan = get_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale, 1);
+  if (!vplan)
   {
     goto exit;
   }
+  vlength = vplan->length;
+  vkernel = vplan->kernel;
+  vindex = vplan->index;
+  vmeta = vplan->meta;
 
 #if DEBUG_RESAMPLING_TIMING
   ts_plan = getts() - ts_plan;
@@ -1428,11 +1611,11 @@ dt_interpolation_resample(
 #endif
 
 exit:
-  /* Free the resampling plans. It's nasty to optimize allocs like that, but
-   * it simplifies the code :-D. The length array is in fact the only memory
-   * allocated. */
-  free(hlength);
-  free(vlength);
+  /* Hand the resampling plans back to the cache. It's nasty to optimize
+   * allocs like that, but it simplifies the code :-D. The length array is
+   * in fact the only memory allocated. */
+  release_resampling_plan(hplan);
+  release_resampling_plan(vplan);
 }
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -121,6 +121,15 @@ const struct dt_interpolation*
 dt_interpolation_new(
   enum dt_interpolation_type type);
 
+/** Sets up the cache of resampling plans used by dt_interpolation_resample() */
+void
+dt_interpolation_init();
+
+/** Frees the cached resampling plans, and prints how often they were reused
+ * with -d perf */
+void
+dt_interpolation_cleanup();
+
 /** Image resampler.
  *
  * Resamples the image "in" to "out" according to roi values. Here is the
@@ -22,6 +22,7 @@
 #include "common/imageio_module.h"
 #include "common/imageio_jpeg.h"
 #include "common/mipmap_cache.h"
+#include "common/trace.h"
 #include "control/conf.h"
 #include "control/jobs.h"
 #include "libraw/libraw.h"
@@ -804,6 +805,8 @@ dt_mipmap_cache_read_get(
   {
     // simple case: only get and lock if it's there.
     struct dt_mipmap_buffer_dsc* dsc = (struct dt_mipmap_buffer_dsc*)dt_cache_read_testget(&cache->mip[mip].cache, key);
+    if(dt_trace_enabled())
+      dt_trace_instant("mipmap", "testlock", "\"imgid\": %u, \"mip\": %d, \"cache\": \"%s\"", imgid, mip, dsc ? "hit" : "miss");
     if(dsc)
     {
       buf->width  = dsc->width;
@@ -835,6 +838,8 @@ dt_mipmap_cache_read_get(
   else if(flags == DT_MIPMAP_BLOCKING)
   {
     // simple case: blocking get
+    const double trace_start = dt_trace_enabled() ? dt_get_wtime() : 0.0;
+    int trace_miss = 0;
     struct dt_mipmap_buffer_dsc* dsc = (struct dt_mipmap_buffer_dsc*)dt_cache_read_get(&cache->mip[mip].cache, key);
     if(!dsc)
     {
@@ -854,6 +859,7 @@ dt_mipmap_cache_read_get(
       //assert(dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE || dsc->size == 0);
       if(dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE)
       {
+        trace_miss = 1;
         // fprintf(stderr, "[mipmap cache get] now initializing buffer for img %u mip %d!\n", imgid, mip);
         // we're write locked here, as requested by the alloc callback.
         // now fill it with data:
@@ -949,6 +955,9 @@ dt_mipmap_cache_read_get(
         else buf->buf = NULL; // full images with NULL buffer have to be handled, indicates `missing image'
       }
     }
+    if(dt_trace_enabled())
+      dt_trace_span("mipmap", "get", trace_start, dt_get_wtime(), "\"imgid\": %u, \"mip\": %d, \"cache\": \"%s\"",
+                    imgid, mip, trace_miss ? "miss" : "hit");
   }
   else if(flags == DT_MIPMAP_BEST_EFFORT)
   {
@@ -1203,6 +1212,9 @@ _init_8(
       dt_imageio_jpeg_t jpg;
       if(!dt_imageio_jpeg_read_header(filename, &jpg))
       {
+        // decode only as large as needed for the mip, flip_and_zoom turns the box by orientation.
+        if(orientation & 4) dt_imageio_jpeg_scale_to(&jpg, ht, wd);
+        else dt_imageio_jpeg_scale_to(&jpg, wd, ht);
         uint8_t *tmp = (uint8_t *)malloc(sizeof(uint8_t)*jpg.width*jpg.height*4);
         if(!dt_imageio_jpeg_read(&jpg, tmp))
         {
@@ -1230,9 +1242,11 @@ _init_8(
       const int orientation = raw->sizes.flip;
       if(image->type == LIBRAW_IMAGE_JPEG)
       {
-        // JPEG: decode (directly rescaled to mip4)
+        // JPEG: decode with the scaled idct, directly at about the size of the mip
         dt_imageio_jpeg_t jpg;
         if(dt_imageio_jpeg_decompress_header(image->data, image->data_size, &jpg)) goto libraw_fail;
+        if(orientation & 4) dt_imageio_jpeg_scale_to(&jpg, ht, wd);
+        else dt_imageio_jpeg_scale_to(&jpg, wd, ht);
         uint8_t *tmp = (uint8_t *)malloc(sizeof(uint8_t)*jpg.width*jpg.height*4);
         if(dt_imageio_jpeg_decompress(&jpg, tmp))
         {
@@ -24,6 +24,7 @@
 #include "common/gaussian.h"
 #include "common/dlopencl.h"
 #include "common/nvidia_gpus.h"
+#include "common/trace.h"
 #include "control/conf.h"
 
 #include <string.h>
@@ -1357,6 +1358,25 @@ void dt_opencl_events_wait_for(const int devid)
 }
 
 
+/** put the kernels of events first..last-1 on the trace. the device has its own clock, it is lined up
+with ours at the end of the last event, as the queue has just been waited for. */
+static void _opencl_events_trace(const int devid, const int first, const int last)
+{
+  const dt_opencl_eventtag_t *eventtags = darktable.opencl->dev[devid].eventtags;
+  cl_ulong device_now = 0;
+  for(int k = first; k < last; k++)
+    if(eventtags[k].timelapsed) device_now = MAX(device_now, eventtags[k].start + eventtags[k].timelapsed);
+  const double now = dt_get_wtime();
+  for(int k = first; k < last; k++)
+  {
+    if(!eventtags[k].timelapsed) continue; // lost event, no timing
+    const double begin = now - 1e-9*(device_now - eventtags[k].start);
+    dt_trace_device_span(devid, eventtags[k].tag[0] == '\0' ? "<?>" : eventtags[k].tag, begin,
+                         begin + 1e-9*eventtags[k].timelapsed, "\"retval\": %d", eventtags[k].retval);
+  }
+}
+
+
 /** Wait for events in eventlist to terminate, check for return status and profiling
 info of events.
 If "reset" is TRUE report summary info (would be CL_COMPLETE or last error code) and
@@ -1384,6 +1404,7 @@ cl_int dt_opencl_events_flush(const int devid, const int reset)
   dt_opencl_events_wait_for(devid);
 
   // now check return status and profiling data of all newly terminated events
+  const int first = *eventsconsolidated;
   for (int k = *eventsconsolidated; k < *numevents; k++)
   {
     cl_int err;
@@ -1411,6 +1432,7 @@ cl_int dt_opencl_events_flush(const int devid, const int reset)
     cl_int erre = (cl->dlocl->symbols->dt_clGetEventProfilingInfo)((*eventlist)[k], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
     if (errs == CL_SUCCESS && erre == CL_SUCCESS)
     {
+      (*eventtags)[k].start = start;
       (*eventtags)[k].timelapsed = end - start;
     }
     else
@@ -1424,6 +1446,8 @@ cl_int dt_opencl_events_flush(const int devid, const int reset)
     (*eventsconsolidated)++;
   }
 
+  if(dt_trace_enabled()) _opencl_events_trace(devid, first, *eventsconsolidated);
+
   cl_int result = *summary;
 
   // do we want to get rid of all stored info?
@@ -52,6 +52,7 @@
 typedef struct dt_opencl_eventtag_t
 {
   cl_int retval;
+  cl_ulong start;         // device clock, only used for the trace
   cl_ulong timelapsed;
   char tag[DT_OPENCL_EVENTNAMELENGTH];
 }
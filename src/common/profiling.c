@@ -17,6 +17,7 @@
 */
 
 #include "common/profiling.h"
+#include "common/trace.h"
 
 dt_timer_t *dt_timer_start_with_name (const char *file,const char *function,const char *description)
 {
@@ -25,6 +26,7 @@ dt_timer_t *dt_timer_start_with_name (const char *file,const char *function,cons
   t->function = function;
   t->timer = g_timer_new ();
   t->description = description;
+  t->start = dt_get_wtime();
   return t;
 }
 
@@ -34,6 +36,8 @@ void dt_timer_stop_with_name (dt_timer_t *t)
   g_timer_stop (t->timer);
   gulong ms=0;
   fprintf (stderr,"Timer %s in function %s took %.3f seconds to execute.\n",t->description,t->function,g_timer_elapsed (t->timer,&ms));
+  if(dt_trace_enabled())
+    dt_trace_span("timer", t->description, t->start, dt_get_wtime(), "\"function\": \"%s\", \"file\": \"%s\"", t->function, t->file);
   g_timer_destroy (t->timer);
   g_free (t);
 }
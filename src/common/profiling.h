@@ -41,6 +41,7 @@ typedef struct dt_timer_t
   const char *function;
   const char *description;
   GTimer *timer;
+  double start;  // dt_get_wtime(), for the trace
 }
 dt_timer_t;
 
@@ -39,8 +39,9 @@ void dt_ratings_apply_to_selection (int rating)
     DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), query, NULL, NULL, NULL);
 #endif
 
-    /* for each selected image update rating */
+    /* for each selected image update rating, in one transaction */
     sqlite3_stmt *stmt;
+    dt_database_start_transaction(darktable.db);
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select imgid from selected_images", -1, &stmt, NULL);
     while(sqlite3_step(stmt) == SQLITE_ROW)
     {
@@ -52,6 +53,7 @@ void dt_ratings_apply_to_selection (int rating)
       dt_image_cache_read_release(darktable.image_cache, image);
     }
     sqlite3_finalize(stmt);
+    dt_database_release_transaction(darktable.db);
 
     /* redraw view */
     dt_control_queue_redraw_center();
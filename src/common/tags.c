@@ -190,24 +190,23 @@ void dt_tag_attach(guint tagid,gint imgid)
   sqlite3_stmt *stmt;
   if(imgid > 0)
   {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT OR REPLACE INTO tagged_images (imgid, tagid) VALUES (?1, ?2)",
-                                -1, &stmt, NULL);
+    // runs once per image for bulk tagging and import, so the statements are cached:
+    stmt = dt_database_get_statement(darktable.db,
+                                     "INSERT OR REPLACE INTO tagged_images (imgid, tagid) VALUES (?1, ?2)");
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, tagid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_statement(darktable.db, stmt);
 
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "UPDATE tagxtag SET count = count + 1 WHERE "
-                                "(id1 = ?1 AND id2 IN (SELECT tagid FROM tagged_images WHERE imgid = ?2)) "
-                                "OR "
-                                "(id2 = ?1 AND id1 IN (SELECT tagid FROM tagged_images WHERE imgid = ?2))",
-                                -1, &stmt, NULL);
+    stmt = dt_database_get_statement(darktable.db,
+                                     "UPDATE tagxtag SET count = count + 1 WHERE "
+                                     "(id1 = ?1 AND id2 IN (SELECT tagid FROM tagged_images WHERE imgid = ?2)) "
+                                     "OR "
+                                     "(id2 = ?1 AND id1 IN (SELECT tagid FROM tagged_images WHERE imgid = ?2))");
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_statement(darktable.db, stmt);
   }
   else
   {
@@ -234,12 +233,14 @@ void dt_tag_attach(guint tagid,gint imgid)
 void dt_tag_attach_list(GList *tags,gint imgid)
 {
   GList *child=NULL;
+  dt_database_start_transaction(darktable.db);
   if( (child=g_list_first(tags))!=NULL )
     do
     {
       dt_tag_attach((guint)(long int)child->data,imgid);
     }
     while( (child=g_list_next(child)) !=NULL);
+  dt_database_release_transaction(darktable.db);
 }
 
 void dt_tag_attach_string_list(const gchar *tags, gint imgid)
@@ -247,6 +248,7 @@ void dt_tag_attach_string_list(const gchar *tags, gint imgid)
   gchar **tokens = g_strsplit(tags, ",", 0);
   if(tokens)
   {
+    dt_database_start_transaction(darktable.db);
     gchar **entry = tokens;
     while(*entry)
     {
@@ -264,6 +266,7 @@ void dt_tag_attach_string_list(const gchar *tags, gint imgid)
       }
       entry++;
     }
+    dt_database_release_transaction(darktable.db);
   }
   g_strfreev(tokens);
 }
@@ -274,24 +277,22 @@ void dt_tag_detach(guint tagid,gint imgid)
   if(imgid > 0)
   {
     // remove from specified image by id
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "UPDATE tagxtag SET count = count - 1 WHERE (id1 = ?1 AND id2 IN "
-                                "(SELECT tagid FROM tagged_images WHERE imgid = ?2)) OR (id2 = ?1 "
-                                "AND id1 IN (SELECT tagid FROM tagged_images WHERE imgid = ?2))",
-                                -1, &stmt, NULL);
+    stmt = dt_database_get_statement(darktable.db,
+                                     "UPDATE tagxtag SET count = count - 1 WHERE (id1 = ?1 AND id2 IN "
+                                     "(SELECT tagid FROM tagged_images WHERE imgid = ?2)) OR (id2 = ?1 "
+                                     "AND id1 IN (SELECT tagid FROM tagged_images WHERE imgid = ?2))");
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_statement(darktable.db, stmt);
 
     // remove from tagged_images
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "DELETE FROM tagged_images WHERE tagid = ?1 AND imgid = ?2",
-                                -1, &stmt, NULL);
+    stmt = dt_database_get_statement(darktable.db,
+                                     "DELETE FROM tagged_images WHERE tagid = ?1 AND imgid = ?2");
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_statement(darktable.db, stmt);
   }
   else
   {
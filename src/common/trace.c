@@ -0,0 +1,145 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2012 johannes hanika.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "common/trace.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// processes as the trace viewers show them: our threads, and the opencl devices.
+#define DT_TRACE_PID_THREADS 1
+#define DT_TRACE_PID_DEVICES 2
+
+// small thread ids in order of appearance, these are easier to read than pthread_self().
+static int _trace_threads = 0;
+static __thread int _trace_tid = 0;
+
+static int _trace_thread_id()
+{
+  if(!_trace_tid) _trace_tid = __sync_add_and_fetch(&_trace_threads, 1);
+  return _trace_tid;
+}
+
+static void _trace_string(FILE *f, const char *s)
+{
+  fputc('"', f);
+  for(; *s; s++)
+  {
+    if(*s == '"' || *s == '\\') fprintf(f, "\\%c", *s);
+    else if((unsigned char)*s < 0x20) fprintf(f, "\\u%04x", *s);
+    else fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+// ph is the event type of the trace format: X complete span, i instant, M metadata.
+static void _trace_event(const int pid, const int tid, const char ph, const char *category, const char *name,
+                         const double begin, const double end, const char *args, va_list ap)
+{
+  dt_trace_t *t = darktable.trace;
+  dt_pthread_mutex_lock(&t->mutex);
+  fprintf(t->f, "%s{\"ph\": \"%c\", \"pid\": %d, \"tid\": %d, \"ts\": %.1f", t->events ? ",\n" : "", ph, pid, tid,
+          1e6*(begin - t->start));
+  if(ph == 'X') fprintf(t->f, ", \"dur\": %.1f", 1e6*(end - begin));
+  if(ph == 'i') fprintf(t->f, ", \"s\": \"t\"");
+  if(category) fprintf(t->f, ", \"cat\": \"%s\"", category);
+  fprintf(t->f, ", \"name\": ");
+  _trace_string(t->f, name);
+  if(args)
+  {
+    fprintf(t->f, ", \"args\": {");
+    vfprintf(t->f, args, ap);
+    fprintf(t->f, "}");
+  }
+  fprintf(t->f, "}");
+  t->events++;
+  dt_pthread_mutex_unlock(&t->mutex);
+}
+
+static void _trace_metadata(const int pid, const char *name, const char *args, ...)
+{
+  va_list ap;
+  va_start(ap, args);
+  _trace_event(pid, 0, 'M', NULL, name, darktable.trace->start, darktable.trace->start, args, ap);
+  va_end(ap);
+}
+
+void dt_trace_init(const char *filename)
+{
+  darktable.trace = NULL;
+  if(!filename) return;
+  FILE *f = fopen(filename, "wb");
+  if(!f)
+  {
+    fprintf(stderr, "[trace] can't open `%s' for writing\n", filename);
+    return;
+  }
+  dt_trace_t *t = (dt_trace_t *)malloc(sizeof(dt_trace_t));
+  t->f = f;
+  t->start = dt_get_wtime();
+  t->events = 0;
+  dt_pthread_mutex_init(&t->mutex, NULL);
+  // the closing bracket is optional in this format, so a crash still leaves a trace that loads.
+  fprintf(f, "[\n");
+  darktable.trace = t;
+  _trace_metadata(DT_TRACE_PID_THREADS, "process_name", "\"name\": \"darktable\"");
+  _trace_metadata(DT_TRACE_PID_DEVICES, "process_name", "\"name\": \"opencl devices\"");
+}
+
+void dt_trace_cleanup()
+{
+  dt_trace_t *t = darktable.trace;
+  if(!t) return;
+  darktable.trace = NULL;
+  fprintf(t->f, "\n]\n");
+  fclose(t->f);
+  dt_pthread_mutex_destroy(&t->mutex);
+  free(t);
+}
+
+void dt_trace_span(const char *category, const char *name, double begin, double end, const char *args, ...)
+{
+  if(!darktable.trace) return;
+  va_list ap;
+  va_start(ap, args);
+  _trace_event(DT_TRACE_PID_THREADS, _trace_thread_id(), 'X', category, name, begin, end, args, ap);
+  va_end(ap);
+}
+
+void dt_trace_instant(const char *category, const char *name, const char *args, ...)
+{
+  if(!darktable.trace) return;
+  const double now = dt_get_wtime();
+  va_list ap;
+  va_start(ap, args);
+  _trace_event(DT_TRACE_PID_THREADS, _trace_thread_id(), 'i', category, name, now, now, args, ap);
+  va_end(ap);
+}
+
+void dt_trace_device_span(int device, const char *name, double begin, double end, const char *args, ...)
+{
+  if(!darktable.trace) return;
+  va_list ap;
+  va_start(ap, args);
+  _trace_event(DT_TRACE_PID_DEVICES, device, 'X', "opencl", name, begin, end, args, ap);
+  va_end(ap);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,66 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2012 johannes hanika.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_TRACE_H
+#define DT_TRACE_H
+
+#include "common/darktable.h"
+
+/**
+ * timeline of what darktable is doing, enabled by `--trace <file>'.
+ * the file is in the chrome trace event format (a json array of events),
+ * chrome://tracing and ui.perfetto.dev load it as is. pixelpipe nodes,
+ * control jobs, mipmap cache gets and opencl kernels end up in it, every
+ * span with the thread it ran on.
+ *
+ * all times are seconds as returned by dt_get_wtime(). callers check
+ * dt_trace_enabled() before they take any, so tracing costs a single
+ * compare if it is off.
+ */
+
+typedef struct dt_trace_t
+{
+  FILE *f;
+  dt_pthread_mutex_t mutex;
+  double start;          // dt_get_wtime() at init, the origin of the timeline
+  int events;
+}
+dt_trace_t;
+
+/** opens the trace file, does nothing if filename is NULL. */
+void dt_trace_init(const char *filename);
+/** closes the json array and the file. */
+void dt_trace_cleanup();
+
+static inline int dt_trace_enabled()
+{
+  return darktable.trace != NULL;
+}
+
+/** a span from begin to end on the calling thread. args is a printf-like format for the
+ * members of the event's args object, e.g. "\"width\": %d", or NULL. name is escaped,
+ * whatever args expands to has to be valid json. */
+void dt_trace_span(const char *category, const char *name, double begin, double end, const char *args, ...);
+/** something that happened at one point in time on the calling thread, a cache hit for example. */
+void dt_trace_instant(const char *category, const char *name, const char *args, ...);
+/** a span on the track of a device, for work that does not run on one of our threads. */
+void dt_trace_device_span(int device, const char *name, double begin, double end, const char *args, ...);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -27,6 +27,7 @@
 #include "common/image_cache.h"
 #include "common/imageio.h"
 #include "common/debug.h"
+#include "common/trace.h"
 #include "bauhaus/bauhaus.h"
 #include "views/view.h"
 #include "gui/gtk.h"
@@ -49,6 +50,7 @@
 #endif
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <strings.h>
 #include <assert.h>
 #include <math.h>
@@ -862,6 +864,17 @@ void dt_control_job_print(dt_job_t *j)
 #endif
 }
 
+static void _control_job_trace(dt_job_t *j, const int worker, const double start)
+{
+#ifdef DT_CONTROL_JOB_DEBUG
+  const char *name = j->description;
+#else
+  const char *name = "job";
+#endif
+  dt_trace_span("control", name, start, dt_get_wtime(), "\"worker\": %d, \"queued_ms\": %.3f, \"result\": %d",
+                worker, 1e3*(start - j->ts_queued), j->result);
+}
+
 void _control_job_set_state(dt_job_t *j,int state)
 {
   dt_pthread_mutex_lock (&j->state_mutex);
@@ -920,7 +933,9 @@ int32_t dt_control_run_job_res(dt_control_t *s, int32_t res)
     _control_job_set_state (j,DT_JOB_STATE_RUNNING);
 
     /* execute job */
+    const double start = dt_trace_enabled() ? dt_get_wtime() : 0.0;
     j->result = j->execute (j);
+    if(dt_trace_enabled()) _control_job_trace(j, res, start);
 
     _control_job_set_state (j,DT_JOB_STATE_FINISHED);
     dt_print(DT_DEBUG_CONTROL, "[run_job-] %02d %f ", res, dt_get_wtime());
@@ -998,7 +1013,9 @@ int32_t dt_control_run_job(dt_control_t *s)
     _control_job_set_state (j,DT_JOB_STATE_RUNNING);
 
     /* execute job */
+    const double start = dt_trace_enabled() ? dt_get_wtime() : 0.0;
     j->result = j->execute (j);
+    if(dt_trace_enabled()) _control_job_trace(j, DT_CTL_WORKER_RESERVED+dt_control_get_threadid(), start);
 
     _control_job_set_state (j,DT_JOB_STATE_FINISHED);
 
@@ -1026,6 +1043,8 @@ int32_t dt_control_add_job_res(dt_control_t *s, dt_job_t *job, int32_t res)
   dt_print(DT_DEBUG_CONTROL, "\n");
   _control_job_set_state (job,DT_JOB_STATE_QUEUED);
   s->job_res[res] = *job;
+  // background jobs keep the time they entered the queue
+  if(dt_trace_enabled() && job->ts_queued == 0.0) s->job_res[res].ts_queued = dt_get_wtime();
   s->new_res[res] = 1;
   dt_pthread_mutex_unlock(&s->queue_mutex);
   dt_pthread_mutex_lock(&s->cond_mutex);
@@ -1062,7 +1081,7 @@ int32_t dt_control_add_job(dt_control_t *s, dt_job_t *job)
   if(jobitem)
     do
     {
-      if(!memcmp(job, jobitem->data, sizeof(dt_job_t)))
+      if(!memcmp(job, jobitem->data, offsetof(dt_job_t, ts_queued)))
       {
         dt_print(DT_DEBUG_CONTROL, "[add_job] found job already in queue\n");
         _control_job_set_state (job,DT_JOB_STATE_DISCARDED);
@@ -1082,6 +1101,7 @@ int32_t dt_control_add_job(dt_control_t *s, dt_job_t *job)
     /* allocate storage for the job, and set job state */
     dt_job_t *thejob = g_malloc(sizeof(dt_job_t));
     memcpy(thejob,job,sizeof(dt_job_t));
+    if(dt_trace_enabled()) thejob->ts_queued = dt_get_wtime();
     _control_job_set_state (thejob,DT_JOB_STATE_QUEUED);
     s->queue = g_list_append(s->queue, thejob);
     dt_pthread_mutex_unlock(&s->queue_mutex);
@@ -1114,7 +1134,7 @@ int32_t dt_control_revive_job(dt_control_t *s, dt_job_t *job)
   if (jobitem)
     do
     {
-      if(!memcmp(job, jobitem->data, sizeof(dt_job_t)))
+      if(!memcmp(job, jobitem->data, offsetof(dt_job_t, ts_queued)))
       {
         s->queue = g_list_remove_link(s->queue, jobitem);
         s->queue = g_list_insert(s->queue, jobitem->data, 0);
@@ -170,6 +170,10 @@ typedef struct dt_job_t
 #ifdef DT_CONTROL_JOB_DEBUG
   char description[DT_CONTROL_DESCRIPTION_LEN];
 #endif
+
+  /* dt_get_wtime() when the job was queued, only set if tracing. has to stay
+      the last member, it is not compared when looking for duplicate jobs. */
+  double ts_queued;
 }
 dt_job_t;
 
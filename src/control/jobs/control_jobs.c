@@ -32,6 +32,7 @@
 #include "common/tags.h"
 #include "common/debug.h"
 #include "common/gpx.h"
+#include "common/hdr_merge.h"
 #include "control/conf.h"
 #include "control/jobs/control_jobs.h"
 
@@ -364,27 +365,6 @@ int32_t dt_control_match_similar_job_run(dt_job_t *job)
   return 0;
 }
 
-static float
-envelope(const float xx)
-{
-  const float x = CLAMPS(xx, 0.0f, 1.0f);
-  // const float alpha = 2.0f;
-  const float beta = 0.5f;
-  if(x < beta)
-  {
-    // return 1.0f-fabsf(x/beta-1.0f)^2
-    const float tmp = fabsf(x/beta-1.0f);
-    return 1.0f-tmp*tmp;
-  }
-  else
-  {
-    const float tmp1 = (1.0f-x)/(1.0f-beta);
-    const float tmp2 = tmp1*tmp1;
-    const float tmp3 = tmp2*tmp1;
-    return 3.0f*tmp2 - 2.0f*tmp3;
-  }
-}
-
 int32_t dt_control_merge_hdr_job_run(dt_job_t *job)
 {
   long int imgid = -1;
@@ -397,17 +377,18 @@ int32_t dt_control_merge_hdr_job_run(dt_job_t *job)
 
   const guint *jid = dt_control_backgroundjobs_create(darktable.control, 1, message);
 
-  float *pixels = NULL;
-  float *weight = NULL;
+  dt_hdr_merge_t *merge = NULL;
   int wd = 0, ht = 0, first_imgid = -1;
   uint32_t filter = 0;
-  float whitelevel = 0.0f;
   total ++;
   while(t)
   {
     imgid = (long int)t->data;
     dt_mipmap_buffer_t buf;
     dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING);
+    // have the next raw loaded by another worker while we accumulate this one:
+    if(t->next)
+      dt_mipmap_cache_read_get(darktable.mipmap_cache, NULL, (long int)t->next->data, DT_MIPMAP_FULL, DT_MIPMAP_PREFETCH);
     // just take a copy. also do it after blocking read, so filters and bpp will make sense.
     const dt_image_t *img = dt_image_cache_read_get(darktable.image_cache, imgid);
     dt_image_t image = *img;
@@ -416,35 +397,35 @@ int32_t dt_control_merge_hdr_job_run(dt_job_t *job)
     {
       dt_control_log(_("exposure bracketing only works on raw images"));
       dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
-      free(pixels);
-      free(weight);
+      dt_hdr_merge_cleanup(merge);
       goto error;
     }
-    filter = dt_image_flipped_filter(img);
+    filter = dt_image_flipped_filter(&image);
     if(buf.size != DT_MIPMAP_FULL)
     {
       dt_control_log(_("failed to get raw buffer from image `%s'"), image.filename);
       dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
-      free(pixels);
-      free(weight);
+      dt_hdr_merge_cleanup(merge);
       goto error;
     }
 
-    if(!pixels)
+    if(!merge)
     {
       first_imgid = imgid;
-      pixels = (float *)malloc(sizeof(float)*image.width*image.height);
-      weight = (float *)malloc(sizeof(float)*image.width*image.height);
-      memset(pixels, 0x0, sizeof(float)*image.width*image.height);
-      memset(weight, 0x0, sizeof(float)*image.width*image.height);
       wd = image.width;
       ht = image.height;
+      merge = dt_hdr_merge_init(wd, ht);
+      if(!merge)
+      {
+        dt_control_log(_("not enough memory to merge `%s'"), image.filename);
+        dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+        goto error;
+      }
     }
     else if(image.width != wd || image.height != ht)
     {
       dt_control_log(_("images have to be of same size!"));
-      free(pixels);
-      free(weight);
+      dt_hdr_merge_cleanup(merge);
       dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
       goto error;
     }
@@ -458,50 +439,19 @@ int32_t dt_control_merge_hdr_job_run(dt_job_t *job)
     const float cal = 100.0f/(aperture*exp*iso);
     // about proportional to how many photons we can expect from this shot:
     const float photoncnt = 100.0f*aperture*exp/iso;
-    // stupid, but we don't know the real sensor saturation level:
-    uint16_t saturation = 0;
-    for(int k=0; k<wd*ht; k++)
-      saturation = MAX(saturation, ((uint16_t *)buf.buf)[k]);
-    // seems to be around 64500--64700 for 5dm2
-    // fprintf(stderr, "saturation: %u\n", saturation);
-    whitelevel = fmaxf(whitelevel, saturation*cal);
-#ifdef _OPENMP
-    #pragma omp parallel for schedule(static) default(none) shared(buf, pixels, weight, wd, ht, saturation)
-#endif
-    for(int k=0; k<wd*ht; k++)
-    {
-      const uint16_t in = ((uint16_t *)buf.buf)[k];
-      // weights based on siggraph 12 poster
-      // zijian zhu, zhengguo li, susanto rahardja, pasi fraenti
-      // 2d denoising factor for high dynamic range imaging
-      float w = envelope(in/(float)saturation) * photoncnt;
-      // in case we are black and drop to zero weight, give it something
-      // just so numerics don't collapse. blown out whites are handled below.
-      if(w < 1e-3f && in < saturation/3) w = 1e-3f;
-      pixels[k] += w * in * cal;
-      weight[k] += w;
-    }
+    dt_hdr_merge_add(merge, (const uint16_t *)buf.buf, photoncnt, cal);
+
+    // done with this raw, so we hold at most two of them (this and the prefetched one) at any time.
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
 
     t = g_list_delete_link(t, t);
 
     /* update backgroundjob ui plate */
     fraction+=1.0/total;
     dt_control_backgroundjobs_progress(darktable.control, jid, fraction);
-
-    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
-  }
-  // normalize by white level to make clipping at 1.0 work as expected (to be sure, scale down one more stop, thus the 0.5):
-#ifdef _OPENMP
-  #pragma omp parallel for schedule(static) default(none) shared(pixels, wd, ht, weight, whitelevel)
-#endif
-  for(int k=0; k<wd*ht; k++)
-  {
-    // in case w == 0, all pixels were overexposed (too dark would have been clamped to w >= eps above)
-    if(weight[k] < 1e-3f)
-      pixels[k] = 1.f; // mark as blown out.
-    else // normalize:
-      pixels[k] = fmaxf(0.0f, pixels[k]/(whitelevel*weight[k]));
   }
+  if(!merge) goto error;
+  float *pixels = dt_hdr_merge_finish(merge);
 
   // output hdr as digital negative with exif data.
   uint8_t exif[65535];
@@ -525,8 +475,7 @@ int32_t dt_control_merge_hdr_job_run(dt_job_t *job)
   dt_image_import(filmid, pathname, TRUE);
   g_free (directory);
 
-  free(pixels);
-  free(weight);
+  dt_hdr_merge_cleanup(merge);
 error:
   dt_control_backgroundjobs_destroy(darktable.control, jid);
   dt_control_queue_redraw_center();
@@ -667,8 +616,12 @@ int32_t dt_control_delete_images_job_run(dt_job_t *job)
   while(t)
   {
     imgid = (long int)t->data;
-    char filename[DT_MAX_PATH_LEN];
+    char filename[DT_MAX_PATH_LEN] = {0};
+    char xmpname[DT_MAX_PATH_LEN+8];
     dt_image_full_path(imgid, filename, DT_MAX_PATH_LEN);
+    g_strlcpy(xmpname, filename, DT_MAX_PATH_LEN);
+    dt_image_path_append_version(imgid, xmpname, DT_MAX_PATH_LEN);
+    g_strlcat(xmpname, ".xmp", sizeof(xmpname));
 
     int duplicates = 0;
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
@@ -677,15 +630,14 @@ int32_t dt_control_delete_images_job_run(dt_job_t *job)
     sqlite3_reset(stmt);
     sqlite3_clear_bindings(stmt);
 
+    // remove from the library first, this drops queued sidecar writes and waits for a running
+    // one, so none can bring back the xmp we delete below.
+    dt_image_remove(imgid);
+
     // remove from disk:
     if(duplicates == 1) // don't remove the actual data if there are (other) duplicates using it
       (void)g_unlink(filename);
-    dt_image_path_append_version(imgid, filename, DT_MAX_PATH_LEN);
-    char *c = filename + strlen(filename);
-    sprintf(c, ".xmp");
-    (void)g_unlink(filename);
-
-    dt_image_remove(imgid);
+    (void)g_unlink(xmpname);
 
     t = g_list_delete_link(t, t);
     fraction=1.0/total;
@@ -1267,6 +1219,9 @@ int32_t dt_control_export_job_run(dt_job_t *job)
           etagid = 0;
     dt_tag_new("darktable|changed",&tagid);
     dt_tag_new("darktable|exported",&etagid);
+    // keep one pipe per thread for the whole job, most batches share most of their history:
+    dt_imageio_export_context_t *ectx = dt_imageio_export_context_new();
+    dt_imageio_export_context_set(ectx);
 
     while(t && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED)
     {
@@ -1323,8 +1278,9 @@ int32_t dt_control_export_job_run(dt_job_t *job)
       if(mstorage->finalize_store) mstorage->finalize_store(mstorage, sdata);
       mstorage->free_params(mstorage, sdata);
     }
-    // all threads free their fdata
+    // all threads free their fdata and pipes
     mformat->free_params (mformat, fdata);
+    dt_imageio_export_context_free(ectx);
 #ifdef _OPENMP
   }
 #endif
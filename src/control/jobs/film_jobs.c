@@ -45,6 +45,23 @@ int32_t dt_film_import1_run(dt_job_t *job)
   }
   return 0;
 }
+
+void dt_film_rescan_init(dt_job_t *job, const int32_t id, GHashTable *names)
+{
+  dt_control_job_init(job, "rescan film roll folder");
+  job->execute = &dt_film_rescan_run;
+  dt_film_rescan_t *t = (dt_film_rescan_t *)job->param;
+  t->id = id;
+  t->names = names;
+}
+
+int32_t dt_film_rescan_run(dt_job_t *job)
+{
+  dt_film_rescan_t *t = (dt_film_rescan_t *)job->param;
+  dt_film_rescan(t->id, t->names);
+  g_hash_table_destroy(t->names);
+  return 0;
+}
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
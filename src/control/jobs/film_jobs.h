@@ -30,6 +30,17 @@ dt_film_import1_t;
 int32_t dt_film_import1_run(dt_job_t *job);
 void dt_film_import1_init(dt_job_t *job, dt_film_t *film);
 
+typedef struct dt_film_rescan_t
+{
+  int32_t id;
+  GHashTable *names;
+}
+dt_film_rescan_t;
+
+int32_t dt_film_rescan_run(dt_job_t *job);
+/** the job takes over names, a set of file names which changed in the folder of film roll id. */
+void dt_film_rescan_init(dt_job_t *job, const int32_t id, GHashTable *names);
+
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
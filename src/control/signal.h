@@ -115,6 +115,11 @@ typedef enum dt_signal_t
     */
   DT_SIGNAL_IMAGE_IMPORT,
 
+  /** \brief This signal is raised when the darkroom histogram and scopes have been recomputed
+  no param, no returned value
+    */
+  DT_SIGNAL_DEVELOP_HISTOGRAM_UPDATED,
+
   /* do not touch !*/
   DT_SIGNAL_COUNT
 }
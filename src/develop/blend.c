@@ -21,6 +21,13 @@
 #include "common/gaussian.h"
 #include "blend.h"
 
+#include <float.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#if defined(DT_HAVE_AVX2_TARGET) || defined(DT_HAVE_AVX512_TARGET)
+#include <immintrin.h>
+#endif
+
 #define CLAMP_RANGE(x,y,z)      (CLAMP(x,y,z))
 
 typedef void (_blend_row_func)(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag);
@@ -136,7 +143,7 @@ static inline void _CLAMP_XYZ(float *XYZ, const float *min, const float *max)
 
 
 
-static inline float _blendif_factor(dt_iop_colorspace_type_t cst,const float *input, const float *output, const unsigned int blendif, const float *parameters)
+static inline __attribute__((always_inline)) float _blendif_factor(dt_iop_colorspace_type_t cst,const float *input, const float *output, const unsigned int blendif, const float *parameters)
 {
   float result = 1.0f;
   float scaled[DEVELOP_BLENDIF_SIZE] = { 0.5f };
@@ -292,516 +299,392 @@ static inline void _blend_Lab_rescale(const float *i, float *o)
 }
 
 
-/* generate blend mask */
+/* generate blend mask. the colorspace is resolved once per row, so each loop
+   gets its own inlined copy of _blendif_factor() with the switch folded away. */
 static void _blend_make_mask(dt_iop_colorspace_type_t cst,const unsigned int blendif,const float *blendif_parameters,const float opacity,const float *a, const float *b, float *mask, int stride)
 {
- 
-  for(int i=0, j=0; j<stride; i++, j+=4)
+  if(!(blendif & (1<<DEVELOP_BLENDIF_active)) || (cst != iop_cs_Lab && cst != iop_cs_rgb))
+  {
+    for(int i=0, j=0; j<stride; i++, j+=4)
+      mask[i] = opacity;
+  }
+  else if(cst == iop_cs_Lab)
+  {
+    for(int i=0, j=0; j<stride; i++, j+=4)
+      mask[i] = opacity*_blendif_factor(iop_cs_Lab,&a[j],&b[j],blendif,blendif_parameters);
+  }
+  else
   {
-    mask[i] = opacity*_blendif_factor(cst,&a[j],&b[j],blendif,blendif_parameters);
+    for(int i=0, j=0; j<stride; i++, j+=4)
+      mask[i] = opacity*_blendif_factor(iop_cs_rgb,&a[j],&b[j],blendif,blendif_parameters);
   }
 }
 
 
-
-/* normal blend */
-static void _blend_normal(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+/* common sse code for normal and unbounded blend. one pixel is one vector: Lab gets
+   scaled per lane, the lightness only flag turns into a zero opacity weight for
+   a and b, and the mask value is written to the alpha lane (except for raw). */
+static inline __attribute__((always_inline)) void _blend_lerp_sse(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag, const int clamp)
 {
-  float ta[3], tb[3];
-  int channels = _blend_colorspace_channels(cst);
   float max[4]= {0},min[4]= {0};
 
   _blend_colorspace_channel_range(cst,min,max);
 
+  if(cst==iop_cs_Lab && flag)
+  {
+    // a and b are copied from the input unclamped
+    min[1] = min[2] = -FLT_MAX;
+    max[1] = max[2] = FLT_MAX;
+  }
+
+  const __m128 vmin = _mm_loadu_ps(min);
+  const __m128 vmax = _mm_loadu_ps(max);
+  const __m128 scale = (cst==iop_cs_Lab) ? _mm_set_ps(1.0f, 128.0f, 128.0f, 100.0f) : _mm_set1_ps(1.0f);
+  const __m128 weight = (cst==iop_cs_Lab && flag) ? _mm_set_ps(1.0f, 0.0f, 0.0f, 1.0f) : _mm_set1_ps(1.0f);
+  const __m128 alpha = (cst==iop_cs_RAW) ? _mm_setzero_ps() : _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+  const __m128 one = _mm_set1_ps(1.0f);
+
   for(int i=0, j=0; j<stride; i++, j+=4)
   {
-    float local_opacity = mask[i];
+    const __m128 local_opacity = _mm_set1_ps(mask[i]);
+    const __m128 op = _mm_mul_ps(local_opacity, weight);
 
-    if(cst==iop_cs_Lab)
-    {
-      _blend_Lab_scale(&a[j], ta);
-      _blend_Lab_scale(&b[j], tb);
+    const __m128 ta = _mm_div_ps(_mm_loadu_ps(&a[j]), scale);
+    const __m128 tb = _mm_div_ps(_mm_loadu_ps(&b[j]), scale);
 
-      tb[0] =  CLAMP_RANGE((ta[0] * (1.0f - local_opacity)) + tb[0] * local_opacity, min[0], max[0]);;
+    __m128 t = _mm_add_ps(_mm_mul_ps(ta, _mm_sub_ps(one, op)), _mm_mul_ps(tb, op));
 
-      if (flag == 0)
-      {
-        tb[1] =  CLAMP_RANGE((ta[1] * (1.0f - local_opacity)) + tb[1] * local_opacity, min[1], max[1]);
-        tb[2] =  CLAMP_RANGE((ta[2] * (1.0f - local_opacity)) + tb[2] * local_opacity, min[2], max[2]);
-      }
-      else
-      {
-        tb[1] = ta[1];
-        tb[2] = ta[2];
-      }
+    // operands in this order let NaN pass through, like CLAMP() does
+    if(clamp) t = _mm_min_ps(vmax, _mm_max_ps(vmin, t));
 
-      _blend_Lab_rescale(tb, &b[j]);
-    }
-    else
-      for(int k=0; k<channels; k++)
-        b[j+k] =  CLAMP_RANGE((a[j+k] * (1.0f - local_opacity)) + b[j+k] * local_opacity, min[k], max[k]);
+    t = _mm_mul_ps(t, scale);
+    t = _mm_or_ps(_mm_and_ps(alpha, local_opacity), _mm_andnot_ps(alpha, t));
 
-    if(cst != iop_cs_RAW) b[j+3] = local_opacity;
+    _mm_storeu_ps(&b[j], t);
   }
 }
 
-/* normal blend without any clamping */
-static void _blend_unbounded(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+
+#ifdef DT_HAVE_AVX2_TARGET
+/* same as _blend_lerp_sse with two pixels per ymm register. the lerp is one fused
+   mul+add, so results can differ from the sse path in the last bit. */
+static inline __attribute__((always_inline)) DT_TARGET_AVX2 void _blend_lerp_avx2(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag, const int clamp)
 {
-  float ta[3], tb[3];
-  int channels = _blend_colorspace_channels(cst);
   float max[4]= {0},min[4]= {0};
 
   _blend_colorspace_channel_range(cst,min,max);
 
-  for(int i=0, j=0; j<stride; i++, j+=4)
+  if(cst==iop_cs_Lab && flag)
   {
-    float local_opacity = mask[i];
+    min[1] = min[2] = -FLT_MAX;
+    max[1] = max[2] = FLT_MAX;
+  }
 
-    if(cst==iop_cs_Lab)
-    {
-      _blend_Lab_scale(&a[j], ta);
-      _blend_Lab_scale(&b[j], tb);
+  const __m256 vmin = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(min)), _mm_loadu_ps(min), 1);
+  const __m256 vmax = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(max)), _mm_loadu_ps(max), 1);
+  const __m256 scale = (cst==iop_cs_Lab) ? _mm256_set_ps(1.0f, 128.0f, 128.0f, 100.0f, 1.0f, 128.0f, 128.0f, 100.0f) : _mm256_set1_ps(1.0f);
+  const __m256 weight = (cst==iop_cs_Lab && flag) ? _mm256_set_ps(1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, 1.0f) : _mm256_set1_ps(1.0f);
+  const __m256 alpha = (cst==iop_cs_RAW) ? _mm256_setzero_ps() : _mm256_castsi256_ps(_mm256_set_epi32(-1, 0, 0, 0, -1, 0, 0, 0));
+  const __m256 one = _mm256_set1_ps(1.0f);
 
-      tb[0] =  (ta[0] * (1.0f - local_opacity)) + tb[0] * local_opacity;
+  int i=0, j=0;
+  for(; j+8<=stride; i+=2, j+=8)
+  {
+    const __m256 local_opacity = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(mask[i])), _mm_set1_ps(mask[i+1]), 1);
+    const __m256 op = _mm256_mul_ps(local_opacity, weight);
 
-      if (flag == 0)
-      {
-        tb[1] =  (ta[1] * (1.0f - local_opacity)) + tb[1] * local_opacity;
-        tb[2] =  (ta[2] * (1.0f - local_opacity)) + tb[2] * local_opacity;
-      }
-      else
-      {
-        tb[1] = ta[1];
-        tb[2] = ta[2];
-      }
+    const __m256 ta = _mm256_div_ps(_mm256_loadu_ps(&a[j]), scale);
+    const __m256 tb = _mm256_div_ps(_mm256_loadu_ps(&b[j]), scale);
 
-      _blend_Lab_rescale(tb, &b[j]);
-    }
-    else
-      for(int k=0; k<channels; k++)
-        b[j+k] =  (a[j+k] * (1.0f - local_opacity)) + b[j+k] * local_opacity;
+    __m256 t = _mm256_fmadd_ps(tb, op, _mm256_mul_ps(ta, _mm256_sub_ps(one, op)));
 
-    if(cst != iop_cs_RAW) b[j+3] = local_opacity;
+    if(clamp) t = _mm256_min_ps(vmax, _mm256_max_ps(vmin, t));
+
+    t = _mm256_mul_ps(t, scale);
+    t = _mm256_or_ps(_mm256_and_ps(alpha, local_opacity), _mm256_andnot_ps(alpha, t));
+
+    _mm256_storeu_ps(&b[j], t);
   }
+  if(j < stride) _blend_lerp_sse(cst, a+j, b+j, mask+i, stride-j, flag, clamp);
 }
 
+static inline __attribute__((always_inline)) DT_TARGET_AVX2 void _blend_normal_avx2_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
+{
+  _blend_lerp_avx2(cst, a, b, mask, stride, flag, 1);
+}
 
+static inline __attribute__((always_inline)) DT_TARGET_AVX2 void _blend_unbounded_avx2_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
+{
+  _blend_lerp_avx2(cst, a, b, mask, stride, flag, 0);
+}
+#endif
 
-/* lighten */
-static void _blend_lighten(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+#ifdef DT_HAVE_AVX512_TARGET
+/* four pixels per zmm register. avx512f has no float and/andnot, the alpha lane
+   goes through a write mask instead. */
+static inline __attribute__((always_inline)) DT_TARGET_AVX512 void _blend_lerp_avx512(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag, const int clamp)
 {
-  int channels = _blend_colorspace_channels(cst);
-  float ta[3], tb[3], tbo;
   float max[4]= {0},min[4]= {0};
 
   _blend_colorspace_channel_range(cst,min,max);
 
-  for(int i=0, j=0; j<stride; i++, j+=4)
+  if(cst==iop_cs_Lab && flag)
   {
-    float local_opacity = mask[i];
+    min[1] = min[2] = -FLT_MAX;
+    max[1] = max[2] = FLT_MAX;
+  }
 
-    if(cst==iop_cs_Lab)
-    {
-      _blend_Lab_scale(&a[j], ta);
-      _blend_Lab_scale(&b[j], tb);
+  const __m512 vmin = _mm512_broadcast_f32x4(_mm_loadu_ps(min));
+  const __m512 vmax = _mm512_broadcast_f32x4(_mm_loadu_ps(max));
+  const __m512 scale = _mm512_broadcast_f32x4((cst==iop_cs_Lab) ? _mm_set_ps(1.0f, 128.0f, 128.0f, 100.0f) : _mm_set1_ps(1.0f));
+  const __m512 weight = _mm512_broadcast_f32x4((cst==iop_cs_Lab && flag) ? _mm_set_ps(1.0f, 0.0f, 0.0f, 1.0f) : _mm_set1_ps(1.0f));
+  const __mmask16 alpha = (cst==iop_cs_RAW) ? 0 : 0x8888;
+  const __m512i spread = _mm512_set_epi32(3, 3, 3, 3, 2, 2, 2, 2, 1, 1, 1, 1, 0, 0, 0, 0);
+  const __m512 one = _mm512_set1_ps(1.0f);
 
-      tbo = tb[0];
-      tb[0] =  CLAMP_RANGE(ta[0] * (1.0f - local_opacity) + (ta[0]>tb[0]?ta[0]:tb[0]) * local_opacity, min[0], max[0]);
+  int i=0, j=0;
+  for(; j+16<=stride; i+=4, j+=16)
+  {
+    const __m512 local_opacity = _mm512_permutexvar_ps(spread, _mm512_castps128_ps512(_mm_loadu_ps(&mask[i])));
+    const __m512 op = _mm512_mul_ps(local_opacity, weight);
 
-      if (flag == 0)
-      {
-        tb[1] = CLAMP_RANGE(ta[1] * (1.0f - fabs(tbo - tb[0])) + 0.5f * (ta[1] + tb[1]) * fabs(tbo - tb[0]), min[1], max[1]);
-        tb[2] = CLAMP_RANGE(ta[2] * (1.0f - fabs(tbo - tb[0])) + 0.5f * (ta[2] + tb[2]) * fabs(tbo - tb[0]), min[2], max[2]);
-      }
-      else
-      {
-        tb[1] = ta[1];
-        tb[2] = ta[2];
-      }
+    const __m512 ta = _mm512_div_ps(_mm512_loadu_ps(&a[j]), scale);
+    const __m512 tb = _mm512_div_ps(_mm512_loadu_ps(&b[j]), scale);
 
-      _blend_Lab_rescale(tb, &b[j]);
-    }
-    else
-      for(int k=0; k<channels; k++)
-        b[j+k] =  CLAMP_RANGE(a[j+k] * (1.0f - local_opacity) + fmax(a[j+k],b[j+k]) * local_opacity, min[k], max[k]);
+    __m512 t = _mm512_fmadd_ps(tb, op, _mm512_mul_ps(ta, _mm512_sub_ps(one, op)));
 
-    if(cst != iop_cs_RAW) b[j+3] = local_opacity;
+    if(clamp) t = _mm512_min_ps(vmax, _mm512_max_ps(vmin, t));
+
+    t = _mm512_mul_ps(t, scale);
+    t = _mm512_mask_blend_ps(alpha, t, local_opacity);
+
+    _mm512_storeu_ps(&b[j], t);
   }
+  if(j < stride) _blend_lerp_sse(cst, a+j, b+j, mask+i, stride-j, flag, clamp);
 }
 
-/* darken */
-static void _blend_darken(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+static inline __attribute__((always_inline)) DT_TARGET_AVX512 void _blend_normal_avx512_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
 {
-  int channels = _blend_colorspace_channels(cst);
-  float ta[3], tb[3], tbo;
-  float max[4]= {0},min[4]= {0};
+  _blend_lerp_avx512(cst, a, b, mask, stride, flag, 1);
+}
 
-  _blend_colorspace_channel_range(cst,min,max);
+static inline __attribute__((always_inline)) DT_TARGET_AVX512 void _blend_unbounded_avx512_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
+{
+  _blend_lerp_avx512(cst, a, b, mask, stride, flag, 0);
+}
+#endif
 
-  for(int i=0, j=0; j<stride; i++, j+=4)
-  {
-    float local_opacity = mask[i];
 
-    if(cst==iop_cs_Lab)
-    {
-      _blend_Lab_scale(&a[j], ta);
-      _blend_Lab_scale(&b[j], tb);
+/* normal blend */
+static inline __attribute__((always_inline)) void _blend_normal_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
+{
+  _blend_lerp_sse(cst, a, b, mask, stride, flag, 1);
+}
 
-      tbo = tb[0];
-      tb[0] =  CLAMP_RANGE(ta[0] * (1.0f - local_opacity) + (ta[0]<tb[0]?ta[0]:tb[0]) * local_opacity, min[0], max[0]);
+/* normal blend without any clamping */
+static inline __attribute__((always_inline)) void _blend_unbounded_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
+{
+  _blend_lerp_sse(cst, a, b, mask, stride, flag, 0);
+}
 
-      if (flag == 0)
-      {
-        tb[1] = CLAMP_RANGE(ta[1] * (1.0f - fabs(tbo - tb[0])) + 0.5f * (ta[1] + tb[1]) * fabs(tbo - tb[0]), min[1], max[1]);
-        tb[2] = CLAMP_RANGE(ta[2] * (1.0f - fabs(tbo - tb[0])) + 0.5f * (ta[2] + tb[2]) * fabs(tbo - tb[0]), min[2], max[2]);
-      }
-      else
-      {
-        tb[1] = ta[1];
-        tb[2] = ta[2];
-      }
 
-      _blend_Lab_rescale(tb, &b[j]);
-    }
-    else
-      for(int k=0; k<channels; k++)
-        b[j+k] =  CLAMP_RANGE(a[j+k] * (1.0f - local_opacity) + fmin(a[j+k],b[j+k]) * local_opacity, min[k], max[k]);
 
-    if(cst != iop_cs_RAW) b[j+3] = local_opacity;
-  }
-  // return fmin(a,b);
+/* the arithmetic modes below share one sse loop, like normal and unbounded share
+   _blend_lerp_sse(). the mode is a constant after inlining, so the switch is folded. */
+typedef enum _blend_arith_t
+{
+  _BLEND_ARITH_LIGHTEN,
+  _BLEND_ARITH_DARKEN,
+  _BLEND_ARITH_MULTIPLY,
+  _BLEND_ARITH_AVERAGE,
+  _BLEND_ARITH_ADD,
+  _BLEND_ARITH_SUBSTRACT,
+  _BLEND_ARITH_DIFFERENCE,
+  _BLEND_ARITH_SCREEN
 }
+_blend_arith_t;
 
-
-/* multiply */
-static void _blend_multiply(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+/* one pixel is one vector and every channel goes through the same formula. for Lab,
+   lighten, darken, multiply and screen mix a and b depending on the new lightness, so
+   that gets broadcast from lane 0 and the chroma lanes are computed again from it. */
+static inline __attribute__((always_inline)) void _blend_arith_sse(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag, const _blend_arith_t mode)
 {
-  float ta[3], tb[3];
-  int channels = _blend_colorspace_channels(cst);
   float max[4]= {0},min[4]= {0};
-  float lmin = 0.0, lmax, la, lb;
 
   _blend_colorspace_channel_range(cst,min,max);
 
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  const __m128 vmin = _mm_loadu_ps(min);
+  const __m128 vmax = _mm_loadu_ps(max);
+  // the ranges shifted to start at zero, and the offset of the range
+  const __m128 lmin = _mm_setzero_ps();
+  const __m128 off = _mm_andnot_ps(sign, vmin);
+  const __m128 lmax = _mm_add_ps(vmax, off);
+  const __m128 range = _mm_andnot_ps(sign, _mm_add_ps(vmin, vmax));
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 low = _mm_set1_ps(0.01f);
+
+  const int lab = (cst == iop_cs_Lab);
+  const int chroma = lab && !flag && (mode == _BLEND_ARITH_LIGHTEN || mode == _BLEND_ARITH_DARKEN || mode == _BLEND_ARITH_MULTIPLY || mode == _BLEND_ARITH_SCREEN);
+  const __m128 ab = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, 0));
+  const __m128 scale = lab ? _mm_set_ps(1.0f, 128.0f, 128.0f, 100.0f) : _mm_set1_ps(1.0f);
+  const __m128 alpha = (cst==iop_cs_RAW) ? _mm_setzero_ps() : _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+
   for(int i=0, j=0; j<stride; i++, j+=4)
   {
-    float local_opacity = mask[i];
+    const __m128 local_opacity = _mm_set1_ps(mask[i]);
+    const __m128 ta = _mm_div_ps(_mm_loadu_ps(&a[j]), scale);
+    const __m128 tb = _mm_div_ps(_mm_loadu_ps(&b[j]), scale);
+    const __m128 ia = _mm_mul_ps(ta, _mm_sub_ps(one, local_opacity));
 
-    if(cst==iop_cs_Lab)
+    __m128 t, la, lb;
+    switch(mode)
     {
-      _blend_Lab_scale(&a[j], ta);
-      _blend_Lab_scale(&b[j], tb);
-      lmax = max[0]+fabs(min[0]);
-      la = CLAMP_RANGE(ta[0]+fabs(min[0]), lmin, lmax);
-      lb = CLAMP_RANGE(tb[0]+fabs(min[0]), lmin, lmax);
-
-      tb[0] = CLAMP_RANGE( ((la * (1.0f - local_opacity)) + ((la * lb) * local_opacity)), min[0], max[0]) - fabs(min[0]);
-
-      if (flag == 0)
-      {
-        if (ta[0] > 0.01f)
+      case _BLEND_ARITH_LIGHTEN:
+        t = _mm_add_ps(ia, _mm_mul_ps(_mm_max_ps(ta, tb), local_opacity));
+        break;
+      case _BLEND_ARITH_DARKEN:
+        t = _mm_add_ps(ia, _mm_mul_ps(_mm_min_ps(ta, tb), local_opacity));
+        break;
+      case _BLEND_ARITH_MULTIPLY:
+        if(lab)
         {
-          tb[1] = CLAMP_RANGE(ta[1] * (1.0f - local_opacity) + (ta[1] + tb[1]) * tb[0]/ta[0] * local_opacity, min[1], max[1]);
-          tb[2] = CLAMP_RANGE(ta[2] * (1.0f - local_opacity) + (ta[2] + tb[2]) * tb[0]/ta[0] * local_opacity, min[2], max[2]);
+          // only used for the lightness, the offset is zero there
+          la = _mm_min_ps(lmax, _mm_max_ps(lmin, _mm_add_ps(ta, off)));
+          lb = _mm_min_ps(lmax, _mm_max_ps(lmin, _mm_add_ps(tb, off)));
+          t = _mm_add_ps(_mm_mul_ps(la, _mm_sub_ps(one, local_opacity)), _mm_mul_ps(_mm_mul_ps(la, lb), local_opacity));
         }
         else
+          t = _mm_add_ps(ia, _mm_mul_ps(_mm_mul_ps(ta, tb), local_opacity));
+        break;
+      case _BLEND_ARITH_AVERAGE:
+        t = _mm_add_ps(ia, _mm_mul_ps(_mm_mul_ps(_mm_add_ps(ta, tb), half), local_opacity));
+        break;
+      case _BLEND_ARITH_ADD:
+        t = _mm_add_ps(ia, _mm_mul_ps(_mm_add_ps(ta, tb), local_opacity));
+        break;
+      case _BLEND_ARITH_SUBSTRACT:
+        t = _mm_add_ps(ia, _mm_mul_ps(_mm_sub_ps(_mm_add_ps(tb, ta), range), local_opacity));
+        break;
+      case _BLEND_ARITH_DIFFERENCE:
+        la = _mm_add_ps(ta, off);
+        lb = _mm_add_ps(tb, off);
+        if(lab)
         {
-          tb[1] = CLAMP_RANGE(ta[1] * (1.0f - local_opacity) + (ta[1] + tb[1]) * tb[0]/0.01f * local_opacity, min[1], max[1]);
-          tb[2] = CLAMP_RANGE(ta[2] * (1.0f - local_opacity) + (ta[2] + tb[2]) * tb[0]/0.01f * local_opacity, min[2], max[2]);
+          la = _mm_min_ps(lmax, _mm_max_ps(lmin, la));
+          lb = _mm_min_ps(lmax, _mm_max_ps(lmin, lb));
         }
-      }
-      else
-      {
-        tb[1] = ta[1];
-        tb[2] = ta[2];
-      }
-
-      _blend_Lab_rescale(tb, &b[j]);
+        t = _mm_add_ps(_mm_mul_ps(la, _mm_sub_ps(one, local_opacity)), _mm_mul_ps(_mm_andnot_ps(sign, _mm_sub_ps(la, lb)), local_opacity));
+        break;
+      case _BLEND_ARITH_SCREEN:
+      default:
+        la = _mm_min_ps(lmax, _mm_max_ps(lmin, _mm_add_ps(ta, off)));
+        lb = _mm_min_ps(lmax, _mm_max_ps(lmin, _mm_add_ps(tb, off)));
+        t = _mm_add_ps(_mm_mul_ps(la, _mm_sub_ps(one, local_opacity)), _mm_mul_ps(_mm_sub_ps(lmax, _mm_mul_ps(_mm_sub_ps(lmax, la), _mm_sub_ps(lmax, lb))), local_opacity));
+        break;
     }
-    else
-      for(int k=0; k<channels; k++)
-      {
-        lmax = max[k]+fabs(min[k]);
-        la = CLAMP_RANGE(a[j+k]+fabs(min[k]), lmin, lmax);
-        lb = CLAMP_RANGE(b[j+k]+fabs(min[k]), lmin, lmax);
-
-        b[j+k] = CLAMP_RANGE( ((a[j+k] * (1.0f - local_opacity)) + ((a[j+k] * b[j+k]) * local_opacity)), min[k], max[k]);
-      }
-
-    if(cst != iop_cs_RAW) b[j+3] = local_opacity;
-  }
-
-
-  // return (a*b);
-}
-
 
-/* average */
-static void _blend_average(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
-{
-  float ta[3], tb[3];
-  int channels = _blend_colorspace_channels(cst);
-  float max[4]= {0},min[4]= {0};
-
-  _blend_colorspace_channel_range(cst,min,max);
-
-  for(int i=0, j=0; j<stride; i++, j+=4)
-  {
-    float local_opacity = mask[i];
+    // operands in this order let NaN pass through, like CLAMP() does
+    if(mode == _BLEND_ARITH_DIFFERENCE || mode == _BLEND_ARITH_SCREEN)
+      t = _mm_sub_ps(_mm_min_ps(lmax, _mm_max_ps(lmin, t)), off);
+    else
+      t = _mm_min_ps(vmax, _mm_max_ps(vmin, t));
 
-    if(cst==iop_cs_Lab)
+    if(chroma)
     {
-      _blend_Lab_scale(&a[j], ta);
-      _blend_Lab_scale(&b[j], tb);
-
-      tb[0] = CLAMP_RANGE(ta[0] * (1.0f - local_opacity) + (ta[0] + tb[0])/2.0f * local_opacity, min[0], max[0]);
-
-      if (flag == 0)
+      const __m128 L = _mm_shuffle_ps(t, t, _MM_SHUFFLE(0,0,0,0));
+      __m128 c;
+      if(mode == _BLEND_ARITH_LIGHTEN || mode == _BLEND_ARITH_DARKEN)
       {
-        tb[1] = CLAMP_RANGE(ta[1] * (1.0f - local_opacity) +  (ta[1] + tb[1])/2.0f * local_opacity, min[1], max[1]);
-        tb[2] = CLAMP_RANGE(ta[2] * (1.0f - local_opacity) +  (ta[2] + tb[2])/2.0f * local_opacity, min[2], max[2]);
+        const __m128 d = _mm_andnot_ps(sign, _mm_sub_ps(_mm_shuffle_ps(tb, tb, _MM_SHUFFLE(0,0,0,0)), L));
+        c = _mm_add_ps(_mm_mul_ps(ta, _mm_sub_ps(one, d)), _mm_mul_ps(_mm_mul_ps(half, _mm_add_ps(ta, tb)), d));
       }
       else
       {
-        tb[1] = ta[1];
-        tb[2] = ta[2];
+        // divide by the lightness of a, but not by (almost) zero
+        const __m128 la0 = _mm_max_ps(_mm_shuffle_ps(ta, ta, _MM_SHUFFLE(0,0,0,0)), low);
+        const __m128 s = (mode == _BLEND_ARITH_SCREEN) ? _mm_mul_ps(half, _mm_add_ps(ta, tb)) : _mm_add_ps(ta, tb);
+        c = _mm_add_ps(ia, _mm_mul_ps(_mm_div_ps(_mm_mul_ps(s, L), la0), local_opacity));
       }
-
-      _blend_Lab_rescale(tb, &b[j]);
+      c = _mm_min_ps(vmax, _mm_max_ps(vmin, c));
+      t = _mm_or_ps(_mm_and_ps(ab, c), _mm_andnot_ps(ab, t));
     }
-    else
-      for(int k=0; k<channels; k++)
-        b[j+k] =  CLAMP_RANGE(a[j+k] * (1.0f - local_opacity) + (a[j+k] + b[j+k])/2.0f * local_opacity, min[k], max[k]);
+    // a and b are copied from the input
+    if(lab && flag) t = _mm_or_ps(_mm_and_ps(ab, ta), _mm_andnot_ps(ab, t));
 
-    if(cst != iop_cs_RAW) b[j+3] = local_opacity;
+    t = _mm_mul_ps(t, scale);
+    t = _mm_or_ps(_mm_and_ps(alpha, local_opacity), _mm_andnot_ps(alpha, t));
+
+    _mm_storeu_ps(&b[j], t);
   }
-  // return (a+b)/2.0;
 }
 
+/* lighten */
+static inline __attribute__((always_inline)) void _blend_lighten_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
+{
+  _blend_arith_sse(cst, a, b, mask, stride, flag, _BLEND_ARITH_LIGHTEN);
+  // return fmax(a,b);
+}
 
-/* add */
-static void _blend_add(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+/* darken */
+static inline __attribute__((always_inline)) void _blend_darken_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
 {
-  float ta[3], tb[3];
-  int channels = _blend_colorspace_channels(cst);
-  float max[4]= {0},min[4]= {0};
-  _blend_colorspace_channel_range(cst,min,max);
+  _blend_arith_sse(cst, a, b, mask, stride, flag, _BLEND_ARITH_DARKEN);
+  // return fmin(a,b);
+}
 
-  for(int i=0, j=0; j<stride; i++, j+=4)
-  {
-    float local_opacity = mask[i];
 
-    if(cst==iop_cs_Lab)
-    {
-      _blend_Lab_scale(&a[j], ta);
-      _blend_Lab_scale(&b[j], tb);
+/* multiply */
+static inline __attribute__((always_inline)) void _blend_multiply_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
+{
+  _blend_arith_sse(cst, a, b, mask, stride, flag, _BLEND_ARITH_MULTIPLY);
+  // return (a*b);
+}
 
-      tb[0] = CLAMP_RANGE((ta[0] * (1.0f - local_opacity)) + ( ((ta[0] + tb[0])) * local_opacity), min[0], max[0]);
 
-      if (flag == 0)
-      {
-        tb[1] = CLAMP_RANGE( (ta[1] * (1.0f - local_opacity)) + ( ((ta[1] + tb[1])) * local_opacity), min[1], max[1]);
-        tb[2] = CLAMP_RANGE( (ta[2] * (1.0f - local_opacity)) + ( ((ta[2] + tb[2])) * local_opacity), min[2], max[2]);
-      }
-      else
-      {
-        tb[1] = ta[1];
-        tb[2] = ta[2];
-      }
+/* average */
+static inline __attribute__((always_inline)) void _blend_average_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
+{
+  _blend_arith_sse(cst, a, b, mask, stride, flag, _BLEND_ARITH_AVERAGE);
+  // return (a+b)/2.0;
+}
 
-      _blend_Lab_rescale(tb, &b[j]);
-    }
-    else
-      for(int k=0; k<channels; k++)
-        b[j+k] =  CLAMP_RANGE( (a[j+k] * (1.0f - local_opacity)) + ( ((a[j+k] + b[j+k])) * local_opacity), min[k], max[k]);
 
-    if(cst != iop_cs_RAW) b[j+3] = local_opacity;
-  }
-  /*
-  float max,min;
-  _blend_colorspace_channel_range(cst,channel,&min,&max);
-  return CLAMP_RANGE(a+b,min,max);
-  */
+/* add */
+static inline __attribute__((always_inline)) void _blend_add_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
+{
+  _blend_arith_sse(cst, a, b, mask, stride, flag, _BLEND_ARITH_ADD);
+  // return CLAMP_RANGE(a+b,min,max);
 }
 
 
 /* substract */
-static void _blend_substract(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+static inline __attribute__((always_inline)) void _blend_substract_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
 {
-  float ta[3], tb[3];
-  int channels = _blend_colorspace_channels(cst);
-  float max[4]= {0},min[4]= {0};
-  _blend_colorspace_channel_range(cst,min,max);
-
-  for(int i=0, j=0; j<stride; i++, j+=4)
-  {
-    float local_opacity = mask[i];
-
-    if(cst==iop_cs_Lab)
-    {
-      _blend_Lab_scale(&a[j], ta);
-      _blend_Lab_scale(&b[j], tb);
-
-      tb[0] = CLAMP_RANGE( ((ta[0] * (1.0f - local_opacity)) + ( ((tb[0] + ta[0]) - (fabs(min[0]+max[0]))) * local_opacity)), min[0], max[0]);
-
-      if (flag == 0)
-      {
-        tb[1] = CLAMP_RANGE( ((ta[1] * (1.0f - local_opacity)) + ( ((tb[1] + ta[1]) - (fabs(min[1]+max[1]))) * local_opacity)), min[1], max[1]);
-        tb[2] = CLAMP_RANGE( ((ta[2] * (1.0f - local_opacity)) + ( ((tb[2] + ta[2]) - (fabs(min[2]+max[2]))) * local_opacity)), min[2], max[2]);
-      }
-      else
-      {
-        tb[1] = ta[1];
-        tb[2] = ta[2];
-      }
-
-      _blend_Lab_rescale(tb, &b[j]);
-    }
-    else
-      for(int k=0; k<channels; k++)
-        b[j+k] =  CLAMP_RANGE( ((a[j+k] * (1.0f - local_opacity)) + ( ((b[j+k] + a[j+k]) - (fabs(min[k]+max[k]))) * local_opacity)), min[k], max[k]);
-
-    if(cst != iop_cs_RAW) b[j+3] = local_opacity;
-  }
-  /*
-  float max,min;
-  _blend_colorspace_channel_range(cst,channel,&min,&max);
-  return ((a+b<max) ? 0:(b+a-max));
-  */
+  _blend_arith_sse(cst, a, b, mask, stride, flag, _BLEND_ARITH_SUBSTRACT);
+  // return ((a+b<max) ? 0:(b+a-max));
 }
 
 
 
 /* difference */
-static void _blend_difference(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+static inline __attribute__((always_inline)) void _blend_difference_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
 {
-  float ta[3], tb[3];
-  int channels = _blend_colorspace_channels(cst);
-  float max[4]= {0},min[4]= {0};
-  float lmin = 0.0, lmax, la, lb;
-
-  _blend_colorspace_channel_range(cst,min,max);
-
-  for(int i=0, j=0; j<stride; i++, j+=4)
-  {
-    float local_opacity = mask[i];
-
-    if(cst==iop_cs_Lab)
-    {
-      _blend_Lab_scale(&a[j], ta);
-      _blend_Lab_scale(&b[j], tb);
-      lmax = max[0]+fabs(min[0]);
-      la = CLAMP_RANGE(ta[0]+fabs(min[0]), lmin, lmax);
-      lb = CLAMP_RANGE(tb[0]+fabs(min[0]), lmin, lmax);
-
-      tb[0] = CLAMP_RANGE( (la * (1.0f - local_opacity)) + ( fabs(la - lb) * local_opacity), lmin, lmax)-fabs(min[0]);
-
-      if (flag == 0)
-      {
-        lmax = max[1]+fabs(min[1]);
-        la = CLAMP_RANGE(ta[1]+fabs(min[1]), lmin, lmax);
-        lb = CLAMP_RANGE(tb[1]+fabs(min[1]), lmin, lmax);
-        tb[1] = CLAMP_RANGE( (la * (1.0f - local_opacity)) + ( fabs(la - lb) * local_opacity), lmin, lmax)-fabs(min[1]);
-        lmax = max[2]+fabs(min[2]);
-        la = CLAMP_RANGE(ta[2]+fabs(min[2]), lmin, lmax);
-        lb = CLAMP_RANGE(tb[2]+fabs(min[2]), lmin, lmax);
-        tb[2] = CLAMP_RANGE( (la * (1.0f - local_opacity)) + ( fabs(la - lb) * local_opacity), lmin, lmax)-fabs(min[2]);
-      }
-      else
-      {
-        tb[1] = ta[1];
-        tb[2] = ta[2];
-      }
-
-      _blend_Lab_rescale(tb, &b[j]);
-    }
-    else
-    {
-      for(int k=0; k<channels; k++)
-      {
-        lmax = max[k]+fabs(min[k]);
-        la = a[j+k]+fabs(min[k]);
-        lb = b[j+k]+fabs(min[k]);
-
-        b[j+k] =  CLAMP_RANGE( (la * (1.0f - local_opacity)) + ( fabs(la - lb) * local_opacity), lmin, lmax)-fabs(min[k]);
-      }
-    }
-
-    if(cst != iop_cs_RAW) b[j+3] = local_opacity;
-  }
+  _blend_arith_sse(cst, a, b, mask, stride, flag, _BLEND_ARITH_DIFFERENCE);
   // return fabs(a-b);
 }
 
 
 /* screen */
-static void _blend_screen(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+static inline __attribute__((always_inline)) void _blend_screen_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
 {
-  float ta[3], tb[3];
-  int channels = _blend_colorspace_channels(cst);
-  float max[4]= {0},min[4]= {0};
-  float lmin = 0.0, lmax, la, lb;
-
-  _blend_colorspace_channel_range(cst,min,max);
-
-  for(int i=0, j=0; j<stride; i++, j+=4)
-  {
-    float local_opacity = mask[i];
-
-    if(cst==iop_cs_Lab)
-    {
-      _blend_Lab_scale(&a[j], ta);
-      _blend_Lab_scale(&b[j], tb);
-      lmax = max[0]+fabs(min[0]);
-      la = CLAMP_RANGE(ta[0]+fabs(min[0]), lmin, lmax);
-      lb = CLAMP_RANGE(tb[0]+fabs(min[0]), lmin, lmax);
-
-      tb[0] = CLAMP_RANGE( (la * (1.0 - local_opacity)) + (( (lmax - (lmax-la) * (lmax-lb)) ) * local_opacity), lmin, lmax)-fabs(min[0]);
-
-      if (flag == 0)
-      {
-        if (ta[0] > 0.01f)
-        {
-          tb[1] = CLAMP_RANGE(ta[1] * (1.0f - local_opacity) + 0.5f * (ta[1] + tb[1]) * tb[0]/ta[0] * local_opacity, min[1], max[1]);
-          tb[2] = CLAMP_RANGE(ta[2] * (1.0f - local_opacity) + 0.5f * (ta[2] + tb[2]) * tb[0]/ta[0] * local_opacity, min[2], max[2]);
-        }
-        else
-        {
-          tb[1] = CLAMP_RANGE(ta[1] * (1.0f - local_opacity) + 0.5f * (ta[1] + tb[1]) * tb[0]/0.01f * local_opacity, min[1], max[1]);
-          tb[2] = CLAMP_RANGE(ta[2] * (1.0f - local_opacity) + 0.5f * (ta[2] + tb[2]) * tb[0]/0.01f * local_opacity, min[2], max[2]);
-        }
-      }
-      else
-      {
-        tb[1] = ta[1];
-        tb[2] = ta[2];
-      }
-
-      _blend_Lab_rescale(tb, &b[j]);
-    }
-    else
-    {
-      for(int k=0; k<channels; k++)
-      {
-        lmax = max[k]+fabs(min[k]);
-        la = CLAMP_RANGE(a[j+k]+fabs(min[k]), lmin, lmax);
-        lb = CLAMP_RANGE(b[j+k]+fabs(min[k]), lmin, lmax);
-
-        b[j+k] =  CLAMP_RANGE( (la * (1.0f - local_opacity)) + (( (lmax - (lmax-la) * (lmax-lb)) ) * local_opacity), lmin, lmax)-fabs(min[k]);
-      }
-    }
-
-    if(cst != iop_cs_RAW) b[j+3] = local_opacity;
-  }
-  /*
-  float max,min;
-  _blend_colorspace_channel_range(cst,channel,&min,&max);
-  return max - (max-a) * (max-b);
-  */
+  _blend_arith_sse(cst, a, b, mask, stride, flag, _BLEND_ARITH_SCREEN);
+  // return max - (max-a) * (max-b);
 }
 
 /* overlay */
-static void _blend_overlay(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+static inline __attribute__((always_inline)) void _blend_overlay_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -879,7 +762,7 @@ static void _blend_overlay(dt_iop_colorspace_type_t cst,const float *a, float *b
 }
 
 /* softlight */
-static void _blend_softlight(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+static inline __attribute__((always_inline)) void _blend_softlight_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -953,7 +836,7 @@ static void _blend_softlight(dt_iop_colorspace_type_t cst,const float *a, float
 }
 
 /* hardlight */
-static void _blend_hardlight(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+static inline __attribute__((always_inline)) void _blend_hardlight_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -1033,7 +916,7 @@ static void _blend_hardlight(dt_iop_colorspace_type_t cst,const float *a, float
 
 
 /* vividlight */
-static void _blend_vividlight(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+static inline __attribute__((always_inline)) void _blend_vividlight_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -1110,7 +993,7 @@ static void _blend_vividlight(dt_iop_colorspace_type_t cst,const float *a, float
 }
 
 /* linearlight */
-static void _blend_linearlight(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+static inline __attribute__((always_inline)) void _blend_linearlight_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -1181,7 +1064,7 @@ static void _blend_linearlight(dt_iop_colorspace_type_t cst,const float *a, floa
 }
 
 /* pinlight */
-static void _blend_pinlight(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+static inline __attribute__((always_inline)) void _blend_pinlight_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -1244,7 +1127,7 @@ static void _blend_pinlight(dt_iop_colorspace_type_t cst,const float *a, float *
 
 
 /* lightness blend */
-static void _blend_lightness(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+static inline __attribute__((always_inline)) void _blend_lightness_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
 {
   float ta[3], tb[3];
   float tta[3], ttb[3];
@@ -1293,7 +1176,7 @@ static void _blend_lightness(dt_iop_colorspace_type_t cst,const float *a, float
 
 
 /* chroma blend */
-static void _blend_chroma(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+static inline __attribute__((always_inline)) void _blend_chroma_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
 {
   float ta[3], tb[3];
   float tta[3], ttb[3];
@@ -1343,7 +1226,7 @@ static void _blend_chroma(dt_iop_colorspace_type_t cst,const float *a, float *b,
 
 
 /* hue blend */
-static void _blend_hue(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+static inline __attribute__((always_inline)) void _blend_hue_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
 {
   float ta[3], tb[3];
   float tta[3], ttb[3];
@@ -1400,7 +1283,7 @@ static void _blend_hue(dt_iop_colorspace_type_t cst,const float *a, float *b, co
 
 
 /* color blend; blend hue and chroma, but not lightness */
-static void _blend_color(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+static inline __attribute__((always_inline)) void _blend_color_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
 {
   float ta[3], tb[3];
   float tta[3], ttb[3];
@@ -1458,7 +1341,7 @@ static void _blend_color(dt_iop_colorspace_type_t cst,const float *a, float *b,
 }
 
 /* color adjustment; blend hue and chroma; take lightness from module output */
-static void _blend_coloradjust(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+static inline __attribute__((always_inline)) void _blend_coloradjust_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
 {
   float ta[3], tb[3];
   float tta[3], ttb[3];
@@ -1517,7 +1400,7 @@ static void _blend_coloradjust(dt_iop_colorspace_type_t cst,const float *a, floa
 
 
 /* inverse blend */
-static void _blend_inverse(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+static inline __attribute__((always_inline)) void _blend_inverse_kernel(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, const int stride, const int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -1558,6 +1441,74 @@ static void _blend_inverse(dt_iop_colorspace_type_t cst,const float *a, float *b
   }
 }
 
+/* instantiate the row function for a blend operator. the kernels above are forced
+   inline and get constant arguments here, so each (colorspace, lightness only)
+   combination ends up as its own loop without per pixel branches on cst or flag. */
+#define _BLEND_SPECIALIZE_TARGET(name, target) \
+static target void name(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag) \
+{ \
+  switch(cst) \
+  { \
+    case iop_cs_Lab: \
+      if(flag) name##_kernel(iop_cs_Lab, a, b, mask, stride, 1); \
+      else     name##_kernel(iop_cs_Lab, a, b, mask, stride, 0); \
+      break; \
+    case iop_cs_RAW: \
+      name##_kernel(iop_cs_RAW, a, b, mask, stride, 0); \
+      break; \
+    case iop_cs_rgb: \
+    default: \
+      name##_kernel(iop_cs_rgb, a, b, mask, stride, 0); \
+      break; \
+  } \
+}
+#define _BLEND_SPECIALIZE(name) _BLEND_SPECIALIZE_TARGET(name, )
+
+_BLEND_SPECIALIZE(_blend_normal)
+_BLEND_SPECIALIZE(_blend_unbounded)
+_BLEND_SPECIALIZE(_blend_lighten)
+_BLEND_SPECIALIZE(_blend_darken)
+_BLEND_SPECIALIZE(_blend_multiply)
+_BLEND_SPECIALIZE(_blend_average)
+_BLEND_SPECIALIZE(_blend_add)
+_BLEND_SPECIALIZE(_blend_substract)
+_BLEND_SPECIALIZE(_blend_difference)
+_BLEND_SPECIALIZE(_blend_screen)
+_BLEND_SPECIALIZE(_blend_overlay)
+_BLEND_SPECIALIZE(_blend_softlight)
+_BLEND_SPECIALIZE(_blend_hardlight)
+_BLEND_SPECIALIZE(_blend_vividlight)
+_BLEND_SPECIALIZE(_blend_linearlight)
+_BLEND_SPECIALIZE(_blend_pinlight)
+_BLEND_SPECIALIZE(_blend_lightness)
+_BLEND_SPECIALIZE(_blend_chroma)
+_BLEND_SPECIALIZE(_blend_hue)
+_BLEND_SPECIALIZE(_blend_color)
+_BLEND_SPECIALIZE(_blend_coloradjust)
+_BLEND_SPECIALIZE(_blend_inverse)
+#ifdef DT_HAVE_AVX2_TARGET
+_BLEND_SPECIALIZE_TARGET(_blend_normal_avx2, DT_TARGET_AVX2)
+_BLEND_SPECIALIZE_TARGET(_blend_unbounded_avx2, DT_TARGET_AVX2)
+#else
+#define _blend_normal_avx2 NULL
+#define _blend_unbounded_avx2 NULL
+#endif
+#ifdef DT_HAVE_AVX512_TARGET
+_BLEND_SPECIALIZE_TARGET(_blend_normal_avx512, DT_TARGET_AVX512)
+_BLEND_SPECIALIZE_TARGET(_blend_unbounded_avx512, DT_TARGET_AVX512)
+#else
+#define _blend_normal_avx512 NULL
+#define _blend_unbounded_avx512 NULL
+#endif
+
+#undef _BLEND_SPECIALIZE
+#undef _BLEND_SPECIALIZE_TARGET
+
+/* normal and unbounded are the most common operators by far, these get a wider
+   variant picked once in dt_develop_blend_init() for the cpu we run on. */
+static _blend_row_func *_blend_normal_row = _blend_normal;
+static _blend_row_func *_blend_unbounded_row = _blend_unbounded;
+
 void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const struct dt_iop_roi_t *roi_in, const struct dt_iop_roi_t *roi_out)
 {
 
@@ -1629,7 +1580,7 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
       blend = _blend_inverse;
       break;
     case DEVELOP_BLEND_UNBOUNDED:
-      blend = _blend_unbounded;
+      blend = _blend_unbounded_row;
       break;
     case DEVELOP_BLEND_COLORADJUST:
       blend = _blend_coloradjust;
@@ -1638,18 +1589,10 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
       /* fallback to normal blend */
     case DEVELOP_BLEND_NORMAL:
     default:
-      blend = _blend_normal;
+      blend = _blend_normal_row;
       break;
   }
 
-  /* allocate space for blend mask */
-  float *mask = dt_alloc_align(64, roi_out->width*roi_out->height*sizeof(float));
-  if(!mask)
-  {
-    dt_control_log("could not allocate buffer for blending");
-    return;
-  }
-
   if (!(d->mode & DEVELOP_BLEND_MASK_FLAG))
   {
     /* get the clipped opacity value  0 - 1 */
@@ -1673,70 +1616,62 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
     /* only true if mask_display was set by an _earlier_ module */
     const int mask_display = piece->pipe->mask_display;
 
-#ifdef _OPENMP
-#if !defined(__SUNOS__) && !defined(__NetBSD__)
-    #pragma omp parallel for default(none) shared(i,roi_out,o,mask,blend,d,stderr,ch)
-#else
-    #pragma omp parallel for shared(i,roi_out,o,mask,blend,d,ch)
-#endif
+    /* check if mask should be suppressed (i.e. just set to global opacity value) */
+    const int suppress_mask = self->suppress_mask && self->dev->gui_attached && self == self->dev->gui_module && piece->pipe == self->dev->pipe && (d->blendif & (1<<31));
 
-#endif
-    for (int y=0; y<roi_out->height; y++)
-    {
-      int index = ch * y * roi_out->width;
-      int stride = ch * roi_out->width;
-      float *in = (float *)i + index;
-      float *out = (float *)o + index;
-      float *m = (float *)mask + y * roi_out->width;
-      _blend_make_mask(cst, d->blendif, d->blendif_parameters, opacity, in, out, m, stride);
-    }
+    /* if the mask needs no blurring, it is generated row by row in the blend pass
+       and never leaves the cache. we then only need one row per thread. */
+    const int fused = !(maskblur && gaussian) || suppress_mask;
+    const size_t mask_rows = fused ? dt_get_num_threads() : roi_out->height;
 
-    if(maskblur)
+    /* allocate space for blend mask */
+    float *mask = dt_alloc_align(64, roi_out->width*mask_rows*sizeof(float));
+    if(!mask)
     {
-      if(gaussian)
-      {
-        const float sigma = radius * roi_in->scale / piece ->iscale;
-
-        const float mmax[] = { 1.0f };
-        const float mmin[] = { 0.0f };
-
-        dt_gaussian_t *g = dt_gaussian_init(roi_out->width, roi_out->height, 1, mmax, mmin, sigma, 0);
-        if(g)
-        {
-          dt_gaussian_blur(g, mask, mask);
-          dt_gaussian_free(g);
-        }
-      }
-      else
-      {
-        // potential further blend algorithm (bilateral grid?)
-      }
+      dt_control_log("could not allocate buffer for blending");
+      return;
     }
 
-
-    /* check if mask should be suppressed (i.e. just set to global opacity value) */
-    if(self->suppress_mask && self->dev->gui_attached && self == self->dev->gui_module && piece->pipe == self->dev->pipe && (d->blendif & (1<<31)))
+    if(!fused)
     {
 #ifdef _OPENMP
-#if !defined(__SUNOS__)
-    #pragma omp parallel for default(none) shared(roi_out,mask,stderr)
+#if !defined(__SUNOS__) && !defined(__NetBSD__)
+      #pragma omp parallel for default(none) shared(i,roi_out,o,mask,d,stderr,ch)
 #else
-    #pragma omp parallel for shared(roi_out,mask)
+      #pragma omp parallel for shared(i,roi_out,o,mask,d,ch)
 #endif
 
 #endif
-      for (int k=0; k<roi_out->height*roi_out->width; k++)
+      for (int y=0; y<roi_out->height; y++)
       {
-        mask[k] = opacity;
+        int index = ch * y * roi_out->width;
+        int stride = ch * roi_out->width;
+        float *in = (float *)i + index;
+        float *out = (float *)o + index;
+        float *m = (float *)mask + y * roi_out->width;
+        _blend_make_mask(cst, d->blendif, d->blendif_parameters, opacity, in, out, m, stride);
+      }
+
+      const float sigma = radius * roi_in->scale / piece ->iscale;
+
+      const float mmax[] = { 1.0f };
+      const float mmin[] = { 0.0f };
+
+      dt_gaussian_t *g = dt_gaussian_init(roi_out->width, roi_out->height, 1, mmax, mmin, sigma, 0);
+      if(g)
+      {
+        dt_gaussian_blur(g, mask, mask);
+        dt_gaussian_free(g);
       }
     }
+    // else: potential further blend algorithm for the mask (bilateral grid?)
 
 
 #ifdef _OPENMP
-#if !defined(__SUNOS__)
-    #pragma omp parallel for default(none) shared(i,roi_out,o,mask,blend,stderr,ch)
+#if !defined(__SUNOS__) && !defined(__NetBSD__)
+    #pragma omp parallel for default(none) shared(i,roi_out,o,mask,blend,d,stderr,ch)
 #else
-    #pragma omp parallel for shared(i,roi_out,o,mask,blend,ch)
+    #pragma omp parallel for shared(i,roi_out,o,mask,blend,d,ch)
 #endif
 
 #endif
@@ -1746,7 +1681,19 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
       int stride = ch * roi_out->width;
       float *in = (float *)i + index;
       float *out = (float *)o + index;
-      float *m = (float *)mask + y * roi_out->width;
+      float *m;
+
+      if(fused)
+      {
+        m = (float *)mask + dt_get_thread_num() * roi_out->width;
+        if(suppress_mask)
+          for(int k=0; k<roi_out->width; k++) m[k] = opacity;
+        else
+          _blend_make_mask(cst, d->blendif, d->blendif_parameters, opacity, in, out, m, stride);
+      }
+      else
+        m = (float *)mask + y * roi_out->width;
+
       blend(cst, in, out, m, stride, blendflag);
 
       if(mask_display && cst != iop_cs_RAW)
@@ -1754,6 +1701,8 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
           out[j+3] = in[j+3];
     }
 
+    free(mask);
+
     /* check if _this_ module should expose mask. */
     if(self->request_mask_display && self->dev->gui_attached && self == self->dev->gui_module && piece->pipe == self->dev->pipe && (d->blendif & (1<<31)))
     {
@@ -1767,8 +1716,6 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
     dt_control_log("blending using masks is not yet implemented.");
 
   }
-
-  free(mask);
 }
 
 
@@ -1918,6 +1865,9 @@ error:
 /** global init of blendops */
 void dt_develop_blend_init(dt_blendop_t *gd)
 {
+  _blend_normal_row = dt_cpu_dispatch(_blend_normal, _blend_normal_avx2, _blend_normal_avx512);
+  _blend_unbounded_row = dt_cpu_dispatch(_blend_unbounded, _blend_unbounded_avx2, _blend_unbounded_avx512);
+
 #ifdef HAVE_OPENCL
   const int program = 3; // blendop.cl, from programs.conf
   gd->kernel_blendop_mask_Lab = dt_opencl_create_kernel(program, "blendop_mask_Lab");
@@ -28,6 +28,7 @@
 #include "common/tags.h"
 #include "common/debug.h"
 #include "common/similarity.h"
+#include "common/histogram.h"
 #include "gui/gtk.h"
 
 #include <glib/gprintf.h>
@@ -42,6 +43,12 @@
 #define DT_DEV_AVERAGE_DELAY_START            250
 #define DT_DEV_PREVIEW_AVERAGE_DELAY_START     50
 #define DT_DEV_AVERAGE_DELAY_COUNT              5
+// full pipe runs slower than this (ms) are rendered progressively
+#define DT_DEV_PROGRESSIVE_DELAY              300
+// size of the coarse pass relative to the final one
+#define DT_DEV_PROGRESSIVE_COARSE            0.25f
+// size in pixels of the part in the center of the view which is shown at full scale before the rest
+#define DT_DEV_PROGRESSIVE_TILE               512
 
 void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
 {
@@ -68,7 +75,11 @@ void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
   dev->preview_input_changed = 0;
 
   dev->pipe = dev->preview_pipe = NULL;
-  dev->histogram = NULL;
+  dev->input_region = NULL;
+  dev->progressive.buf = NULL;
+  dev->progressive.size = 0;
+  dev->progressive.valid = 0;
+  dev->scopes = NULL;
   dev->histogram_pre_tonecurve = NULL;
   dev->histogram_pre_levels = NULL;
   if(g_strcmp0(dt_conf_get_string("plugins/darkroom/histogram/mode"), "linear") == 0)
@@ -83,13 +94,11 @@ void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
     dt_dev_pixelpipe_init(dev->pipe);
     dt_dev_pixelpipe_init_preview(dev->preview_pipe);
 
-    dev->histogram = (float *)malloc(sizeof(float)*4*256);
-    dev->histogram_pre_tonecurve = (float *)malloc(sizeof(float)*4*256);
-    dev->histogram_pre_levels = (float*)malloc(sizeof(float) * 4 * 256);
-    memset(dev->histogram, 0, sizeof(float)*256*4);
-    memset(dev->histogram_pre_tonecurve, 0, sizeof(float)*256*4);
-    memset(dev->histogram_pre_levels, 0, sizeof(float)*256*4);
-    dev->histogram_max = -1;
+    dev->scopes = dt_histogram_scopes_new();
+    dev->histogram_pre_tonecurve = (float *)malloc(sizeof(float)*4*DT_HISTOGRAM_BINS);
+    dev->histogram_pre_levels = (float*)malloc(sizeof(float)*4*DT_HISTOGRAM_BINS);
+    memset(dev->histogram_pre_tonecurve, 0, sizeof(float)*4*DT_HISTOGRAM_BINS);
+    memset(dev->histogram_pre_levels, 0, sizeof(float)*4*DT_HISTOGRAM_BINS);
     dev->histogram_pre_tonecurve_max = -1;
     dev->histogram_pre_levels_max = -1;
   }
@@ -98,6 +107,18 @@ void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
   dev->iop = NULL;
 }
 
+static void _dev_free_history(dt_develop_t *dev)
+{
+  while(dev->history)
+  {
+    free(((dt_dev_history_item_t *)dev->history->data)->params);
+    free(((dt_dev_history_item_t *)dev->history->data)->blend_params);
+    free( (dt_dev_history_item_t *)dev->history->data);
+    dev->history = g_list_delete_link(dev->history, dev->history);
+  }
+  dev->history_end = 0;
+}
+
 void dt_dev_cleanup(dt_develop_t *dev)
 {
   if(!dev) return;
@@ -112,13 +133,9 @@ void dt_dev_cleanup(dt_develop_t *dev)
     dt_dev_pixelpipe_cleanup(dev->preview_pipe);
     free(dev->preview_pipe);
   }
-  while(dev->history)
-  {
-    free(((dt_dev_history_item_t *)dev->history->data)->params);
-    free(((dt_dev_history_item_t *)dev->history->data)->blend_params);
-    free( (dt_dev_history_item_t *)dev->history->data);
-    dev->history = g_list_delete_link(dev->history, dev->history);
-  }
+  if(dev->input_region) dt_imageio_region_free(dev->input_region);
+  free(dev->progressive.buf);
+  _dev_free_history(dev);
   while(dev->iop)
   {
     dt_iop_cleanup_module((dt_iop_module_t *)dev->iop->data);
@@ -126,7 +143,7 @@ void dt_dev_cleanup(dt_develop_t *dev)
     dev->iop = g_list_delete_link(dev->iop, dev->iop);
   }
   dt_pthread_mutex_destroy(&dev->history_mutex);
-  free(dev->histogram);
+  dt_histogram_scopes_free(dev->scopes);
   free(dev->histogram_pre_tonecurve);
   free(dev->histogram_pre_levels);
 }
@@ -234,6 +251,115 @@ restart:
   dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
 }
 
+// upscale the 8-bit output of the coarse pass to the size of the progressive buffer
+static void _progressive_upscale(uint8_t *out, const int wd, const int ht, const uint8_t *in, const int cwd, const int cht)
+{
+  const float sx = cwd/(float)wd, sy = cht/(float)ht;
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(out, in) schedule(static)
+#endif
+  for(int j=0; j<ht; j++)
+  {
+    const float fy = CLAMPS((j + .5f)*sy - .5f, 0.0f, cht - 1.0f);
+    const int y0 = fy, y1 = MIN(y0 + 1, cht - 1);
+    const float wy = fy - y0;
+    uint8_t *o = out + 4*(size_t)wd*j;
+    for(int i=0; i<wd; i++, o+=4)
+    {
+      const float fx = CLAMPS((i + .5f)*sx - .5f, 0.0f, cwd - 1.0f);
+      const int x0 = fx, x1 = MIN(x0 + 1, cwd - 1);
+      const float wx = fx - x0;
+      const uint8_t *p00 = in + 4*((size_t)cwd*y0 + x0), *p01 = in + 4*((size_t)cwd*y0 + x1);
+      const uint8_t *p10 = in + 4*((size_t)cwd*y1 + x0), *p11 = in + 4*((size_t)cwd*y1 + x1);
+      for(int c=0; c<4; c++)
+        o[c] = (1.0f-wy)*((1.0f-wx)*p00[c] + wx*p01[c]) + wy*((1.0f-wx)*p10[c] + wx*p11[c]) + .5f;
+    }
+  }
+}
+
+// the progressive buffer is about to be overwritten by a run that does not go through it.
+static void _dev_progressive_invalidate(dt_develop_t *dev)
+{
+  dt_pthread_mutex_lock(&dev->pipe->backbuf_mutex);
+  dev->progressive.valid = 0;
+  dt_pthread_mutex_unlock(&dev->pipe->backbuf_mutex);
+}
+
+int dt_dev_progressive_current(dt_develop_t *dev, const dt_dev_zoom_t zoom, const float zoom_x, const float zoom_y)
+{
+  if(!dev->progressive.valid) return 0;
+  // same roi as dt_dev_process_image_job() would render now:
+  const float scale = dt_dev_get_zoom_scale(dev, zoom, 1.0f, 0);
+  const int x = MAX(0, scale*dev->pipe->processed_width *(.5+zoom_x)-dev->capwidth/2);
+  const int y = MAX(0, scale*dev->pipe->processed_height*(.5+zoom_y)-dev->capheight/2);
+  return dev->progressive.scale == scale && dev->progressive.x == x && dev->progressive.y == y &&
+         dev->progressive.width == dev->capwidth && dev->progressive.height == dev->capheight;
+}
+
+// render the roi at reduced scale first, then the tile in the center of the view at full scale, both
+// to dev->progressive.buf, drawn right away. the final image is one run over the whole roi: most
+// filters don't grow their roi by their support, pieces of it would show seams. a changed pipe
+// aborts any of the steps as usual.
+static int _dev_process_image_progressive(dt_develop_t *dev, const int x, const int y, const float scale)
+{
+  dt_dev_pixelpipe_t *pipe = dev->pipe;
+  const int wd = dev->capwidth, ht = dev->capheight;
+  const size_t size = 4*(size_t)wd*ht;
+
+  dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+  if(dev->progressive.size < size)
+  {
+    free(dev->progressive.buf);
+    dev->progressive.buf = (uint8_t *)dt_alloc_align(64, size);
+    dev->progressive.size = dev->progressive.buf ? size : 0;
+    dev->progressive.valid = 0;
+  }
+  // only keep showing the last result if it's for the same roi:
+  if(dev->progressive.x != x || dev->progressive.y != y || dev->progressive.scale != scale ||
+     dev->progressive.width != wd || dev->progressive.height != ht)
+    dev->progressive.valid = 0;
+  dev->progressive.x = x;
+  dev->progressive.y = y;
+  dev->progressive.scale = scale;
+  dev->progressive.width = wd;
+  dev->progressive.height = ht;
+  dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+  if(!dev->progressive.buf) return dt_dev_pixelpipe_process(pipe, dev, x, y, wd, ht, scale);
+
+  // 1) coarse pass, a fraction of the pixels in the final positions
+  const float f = DT_DEV_PROGRESSIVE_COARSE;
+  const int cwd = MAX(1, wd*f), cht = MAX(1, ht*f);
+  if(dt_dev_pixelpipe_process(pipe, dev, x*f, y*f, cwd, cht, scale*f)) return 1;
+  dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+  _progressive_upscale(dev->progressive.buf, wd, ht, pipe->backbuf, cwd, cht);
+  dev->progressive.valid = 1;
+  dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+  dt_control_queue_redraw_center();
+
+  // 2) where one looks first at full scale, if that's only a part of the view
+  const int tw = MIN(wd, DT_DEV_PROGRESSIVE_TILE), th = MIN(ht, DT_DEV_PROGRESSIVE_TILE);
+  if(2*(size_t)tw*th <= (size_t)wd*ht)
+  {
+    const int tx = (wd - tw)/2, ty = (ht - th)/2;
+    if(dt_dev_pixelpipe_process(pipe, dev, x + tx, y + ty, tw, th, scale)) return 1;
+    dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+    for(int j=0; j<th; j++)
+      memcpy(dev->progressive.buf + 4*((size_t)wd*(ty + j) + tx), pipe->backbuf + 4*(size_t)tw*j, 4*tw);
+    dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+    dt_control_queue_redraw_center();
+  }
+
+  // 3) the final image in one go. keep a copy, it is shown while the next edit is processed.
+  if(dt_dev_pixelpipe_process(pipe, dev, x, y, wd, ht, scale)) return 1;
+  dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+  if(pipe->backbuf && pipe->backbuf_width == wd && pipe->backbuf_height == ht)
+    memcpy(dev->progressive.buf, pipe->backbuf, size);
+  else
+    dev->progressive.valid = 0;
+  dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+  return 0;
+}
+
 void dt_dev_process_image_job(dt_develop_t *dev)
 {
   dt_control_log_busy_enter();
@@ -243,7 +369,18 @@ void dt_dev_process_image_job(dt_develop_t *dev)
   dt_mipmap_buffer_t buf;
   dt_times_t start;
   dt_get_times(&start);
-  dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, dev->image_storage.id, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING);
+  buf.size = DT_MIPMAP_NONE;
+  buf.buf = NULL;
+  if(dev->image_loading)
+  {
+    if(dev->input_region) dt_imageio_region_free(dev->input_region);
+    dev->input_region = NULL;
+    // full raw not in the cache yet? only decode the parts we are going to look at.
+    dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, dev->image_storage.id, DT_MIPMAP_FULL, DT_MIPMAP_TESTLOCK);
+    if(!buf.buf) dev->input_region = dt_imageio_open_region(dev->image_storage.id);
+  }
+  if(!buf.buf && !dev->input_region)
+    dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, dev->image_storage.id, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING);
   dt_show_times(&start, "[dev]", "to load the image.");
 
   // copy over image now that width and height are sure to be correct:
@@ -254,13 +391,17 @@ void dt_dev_process_image_job(dt_develop_t *dev)
   dt_image_cache_read_release(darktable.image_cache, img);
 
   // failed to load raw?
-  if(!buf.buf) return;
+  if(!buf.buf && !dev->input_region) return;
 
-  dt_dev_pixelpipe_set_input(dev->pipe, dev, (float *)buf.buf, buf.width, buf.height, 1.0);
+  if(dev->input_region)
+    dt_dev_pixelpipe_set_input_region(dev->pipe, dev, dev->input_region);
+  else
+    dt_dev_pixelpipe_set_input(dev->pipe, dev, (float *)buf.buf, buf.width, buf.height, 1.0);
 
   if(dev->image_loading)
   {
     // init pixel pipeline
+    dev->progressive.valid = 0;
     dt_dev_pixelpipe_cleanup_nodes(dev->pipe);
     dt_dev_pixelpipe_create_nodes(dev->pipe, dev);
     if(dev->image_force_reload) dt_dev_pixelpipe_flush_caches(dev->pipe);
@@ -303,8 +444,21 @@ restart:
   x = MAX(0, scale*dev->pipe->processed_width *(.5+zoom_x)-dev->capwidth/2);
   y = MAX(0, scale*dev->pipe->processed_height*(.5+zoom_y)-dev->capheight/2);
 
+  // slow pipes are rendered coarse to fine, fast ones in one go, which keeps their cache lines useful.
+  // local edits (spot removal) only recompute a small part of the last image, which is fast, too.
+  const dt_iop_roi_t roi = (dt_iop_roi_t)
+  {
+    x, y, dev->capwidth, dev->capheight, scale
+  };
+  dt_iop_roi_t dirty;
+  const int progressive = dev->gui_attached && dev->average_delay > DT_DEV_PROGRESSIVE_DELAY &&
+                          dt_conf_get_bool("plugins/darkroom/progressive") &&
+                          !dt_dev_pixelpipe_dirty_region(dev->pipe, dev, &roi, &dirty);
+  // anything else leaves the progressive buffer behind, expose must not show it for the new roi.
+  if(!progressive) _dev_progressive_invalidate(dev);
   dt_get_times(&start);
-  if(dt_dev_pixelpipe_process(dev->pipe, dev, x, y, dev->capwidth, dev->capheight, scale))
+  if(progressive ? _dev_process_image_progressive(dev, x, y, scale) :
+                   dt_dev_pixelpipe_process(dev->pipe, dev, x, y, dev->capwidth, dev->capheight, scale))
   {
     // interrupted because image changed?
     if(dev->image_force_reload)
@@ -395,6 +549,53 @@ void dt_dev_load_image(dt_develop_t *dev, const uint32_t imgid)
   dev->first_load = 0;
 }
 
+int dt_dev_load_image_reuse(dt_develop_t *dev, const uint32_t imgid)
+{
+  if(!dev->iop)
+  {
+    dt_dev_load_image(dev, imgid);
+    return 1;
+  }
+
+  const dt_image_t *image = dt_image_cache_read_get(darktable.image_cache, imgid);
+  dev->image_storage = *image;
+  dt_image_cache_read_release(darktable.image_cache, image);
+  dev->first_load = 1;
+
+  // forget the previous image, but keep the module instances:
+  _dev_free_history(dev);
+  GList *modules = dev->iop;
+  while(modules)
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+    dt_iop_reload_defaults(module);
+    module->enabled = module->default_enabled;
+    modules = g_list_next(modules);
+  }
+
+  const guint num_modules = g_list_length(dev->iop);
+  dt_dev_read_history(dev);
+
+  // extra instances left over from earlier images which this history does not
+  // reference stay in the list, but have to behave as if they did not exist:
+  modules = dev->iop;
+  while(modules)
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+    if(module->multi_priority > 0)
+    {
+      int used = 0;
+      for(GList *history = dev->history; history && !used; history = g_list_next(history))
+        used = ((dt_dev_history_item_t *)history->data)->module == module;
+      if(!used) module->enabled = module->default_enabled = 0;
+    }
+    modules = g_list_next(modules);
+  }
+
+  dev->first_load = 0;
+  return g_list_length(dev->iop) != num_modules;
+}
+
 void dt_dev_configure (dt_develop_t *dev, int wd, int ht)
 {
   wd = MIN(darktable.thumbnail_width, wd);
@@ -542,6 +743,13 @@ void dt_dev_add_history_item(dt_develop_t *dev, dt_iop_module_t *module, gboolea
   }
 #endif
 
+  // work in progress is only obsolete from this module on, see dt_dev_pixelpipe_piece_cancelled()
+  if(dev->gui_attached)
+  {
+    dev->pipe->changed_priority = MIN(dev->pipe->changed_priority, module->priority);
+    dev->preview_pipe->changed_priority = MIN(dev->preview_pipe->changed_priority, module->priority);
+  }
+
   /* invalidate image data*/
   dt_similarity_image_dirty(dev->image_storage.id);
 
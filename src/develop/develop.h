@@ -63,6 +63,23 @@ typedef struct dt_develop_t
 
   // image processing pipeline with caching
   struct dt_dev_pixelpipe_t *pipe, *preview_pipe;
+  // full pipe input of a raw which is decoded as the pipe needs it, if the format allows that.
+  struct dt_imageio_region_t *input_region;
+
+  // progressive rendering of the full pipe: a coarse pass of the visible roi first, then its center at
+  // full scale, while the final image is processed. buf (8-bit, like the backbuf) is protected by
+  // pipe->backbuf_mutex.
+  struct
+  {
+    uint8_t *buf;
+    size_t size;
+    int32_t width, height;
+    // roi the buffer is showing, and whether it shows anything yet
+    int32_t x, y;
+    float scale;
+    int32_t valid;
+  }
+  progressive;
 
   // image under consideration, which
   // is copied each time an image is changed. this means we have some information
@@ -81,9 +98,11 @@ typedef struct dt_develop_t
   int32_t iop_instance;
   GList *iop;
 
-  // histogram for display.
-  float *histogram, *histogram_pre_tonecurve, *histogram_pre_levels;
-  float histogram_max, histogram_pre_tonecurve_max, histogram_pre_levels_max;
+  // histogram and scopes for display, computed asynchronously from the preview pipe.
+  struct dt_histogram_scopes_t *scopes;
+  // luminance histograms at the input of tonecurve and levels, DT_HISTOGRAM_BINS bins.
+  float *histogram_pre_tonecurve, *histogram_pre_levels;
+  float histogram_pre_tonecurve_max, histogram_pre_levels_max;
   gboolean histogram_linear;
 
   /* proxy for communication between plugins and develop/darkroom */
@@ -140,6 +159,11 @@ void dt_dev_process_image(dt_develop_t *dev);
 void dt_dev_process_preview(dt_develop_t *dev);
 
 void dt_dev_load_image(dt_develop_t *dev, const uint32_t imgid);
+/** whether dev->progressive.buf is valid and shows the roi of the given zoom. call with pipe->backbuf_mutex held. */
+int dt_dev_progressive_current(dt_develop_t *dev, const dt_dev_zoom_t zoom, const float zoom_x, const float zoom_y);
+/** loads imgid into a dev which already holds modules from a previous image, keeping the instances.
+ * returns non-zero if the list of modules changed, i.e. pipe nodes have to be recreated. */
+int dt_dev_load_image_reuse(dt_develop_t *dev, const uint32_t imgid);
 void dt_dev_reload_image(dt_develop_t *dev, const uint32_t imgid);
 /** checks if provided imgid is the image currently in develop */
 int dt_dev_is_current_image(dt_develop_t *dev, uint32_t imgid);
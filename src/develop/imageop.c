@@ -716,6 +716,7 @@ int dt_iop_load_module_so(dt_iop_module_so_t *module, const char *libname, const
   if(!g_module_symbol(module->module, "modify_roi_in",          (gpointer)&(module->modify_roi_in)))          module->modify_roi_in = dt_iop_modify_roi_in;
   if(!g_module_symbol(module->module, "modify_roi_out",         (gpointer)&(module->modify_roi_out)))         module->modify_roi_out = dt_iop_modify_roi_out;
   if(!g_module_symbol(module->module, "legacy_params",          (gpointer)&(module->legacy_params)))          module->legacy_params = NULL;
+  if(!g_module_symbol(module->module, "dirty_region",           (gpointer)&(module->dirty_region)))           module->dirty_region = NULL;
   if(module->init_global) module->init_global(module);
   return 0;
 error:
@@ -790,6 +791,7 @@ dt_iop_load_module_by_so(dt_iop_module_t *module, dt_iop_module_so_t *so, dt_dev
   module->modify_roi_in   = so->modify_roi_in;
   module->modify_roi_out  = so->modify_roi_out;
   module->legacy_params   = so->legacy_params;
+  module->dirty_region    = so->dirty_region;
 
   module->connect_key_accels = so->connect_key_accels;
   module->disconnect_key_accels = so->disconnect_key_accels;
@@ -1605,6 +1607,12 @@ void dt_iop_commit_params(dt_iop_module_t *module, dt_iop_params_t *params, dt_d
     // assume process_cl is ready, commit_params can overwrite this.
     if(module->process_cl) piece->process_cl_ready = 1;
     module->commit_params(module, params, pipe, piece);
+    // the pipe diffs these against the ones it processed last, see dt_dev_pixelpipe_dirty_region()
+    if(module->dirty_region)
+    {
+      if(!piece->params) piece->params = malloc(module->params_size);
+      if(piece->params) memcpy(piece->params, params, module->params_size);
+    }
     for(int i=0; i<length; i++) hash = ((hash << 5) + hash) ^ str[i];
     piece->hash = hash;
 
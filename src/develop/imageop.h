@@ -61,6 +61,7 @@ struct dt_develop_tiling_t;
 #define IOP_FLAGS_HIDDEN               32                       // Hide the iop from userinterface
 #define IOP_FLAGS_TILING_FULL_ROI      64                       // Tiling code has to expect arbitrary roi's for this module (incl. flipping, mirroring etc.)
 #define IOP_FLAGS_ONE_INSTANCE        128     // The module doesn't support multiple instances
+#define IOP_FLAGS_COMMIT_PER_IMAGE    256     // commit_params depends on image data other than the camera (embedded profiles etc.)
 /** status of a module*/
 typedef enum dt_iop_module_state_t
 {
@@ -146,6 +147,7 @@ typedef struct dt_iop_module_so_t
   void (*modify_roi_in)   (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const struct dt_iop_roi_t *roi_out, struct dt_iop_roi_t *roi_in);
   void (*modify_roi_out)  (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, struct dt_iop_roi_t *roi_out, const struct dt_iop_roi_t *roi_in);
   int  (*legacy_params)   (struct dt_iop_module_t *self, const void *const old_params, const int old_version, void *new_params, const int new_version);
+  int  (*dirty_region)    (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const struct dt_iop_params_t *old_params, const struct dt_iop_params_t *new_params, float *box);
 
   void (*process)         (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const struct dt_iop_roi_t *roi_in, const struct dt_iop_roi_t *roi_out);
   void (*process_tiling)  (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const struct dt_iop_roi_t *roi_in, const struct dt_iop_roi_t *roi_out, const int bpp);
@@ -289,6 +291,9 @@ typedef struct dt_iop_module_t
   void (*modify_roi_in)   (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const struct dt_iop_roi_t *roi_out, struct dt_iop_roi_t *roi_in);
   void (*modify_roi_out)  (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, struct dt_iop_roi_t *roi_out, const struct dt_iop_roi_t *roi_in);
   int  (*legacy_params)   (struct dt_iop_module_t *self, const void *const old_params, const int old_version, void *new_params, const int new_version);
+  /** optional: box x0, y0, x1, y1 of the output, relative to piece->buf_out, which changes going from
+    * old_params to new_params. returns 0 if that can't be told, the pipe then recomputes everything. */
+  int  (*dirty_region)    (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const struct dt_iop_params_t *old_params, const struct dt_iop_params_t *new_params, float *box);
 
   /** this is the temp homebrew callback to operations, as long as gegl is so slow.
     * x,y, and scale are just given for orientation in the framebuffer. i and o are
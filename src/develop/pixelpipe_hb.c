@@ -22,7 +22,10 @@
 #include "gui/gtk.h"
 #include "control/control.h"
 #include "control/signal.h"
+#include "common/histogram.h"
+#include "common/imageio.h"
 #include "common/opencl.h"
+#include "common/trace.h"
 #include "libs/lib.h"
 #include "libs/colorpicker.h"
 #include "iop/colorout.h"
@@ -32,10 +35,20 @@
 #include <strings.h>
 #include <stdlib.h>
 #include <math.h>
+#include <limits.h>
 #include <unistd.h>
 
 // this is to ensure compatibility with pixelpipe_gegl.c, which does not need to build the other module:
 #include "develop/pixelpipe_cache.c"
+#include "develop/pixelpipe_scratch.c"
+#include "develop/pixelpipe_picker.c"
+
+// recompute this much around a local change, for filters which don't ask for their full support
+#define DT_DEV_PIXELPIPE_DIRTY_MARGIN 32
+// the dirty region starts and ends on multiples of this, in input (scale 1) coordinates
+#define DT_DEV_PIXELPIPE_DIRTY_ALIGN 16
+// distorting modules are asked for the input of this many cells per row/column of their output
+#define DT_DEV_PIXELPIPE_DIRTY_CELLS 16
 
 #define max(a,b) ((a) > (b) ? (a) : (b))
 
@@ -100,14 +113,21 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, int32_t size, int32_t
   pipe->backbuf_size = size;
   if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size))
     return 0;
+  dt_dev_pixelpipe_scratch_init(&(pipe->scratch));
+  for(int k=0; k<2; k++) dt_dev_pixelpipe_picker_init(&(pipe->picker[k]));
   pipe->cache_obsolete = 0;
   pipe->backbuf = NULL;
+  pipe->backbuf_roi = (dt_iop_roi_t){ 0, 0, 0, 0, 1.0f };
+  pipe->backbuf_bpp = 0;
   pipe->processing = 0;
   pipe->shutdown = 0;
   pipe->opencl_error = 0;
   pipe->tiling = 0;
   pipe->mask_display = 0;
   pipe->input_timestamp = 0;
+  pipe->input_region = NULL;
+  pipe->changed_priority = INT_MAX;
+  pipe->cancelled = 0;
   dt_pthread_mutex_init(&(pipe->backbuf_mutex), NULL);
   dt_pthread_mutex_init(&(pipe->busy_mutex), NULL);
   return 1;
@@ -120,9 +140,16 @@ void dt_dev_pixelpipe_set_input(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, flo
   pipe->iflipped = 0;
   pipe->iscale = iscale;
   pipe->input = input;
+  pipe->input_region = NULL;
   pipe->image = dev->image_storage;
 }
 
+void dt_dev_pixelpipe_set_input_region(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_imageio_region_t *region)
+{
+  dt_dev_pixelpipe_set_input(pipe, dev, (float *)region->buf, region->width, region->height, 1.0f);
+  pipe->input_region = region;
+}
+
 void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe)
 {
   dt_pthread_mutex_lock(&pipe->backbuf_mutex);
@@ -131,6 +158,8 @@ void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe)
   dt_dev_pixelpipe_cleanup_nodes(pipe);
   // so now it's safe to clean up cache:
   dt_dev_pixelpipe_cache_cleanup(&(pipe->cache));
+  dt_dev_pixelpipe_scratch_cleanup(&(pipe->scratch));
+  for(int k=0; k<2; k++) dt_dev_pixelpipe_picker_cleanup(&(pipe->picker[k]));
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
   dt_pthread_mutex_destroy(&(pipe->backbuf_mutex));
   dt_pthread_mutex_destroy(&(pipe->busy_mutex));
@@ -150,6 +179,8 @@ void dt_dev_pixelpipe_cleanup_nodes(dt_dev_pixelpipe_t *pipe)
     // printf("cleanup module `%s'\n", piece->module->name());
     piece->module->cleanup_pipe(piece->module, pipe, piece);
     free(piece->blendop_data);
+    free(piece->params);
+    free(piece->processed_params);
     free(piece);
     nodes = g_list_next(nodes);
   }
@@ -180,6 +211,12 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
       piece->pipe    = pipe;
       piece->data = NULL;
       piece->hash = 0;
+      piece->commit_hash = 0;
+      piece->params = NULL;
+      piece->processed_params = NULL;
+      piece->processed_hash = 0;
+      piece->processed_enabled = -1; // never matches, nothing processed yet
+      memset(&piece->stats, 0, sizeof(piece->stats));
       dt_iop_init_pipe(piece->module, pipe,piece);
       pipe->nodes = g_list_append(pipe->nodes, piece);
     }
@@ -201,6 +238,7 @@ void dt_dev_pixelpipe_synch(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, GList *
     if(piece->module == hist->module)
     {
       piece->enabled = hist->enabled;
+      piece->commit_hash = 0;
       dt_iop_commit_params(hist->module, hist->params, hist->blend_params, pipe, piece);
     }
     nodes = g_list_next(nodes);
@@ -216,6 +254,7 @@ void dt_dev_pixelpipe_synch_all(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
   {
     dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
     piece->hash = 0;
+    piece->commit_hash = 0;
     piece->enabled = piece->module->default_enabled;
     dt_iop_commit_params(piece->module, piece->module->default_params, piece->module->default_blendop_params, pipe, piece);
     nodes = g_list_next(nodes);
@@ -230,6 +269,77 @@ void dt_dev_pixelpipe_synch_all(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
+static inline uint64_t _hash_bytes(uint64_t hash, const void *data, const size_t length)
+{
+  const char *str = (const char *)data;
+  for(size_t i=0; i<length; i++) hash = ((hash << 5) + hash) ^ str[i];
+  return hash;
+}
+
+void dt_dev_pixelpipe_synch_changed(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
+{
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  // the parts of the image commit_params may look at, and the pipe input size (atrous, equalizer):
+  uint64_t image_hash = 5381;
+  image_hash = _hash_bytes(image_hash, pipe->image.exif_maker, sizeof(pipe->image.exif_maker));
+  image_hash = _hash_bytes(image_hash, pipe->image.exif_model, sizeof(pipe->image.exif_model));
+  image_hash = _hash_bytes(image_hash, pipe->image.exif_lens, sizeof(pipe->image.exif_lens));
+  image_hash = _hash_bytes(image_hash, &pipe->image.flags, sizeof(pipe->image.flags));
+  image_hash = _hash_bytes(image_hash, &pipe->image.filters, sizeof(pipe->image.filters));
+  // dt_image_flipped_filter() in demosaic and hotpixels: the cfa pattern turns with the image
+  image_hash = _hash_bytes(image_hash, &pipe->image.orientation, sizeof(pipe->image.orientation));
+  image_hash = _hash_bytes(image_hash, &pipe->image.width, sizeof(pipe->image.width));
+  image_hash = _hash_bytes(image_hash, &pipe->image.height, sizeof(pipe->image.height));
+  image_hash = _hash_bytes(image_hash, pipe->image.d65_color_matrix, sizeof(pipe->image.d65_color_matrix));
+  image_hash = _hash_bytes(image_hash, &pipe->image.colorspace, sizeof(pipe->image.colorspace));
+  image_hash = _hash_bytes(image_hash, &pipe->iwidth, sizeof(pipe->iwidth));
+  image_hash = _hash_bytes(image_hash, &pipe->iheight, sizeof(pipe->iheight));
+  image_hash = _hash_bytes(image_hash, &pipe->iscale, sizeof(pipe->iscale));
+  image_hash = _hash_bytes(image_hash, &pipe->type, sizeof(pipe->type));
+
+  GList *nodes = pipe->nodes;
+  while(nodes)
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    dt_iop_module_t *module = piece->module;
+    piece->iscale  = pipe->iscale;
+    piece->iwidth  = pipe->iwidth;
+    piece->iheight = pipe->iheight;
+
+    // the last history item wins, same as replaying them all in synch_all:
+    dt_dev_history_item_t *hist = NULL;
+    GList *history = dev->history;
+    for(int k=0; k<dev->history_end && history; k++)
+    {
+      dt_dev_history_item_t *item = (dt_dev_history_item_t *)history->data;
+      if(item->module == module) hist = item;
+      history = g_list_next(history);
+    }
+    const int enabled = hist ? hist->enabled : module->default_enabled;
+    dt_iop_params_t *params = hist ? hist->params : module->default_params;
+    dt_develop_blend_params_t *blend_params = hist ? hist->blend_params : module->default_blendop_params;
+
+    uint64_t hash = image_hash;
+    hash = _hash_bytes(hash, &enabled, sizeof(enabled));
+    hash = _hash_bytes(hash, params, module->params_size);
+    hash = _hash_bytes(hash, module->params, module->params_size);
+    hash = _hash_bytes(hash, blend_params, sizeof(dt_develop_blend_params_t));
+    if(module->flags() & IOP_FLAGS_COMMIT_PER_IMAGE)
+      hash = _hash_bytes(hash, &pipe->image.id, sizeof(pipe->image.id));
+    // never collide with the `unknown' marker:
+    hash |= 1;
+
+    if(hash != piece->commit_hash)
+    {
+      piece->enabled = enabled;
+      dt_iop_commit_params(module, params, blend_params, pipe, piece);
+      piece->commit_hash = hash;
+    }
+    nodes = g_list_next(nodes);
+  }
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+}
+
 void dt_dev_pixelpipe_synch_top(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
 {
   dt_pthread_mutex_lock(&pipe->busy_mutex);
@@ -238,6 +348,25 @@ void dt_dev_pixelpipe_synch_top(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
+int dt_dev_pixelpipe_piece_cancelled(dt_dev_pixelpipe_iop_t *piece)
+{
+  dt_dev_pixelpipe_t *pipe = piece->pipe;
+  if(pipe->cancelled) return 1;
+  // the same reasons to stop as between the modules, but only what makes this module's output useless.
+  // changes further down the pipe don't, this output will be found in the cache on the restart.
+  const dt_develop_t *dev = piece->module->dev;
+  const int changed = pipe->changed;
+  int cancel = 0;
+  if(pipe->shutdown || dev->gui_leaving) cancel = 1;
+  else if(pipe == dev->pipe && dev->image_force_reload) cancel = 1;
+  else if(pipe == dev->preview_pipe && dev->preview_loading) cancel = 1;
+  else if(changed & DT_DEV_PIPE_REMOVE) cancel = 1;
+  else if(pipe != dev->preview_pipe && (changed & DT_DEV_PIPE_ZOOMED)) cancel = 1;
+  else if((changed & (DT_DEV_PIPE_TOP_CHANGED | DT_DEV_PIPE_SYNCH)) && pipe->changed_priority <= piece->module->priority) cancel = 1;
+  if(cancel) pipe->cancelled = 1;
+  return cancel;
+}
+
 void dt_dev_pixelpipe_change(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev)
 {
   dt_pthread_mutex_lock(&dev->history_mutex);
@@ -260,6 +389,7 @@ void dt_dev_pixelpipe_change(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev)
     dt_dev_pixelpipe_synch_all(pipe, dev);
   }
   pipe->changed = DT_DEV_PIPE_UNCHANGED;
+  pipe->changed_priority = INT_MAX;
   dt_pthread_mutex_unlock(&dev->history_mutex);
   dt_dev_pixelpipe_get_dimensions(pipe, dev, pipe->iwidth, pipe->iheight, &pipe->processed_width, &pipe->processed_height);
 }
@@ -287,19 +417,14 @@ get_output_bpp(dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpi
 }
 
 
-// helper for color picking
+// helper for color picking. hash identifies the contents of img, see dt_dev_pixelpipe_picker_box().
 static void
 pixelpipe_picker(dt_iop_module_t *module, const float *img, const dt_iop_roi_t *roi,
+                 dt_dev_pixelpipe_picker_t *picker, const uint64_t hash,
                  float *picked_color, float *picked_color_min, float *picked_color_max)
 {
   int box[4];
   int point[2];
-  float Lab[3];
-
-  for(int k=0; k<3; k++) picked_color_min[k] =  666.0f;
-  for(int k=0; k<3; k++) picked_color_max[k] = -666.0f;
-
-  for(int k=0; k<3; k++) Lab[k] = 0.0f;
 
   // Initializing bounds of colorpicker box
   for(int k=0; k<4; k+=2) box[k] = MIN(roi->width -1, MAX(0, module->color_picker_box[k]*roi->width));
@@ -311,23 +436,8 @@ pixelpipe_picker(dt_iop_module_t *module, const float *img, const dt_iop_roi_t *
 
   if(darktable.lib->proxy.colorpicker.size)
   {
-    const float w = 1.0/((box[3]-box[1]+1)*(box[2]-box[0]+1));
-    for(int j=box[1]; j<=box[3]; j++) for(int i=box[0]; i<=box[2]; i++)
-      {
-        const float L = img[4*(roi->width*j + i) + 0];
-        const float a = img[4*(roi->width*j + i) + 1];
-        const float b = img[4*(roi->width*j + i) + 2];
-        Lab[0] += w*L;
-        Lab[1] += w*a;
-        Lab[2] += w*b;
-        picked_color_min[0] = fminf(picked_color_min[0], L);
-        picked_color_min[1] = fminf(picked_color_min[1], a);
-        picked_color_min[2] = fminf(picked_color_min[2], b);
-        picked_color_max[0] = fmaxf(picked_color_max[0], L);
-        picked_color_max[1] = fmaxf(picked_color_max[1], a);
-        picked_color_max[2] = fmaxf(picked_color_max[2], b);
-        for(int k=0; k<3; k++) picked_color[k] = Lab[k];
-      }
+    dt_dev_pixelpipe_picker_box(picker, hash, img, roi->width, roi->height, box,
+                                picked_color, picked_color_min, picked_color_max);
   }
   else
   {
@@ -339,6 +449,17 @@ pixelpipe_picker(dt_iop_module_t *module, const float *img, const dt_iop_roi_t *
   }
 }
 
+// identifies the output of the module at pos for the picker. unlike the cache hash, this
+// does not depend on the picker box, and is the same while the box is dragged around.
+static uint64_t
+pixelpipe_picker_output_hash(const uint64_t input_hash, const dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_out)
+{
+  uint64_t hash = input_hash;
+  hash = _hash_bytes(hash, &piece->hash, sizeof(piece->hash));
+  hash = _hash_bytes(hash, roi_out, sizeof(dt_iop_roi_t));
+  return hash;
+}
+
 
 // recursive helper for process:
 static int
@@ -383,6 +504,9 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
     (void) dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output);
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
     if(!modules) return 0;
+    if(dt_trace_enabled())
+      dt_trace_instant("pixelpipe", module->op, "\"pipe\": \"%s\", \"width\": %d, \"height\": %d, \"cache\": \"hit\"",
+                       _pipe_type_to_str(pipe->type), roi_out->width, roi_out->height);
     // go to post-collect directly:
     goto post_process_collect_info;
   }
@@ -409,6 +533,15 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
     }
     dt_times_t start;
     dt_get_times(&start);
+    if(pipe->input_region)
+    {
+      // make sure the raw is decoded where we are going to read it, plus a margin for the interpolation.
+      const int margin = 2 + 1.0f/roi_out->scale;
+      const int x = roi_out->x/roi_out->scale, y = roi_out->y/roi_out->scale;
+      if(dt_imageio_region_decode(pipe->input_region, x - margin, y - margin,
+                                  roi_out->width/roi_out->scale + 2*margin, roi_out->height/roi_out->scale + 2*margin))
+        fprintf(stderr, "[dev_pixelpipe] failed to decode region of image %d\n", pipe->image.id);
+    }
     if(pipe->type != DT_DEV_PIXELPIPE_PREVIEW)
     {
       if(roi_out->scale == 1.0 && roi_out->x == 0 && roi_out->y == 0 && pipe->iwidth == roi_out->width && pipe->iheight == roi_out->height)
@@ -463,6 +596,9 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
       }
     }
     dt_show_times(&start, "[dev_pixelpipe]", "initing base buffer [%s]", _pipe_type_to_str(pipe->type));
+    if(dt_trace_enabled())
+      dt_trace_span("pixelpipe", "input", start.clock, dt_get_wtime(), "\"pipe\": \"%s\", \"width\": %d, \"height\": %d",
+                    _pipe_type_to_str(pipe->type), roi_out->width, roi_out->height);
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
   }
   else
@@ -483,6 +619,8 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
     int in_bpp;
     if(dt_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &in_bpp, &roi_in, g_list_previous(modules), g_list_previous(pieces), pos-1)) return 1;
     piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    // same as the cache line of input, lets the color picker recognize a buffer it has seen before
+    const uint64_t input_hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, &roi_in, pipe, pos-1);
 
     // reserve new cache line: output
     dt_pthread_mutex_lock(&pipe->busy_mutex);
@@ -523,15 +661,7 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
         histogram_pre_max = &(dev->histogram_pre_levels_max);
       }
 
-      *histogram_pre_max = 0;
-      memset (histogram_pre, 0, sizeof(float)*4*64);
-      for(int j=0; j<roi_in.height; j+=4) for(int i=0; i<roi_in.width; i+=4)
-        {
-          uint8_t L = CLAMP(63/100.0*(pixel[4*j*roi_in.width+4*i]), 0, 63);
-          histogram_pre[4*L+3] ++;
-        }
-      // don't count <= 0 pixels
-      for(int k=19; k<4*64; k+=4) *histogram_pre_max = *histogram_pre_max > histogram_pre[k] ? *histogram_pre_max : histogram_pre[k];
+      dt_histogram_Lab_L(pixel, roi_in.width, roi_in.height, histogram_pre, histogram_pre_max);
       dt_pthread_mutex_unlock(&pipe->busy_mutex);
       if(module->widget) dt_control_queue_redraw_widget(module->widget);
     }
@@ -551,7 +681,7 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
         (module == dev->gui_module || !strcmp(module->op, "colorout")) && // only modules with focus or colorout for bottom panel can pick
         module->request_color_pick) // and they need to want to pick ;)
     {
-      pixelpipe_picker(module, (float *)input, &roi_in, module->picked_color, module->picked_color_min, module->picked_color_max);
+      pixelpipe_picker(module, (float *)input, &roi_in, &pipe->picker[0], input_hash, module->picked_color, module->picked_color_min, module->picked_color_max);
 
       dt_pthread_mutex_unlock(&pipe->busy_mutex);
 
@@ -597,12 +727,24 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
 
     assert(tiling.factor > 0.0f && tiling.factor < 100.0f);
 
+    /* on the cpu, tile if the module allows it and its buffers don't fit into host memory at once */
+    const int tiling_cpu = (module->flags() & IOP_FLAGS_ALLOW_TILING) &&
+      !dt_tiling_piece_fits_host_memory(max(roi_in.width, roi_out->width), max(roi_in.height, roi_out->height),
+                                        max(in_bpp, bpp), tiling.factor, tiling.overhead);
+    /* the tiling code fills in the tiles it used */
+    piece->stats.tiles_x = piece->stats.tiles_y = 0;
+    piece->stats.tiling_factor = tiling.factor;
+    piece->stats.tiling_overhead = tiling.overhead;
+
     if(pipe->shutdown)
     {
       dt_pthread_mutex_unlock(&pipe->busy_mutex);
       return 1;
     }
 
+    // the module may give up on its output from here on, see dt_dev_pixelpipe_piece_cancelled()
+    pipe->cancelled = 0;
+
 
 #ifdef HAVE_OPENCL
     /* do we have opencl at all? did user tell us to use it? did we get a resource? */
@@ -771,6 +913,18 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
           return 1;
         }
 
+        // the module gave up because its output is obsolete, no reason to fall back to the cpu:
+        if(pipe->cancelled)
+        {
+          if(cl_mem_input != NULL) dt_opencl_release_mem_object(cl_mem_input);
+          if(*cl_mem_output != NULL) dt_opencl_release_mem_object(*cl_mem_output);
+          *cl_mem_output = NULL;
+          if(valid_input_on_gpu_only) dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), input);
+          dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+          dt_pthread_mutex_unlock(&pipe->busy_mutex);
+          return 1;
+        }
+
         // if (rand() % 20 == 0) success_opencl = FALSE; // Test code: simulate spurious failures
 
         /* finally check, if we were successful */
@@ -857,9 +1011,7 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
           }
 
           /* process module on cpu. use tiling if needed and possible. */
-          if((module->flags() & IOP_FLAGS_ALLOW_TILING) &&
-              !dt_tiling_piece_fits_host_memory(max(roi_in.width, roi_out->width), max(roi_in.height, roi_out->height),
-                                                max(in_bpp, bpp), tiling.factor, tiling.overhead))
+          if(tiling_cpu)
             module->process_tiling(module, piece, input, *output, &roi_in, roi_out, in_bpp);
           else
             module->process(module, piece, input, *output, &roi_in, roi_out);
@@ -916,9 +1068,7 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
         }
 
         /* process module on cpu. use tiling if needed and possible. */
-        if((module->flags() & IOP_FLAGS_ALLOW_TILING) &&
-            !dt_tiling_piece_fits_host_memory(max(roi_in.width, roi_out->width), max(roi_in.height, roi_out->height),
-                                              max(in_bpp, bpp), tiling.factor, tiling.overhead))
+        if(tiling_cpu)
           module->process_tiling(module, piece, input, *output, &roi_in, roi_out, in_bpp);
         else
           module->process(module, piece, input, *output, &roi_in, roi_out);
@@ -948,9 +1098,7 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
       /* opencl is not inited or not enabled or we got no resource/device -> everything runs on cpu */
 
       /* process module on cpu. use tiling if needed and possible. */
-      if((module->flags() & IOP_FLAGS_ALLOW_TILING) &&
-          !dt_tiling_piece_fits_host_memory(max(roi_in.width, roi_out->width), max(roi_in.height, roi_out->height),
-                                            max(in_bpp, bpp), tiling.factor, tiling.overhead))
+      if(tiling_cpu)
         module->process_tiling(module, piece, input, *output, &roi_in, roi_out, in_bpp);
       else
         module->process(module, piece, input, *output, &roi_in, roi_out);
@@ -963,11 +1111,13 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
 
       // Lab color picking for module
       if(dev->gui_attached && pipe == dev->preview_pipe && // pick from preview pipe to get pixels outside the viewport
+          !pipe->cancelled && // process() gave up, the output is incomplete
           module == dev->gui_module && // only modules with focus can pick
           module->request_color_pick) // and they need to want to pick ;)
       {
-        pixelpipe_picker(module, (float *)input, &roi_in, module->picked_color, module->picked_color_min, module->picked_color_max);
-        pixelpipe_picker(module, (float *)(*output), roi_out, module->picked_output_color, module->picked_output_color_min, module->picked_output_color_max);
+        pixelpipe_picker(module, (float *)input, &roi_in, &pipe->picker[0], input_hash, module->picked_color, module->picked_color_min, module->picked_color_max);
+        pixelpipe_picker(module, (float *)(*output), roi_out, &pipe->picker[1], pixelpipe_picker_output_hash(input_hash, piece, roi_out),
+                         module->picked_output_color, module->picked_output_color_min, module->picked_output_color_max);
 
         dt_pthread_mutex_unlock(&pipe->busy_mutex);
 
@@ -989,9 +1139,7 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
     }
 #else
     /* process module on cpu. use tiling if needed and possible. */
-    if((module->flags() & IOP_FLAGS_ALLOW_TILING) &&
-        !dt_tiling_piece_fits_host_memory(max(roi_in.width, roi_out->width), max(roi_in.height, roi_out->height),
-                                          max(in_bpp, bpp), tiling.factor, tiling.overhead))
+    if(tiling_cpu)
       module->process_tiling(module, piece, input, *output, &roi_in, roi_out, in_bpp);
     else
       module->process(module, piece, input, *output, &roi_in, roi_out);
@@ -1004,11 +1152,13 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
 
     // Lab color picking for module
     if(dev->gui_attached && pipe == dev->preview_pipe && // pick from preview pipe to get pixels outside the viewport
+        !pipe->cancelled && // process() gave up, the output is incomplete
         module == dev->gui_module && // only modules with focus can pick
         module->request_color_pick) // and they need to want to pick ;)
     {
-      pixelpipe_picker(module, (float *)input, &roi_in, module->picked_color, module->picked_color_min, module->picked_color_max);
-      pixelpipe_picker(module, (float *)(*output), roi_out, module->picked_output_color, module->picked_output_color_min, module->picked_output_color_max);
+      pixelpipe_picker(module, (float *)input, &roi_in, &pipe->picker[0], input_hash, module->picked_color, module->picked_color_min, module->picked_color_max);
+      pixelpipe_picker(module, (float *)(*output), roi_out, &pipe->picker[1], pixelpipe_picker_output_hash(input_hash, piece, roi_out),
+                         module->picked_output_color, module->picked_output_color_min, module->picked_output_color_max);
 
       dt_pthread_mutex_unlock(&pipe->busy_mutex);
 
@@ -1029,8 +1179,29 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
     dt_develop_blend_process(module, piece, input, *output, &roi_in, roi_out);
 #endif
 
+    if(pipe->cancelled)
+    {
+      // process() returned early, the output must not be found in the cache.
+      dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      return 1;
+    }
+
     dt_show_times(&start, "[dev_pixelpipe]", "processing `%s' [%s]", module->name(),
                   _pipe_type_to_str(pipe->type));
+    dt_times_t end;
+    dt_get_times(&end);
+    piece->stats.runs++;
+    piece->stats.wall += end.clock - start.clock;
+    piece->stats.user += end.user - start.user;
+    if(piece->stats.tiles_x > 0) piece->stats.tiled++;
+    if(dt_trace_enabled())
+      dt_trace_span("pixelpipe", module->op, start.clock, end.clock,
+                    "\"pipe\": \"%s\", \"width\": %d, \"height\": %d, \"cache\": \"miss\", \"tiles\": [%d, %d]",
+                    _pipe_type_to_str(pipe->type), roi_out->width, roi_out->height, piece->stats.tiles_x, piece->stats.tiles_y);
+    // export pipes don't run the same modules again and again, here kept scratch buffers would only raise the peak memory:
+    if(pipe->type == DT_DEV_PIXELPIPE_EXPORT || pipe->type == DT_DEV_PIXELPIPE_THUMBNAIL)
+      dt_dev_pixelpipe_scratch_flush(&(pipe->scratch));
     // in case we get this buffer from the cache, also get the processed max:
     for(int k=0; k<3; k++) piece->processed_maximum[k] = pipe->processed_maximum[k];
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
@@ -1320,8 +1491,7 @@ post_process_collect_info:
     if(dev->gui_attached && !dev->gui_leaving &&
         pipe == dev->preview_pipe && (strcmp(module->op, "gamma") == 0))
     {
-      uint8_t *pixel = (uint8_t *)*output;
-      float box[4];
+      int box[4];
       // Constraining the area if the colorpicker is active in area mode
       if(dev->gui_module
           && !strcmp(dev->gui_module->op, "colorout")
@@ -1358,22 +1528,9 @@ post_process_collect_info:
         box[2] = roi_out->width;
         box[3] = roi_out->height;
       }
-      dev->histogram_max = 0;
-      memset(dev->histogram, 0, sizeof(float)*4*64);
-      for(int j=box[1]; j<=box[3]; j+=4) for(int i=box[0]; i<=box[2]; i+=4)
-        {
-          uint8_t rgb[3];
-          for(int k=0; k<3; k++)
-            rgb[k] = pixel[4*j*roi_out->width+4*i+2-k]>>2;
-
-          for(int k=0; k<3; k++)
-            dev->histogram[4*rgb[k]+k] ++;
-          uint8_t lum = MAX(MAX(rgb[0], rgb[1]), rgb[2]);
-          dev->histogram[4*lum+3] ++;
-        }
-
-      // don't count <= 0 pixels
-      for(int k=19; k<4*64; k+=4) dev->histogram_max = dev->histogram_max > dev->histogram[k] ? dev->histogram_max : dev->histogram[k];
+      // hand the float input of gamma to the scopes worker, the histogram is computed from the
+      // display referred values off the pipe thread.
+      dt_histogram_scopes_submit(dev->scopes, (const float *)input, roi_out->width, roi_out->height, box);
 
       dt_pthread_mutex_unlock(&pipe->busy_mutex);
 
@@ -1491,8 +1648,268 @@ dt_dev_pixelpipe_process_rec_and_backcopy(dt_dev_pixelpipe_t *pipe, dt_develop_t
 #endif
 }
 
+// the same test as in dt_dev_pixelpipe_process_rec(), whether the piece takes part in the pipe.
+static inline int _piece_enabled(const dt_develop_t *dev, const dt_dev_pixelpipe_iop_t *piece)
+{
+  return piece->enabled && !(dev->gui_module && (dev->gui_module->operation_tags_filter() & piece->module->operation_tags()));
+}
+
+// remember what went into the backbuf, for dt_dev_pixelpipe_dirty_region().
+static void _pixelpipe_snapshot(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
+{
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  GList *nodes = pipe->nodes;
+  while(nodes)
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    piece->processed_enabled = _piece_enabled(dev, piece);
+    piece->processed_hash = piece->hash;
+    if(piece->params)
+    {
+      if(!piece->processed_params) piece->processed_params = malloc(piece->module->params_size);
+      if(piece->processed_params) memcpy(piece->processed_params, piece->params, piece->module->params_size);
+    }
+    nodes = g_list_next(nodes);
+  }
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+}
+
+// grows d (x0, y0, x1, y1 on the input of piece) to the part of its output that reads from it.
+static void _dirty_propagate(dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
+                             const int overlap, int *d)
+{
+  dt_iop_module_t *module = piece->module;
+  if(d[0] >= d[2] || d[1] >= d[3]) return;
+  if(!(module->operation_tags() & IOP_TAG_DISTORT))
+  {
+    // same pixels in and out, just the filter support
+    d[0] = MAX(roi_out->x, d[0] - overlap);
+    d[1] = MAX(roi_out->y, d[1] - overlap);
+    d[2] = MIN(roi_out->x + roi_out->width,  d[2] + overlap);
+    d[3] = MIN(roi_out->y + roi_out->height, d[3] + overlap);
+    return;
+  }
+  // otherwise ask the module cell by cell of its output where that reads from
+  const int cw = MAX(DT_DEV_PIXELPIPE_DIRTY_ALIGN, (roi_out->width  + DT_DEV_PIXELPIPE_DIRTY_CELLS - 1)/DT_DEV_PIXELPIPE_DIRTY_CELLS);
+  const int ch = MAX(DT_DEV_PIXELPIPE_DIRTY_ALIGN, (roi_out->height + DT_DEV_PIXELPIPE_DIRTY_CELLS - 1)/DT_DEV_PIXELPIPE_DIRTY_CELLS);
+  int o[4] = { INT_MAX, INT_MAX, INT_MIN, INT_MIN };
+  for(int j=0; j<roi_out->height; j+=ch) for(int i=0; i<roi_out->width; i+=cw)
+  {
+    const dt_iop_roi_t cell = (dt_iop_roi_t)
+    {
+      roi_out->x + i, roi_out->y + j, MIN(cw, roi_out->width - i), MIN(ch, roi_out->height - j), roi_out->scale
+    };
+    dt_iop_roi_t in = cell;
+    module->modify_roi_in(module, piece, &cell, &in);
+    if(in.x - overlap >= d[2] || in.x + in.width  + overlap <= d[0] ||
+       in.y - overlap >= d[3] || in.y + in.height + overlap <= d[1]) continue;
+    o[0] = MIN(o[0], cell.x);
+    o[1] = MIN(o[1], cell.y);
+    o[2] = MAX(o[2], cell.x + cell.width);
+    o[3] = MAX(o[3], cell.y + cell.height);
+  }
+  for(int k=0; k<4; k++) d[k] = o[k];
+}
+
+// the alignment in output coordinates which keeps the dirty region on the grid of
+// DT_DEV_PIXELPIPE_DIRTY_ALIGN input pixels, or 0 if there is none at this scale.
+static int _dirty_align(const float scale)
+{
+  const float inv = 1.0f/scale;
+  // 1/n: every output multiple of the alignment is n of them in the input
+  if(fabsf(inv - roundf(inv)) <= 1e-4f*inv) return DT_DEV_PIXELPIPE_DIRTY_ALIGN;
+  // n: output multiples of n times the alignment
+  if(fabsf(scale - roundf(scale)) <= 1e-4f*scale) return DT_DEV_PIXELPIPE_DIRTY_ALIGN*(int)roundf(scale);
+  return 0;
+}
+
+// see dt_dev_pixelpipe_dirty_region(), support is the sum of the filter sizes of all modules.
+static int _dirty_region(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const dt_iop_roi_t *roi, dt_iop_roi_t *dirty, int *support)
+{
+  // preview and export pipes are done in one go, the histograms want the whole image anyways.
+  if(pipe->type != DT_DEV_PIXELPIPE_FULL || pipe->cache_obsolete) return 0;
+  // at other scales the part would be resampled on another grid than the full run, and show seams.
+  const int a = _dirty_align(roi->scale);
+  if(!a) return 0;
+  dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+  const int same_roi = pipe->backbuf && pipe->backbuf_roi.x == roi->x && pipe->backbuf_roi.y == roi->y &&
+                       pipe->backbuf_roi.width == roi->width && pipe->backbuf_roi.height == roi->height &&
+                       pipe->backbuf_roi.scale == roi->scale;
+  dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+  if(!same_roi) return 0;
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  const int n = g_list_length(pipe->nodes);
+  dt_iop_roi_t *rois = (dt_iop_roi_t *)malloc(sizeof(dt_iop_roi_t)*2*n);
+  if(!rois)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 0;
+  }
+
+  // 1) roi in and out of every piece in the last run, from the end as dt_dev_pixelpipe_process_rec() does.
+  dt_iop_roi_t r = *roi;
+  GList *nodes = g_list_last(pipe->nodes);
+  for(int k=n-1; nodes; k--)
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    rois[2*k+1] = rois[2*k] = r;
+    if(_piece_enabled(dev, piece)) piece->module->modify_roi_in(piece->module, piece, rois + 2*k+1, rois + 2*k);
+    r = rois[2*k];
+    nodes = g_list_previous(nodes);
+  }
+
+  // 2) find the one piece which changed since, and carry what it says about it down the pipe.
+  int found = 0, ok = 1;
+  int d[4] = { 0 };
+  *support = 0;
+  nodes = pipe->nodes;
+  for(int k=0; nodes && ok; k++, nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    dt_iop_module_t *module = piece->module;
+    const int enabled = _piece_enabled(dev, piece);
+    if(enabled != piece->processed_enabled) ok = 0;
+    if(!enabled || !ok) continue;
+    // color pickers want the whole buffer, blurred masks reach arbitrarily far.
+    const dt_develop_blend_params_t *bp = (const dt_develop_blend_params_t *)piece->blendop_data;
+    if(module->request_color_pick || (bp && bp->mode != DEVELOP_BLEND_DISABLED && fabsf(bp->radius) >= 0.1f))
+    {
+      ok = 0;
+      continue;
+    }
+    const dt_iop_roi_t *roi_in = rois + 2*k, *roi_out = rois + 2*k+1;
+    dt_develop_tiling_t tiling = { 0 };
+    module->tiling_callback(module, piece, roi_in, roi_out, &tiling);
+    *support += tiling.overlap;
+
+    if(piece->hash != piece->processed_hash)
+    {
+      float box[4];
+      if(found || !module->dirty_region || !piece->params || !piece->processed_params ||
+         !module->dirty_region(module, piece, piece->processed_params, piece->params, box))
+      {
+        ok = 0;
+        continue;
+      }
+      for(int c=0; c<4; c++) box[c] = CLAMPS(box[c], 0.0f, 1.0f);
+      const float sx = piece->buf_out.width*roi_out->scale, sy = piece->buf_out.height*roi_out->scale;
+      d[0] = MAX(roi_out->x, (int)floorf(box[0]*sx));
+      d[1] = MAX(roi_out->y, (int)floorf(box[1]*sy));
+      d[2] = MIN(roi_out->x + roi_out->width,  (int)ceilf(box[2]*sx));
+      d[3] = MIN(roi_out->y + roi_out->height, (int)ceilf(box[3]*sy));
+      found = 1;
+    }
+    // modules which can't be tiled might look at the whole roi (gamma is only the display encoding).
+    else if(!(module->flags() & IOP_FLAGS_ALLOW_TILING) && strcmp(module->op, "gamma")) ok = 0;
+    else if(found) _dirty_propagate(piece, roi_in, roi_out, tiling.overlap, d);
+  }
+  free(rois);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  if(!ok || !found) return 0;
+
+  // 3) some room around it, aligned to keep mosaic patterns and downscaling in step with the full run.
+  const int m = DT_DEV_PIXELPIPE_DIRTY_MARGIN;
+  const int x0 = MAX(roi->x, (MAX(0, d[0] - m)/a)*a), y0 = MAX(roi->y, (MAX(0, d[1] - m)/a)*a);
+  const int x1 = MIN(roi->x + roi->width,  ((d[2] + m + a - 1)/a)*a);
+  const int y1 = MIN(roi->y + roi->height, ((d[3] + m + a - 1)/a)*a);
+  *dirty = (dt_iop_roi_t)
+  {
+    x0, y0, 0, 0, roi->scale
+  };
+  if(d[0] >= d[2] || d[1] >= d[3] || x0 >= x1 || y0 >= y1) return 1; // nothing to see of it
+  // not worth it for large parts of the image:
+  if(2*(size_t)(x1 - x0)*(y1 - y0) > (size_t)roi->width*roi->height) return 0;
+  dirty->width  = x1 - x0;
+  dirty->height = y1 - y0;
+  *support = ((*support + m + a - 1)/a)*a;
+  return 1;
+}
+
+int dt_dev_pixelpipe_dirty_region(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const dt_iop_roi_t *roi, dt_iop_roi_t *dirty)
+{
+  int support;
+  return _dirty_region(pipe, dev, roi, dirty, &support);
+}
+
+static int _pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width, int height, float scale);
+
+// recompute only the dirty part of the backbuf, and patch it into a copy of the last image.
+static int _pixelpipe_process_dirty(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const dt_iop_roi_t *roi,
+                                    const dt_iop_roi_t *dirty, const int support)
+{
+  // the part which changed is out of view, the last image is still good.
+  if(dirty->width <= 0 || dirty->height <= 0) return 0;
+
+  // the cache line of the last image will be reused on the way, keep a copy.
+  dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+  const int bpp = pipe->backbuf_bpp;
+  const size_t size = (size_t)bpp*roi->width*roi->height;
+  uint8_t *img = (uint8_t *)dt_alloc_align(64, size);
+  if(img) memcpy(img, pipe->backbuf, size);
+  dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+  if(!img) return _pixelpipe_process(pipe, dev, roi->x, roi->y, roi->width, roi->height, roi->scale);
+
+  // process a bit more than we copy, so filters which don't ask for their full support are
+  // only off at the border of the part we throw away.
+  const int x0 = MAX(roi->x, dirty->x - support), y0 = MAX(roi->y, dirty->y - support);
+  const int x1 = MIN(roi->x + roi->width,  dirty->x + dirty->width  + support);
+  const int y1 = MIN(roi->y + roi->height, dirty->y + dirty->height + support);
+  if(_pixelpipe_process(pipe, dev, x0, y0, x1 - x0, y1 - y0, roi->scale))
+  {
+    free(img);
+    return 1;
+  }
+  dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+  for(int j=0; j<dirty->height; j++)
+    memcpy(img + bpp*((size_t)(dirty->y - roi->y + j)*roi->width + dirty->x - roi->x),
+           pipe->backbuf + bpp*((size_t)(dirty->y - y0 + j)*(x1 - x0) + dirty->x - x0), (size_t)bpp*dirty->width);
+  dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+
+  // put the patched image where a full run would have left it
+  void *buf = NULL;
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  const uint64_t hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, roi, pipe, g_list_length(dev->iop));
+  (void) dt_dev_pixelpipe_cache_get_important(&(pipe->cache), hash, size, &buf);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  memcpy(buf, img, size);
+  free(img);
+
+  dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+  pipe->backbuf_hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, roi, pipe, 0);
+  pipe->backbuf = buf;
+  pipe->backbuf_width  = roi->width;
+  pipe->backbuf_height = roi->height;
+  pipe->backbuf_roi = *roi;
+  dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+  dt_print(DT_DEBUG_DEV, "[pixelpipe_process] [%s] recomputed %dx%d of %dx%d\n", _pipe_type_to_str(pipe->type),
+           dirty->width, dirty->height, roi->width, roi->height);
+  return 0;
+}
 
 int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width, int height, float scale)
+{
+  const dt_iop_roi_t roi = (dt_iop_roi_t)
+  {
+    x, y, width, height, scale
+  };
+  const double start = dt_trace_enabled() ? dt_get_wtime() : 0.0;
+  dt_iop_roi_t dirty;
+  int support, ret;
+  // a local edit since the last image, only recompute what it touched?
+  const int local = _dirty_region(pipe, dev, &roi, &dirty, &support);
+  if(local)
+    ret = _pixelpipe_process_dirty(pipe, dev, &roi, &dirty, support);
+  else
+    ret = _pixelpipe_process(pipe, dev, x, y, width, height, scale);
+  if(dt_trace_enabled())
+    dt_trace_span("pixelpipe", _pipe_type_to_str(pipe->type), start, dt_get_wtime(),
+                  "\"x\": %d, \"y\": %d, \"width\": %d, \"height\": %d, \"scale\": %g, \"dirty_region\": %d, \"aborted\": %d",
+                  x, y, width, height, scale, local, ret);
+  return ret;
+}
+
+static int _pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width, int height, float scale)
 {
   pipe->processing = 1;
   pipe->opencl_enabled = dt_opencl_update_enabled(); // update enabled flag from preferences
@@ -1582,7 +1999,10 @@ restart:
   pipe->backbuf = buf;
   pipe->backbuf_width  = width;
   pipe->backbuf_height = height;
+  pipe->backbuf_roi = roi;
+  pipe->backbuf_bpp = out_bpp;
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+  _pixelpipe_snapshot(pipe, dev);
 
   // printf("pixelpipe homebrew process end\n");
   pipe->processing = 0;
@@ -1594,6 +2014,17 @@ void dt_dev_pixelpipe_flush_caches(dt_dev_pixelpipe_t *pipe)
   dt_dev_pixelpipe_cache_flush(&pipe->cache);
 }
 
+void dt_dev_pixelpipe_clear_stats(dt_dev_pixelpipe_t *pipe)
+{
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    memset(&piece->stats, 0, sizeof(piece->stats));
+  }
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+}
+
 void dt_dev_pixelpipe_get_dimensions(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int width_in, int height_in, int *width, int *height)
 {
   dt_pthread_mutex_lock(&pipe->busy_mutex);
@@ -22,6 +22,8 @@
 #include "develop/imageop.h"
 #include "develop/develop.h"
 #include "develop/pixelpipe_cache.h"
+#include "develop/pixelpipe_scratch.h"
+#include "develop/pixelpipe_picker.h"
 
 /**
  * struct used by iop modules to connect to pixelpipe.
@@ -39,6 +41,19 @@ typedef struct dt_iop_roi_t
 }
 dt_iop_roi_t;
 
+/** what the pipe did with a piece, summed up over all runs since the piece was created
+ * or the stats were cleared. process() taken from the cache does not count. */
+typedef struct dt_dev_pixelpipe_iop_stats_t
+{
+  int runs;                        // how often process() (or process_cl()) ran
+  double wall, user;               // seconds spent in it, including blending
+  int tiled;                       // how many of the runs went through the tiling code
+  int tiles_x, tiles_y;            // tiles of the last run, 0 if it was processed in one piece
+  float tiling_factor;             // memory requirement reported by the last tiling_callback()
+  size_t tiling_overhead;
+}
+dt_dev_pixelpipe_iop_stats_t;
+
 typedef struct dt_dev_pixelpipe_iop_t
 {
   struct dt_iop_module_t *module;  // the module in the dev operation stack
@@ -49,11 +64,17 @@ typedef struct dt_dev_pixelpipe_iop_t
   float iscale;                    // input actually just downscaled buffer? iscale*iwidth = actual width
   int iwidth, iheight;             // width and height of input buffer
   uint64_t hash;                   // hash of params and enabled.
+  uint64_t commit_hash;            // hash of everything commit_params last saw, 0 if unknown.
   int bpc;                         // bits per channel, 32 means float
   int colors;                      // how many colors per pixel
   dt_iop_roi_t buf_in, buf_out;    // theoretical full buffer regions of interest, as passed through modify_roi_out
   int process_cl_ready;            // set this to 0 in commit_params to temporarily disable the use of process_cl
   float processed_maximum[3];      // sensor saturation after this iop, used internally for caching
+  void *params;                    // copy of the committed params, only kept for modules with dirty_region()
+  void *processed_params;          // params, hash and enabled state of the last run which ended up
+  uint64_t processed_hash;         // in the backbuf, see dt_dev_pixelpipe_dirty_region().
+  int processed_enabled;
+  dt_dev_pixelpipe_iop_stats_t stats;  // for profiling, see dt_dev_pixelpipe_clear_stats()
 }
 dt_dev_pixelpipe_iop_t;
 
@@ -86,6 +107,10 @@ typedef struct dt_dev_pixelpipe_t
 {
   // store history/zoom caches
   dt_dev_pixelpipe_cache_t cache;
+  // temporary buffers shared by the modules' process()
+  dt_dev_pixelpipe_scratch_t scratch;
+  // tables for the color picker on module input and output
+  dt_dev_pixelpipe_picker_t picker[2];
   // set to non-zero in order to obsolete old cache entries on next pixelpipe run
   int cache_obsolete;
   // input buffer
@@ -96,6 +121,8 @@ typedef struct dt_dev_pixelpipe_t
   int iflipped;
   // input actually just downscaled buffer? iscale*iwidth = actual width
   float iscale;
+  // if set, input is only decoded where the pipe asks for it
+  struct dt_imageio_region_t *input_region;
   // dimensions of processed buffer
   int processed_width, processed_height;
   // sensor saturation, propagated through the operations:
@@ -104,11 +131,18 @@ typedef struct dt_dev_pixelpipe_t
   GList *nodes;
   // event flag
   dt_dev_pixelpipe_change_t changed;
+  // lowest priority of the modules whose params changed since the last synch, everything from there on is obsolete.
+  int changed_priority;
+  // set by dt_dev_pixelpipe_piece_cancelled() when a module gave up on its output.
+  int cancelled;
   // backbuffer (output)
   uint8_t *backbuf;
   int backbuf_size;
   int backbuf_width, backbuf_height;
   uint64_t backbuf_hash;
+  // region of interest and bytes per pixel of the backbuf, width is 0 if there is none.
+  dt_iop_roi_t backbuf_roi;
+  int backbuf_bpp;
   dt_pthread_mutex_t backbuf_mutex, busy_mutex;
   // working?
   int processing;
@@ -146,6 +180,8 @@ int dt_dev_pixelpipe_init_thumbnail(dt_dev_pixelpipe_t *pipe, int32_t width, int
 int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, int32_t size, int32_t entries);
 // constructs a new input gegl_buffer from given RGB float array.
 void dt_dev_pixelpipe_set_input(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, float *input, int width, int height, float iscale);
+// uses the (not yet decoded) raw of the region as input, decodes the parts of it the pipe processes.
+void dt_dev_pixelpipe_set_input_region(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, struct dt_imageio_region_t *region);
 
 // returns the dimensions of the full image after processing.
 void dt_dev_pixelpipe_get_dimensions(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int width_in, int height_in, int *width, int *height);
@@ -155,6 +191,13 @@ void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe);
 
 // flushes all cached data. usefull if input pixels unexpectedly change.
 void dt_dev_pixelpipe_flush_caches(dt_dev_pixelpipe_t *pipe);
+// zeroes the timing and tiling stats of all pieces.
+void dt_dev_pixelpipe_clear_stats(dt_dev_pixelpipe_t *pipe);
+
+// cooperative cancellation: returns non-zero if the output piece is working on has become obsolete
+// (its params or anything before it changed, the roi moved, the pipe shuts down). process() and tiling
+// loops poll this once per block of rows or per kernel run and return early, the pipe discards the output.
+int dt_dev_pixelpipe_piece_cancelled(dt_dev_pixelpipe_iop_t *piece);
 
 // wrapper for cleanup_nodes, create_nodes, synch_all and synch_top, decides upon changed event which one to take on. also locks dev->history_mutex.
 void dt_dev_pixelpipe_change(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev);
@@ -166,9 +209,15 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, struct dt_develop_t
 void dt_dev_pixelpipe_synch_all(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev);
 // adjust gegl:nop output node according to history stack (history pop event)
 void dt_dev_pixelpipe_synch_top(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev);
+// like synch_all, but only commits params to pieces where params, blend params, enabled flag or image changed since the last call.
+void dt_dev_pixelpipe_synch_changed(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev);
 
 // process region of interest of pixels. returns 1 if pipe was altered during processing.
 int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int x, int y, int width, int height, float scale);
+// if the backbuf is for roi, and only modules changed since which can tell which part of their output
+// changed (and everything else in the pipe is local), returns 1 and the region of the output to recompute.
+// dt_dev_pixelpipe_process() then only processes that part and patches it into the last image.
+int dt_dev_pixelpipe_dirty_region(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, const dt_iop_roi_t *roi, dt_iop_roi_t *dirty);
 // convenience method that does not gamma-compress the image.
 int dt_dev_pixelpipe_process_no_gamma(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int x, int y, int width, int height, float scale);
 
@@ -0,0 +1,274 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2009--2010 johannes hanika.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/darktable.h"
+#include "develop/pixelpipe_picker.h"
+#include <stdlib.h>
+#include <string.h>
+#include <xmmintrin.h>
+
+void dt_dev_pixelpipe_picker_init(dt_dev_pixelpipe_picker_t *picker)
+{
+  memset(picker, 0, sizeof(dt_dev_pixelpipe_picker_t));
+}
+
+void dt_dev_pixelpipe_picker_cleanup(dt_dev_pixelpipe_picker_t *picker)
+{
+  free(picker->sum);
+  free(picker->minmax);
+  dt_dev_pixelpipe_picker_init(picker);
+}
+
+// go over all pixels of the box, rows are spread over the threads.
+static void _picker_reduce(const float *img, const int width, const int *box, float *mean, float *min, float *max)
+{
+  const int x0 = box[0], y0 = box[1], x1 = box[2], y1 = box[3];
+  const int nthreads = dt_get_num_threads();
+  // one cache line each per thread
+  double *psum = (double *)dt_alloc_align(64, sizeof(double)*8*nthreads);
+  float *pminmax = (float *)dt_alloc_align(64, sizeof(float)*16*nthreads);
+  for(int t=0; t<nthreads; t++)
+  {
+    for(int k=0; k<8; k++) psum[8*t+k] = 0.0;
+    for(int k=0; k<4; k++) pminmax[16*t+k]   =  666.0f;
+    for(int k=0; k<4; k++) pminmax[16*t+4+k] = -666.0f;
+  }
+
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(img, psum, pminmax) schedule(static)
+#endif
+  for(int j=y0; j<=y1; j++)
+  {
+    const int t = dt_get_thread_num();
+    __m128 sum = _mm_setzero_ps();
+    __m128 mn = _mm_load_ps(pminmax + 16*t);
+    __m128 mx = _mm_load_ps(pminmax + 16*t + 4);
+    const float *p = img + 4*((size_t)j*width + x0);
+    for(int i=x0; i<=x1; i++, p+=4)
+    {
+      const __m128 v = _mm_load_ps(p);
+      sum = _mm_add_ps(sum, v);
+      // nan in v keeps the old value, as fminf/fmaxf would
+      mn = _mm_min_ps(v, mn);
+      mx = _mm_max_ps(v, mx);
+    }
+    _mm_store_ps(pminmax + 16*t, mn);
+    _mm_store_ps(pminmax + 16*t + 4, mx);
+    float s[4] __attribute__((aligned(16)));
+    _mm_store_ps(s, sum);
+    for(int k=0; k<3; k++) psum[8*t+k] += s[k];
+  }
+
+  const double w = 1.0/((double)(x1-x0+1)*(y1-y0+1));
+  for(int k=0; k<3; k++)
+  {
+    double s = 0.0;
+    min[k] =  666.0f;
+    max[k] = -666.0f;
+    for(int t=0; t<nthreads; t++)
+    {
+      s += psum[8*t+k];
+      min[k] = fminf(min[k], pminmax[16*t+k]);
+      max[k] = fmaxf(max[k], pminmax[16*t+4+k]);
+    }
+    mean[k] = s*w;
+  }
+  free(psum);
+  free(pminmax);
+}
+
+static int _picker_build(dt_dev_pixelpipe_picker_t *picker, const float *img)
+{
+  const int width = picker->width, height = picker->height;
+
+  // pyramid layout: halve until a single node is left
+  int levels = 1;
+  size_t nodes = 0;
+  picker->level_width[0] = width;
+  picker->level_height[0] = height;
+  while(picker->level_width[levels-1] > 1 || picker->level_height[levels-1] > 1)
+  {
+    if(levels == DT_DEV_PIXELPIPE_PICKER_MAX_LEVELS) return 0;
+    picker->level_width[levels]  = (picker->level_width[levels-1] + 1)/2;
+    picker->level_height[levels] = (picker->level_height[levels-1] + 1)/2;
+    picker->level_offset[levels] = nodes;
+    nodes += (size_t)picker->level_width[levels]*picker->level_height[levels];
+    levels++;
+  }
+  picker->levels = levels;
+
+  const size_t sum_size = sizeof(double)*3*(size_t)(width+1)*(height+1);
+  const size_t minmax_size = sizeof(float)*8*MAX(nodes, 1);
+  if(picker->sum_size < sum_size)
+  {
+    free(picker->sum);
+    picker->sum = (double *)dt_alloc_align(64, sum_size);
+    picker->sum_size = picker->sum ? sum_size : 0;
+  }
+  if(picker->minmax_size < minmax_size)
+  {
+    free(picker->minmax);
+    picker->minmax = (float *)dt_alloc_align(64, minmax_size);
+    picker->minmax_size = picker->minmax ? minmax_size : 0;
+  }
+  if(!picker->sum || !picker->minmax) return 0;
+
+  // summed area table: prefix sums along the rows, then down the columns
+  double *sum = picker->sum;
+  const size_t stride = 3*(size_t)(width+1);
+  memset(sum, 0, sizeof(double)*stride);
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(img, sum) schedule(static)
+#endif
+  for(int j=0; j<height; j++)
+  {
+    double *s = sum + stride*(j+1);
+    const float *p = img + 4*(size_t)j*width;
+    double r[3] = { 0.0, 0.0, 0.0 };
+    s[0] = s[1] = s[2] = 0.0;
+    for(int i=0; i<width; i++, p+=4)
+      for(int k=0; k<3; k++) s[3*(i+1)+k] = (r[k] += p[k]);
+  }
+  // columns in chunks, so every thread walks down contiguous pieces of the rows
+  const int chunk = 64;
+  const int chunks = (width + chunk)/chunk;
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(sum) schedule(static)
+#endif
+  for(int c=0; c<chunks; c++)
+  {
+    const size_t i0 = 3*(size_t)c*chunk, i1 = MIN(3*(size_t)(c+1)*chunk, stride);
+    for(int j=2; j<=height; j++)
+    {
+      double *s = sum + stride*j;
+      const double *u = s - stride;
+      for(size_t i=i0; i<i1; i++) s[i] += u[i];
+    }
+  }
+
+  // min/max pyramid, level 1 from the pixels, then every level from the one below
+  for(int l=1; l<levels; l++)
+  {
+    float *out = picker->minmax + 8*picker->level_offset[l];
+    const float *below = l > 1 ? picker->minmax + 8*picker->level_offset[l-1] : img;
+    const int bw = picker->level_width[l-1], bh = picker->level_height[l-1];
+    const int lw = picker->level_width[l], lh = picker->level_height[l];
+    // pixels have min == max and no second half
+    const int bstride = l > 1 ? 8 : 4, boff = l > 1 ? 4 : 0;
+#ifdef _OPENMP
+    #pragma omp parallel for default(none) shared(out, below) schedule(static)
+#endif
+    for(int y=0; y<lh; y++)
+    {
+      for(int x=0; x<lw; x++)
+      {
+        __m128 mn = _mm_set1_ps( 666.0f);
+        __m128 mx = _mm_set1_ps(-666.0f);
+        for(int cy=2*y; cy<=MIN(2*y+1, bh-1); cy++)
+          for(int cx=2*x; cx<=MIN(2*x+1, bw-1); cx++)
+          {
+            const float *b = below + bstride*((size_t)cy*bw + cx);
+            mn = _mm_min_ps(_mm_load_ps(b), mn);
+            mx = _mm_max_ps(_mm_load_ps(b + boff), mx);
+          }
+        _mm_store_ps(out + 8*((size_t)y*lw + x), mn);
+        _mm_store_ps(out + 8*((size_t)y*lw + x) + 4, mx);
+      }
+    }
+  }
+  return 1;
+}
+
+// descend from node x,y of level l into the parts that are cut by the box, take the rest as a whole.
+static void _picker_pyramid(const dt_dev_pixelpipe_picker_t *picker, const float *img, const int l,
+                            const int x, const int y, const int *box, __m128 *mn, __m128 *mx)
+{
+  const int x0 = x << l, y0 = y << l;
+  const int x1 = MIN(((x+1) << l) - 1, picker->width-1), y1 = MIN(((y+1) << l) - 1, picker->height-1);
+  if(x0 > box[2] || x1 < box[0] || y0 > box[3] || y1 < box[1]) return;
+  if(x0 >= box[0] && x1 <= box[2] && y0 >= box[1] && y1 <= box[3])
+  {
+    if(l == 0)
+    {
+      const __m128 v = _mm_load_ps(img + 4*((size_t)y*picker->width + x));
+      *mn = _mm_min_ps(v, *mn);
+      *mx = _mm_max_ps(v, *mx);
+    }
+    else
+    {
+      const float *node = picker->minmax + 8*(picker->level_offset[l] + (size_t)y*picker->level_width[l] + x);
+      *mn = _mm_min_ps(_mm_load_ps(node), *mn);
+      *mx = _mm_max_ps(_mm_load_ps(node + 4), *mx);
+    }
+    return;
+  }
+  // partly covered, so l > 0: single pixels are either in or out.
+  for(int cy=2*y; cy<=MIN(2*y+1, picker->level_height[l-1]-1); cy++)
+    for(int cx=2*x; cx<=MIN(2*x+1, picker->level_width[l-1]-1); cx++)
+      _picker_pyramid(picker, img, l-1, cx, cy, box, mn, mx);
+}
+
+static void _picker_query(const dt_dev_pixelpipe_picker_t *picker, const float *img, const int *box,
+                          float *mean, float *min, float *max)
+{
+  const size_t stride = 3*(size_t)(picker->width+1);
+  const double *s00 = picker->sum + stride*box[1]     + 3*box[0];
+  const double *s01 = picker->sum + stride*box[1]     + 3*(box[2]+1);
+  const double *s10 = picker->sum + stride*(box[3]+1) + 3*box[0];
+  const double *s11 = picker->sum + stride*(box[3]+1) + 3*(box[2]+1);
+  const double w = 1.0/((double)(box[2]-box[0]+1)*(box[3]-box[1]+1));
+  for(int k=0; k<3; k++) mean[k] = (s11[k] - s10[k] - s01[k] + s00[k])*w;
+
+  __m128 mn = _mm_set1_ps( 666.0f);
+  __m128 mx = _mm_set1_ps(-666.0f);
+  _picker_pyramid(picker, img, picker->levels-1, 0, 0, box, &mn, &mx);
+  float m[4] __attribute__((aligned(16)));
+  _mm_store_ps(m, mn);
+  for(int k=0; k<3; k++) min[k] = m[k];
+  _mm_store_ps(m, mx);
+  for(int k=0; k<3; k++) max[k] = m[k];
+}
+
+void dt_dev_pixelpipe_picker_box(dt_dev_pixelpipe_picker_t *picker, const uint64_t hash, const float *img,
+                                 const int width, const int height, const int *box,
+                                 float *mean, float *min, float *max)
+{
+  if(picker && picker->valid && picker->hash == hash && picker->width == width && picker->height == height)
+  {
+    // second pick from the same buffer: the box is being moved around, worth building the tables.
+    if(!picker->built) picker->built = _picker_build(picker, img);
+    if(picker->built)
+    {
+      _picker_query(picker, img, box, mean, min, max);
+      return;
+    }
+  }
+  else if(picker)
+  {
+    picker->valid = 1;
+    picker->built = 0;
+    picker->hash = hash;
+    picker->width = width;
+    picker->height = height;
+  }
+  _picker_reduce(img, width, box, mean, min, max);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
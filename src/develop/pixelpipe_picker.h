@@ -0,0 +1,66 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2009--2010 johannes hanika.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_PIXELPIPE_PICKER_H
+#define DT_PIXELPIPE_PICKER_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#define DT_DEV_PIXELPIPE_PICKER_MAX_LEVELS 32
+
+/**
+ * mean, min and max of a color picker box over a 4 channel float buffer.
+ * while the user drags the box around, the module's input comes out of the
+ * pipe cache unchanged. if the same buffer (as identified by its hash) is
+ * picked from twice, a summed area table and a min/max pyramid are built for
+ * it, and every further box on that buffer is answered from these without
+ * going over all the pixels again.
+ */
+typedef struct dt_dev_pixelpipe_picker_t
+{
+  int valid;            // hash is set
+  int built;            // tables are filled for hash
+  uint64_t hash;        // of the last buffer picked from
+  int width, height;
+
+  // (width+1)*(height+1) sums of channels 0..2, in double to survive the differences
+  double *sum;
+  size_t sum_size;
+
+  // levels 1..levels-1 of min and max (4 floats each) over 2^l x 2^l blocks.
+  // level 0 is the buffer itself.
+  int levels;
+  int level_width[DT_DEV_PIXELPIPE_PICKER_MAX_LEVELS], level_height[DT_DEV_PIXELPIPE_PICKER_MAX_LEVELS];
+  size_t level_offset[DT_DEV_PIXELPIPE_PICKER_MAX_LEVELS];
+  float *minmax;
+  size_t minmax_size;
+}
+dt_dev_pixelpipe_picker_t;
+
+void dt_dev_pixelpipe_picker_init(dt_dev_pixelpipe_picker_t *picker);
+void dt_dev_pixelpipe_picker_cleanup(dt_dev_pixelpipe_picker_t *picker);
+/** mean, min and max of channels 0..2 of img over box x0,y0,x1,y1 (inclusive, inside the buffer).
+ * hash identifies the contents of img, pass picker == NULL to always go over the pixels. */
+void dt_dev_pixelpipe_picker_box(dt_dev_pixelpipe_picker_t *picker, const uint64_t hash, const float *img,
+                                 const int width, const int height, const int *box,
+                                 float *mean, float *min, float *max);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,75 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2009--2010 johannes hanika.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/darktable.h"
+#include "develop/pixelpipe_scratch.h"
+#include <stdlib.h>
+#include <string.h>
+
+void dt_dev_pixelpipe_scratch_init(dt_dev_pixelpipe_scratch_t *scratch)
+{
+  scratch->entries = 0;
+  scratch->data = NULL;
+  scratch->size = NULL;
+}
+
+void dt_dev_pixelpipe_scratch_flush(dt_dev_pixelpipe_scratch_t *scratch)
+{
+  for(int k=0; k<scratch->entries; k++)
+  {
+    free(scratch->data[k]);
+    scratch->data[k] = NULL;
+    scratch->size[k] = 0;
+  }
+}
+
+void dt_dev_pixelpipe_scratch_cleanup(dt_dev_pixelpipe_scratch_t *scratch)
+{
+  dt_dev_pixelpipe_scratch_flush(scratch);
+  free(scratch->data);
+  free(scratch->size);
+  dt_dev_pixelpipe_scratch_init(scratch);
+}
+
+void *dt_dev_pixelpipe_scratch_get(dt_dev_pixelpipe_scratch_t *scratch, const int k, const size_t size)
+{
+  if(k >= scratch->entries)
+  {
+    void **data = (void **)realloc(scratch->data, sizeof(void *)*(k+1));
+    if(!data) return NULL;
+    scratch->data = data;
+    size_t *sz = (size_t *)realloc(scratch->size, sizeof(size_t)*(k+1));
+    if(!sz) return NULL;
+    scratch->size = sz;
+    memset(scratch->data + scratch->entries, 0, sizeof(void *)*(k+1-scratch->entries));
+    memset(scratch->size + scratch->entries, 0, sizeof(size_t)*(k+1-scratch->entries));
+    scratch->entries = k+1;
+  }
+  if(scratch->size[k] < size)
+  {
+    // old contents don't need to survive, so no realloc:
+    free(scratch->data[k]);
+    scratch->data[k] = dt_alloc_align(64, size);
+    scratch->size[k] = scratch->data[k] ? size : 0;
+  }
+  return scratch->data[k];
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
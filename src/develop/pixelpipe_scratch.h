@@ -0,0 +1,48 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2009--2010 johannes hanika.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_PIXELPIPE_SCRATCH_H
+#define DT_PIXELPIPE_SCRATCH_H
+
+#include <stddef.h>
+/**
+ * per pipe arena of temporary buffers for the cpu process() of modules.
+ * modules of one pipe run one after the other, so they can all share the same
+ * buffers. these only ever grow to the largest roi seen and are kept until the
+ * pipe is cleaned up, which saves fresh allocations (and page faults on touching
+ * them) on every run while the user drags a slider.
+ */
+typedef struct dt_dev_pixelpipe_scratch_t
+{
+  int     entries;  // number of buffers handed out so far
+  void  **data;     // 64 byte aligned buffers
+  size_t *size;     // and their sizes in bytes
+}
+dt_dev_pixelpipe_scratch_t;
+
+void dt_dev_pixelpipe_scratch_init(dt_dev_pixelpipe_scratch_t *scratch);
+void dt_dev_pixelpipe_scratch_cleanup(dt_dev_pixelpipe_scratch_t *scratch);
+/** returns scratch buffer number k of at least size bytes, or NULL if out of memory.
+ * contents are undefined and only valid until the next module runs. do not free it. */
+void *dt_dev_pixelpipe_scratch_get(dt_dev_pixelpipe_scratch_t *scratch, const int k, const size_t size);
+/** gives all buffers back to the system, the next get will allocate again. */
+void dt_dev_pixelpipe_scratch_flush(dt_dev_pixelpipe_scratch_t *scratch);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -695,6 +695,8 @@ _default_process_tiling_ptp (struct dt_iop_module_t *self, struct dt_dev_pixelpi
 
 
   dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] use tiling on module '%s' for image with full size %d x %d\n", self->op, roi_in->width, roi_in->height);
+  piece->stats.tiles_x = tiles_x;
+  piece->stats.tiles_y = tiles_y;
   dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] (%d x %d) tiles with max dimensions %d x %d and overlap %d\n", tiles_x, tiles_y, width, height, overlap);
 
   /* reserve input and output buffers for tiles */
@@ -724,6 +726,9 @@ _default_process_tiling_ptp (struct dt_iop_module_t *self, struct dt_dev_pixelpi
     {
       piece->pipe->tiling = 1;
 
+      /* output became obsolete, the pipe discards it anyways */
+      if(dt_dev_pixelpipe_piece_cancelled(piece)) goto cancelled;
+
       size_t wd = tx * tile_wd + width > roi_in->width  ? roi_in->width - tx * tile_wd : width;
       size_t ht = ty * tile_ht + height > roi_in->height ? roi_in->height- ty * tile_ht : height;
 
@@ -792,6 +797,7 @@ _default_process_tiling_ptp (struct dt_iop_module_t *self, struct dt_dev_pixelpi
         memcpy((char *)ovoid+ooffs+j*opitch, (char *)output+((j+origin[1])*wd+origin[0])*out_bpp, region[0]*out_bpp);
     }
 
+cancelled:
   /* copy back final processed_maximum */
   for(int k=0; k<3; k++)
     piece->pipe->processed_maximum[k] = processed_maximum_new[k];
@@ -809,6 +815,7 @@ fallback:
   if(input != NULL) free(input);
   if(output != NULL) free(output);
   piece->pipe->tiling = 0;
+  piece->stats.tiles_x = piece->stats.tiles_y = 0;
   dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] fall back to standard processing for module '%s'\n", self->op);
   self->process(self, piece, ivoid, ovoid, roi_in, roi_out);
   return;
@@ -940,6 +947,8 @@ _default_process_tiling_roi (struct dt_iop_module_t *self, struct dt_dev_pixelpi
   const int tile_ht = _align_up(roi_out->height % tiles_y == 0 ? roi_out->height / tiles_y : roi_out->height / tiles_y + 1, xyalign);
 
   dt_print(DT_DEBUG_DEV, "[default_process_tiling_roi] use tiling on module '%s' for image with full input size %d x %d\n", self->op, roi_in->width, roi_in->height);
+  piece->stats.tiles_x = tiles_x;
+  piece->stats.tiles_y = tiles_y;
   dt_print(DT_DEBUG_DEV, "[default_process_tiling_roi] (%d x %d) tiles with max dimensions %d x %d\n", tiles_x, tiles_y, width, height);
 
 
@@ -955,6 +964,9 @@ _default_process_tiling_roi (struct dt_iop_module_t *self, struct dt_dev_pixelpi
     {
       piece->pipe->tiling = 1;
 
+      /* output became obsolete, the pipe discards it anyways */
+      if(dt_dev_pixelpipe_piece_cancelled(piece)) goto cancelled;
+
       /* the output dimensions of the good part of this specific tile */
       size_t wd = (tx + 1) * tile_wd > roi_out->width  ? roi_out->width - tx * tile_wd : tile_wd;
       size_t ht = (ty + 1) * tile_ht > roi_out->height ? roi_out->height- ty * tile_ht : tile_ht;
@@ -1088,6 +1100,7 @@ _default_process_tiling_roi (struct dt_iop_module_t *self, struct dt_dev_pixelpi
       input = output = NULL;
     }
 
+cancelled:
   /* copy back final processed_maximum */
   for(int k=0; k<3; k++)
     piece->pipe->processed_maximum[k] = processed_maximum_new[k];
@@ -1105,6 +1118,7 @@ fallback:
   if(input != NULL) free(input);
   if(output != NULL) free(output);
   piece->pipe->tiling = 0;
+  piece->stats.tiles_x = piece->stats.tiles_y = 0;
   dt_print(DT_DEBUG_DEV, "[default_process_tiling_roi] fall back to standard processing for module '%s'\n", self->op);
   self->process(self, piece, ivoid, ovoid, roi_in, roi_out);
   return;
@@ -1229,6 +1243,8 @@ _default_process_tiling_cl_ptp (struct dt_iop_module_t *self, struct dt_dev_pixe
 
 
   dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_ptp] use tiling on module '%s' for image with full size %d x %d\n", self->op, roi_in->width, roi_in->height);
+  piece->stats.tiles_x = tiles_x;
+  piece->stats.tiles_y = tiles_y;
   dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_ptp] (%d x %d) tiles with max dimensions %d x %d and overlap %d\n", tiles_x, tiles_y, width, height, overlap);
 
 
@@ -1245,6 +1261,9 @@ _default_process_tiling_cl_ptp (struct dt_iop_module_t *self, struct dt_dev_pixe
     {
       piece->pipe->tiling = 1;
 
+      /* output became obsolete, the pipe discards it anyways */
+      if(dt_dev_pixelpipe_piece_cancelled(piece)) goto error;
+
       size_t wd = tx * tile_wd + width > roi_in->width  ? roi_in->width - tx * tile_wd : width;
       size_t ht = ty * tile_ht + height > roi_in->height ? roi_in->height- ty * tile_ht : height;
 
@@ -1341,6 +1360,7 @@ error:
   if(input != NULL) dt_opencl_release_mem_object(input);
   if(output != NULL) dt_opencl_release_mem_object(output);
   piece->pipe->tiling = 0;
+  piece->stats.tiles_x = piece->stats.tiles_y = 0;
   dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_opencl_ptp] couldn't run process_cl() for module '%s' in tiling mode: %d\n", self->op, err);
   return FALSE;
 }
@@ -1460,6 +1480,8 @@ _default_process_tiling_cl_roi (struct dt_iop_module_t *self, struct dt_dev_pixe
 
 
   dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_roi] use tiling on module '%s' for image with full input size %d x %d\n", self->op, roi_in->width, roi_in->height);
+  piece->stats.tiles_x = tiles_x;
+  piece->stats.tiles_y = tiles_y;
   dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_roi] (%d x %d) tiles with max input dimensions %d x %d\n", tiles_x, tiles_y, width, height);
 
 
@@ -1476,6 +1498,9 @@ _default_process_tiling_cl_roi (struct dt_iop_module_t *self, struct dt_dev_pixe
     {
       piece->pipe->tiling = 1;
 
+      /* output became obsolete, the pipe discards it anyways */
+      if(dt_dev_pixelpipe_piece_cancelled(piece)) goto error;
+
       /* the output dimensions of the good part of this specific tile */
       size_t wd = (tx + 1) * tile_wd > roi_out->width  ? roi_out->width - tx * tile_wd : tile_wd;
       size_t ht = (ty + 1) * tile_ht > roi_out->height ? roi_out->height- ty * tile_ht : tile_ht;
@@ -1623,6 +1648,7 @@ error:
   if(input != NULL) dt_opencl_release_mem_object(input);
   if(output != NULL) dt_opencl_release_mem_object(output);
   piece->pipe->tiling = 0;
+  piece->stats.tiles_x = piece->stats.tiles_y = 0;
   dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_opencl_roi] couldn't run process_cl() for module '%s' in tiling mode: %d\n", self->op, err);
   return FALSE;
 }
@@ -39,6 +39,10 @@ DngDecoder::DngDecoder(TiffIFD *rootIFD, FileMap* file) : RawDecoder(file), mRoo
     mFixLjpeg = true;
   else
     mFixLjpeg = false;
+  mLazy = false;
+  mLazyCompression = 0;
+  mLazyBps = 0;
+  mLazyBigEndian = false;
 }
 
 DngDecoder::~DngDecoder(void) {
@@ -112,6 +116,11 @@ RawImage DngDecoder::decodeRawInternal() {
 
   try {
     compression = raw->getEntry(COMPRESSION)->getShort();
+
+    // Only leave the pixels for later if nothing below needs to see all of them
+    mLazy = decodeLazily && mRaw->isCFA && sample_format == 1 && compression != 0x884c && !raw->hasEntry(LINEARIZATIONTABLE);
+    mLazyCompression = compression;
+
     if (mRaw->isCFA) {
 
       // Check if layout is OK, if present
@@ -205,16 +214,25 @@ RawImage DngDecoder::decodeRawInternal() {
 
         mRaw->createData();
 
+        bool big_endian = (raw->endian == big);
+        // DNG spec says that if not 8 or 16 bit/sample, always use big endian
+        if (bps != 8 && bps != 16)
+          big_endian = true;
+
+        if (mLazy) {
+          mLazyBps = bps;
+          mLazyBigEndian = big_endian;
+          for (uint32 i = 0; i < slices.size(); i++)
+            mLazySlices.push_back(DngLazySlice(slices[i].offset, slices[i].count, 0, slices[i].offsetY, width, slices[i].h));
+          slices.clear();
+        }
+
         for (uint32 i = 0; i < slices.size(); i++) {
           DngStrip slice = slices[i];
           ByteStream in(mFile->getData(slice.offset), slice.count);
           iPoint2D size(width, slice.h);
           iPoint2D pos(0, slice.offsetY);
 
-          bool big_endian = (raw->endian == big);
-          // DNG spec says that if not 8 or 16 bit/sample, always use big endian
-          if (bps != 8 && bps != 16)
-            big_endian = true;
           try {
             readUncompressedRaw(in, size, pos, mRaw->getCpp()* width * bps / 8, bps, big_endian ? BitOrder_Jpeg : BitOrder_Plain);
           } catch(IOException &ex) {
@@ -266,7 +284,12 @@ RawImage DngDecoder::decodeRawInternal() {
             for (uint32 x = 0; x < tilesX; x++) {
               DngSliceElement e(offsets[x+y*tilesX], counts[x+y*tilesX], tilew*x, tileh*y);
               e.mUseBigtable = tilew * tileh > 1024 * 1024;
-              slices.addSlice(e);
+              if (mLazy) {
+                DngLazySlice l(e.byteOffset, e.byteCount, e.offX, e.offY, tilew, tileh);
+                l.useBigtable = e.mUseBigtable;
+                mLazySlices.push_back(l);
+              } else
+                slices.addSlice(e);
             }
           }
         } else {  // Strips
@@ -290,18 +313,26 @@ RawImage DngDecoder::decodeRawInternal() {
             e.mUseBigtable = yPerSlice * mRaw->dim.y > 1024 * 1024;
             offY += yPerSlice;
 
-            if (mFile->isValid(e.byteOffset + e.byteCount)) // Only decode if size is valid
+            if (!mFile->isValid(e.byteOffset + e.byteCount)) // Only decode if size is valid
+              continue;
+            if (mLazy) {
+              DngLazySlice l(e.byteOffset, e.byteCount, 0, e.offY, mRaw->dim.x, yPerSlice);
+              l.useBigtable = e.mUseBigtable;
+              mLazySlices.push_back(l);
+            } else
               slices.addSlice(e);
           }
         }
-        uint32 nSlices = slices.size();
+        uint32 nSlices = mLazy ? mLazySlices.size() : slices.size();
         if (!nSlices)
           ThrowRDE("DNG Decoder: No valid slices found.");
 
-        slices.startDecoding();
+        if (!mLazy) {
+          slices.startDecoding();
 
-        if (mRaw->errors.size() >= nSlices)
-          ThrowRDE("DNG Decoding: Too many errors encountered. Giving up.\nFirst Error:%s", mRaw->errors[0]);
+          if (mRaw->errors.size() >= nSlices)
+            ThrowRDE("DNG Decoding: Too many errors encountered. Giving up.\nFirst Error:%s", mRaw->errors[0]);
+        }
       } catch (TiffParserException e) {
         ThrowRDE("DNG Decoder: Unsupported format, tried strips and tiles:\n%s", e.what());
       }
@@ -410,6 +441,24 @@ RawImage DngDecoder::decodeRawInternal() {
   // Set black
   setBlack(raw);
 
+  if (mLazy) {
+    iPoint2D full = mRaw->getUncroppedDim();
+    if ((mRaw->blackAreas.empty() && mRaw->blackLevelSeparate[0] < 0 && mRaw->blackLevel < 0) || mRaw->whitePoint >= 65536) {
+      // Black and white will be estimated from the whole image, so it is needed right away
+      decodeLazySlices(iRectangle2D(0, 0, full.x, full.y));
+      mLazy = false;
+    } else {
+      // Masked areas are needed to calculate the black levels
+      for (uint32 i = 0; i < mRaw->blackAreas.size(); i++) {
+        BlackArea &area = mRaw->blackAreas[i];
+        if (area.isVertical)
+          decodeLazySlices(iRectangle2D(area.offset, 0, area.size, full.y));
+        else
+          decodeLazySlices(iRectangle2D(0, area.offset, full.x, area.size));
+      }
+    }
+  }
+
   // Apply opcodes to lossy DNG 
   if (compression == 0x884c) {
     if (raw->hasEntry(OPCODELIST2))
@@ -433,6 +482,51 @@ RawImage DngDecoder::decodeRawInternal() {
   return mRaw;
 }
 
+void DngDecoder::decodeRegion(iRectangle2D area) {
+  if (!mLazy)
+    return;
+  area.offset(mRaw->getCropOffset());
+  decodeLazySlices(area);
+}
+
+/* Decodes all slices touching the area, in uncropped coordinates, that haven't been decoded yet */
+void DngDecoder::decodeLazySlices(iRectangle2D area) {
+  // Slices are positioned in the uncropped image, so undo the crop while writing them
+  iRectangle2D crop(mRaw->getCropOffset(), mRaw->dim);
+  mRaw->resetSubFrame();
+  try {
+    DngDecoderSlices slices(mFile, mRaw, mLazyCompression);
+    slices.mFixLjpeg = mFixLjpeg;
+    for (uint32 i = 0; i < mLazySlices.size(); i++) {
+      DngLazySlice &s = mLazySlices[i];
+      if (s.decoded || (int)s.offX >= area.getRight() || (int)(s.offX + s.w) <= area.getLeft() ||
+          (int)s.offY >= area.getBottom() || (int)(s.offY + s.h) <= area.getTop())
+        continue;
+      s.decoded = true;
+      if (mLazyCompression == 1) {
+        ByteStream in(mFile->getData(s.offset), s.count);
+        iPoint2D size(s.w, s.h);
+        iPoint2D pos(s.offX, s.offY);
+        try {
+          readUncompressedRaw(in, size, pos, mRaw->getCpp() * s.w * mLazyBps / 8, mLazyBps, mLazyBigEndian ? BitOrder_Jpeg : BitOrder_Plain);
+        } catch (IOException &ex) {
+          mRaw->setError(ex.what());
+        }
+      } else {
+        DngSliceElement e(s.offset, s.count, s.offX, s.offY);
+        e.mUseBigtable = s.useBigtable;
+        slices.addSlice(e);
+      }
+    }
+    if (slices.size())
+      slices.startDecoding();
+  } catch (...) {
+    mRaw->subFrame(crop);
+    throw;
+  }
+  mRaw->subFrame(crop);
+}
+
 void DngDecoder::decodeMetaDataInternal(CameraMetaData *meta) {
   if (mRootIFD->hasEntryRecursive(ISOSPEEDRATINGS))
     mRaw->isoSpeed = mRootIFD->getEntryRecursive(ISOSPEEDRATINGS)->getInt();
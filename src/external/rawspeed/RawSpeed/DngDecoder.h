@@ -29,6 +29,20 @@
 
 namespace RawSpeed {
 
+class DngLazySlice {
+public:
+  DngLazySlice(uint32 off, uint32 cnt, uint32 x, uint32 y, uint32 width, uint32 height) :
+      offset(off), count(cnt), offX(x), offY(y), w(width), h(height), useBigtable(false), decoded(false) {};
+  uint32 offset; // Offset in bytes
+  uint32 count;
+  uint32 offX;   // Position in the uncropped image
+  uint32 offY;
+  uint32 w;
+  uint32 h;
+  bool useBigtable;
+  bool decoded;
+};
+
 class DngDecoder : 
   public RawDecoder
 {
@@ -38,6 +52,8 @@ public:
   virtual RawImage decodeRawInternal();
   virtual void decodeMetaDataInternal(CameraMetaData *meta);
   virtual void checkSupportInternal(CameraMetaData *meta);
+  virtual void decodeRegion(iRectangle2D area);
+  virtual bool isDecodedLazily() { return mLazy; };
 protected:
   TiffIFD *mRootIFD;
   bool mFixLjpeg;
@@ -45,6 +61,13 @@ protected:
   bool decodeMaskedAreas(TiffIFD* raw);
   bool decodeBlackLevels(TiffIFD* raw);
   void setBlack(TiffIFD* raw);
+  void decodeLazySlices(iRectangle2D area);
+  /* Tiles or strips left to decodeRegion(), see RawDecoder::decodeLazily */
+  bool mLazy;
+  int mLazyCompression;
+  uint32 mLazyBps;
+  bool mLazyBigEndian;
+  vector<DngLazySlice> mLazySlices;
 };
 
 class DngStrip {
@@ -27,6 +27,7 @@ namespace RawSpeed {
 	RawDecoder::RawDecoder(FileMap* file) : mRaw(RawImage::create()), mFile(file) {
   decoderVersion = 0;
   failOnUnknown = FALSE;
+  decodeLazily = FALSE;
 }
 
 RawDecoder::~RawDecoder(void) {
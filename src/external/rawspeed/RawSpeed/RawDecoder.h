@@ -78,6 +78,13 @@ public:
   /* compensation is not expected to be applied to the image */
   void decodeMetaData(CameraMetaData *meta);
 
+  /* Decodes the pixels of the area (in cropped image coordinates) that haven't been decoded yet. */
+  /* Only does anything if isDecodedLazily(), see decodeLazily. Not thread safe. */
+  virtual void decodeRegion(iRectangle2D area) {};
+
+  /* Returns true if decodeRaw() has left the pixels to decodeRegion() */
+  virtual bool isDecodedLazily() { return false; };
+
   /* Called function for filters that are capable of doing simple multi-threaded decode */
   /* The delivered class gives information on what part of the image should be decoded. */
   virtual void decodeThreaded(RawDecoderThread* t);
@@ -93,6 +100,12 @@ public:
   /* DNGs are always attempted to be decoded, so this variable has no effect on DNGs */
   bool failOnUnknown;
 
+  /* You can set this before decodeRaw(), if you only need parts of the image. Decoders that */
+  /* store the image in independently compressed tiles or strips then only read the layout, */
+  /* and the pixels are decoded on demand by decodeRegion(). Decoders are free to ignore it, */
+  /* so check isDecodedLazily() afterwards. The FileMap must stay valid until you are done. */
+  bool decodeLazily;
+
 protected:
   /* Attempt to decode the image */
   /* A RawDecoderException will be thrown if the image cannot be decoded, */
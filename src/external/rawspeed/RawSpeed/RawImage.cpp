@@ -157,6 +157,16 @@ void RawImageData::subFrame(iRectangle2D crop) {
   dim = crop.dim;
 }
 
+void RawImageData::resetSubFrame() {
+  mOffset = iPoint2D(0, 0);
+  dim = uncropped_dim;
+}
+
+void RawImageData::calculateBlackLevels() {
+  if (blackLevelSeparate[0] < 0)
+    calculateBlackAreas();
+}
+
 void RawImageData::setError( const char* err )
 {
   pthread_mutex_lock(&errMutex);
@@ -47,9 +47,16 @@ public:
   uchar8* getData(uint32 x, uint32 y);    // Not super fast, but safe. Don't use per pixel.
   uchar8* getDataUncropped(uint32 x, uint32 y);
   virtual void subFrame( iRectangle2D cropped );
+  /* Undoes all subFrame() calls, for decoders that fill in the image after it has been cropped */
+  void resetSubFrame();
+  /* Only the black level part of scaleBlackWhite(), for callers that scale the values themselves */
+  void calculateBlackLevels();
   iPoint2D getUncroppedDim();
   iPoint2D getCropOffset();
   virtual void scaleBlackWhite() = 0;
+  /* The values scaleBlackWhite() would give the pixels in area (cropped coordinates), with the same dither, */
+  /* written to out instead of the image. Call calculateBlackLevels() first. */
+  virtual void scaleValuesRegion(iRectangle2D area, ushort16 *out, int out_pitch) = 0;
   bool isAllocated() {return !!data;}
   iPoint2D dim;
   uint32 pitch;
@@ -88,6 +95,7 @@ class RawImageDataU16 : public RawImageData
 {
 public:
   virtual void scaleBlackWhite();
+  virtual void scaleValuesRegion(iRectangle2D area, ushort16 *out, int out_pitch);
 
 protected:
   virtual void calculateBlackAreas();
@@ -101,6 +109,7 @@ class RawImageDataFloat : public RawImageData
 {
 public:
   virtual void scaleBlackWhite();
+  virtual void scaleValuesRegion(iRectangle2D area, ushort16 *out, int out_pitch);
 
 protected:
   virtual void calculateBlackAreas();
@@ -288,4 +288,8 @@ namespace RawSpeed {
 
 #endif
 
+  void RawImageDataFloat::scaleValuesRegion(iRectangle2D area, ushort16 *out, int out_pitch) {
+    ThrowRDE("RawImageDataFloat::scaleValuesRegion: Not supported for float images");
+  }
+
 } // namespace RawSpeed
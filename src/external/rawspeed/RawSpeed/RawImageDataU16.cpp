@@ -351,4 +351,96 @@ void RawImageDataU16::scaleValues(int start_y, int end_y) {
 
 #endif
 
+void RawImageDataU16::scaleValuesRegion(iRectangle2D area, ushort16 *out, int out_pitch) {
+  int depth_values = whitePoint - blackLevelSeparate[0];
+  float app_scale = 65535.0f / depth_values;
+
+  // Scale in 30.2 fp
+  int full_scale_fp = (int)(app_scale * 4.0f);
+  // Half Scale in 18.14 fp
+  int half_scale_fp = (int)(app_scale * 4095.0f);
+
+#if _MSC_VER > 1399 || defined(__SSE2__)
+  bool use_sse2;
+#ifdef _MSC_VER 
+  int info[4];
+  __cpuid(info, 1);
+  use_sse2 = !!(info[3]&(1 << 26));
+#else
+  use_sse2 = TRUE;
+#endif
+
+  if (use_sse2 && app_scale < 63) {
+    // The sse2 loop of scaleValues(), one 16 bit lane at a time. Its random numbers come from
+    // a generator per lane that starts over at column 0 of every uncropped row, so run it up to the area.
+    ushort16 sub[2][8], mul[2][8];
+    for (int r = 0; r < 2; r++) {
+      uint32 m = (int)(1024.0f * 65535.0f / (float)(whitePoint - blackLevelSeparate[2*r+(mOffset.x&1)]));
+      m |= ((int)(1024.0f * 65535.0f / (float)(whitePoint - blackLevelSeparate[2*r+((mOffset.x+1)&1)])))<<16;
+      uint32 b = blackLevelSeparate[2*r+(mOffset.x&1)] | (blackLevelSeparate[2*r+((mOffset.x+1)&1)]<<16);
+      for (int l = 0; l < 8; l++) {
+        sub[r][l] = (l&1) ? b >> 16 : b & 0xffff;
+        mul[r][l] = (l&1) ? m >> 16 : m & 0xffff;
+      }
+    }
+    const ushort16 full_scale16 = (ushort16)(full_scale_fp|(full_scale_fp<<16));
+    const int half_scale = half_scale_fp >> 4;
+    const int x0 = mOffset.x + area.pos.x, x1 = x0 + area.dim.x;
+
+    for (int y = area.pos.y; y < area.pos.y + area.dim.y; y++) {
+      const int seed[4] = {dim.x*1234+y*23464, dim.x*4272+y*12123, dim.x*2342+y*34311, dim.x*1676+y*18000};
+      short random[8];
+      for (int l = 0; l < 8; l++)
+        random[l] = (short)((l&1) ? seed[l/2] >> 16 : seed[l/2] & 0xffff);
+      const short rand_mul[2] = {0x1d32, 0x4d9f};
+      const ushort16 *pixel = (const ushort16*)&data[(mOffset.y+y)*pitch];
+      const int r = (y+mOffset.y)&1;
+      ushort16 *o = out + (size_t)(y - area.pos.y)*out_pitch - x0;
+
+      for (int g = 0; g*8 < x1; g++) {
+        for (int l = 0; l < 8; l++) {
+          const int p = random[l] * rand_mul[l&1];
+          random[l] = (short)((p >> 16) ^ (p & 0xffff));
+        }
+        if ((g+1)*8 <= x0) continue;
+        for (int l = 0; l < 8; l++) {
+          const int x = g*8 + l;
+          if (x < x0 || x >= x1) continue;
+          const ushort16 in = pixel[x] > sub[r][l] ? pixel[x] - sub[r][l] : 0;
+          const int rand = half_scale - (ushort16)((random[l] & 0xff) * full_scale16);
+          const int v = (int)((uint32)in * mul[r][l] + 512 + (uint32)rand) >> 10;
+          o[x] = clampbits(v, 16);
+        }
+      }
+    }
+    return;
+  }
+#endif
+
+  int mul[4];
+  int sub[4];
+  for (int i = 0; i < 4; i++) {
+    int v = i;
+    if ((mOffset.x&1) != 0)
+      v ^= 1;
+    if ((mOffset.y&1) != 0)
+      v ^= 2;
+    mul[i] = (int)(16384.0f * 65535.0f / (float)(whitePoint - blackLevelSeparate[v]));
+    sub[i] = blackLevelSeparate[v];
+  }
+  for (int y = area.pos.y; y < area.pos.y + area.dim.y; y++) {
+    int v = dim.x + y * 36969;
+    const ushort16 *pixel = (const ushort16*)getData(0, y);
+    ushort16 *o = out + (size_t)(y - area.pos.y)*out_pitch - area.pos.x;
+    int *mul_local = &mul[2*(y&1)];
+    int *sub_local = &sub[2*(y&1)];
+    for (int x = 0 ; x < area.pos.x + area.dim.x; x++) {
+      v = 18000 *(v & 65535) + (v >> 16);
+      if (x < area.pos.x) continue;
+      int rand = half_scale_fp - (full_scale_fp * (v&2047));
+      o[x] = clampbits(((pixel[x] - sub_local[x&1]) * mul_local[x&1] + 8192 + rand) >> 14, 16);
+    }
+  }
+}
+
 } // namespace RawSpeed
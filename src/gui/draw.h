@@ -32,6 +32,7 @@
 
 #include "common/darktable.h"
 #include "develop/develop.h"
+#include "common/histogram.h"
 
 /** wrapper around nikon curve or gegl. */
 typedef struct dt_draw_curve_t
@@ -181,9 +182,9 @@ static inline int dt_draw_curve_add_point(dt_draw_curve_t *c, const            f
 static inline void dt_draw_histogram_8_linear(cairo_t *cr, float *hist, int32_t channel)
 {
   cairo_move_to(cr, 0, 0);
-  for(int k=0; k<64; k++)
+  for(int k=0; k<DT_HISTOGRAM_BINS; k++)
     cairo_line_to(cr, k, hist[4*k+channel]);
-  cairo_line_to(cr, 63, 0);
+  cairo_line_to(cr, DT_HISTOGRAM_BINS-1, 0);
   cairo_close_path(cr);
   cairo_fill(cr);
 }
@@ -191,9 +192,9 @@ static inline void dt_draw_histogram_8_linear(cairo_t *cr, float *hist, int32_t
 static inline void dt_draw_histogram_8_log(cairo_t *cr, float *hist, int32_t channel)
 {
   cairo_move_to(cr, 0, 0);
-  for(int k=0; k<64; k++)
+  for(int k=0; k<DT_HISTOGRAM_BINS; k++)
     cairo_line_to(cr, k, logf(1.0 + hist[4*k+channel]));
-  cairo_line_to(cr, 63, 0);
+  cairo_line_to(cr, DT_HISTOGRAM_BINS-1, 0);
   cairo_close_path(cr);
   cairo_fill(cr);
 }
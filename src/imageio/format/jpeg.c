@@ -33,6 +33,7 @@
 #undef HAVE_STDLIB_H
 #undef HAVE_STDDEF_H
 #include <jpeglib.h>
+#include <jerror.h>
 #undef HAVE_STDLIB_H
 #undef HAVE_STDDEF_H
 
@@ -454,40 +455,111 @@ read_icc_profile (j_decompress_ptr cinfo,
 #undef MAX_SEQ_NO
 
 
-int
-write_image (dt_imageio_jpeg_t *jpg, const char *filename, const uint8_t *in, void *exif, int exif_len, int imgid)
+// scanlines handed to libjpeg per call (two iMCU rows of 4:2:0)
+#define DT_IMAGEIO_JPEG_BATCH 32
+// outputs with at least this many pixels are encoded in parallel strips
+#define DT_IMAGEIO_JPEG_PARALLEL_PIXELS (16*1024*1024)
+
+// growing memory destination, used for the strips of the parallel encoder
+typedef struct dt_imageio_jpeg_mem_dest_t
 {
-  struct dt_imageio_jpeg_error_mgr jerr;
+  struct jpeg_destination_mgr pub;
+  uint8_t *buf;
+  size_t size;
+}
+dt_imageio_jpeg_mem_dest_t;
 
-  jpg->cinfo.err = jpeg_std_error(&jerr.pub);
-  jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
-  if (setjmp(jerr.setjmp_buffer))
-  {
-    jpeg_destroy_compress(&(jpg->cinfo));
-    return 1;
-  }
-  jpeg_create_compress(&(jpg->cinfo));
-  FILE *f = fopen(filename, "wb");
-  if(!f) return 1;
-  jpeg_stdio_dest(&(jpg->cinfo), f);
+static void
+dt_imageio_jpeg_mem_init_destination(j_compress_ptr cinfo)
+{
+  dt_imageio_jpeg_mem_dest_t *d = (dt_imageio_jpeg_mem_dest_t *)cinfo->dest;
+  d->pub.next_output_byte = d->buf;
+  d->pub.free_in_buffer = d->size;
+}
 
-  jpg->cinfo.image_width = jpg->width;
-  jpg->cinfo.image_height = jpg->height;
-  jpg->cinfo.input_components = 3;
-  jpg->cinfo.in_color_space = JCS_RGB;
-  jpeg_set_defaults(&(jpg->cinfo));
-  jpeg_set_quality(&(jpg->cinfo), jpg->quality, TRUE);
-  if(jpg->quality > 90) jpg->cinfo.comp_info[0].v_samp_factor = 1;
-  if(jpg->quality > 92) jpg->cinfo.comp_info[0].h_samp_factor = 1;
-  if(jpg->quality > 95) jpg->cinfo.dct_method = JDCT_FLOAT;
-  if(jpg->quality < 50) jpg->cinfo.dct_method = JDCT_IFAST;
-  if(jpg->quality < 80) jpg->cinfo.smoothing_factor = 20;
-  if(jpg->quality < 60) jpg->cinfo.smoothing_factor = 40;
-  if(jpg->quality < 40) jpg->cinfo.smoothing_factor = 60;
-  jpg->cinfo.optimize_coding = 1;
+static boolean
+dt_imageio_jpeg_mem_empty_output_buffer(j_compress_ptr cinfo)
+{
+  dt_imageio_jpeg_mem_dest_t *d = (dt_imageio_jpeg_mem_dest_t *)cinfo->dest;
+  const size_t used = d->size;
+  uint8_t *buf = (uint8_t *)realloc(d->buf, 2*d->size);
+  if(!buf) ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 0);
+  d->buf = buf;
+  d->size *= 2;
+  d->pub.next_output_byte = d->buf + used;
+  d->pub.free_in_buffer = d->size - used;
+  return TRUE;
+}
 
-  jpeg_start_compress(&(jpg->cinfo), TRUE);
+// libjpeg smooths the input for low qualities, across rows: strips would see other neighbours
+// at their borders than a single pass does.
+static int
+_jpeg_smoothing_factor(const int quality)
+{
+  if(quality < 40) return 60;
+  if(quality < 60) return 40;
+  if(quality < 80) return 20;
+  return 0;
+}
 
+// image parameters, shared by the serial and the parallel encoder
+static void
+_jpeg_setup_compress(const dt_imageio_jpeg_t *jpg, struct jpeg_compress_struct *cinfo, const int height, const int parallel)
+{
+  cinfo->image_width = jpg->width;
+  cinfo->image_height = height;
+#ifdef JCS_EXTENSIONS
+  // libjpeg-turbo reads our rgbx rows directly, no need to repack
+  cinfo->input_components = 4;
+  cinfo->in_color_space = JCS_EXT_RGBX;
+#else
+  cinfo->input_components = 3;
+  cinfo->in_color_space = JCS_RGB;
+#endif
+  jpeg_set_defaults(cinfo);
+  jpeg_set_quality(cinfo, jpg->quality, TRUE);
+  if(jpg->quality > 90) cinfo->comp_info[0].v_samp_factor = 1;
+  if(jpg->quality > 92) cinfo->comp_info[0].h_samp_factor = 1;
+  if(jpg->quality > 95) cinfo->dct_method = JDCT_FLOAT;
+  if(jpg->quality < 50) cinfo->dct_method = JDCT_IFAST;
+  cinfo->smoothing_factor = _jpeg_smoothing_factor(jpg->quality);
+  // strips have to share the default huffman tables to be spliced together
+  cinfo->optimize_coding = !parallel;
+}
+
+// feed rows [next_scanline, image_height) of the rgbx buffer in to the compressor
+static void
+_jpeg_write_rows(struct jpeg_compress_struct *cinfo, const uint8_t *in)
+{
+  const int width = cinfo->image_width;
+  JSAMPROW rows[DT_IMAGEIO_JPEG_BATCH];
+#ifndef JCS_EXTENSIONS
+  uint8_t *buf = (uint8_t *)malloc(3*width*DT_IMAGEIO_JPEG_BATCH);
+  if(!buf) ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 0);
+#endif
+  while(cinfo->next_scanline < cinfo->image_height)
+  {
+    const int n = MIN(DT_IMAGEIO_JPEG_BATCH, cinfo->image_height - cinfo->next_scanline);
+    for(int j=0; j<n; j++)
+    {
+      const uint8_t *row = in + (size_t)4*width*(cinfo->next_scanline + j);
+#ifdef JCS_EXTENSIONS
+      rows[j] = (JSAMPROW)row;
+#else
+      rows[j] = buf + 3*width*j;
+      for(int i=0; i<width; i++) for(int k=0; k<3; k++) rows[j][3*i+k] = row[4*i+k];
+#endif
+    }
+    jpeg_write_scanlines(cinfo, rows, n);
+  }
+#ifndef JCS_EXTENSIONS
+  free(buf);
+#endif
+}
+
+static void
+_jpeg_write_markers(struct jpeg_compress_struct *cinfo, void *exif, int exif_len, int imgid)
+{
   if(imgid > 0)
   {
     cmsHPROFILE out_profile = dt_colorspaces_create_output_profile(imgid);
@@ -497,24 +569,182 @@ write_image (dt_imageio_jpeg_t *jpg, const char *filename, const uint8_t *in, vo
     {
       unsigned char buf[len];
       cmsSaveProfileToMem(out_profile, buf, &len);
-      write_icc_profile(&(jpg->cinfo), buf, len);
+      write_icc_profile(cinfo, buf, len);
     }
     dt_colorspaces_cleanup_profile(out_profile);
   }
 
   if(exif && exif_len > 0 && exif_len < 65534)
-    jpeg_write_marker(&(jpg->cinfo), JPEG_APP0+1, exif, exif_len);
+    jpeg_write_marker(cinfo, JPEG_APP0+1, exif, exif_len);
+}
 
-  uint8_t row[3*jpg->width];
-  const uint8_t *buf;
-  while(jpg->cinfo.next_scanline < jpg->cinfo.image_height)
+// compress rows [y, y+height) into a complete jpeg in memory. the first strip carries the markers.
+static int
+_jpeg_compress_strip(const dt_imageio_jpeg_t *jpg, const uint8_t *in, const int y, const int height, void *exif, int exif_len, int imgid, uint8_t **out, size_t *out_len)
+{
+  struct jpeg_compress_struct cinfo;
+  struct dt_imageio_jpeg_error_mgr jerr;
+  dt_imageio_jpeg_mem_dest_t dest;
+  dest.pub.init_destination = dt_imageio_jpeg_mem_init_destination;
+  dest.pub.empty_output_buffer = dt_imageio_jpeg_mem_empty_output_buffer;
+  dest.pub.term_destination = dt_imageio_jpeg_term_destination;
+  dest.size = MAX(65536, (size_t)jpg->width*height/2);
+  dest.buf = (uint8_t *)malloc(dest.size);
+  if(!dest.buf) return 1;
+
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
+  if (setjmp(jerr.setjmp_buffer))
   {
-    JSAMPROW tmp[1];
-    buf = in + jpg->cinfo.next_scanline * jpg->cinfo.image_width * 4;
-    for(int i=0; i<jpg->width; i++) for(int k=0; k<3; k++) row[3*i+k] = buf[4*i+k];
-    tmp[0] = row;
-    jpeg_write_scanlines(&(jpg->cinfo), tmp, 1);
+    jpeg_destroy_compress(&cinfo);
+    free(dest.buf);
+    return 1;
+  }
+  jpeg_create_compress(&cinfo);
+  cinfo.dest = &dest.pub;
+  _jpeg_setup_compress(jpg, &cinfo, height, 1);
+  jpeg_start_compress(&cinfo, TRUE);
+  if(y == 0) _jpeg_write_markers(&cinfo, exif, exif_len, imgid);
+  _jpeg_write_rows(&cinfo, in + (size_t)4*jpg->width*y);
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+
+  *out = dest.buf;
+  *out_len = dest.size - dest.pub.free_in_buffer;
+  return 0;
+}
+
+// offset of the SOS marker in a complete jpeg, and the offset of its entropy coded data
+static int
+_jpeg_find_scan(const uint8_t *buf, const size_t len, size_t *sos, size_t *data)
+{
+  size_t pos = 2; // skip SOI
+  while(pos + 4 <= len && buf[pos] == 0xff)
+  {
+    const size_t seglen = (buf[pos+2] << 8) | buf[pos+3];
+    if(buf[pos+1] == 0xda)
+    {
+      *sos = pos;
+      *data = pos + 2 + seglen;
+      return *data <= len - 2 ? 0 : 1;
+    }
+    pos += 2 + seglen;
+  }
+  return 1;
+}
+
+/*
+ * Encode horizontal strips of the image in parallel, and splice them into one baseline
+ * jpeg with a restart interval of exactly one strip: every strip starts with reset DC
+ * predictors and uses the same (default) tables, just like after a restart marker.
+ * The headers are taken from the first strip, with the SOF height patched and a DRI
+ * marker added. Strips are a multiple of 16 rows, so MCUs never straddle them.
+ */
+static int
+_jpeg_write_image_parallel(dt_imageio_jpeg_t *jpg, FILE *f, const uint8_t *in, void *exif, int exif_len, int imgid)
+{
+  // mcu size as set up by _jpeg_setup_compress(): 8 or 16 pixels
+  const int mcu_w = jpg->quality > 92 ? 8 : 16;
+  const int mcu_h = jpg->quality > 90 ? 8 : 16;
+  const int mcus_per_row = (jpg->width + mcu_w - 1)/mcu_w;
+
+  // about two strips per thread, but the restart interval has to fit 16 bits
+  const int nthreads = dt_get_num_threads();
+  int strip_height = 16*((jpg->height + 2*nthreads*16 - 1)/(2*nthreads*16));
+  while(strip_height > 16 && mcus_per_row*(strip_height/mcu_h) > 0xffff) strip_height -= 16;
+  if(mcus_per_row*(strip_height/mcu_h) > 0xffff) return 1;
+  const int nstrips = (jpg->height + strip_height - 1)/strip_height;
+  const int restart_interval = mcus_per_row*(strip_height/mcu_h);
+
+  uint8_t **strip = (uint8_t **)calloc(nstrips, sizeof(uint8_t *));
+  size_t *strip_len = (size_t *)calloc(nstrips, sizeof(size_t));
+  int failed = 0;
+
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(jpg, in, exif, exif_len, imgid, strip, strip_len, strip_height) reduction(+:failed) schedule(dynamic)
+#endif
+  for(int k=0; k<nstrips; k++)
+  {
+    const int y = k*strip_height;
+    const int height = MIN(strip_height, jpg->height - y);
+    failed += _jpeg_compress_strip(jpg, in, y, height, exif, exif_len, imgid, strip + k, strip_len + k);
+  }
+
+  size_t sos, data;
+  if(!failed) failed = _jpeg_find_scan(strip[0], strip_len[0], &sos, &data);
+  if(!failed)
+  {
+    // patch the image height into the SOF marker
+    for(size_t pos = 2; pos < sos; pos += 2 + ((strip[0][pos+2] << 8) | strip[0][pos+3]))
+    {
+      if(strip[0][pos+1] >= 0xc0 && strip[0][pos+1] <= 0xc2)
+      {
+        strip[0][pos+5] = jpg->height >> 8;
+        strip[0][pos+6] = jpg->height & 0xff;
+      }
+    }
+    const uint8_t dri[6] = { 0xff, 0xdd, 0x00, 0x04, restart_interval >> 8, restart_interval & 0xff };
+    fwrite(strip[0], 1, sos, f);
+    fwrite(dri, 1, sizeof(dri), f);
+    fwrite(strip[0] + sos, 1, strip_len[0] - 2 - sos, f);
+    for(int k=1; k<nstrips && !failed; k++)
+    {
+      size_t ksos, kdata;
+      if(_jpeg_find_scan(strip[k], strip_len[k], &ksos, &kdata))
+      {
+        failed = 1;
+        break;
+      }
+      const uint8_t rst[2] = { 0xff, 0xd0 + ((k-1) & 7) };
+      fwrite(rst, 1, sizeof(rst), f);
+      fwrite(strip[k] + kdata, 1, strip_len[k] - 2 - kdata, f);
+    }
+    const uint8_t eoi[2] = { 0xff, 0xd9 };
+    fwrite(eoi, 1, sizeof(eoi), f);
   }
+
+  for(int k=0; k<nstrips; k++) free(strip[k]);
+  free(strip);
+  free(strip_len);
+  return failed ? 1 : 0;
+}
+
+int
+write_image (dt_imageio_jpeg_t *jpg, const char *filename, const uint8_t *in, void *exif, int exif_len, int imgid)
+{
+  // strips only give the same image as one pass if nothing is smoothed across their borders
+  if((size_t)jpg->width*jpg->height >= DT_IMAGEIO_JPEG_PARALLEL_PIXELS && dt_get_num_threads() > 1 &&
+     _jpeg_smoothing_factor(jpg->quality) == 0)
+  {
+    FILE *f = fopen(filename, "wb");
+    if(!f) return 1;
+    const int res = _jpeg_write_image_parallel(jpg, f, in, exif, exif_len, imgid);
+    fclose(f);
+    return res;
+  }
+
+  struct dt_imageio_jpeg_error_mgr jerr;
+
+  jpg->cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
+  if (setjmp(jerr.setjmp_buffer))
+  {
+    jpeg_destroy_compress(&(jpg->cinfo));
+    return 1;
+  }
+  jpeg_create_compress(&(jpg->cinfo));
+  FILE *f = fopen(filename, "wb");
+  if(!f) return 1;
+  jpeg_stdio_dest(&(jpg->cinfo), f);
+
+  _jpeg_setup_compress(jpg, &(jpg->cinfo), jpg->height, 0);
+
+  jpeg_start_compress(&(jpg->cinfo), TRUE);
+
+  _jpeg_write_markers(&(jpg->cinfo), exif, exif_len, imgid);
+
+  _jpeg_write_rows(&(jpg->cinfo), in);
+
   jpeg_finish_compress (&(jpg->cinfo));
   jpeg_destroy_compress(&(jpg->cinfo));
   fclose(f);
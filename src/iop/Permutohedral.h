@@ -70,6 +70,21 @@ public:
     return filled;
   }
 
+  /* Empties the table, but keeps its storage for the next use. */
+  void clear()
+  {
+    if (!filled) return;
+    for (size_t i = 0; i < capacity; i++) entries[i] = Entry();
+    memset(values, 0, sizeof(float)*VD*filled);
+    filled = 0;
+  }
+
+  /* Makes room for n vectors, so filling the table up to there does not have to grow it. */
+  void reserve(size_t n)
+  {
+    while (n >= (capacity/2)-1) grow();
+  }
+
   // Returns a pointer to the keys array.
   const short *getKeys()
   {
@@ -91,12 +106,6 @@ public:
   int lookupOffset(const short *key, size_t h, bool create = true)
   {
 
-    // Double hash table size if necessary
-    if (filled >= (capacity/2)-1)
-    {
-      grow();
-    }
-
     // Find the entry with the given key
     while (1)
     {
@@ -134,6 +143,14 @@ public:
    */
   float *lookup(const short *k, bool create = true)
   {
+    // Double hash table size if necessary, before h is taken from the
+    // (new) size. lookups only never change the table, so they may run
+    // in parallel.
+    if (create && filled >= (capacity/2)-1)
+    {
+      grow();
+    }
+
     size_t h = hash(k) & capacity_bits;
     int offset = lookupOffset(k, h, create);
     if (offset < 0) return NULL;
@@ -220,17 +237,20 @@ public:
    *     d_ : dimensionality of key vectors
    *    vd_ : dimensionality of value vectors
    * nData_ : number of points in the input
+   * nThreads_ : number of threads splatting at the same time
+   * nVertices : expected number of lattice points, see estimate()
+   *
+   * The lattice can be used again for another input after reset(), it keeps
+   * the storage of its hash tables and buffers between the uses.
    */
-  PermutohedralLattice(int nData_, int nThreads_=1) :
-    nData(nData_), nThreads(nThreads_)
+  PermutohedralLattice(int nData_, int nThreads_=1, size_t nVertices=0) :
+    nData(0), nThreads(nThreads_), replay(NULL), replaySize(0)
   {
 
     // Allocate storage for various arrays
     float *scaleFactorTmp = new float[D];
     int *canonicalTmp = new int[(D+1)*(D+1)];
 
-    replay = new ReplayEntry[nData*(D+1)];
-
     // compute the coordinates of the canonical simplex, in which
     // the difference between a contained point and the zero
     // remainder vertex is always in ascending order. (See pg.4 of paper.)
@@ -265,7 +285,42 @@ public:
     }
     scaleFactor = scaleFactorTmp;
 
+    // every thread splats into a table of its own. these are added up into shards,
+    // each of which holds the vertices with the same top bits of the hash.
+    if (nThreads < 1) nThreads = 1;
+    nShards = 1;
+    shardBits = 0;
+    while (nShards < nThreads)
+    {
+      nShards <<= 1;
+      shardBits++;
+    }
+    shardMask = nShards - 1;
     hashTables = new HashTablePermutohedral<D,VD>[nThreads];
+    shards = nThreads > 1 ? new HashTablePermutohedral<D,VD>[nShards] : NULL;
+
+    order = new int*[nThreads];
+    remap = new unsigned int*[nThreads];
+    mergeSize = new size_t[nThreads];
+    shardStart = new int[nThreads*(nShards+1)];
+    for (int t = 0; t < nThreads; t++)
+    {
+      order[t] = NULL;
+      remap[t] = NULL;
+      mergeSize[t] = 0;
+    }
+
+    current = new float*[nShards];
+    next = new float*[nShards];
+    blurValues = new float*[nShards];
+    blurSize = new size_t[nShards];
+    for (int s = 0; s < nShards; s++)
+    {
+      current[s] = next[s] = blurValues[s] = NULL;
+      blurSize[s] = 0;
+    }
+
+    reset(nData_, nVertices);
   }
 
 
@@ -275,8 +330,54 @@ public:
     delete[] replay;
     delete[] canonical;
     delete[] hashTables;
+    delete[] shards;
+    for (int t = 0; t < nThreads; t++)
+    {
+      delete[] order[t];
+      delete[] remap[t];
+    }
+    delete[] order;
+    delete[] remap;
+    delete[] mergeSize;
+    delete[] shardStart;
+    for (int s = 0; s < nShards; s++)
+      delete[] blurValues[s];
+    delete[] blurValues;
+    delete[] blurSize;
+    delete[] current;
+    delete[] next;
   }
 
+  /* A guess at the number of lattice points filled by an image of width x height pixels,
+   * splatted at positions scaled by inv_sigma_s in the two spatial dimensions. The other
+   * dimensions are taken to be smooth over most of the image, which leaves a few layers
+   * of vertices per spatial cell (about 4 for d=3 and 16 for d=5 on smooth images).
+   * Only used to size the hash tables up front, they still grow if the image has more
+   * detail than that. */
+  static size_t estimate(int width, int height, float inv_sigma_s)
+  {
+    const double cells = (width*inv_sigma_s + 2.0)*(height*inv_sigma_s + 2.0);
+    const double all = (double)width*height*(D+1);
+    return (size_t)fmin(all, cells*(D+1)*(D+1)/2);
+  }
+
+  /* Prepares the lattice for nData_ new points, with about nVertices lattice points. */
+  void reset(int nData_, size_t nVertices=0)
+  {
+    nData = nData_;
+    replay = reserve_array(replay, replaySize, (size_t)nData*(D+1));
+    for (int t = 0; t < nThreads; t++)
+    {
+      hashTables[t].clear();
+      // the bands of rows of the threads overlap a little in the lattice
+      hashTables[t].reserve(nVertices/nThreads + (nThreads > 1 ? nVertices/(2*nThreads) : 0));
+    }
+    for (int s = 0; shards && s < nShards; s++)
+    {
+      shards[s].clear();
+      shards[s].reserve(nVertices/nShards + nVertices/(4*nShards));
+    }
+  }
 
   /* Performs splatting with given position and value vectors */
   void splat(float *position, float *value, int replay_index, int thread_index=0)
@@ -376,43 +477,92 @@ public:
         val[i] += barycentric[remainder]*value[i];
 
       // Record this interaction to use later when slicing
-      replay[replay_index*(D+1)+remainder].table = thread_index;
-      replay[replay_index*(D+1)+remainder].offset = val - hashTables[thread_index].getValues();
+      const unsigned int vertex = (val - hashTables[thread_index].getValues())/VD;
+      replay[replay_index*(D+1)+remainder].offset = (vertex << shardBits) | thread_index;
       replay[replay_index*(D+1)+remainder].weight = barycentric[remainder];
     }
   }
 
-  /* Merge the multiple threads' hash tables into the totals. */
+  /* Merge the multiple threads' hash tables into the totals. All shards are
+   * filled at the same time, every one of them only takes the vertices that
+   * belong to it. */
   void merge_splat_threads(void)
   {
     if (nThreads <= 1)
+    {
+      current[0] = hashTables[0].getValues();
       return;
+    }
 
-    /* Merge the multiple hash tables into one, creating an offset remap table. */
-    int *offset_remap[nThreads];
-    for (int i = 1; i < nThreads; i++)
+    for (int t = 0; t < nThreads; t++)
+    {
+      const size_t filled = hashTables[t].size();
+      if (order[t] && filled <= mergeSize[t]) continue;
+      delete[] order[t];
+      delete[] remap[t];
+      mergeSize[t] = filled > 0 ? filled : 1;
+      order[t] = new int[mergeSize[t]];
+      remap[t] = new unsigned int[mergeSize[t]];
+    }
+
+    // sort the vertices of every thread's table by their shard
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
+    for (int t = 0; t < nThreads; t++)
     {
-      const short *oldKeys = hashTables[i].getKeys();
-      const float *oldVals = hashTables[i].getValues();
-      const int filled = hashTables[i].size();
-      offset_remap[i] = new int[filled];
-      for (int j = 0; j < filled; j++)
+      const short *keys = hashTables[t].getKeys();
+      const int filled = hashTables[t].size();
+      int *start = shardStart + t*(nShards+1);
+      int fill[nShards];
+      for (int s = 0; s <= nShards; s++) start[s] = 0;
+      for (int j = 0; j < filled; j++) start[shardOf(keys + j*D)+1]++;
+      for (int s = 0; s < nShards; s++)
       {
-        float *val = hashTables[0].lookup(oldKeys+j*D, true);
-        const float *oldVal = oldVals + j*VD;
-        for (int k = 0; k < VD; k++)
-          val[k] += oldVal[k];
-        offset_remap[i][j] = val - hashTables[0].getValues();
+        fill[s] = start[s];
+        start[s+1] += start[s];
+      }
+      for (int j = 0; j < filled; j++) order[t][fill[shardOf(keys + j*D)]++] = j;
+    }
+
+    // add up the vertices in the order of the threads, which gives the
+    // same sums as adding one table after the other to the first one.
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic)
+#endif
+    for (int s = 0; s < nShards; s++)
+    {
+      HashTablePermutohedral<D,VD> &shard = shards[s];
+      for (int t = 0; t < nThreads; t++)
+      {
+        const short *keys = hashTables[t].getKeys();
+        const float *values = hashTables[t].getValues();
+        const int *start = shardStart + t*(nShards+1);
+        for (int k = start[s]; k < start[s+1]; k++)
+        {
+          const int j = order[t][k];
+          float *val = shard.lookup(keys + j*D, true);
+          for (int i = 0; i < VD; i++)
+            val[i] += values[j*VD + i];
+          const unsigned int vertex = (val - shard.getValues())/VD;
+          remap[t][j] = (vertex << shardBits) | s;
+        }
       }
     }
 
     /* Rewrite the offsets in the replay structure from the above generated table. */
-    for (int i = 0; i < nData*(D+1); i++)
-      if (replay[i].table > 0)
-        replay[i].offset = offset_remap[replay[i].table][replay[i].offset/VD];
+    const size_t n = (size_t)nData*(D+1);
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
+    for (size_t i = 0; i < n; i++)
+    {
+      const unsigned int o = replay[i].offset;
+      replay[i].offset = remap[o & shardMask][o >> shardBits];
+    }
 
-    for (int i = 1; i < nThreads; i++)
-      delete[] offset_remap[i];
+    for (int s = 0; s < nShards; s++)
+      current[s] = shards[s].getValues();
   }
 
   /* Performs slicing out of position vectors. Note that the barycentric weights and the simplex
@@ -421,14 +571,14 @@ public:
    */
   void slice(float *col, int replay_index)
   {
-    float *base = hashTables[0].getValues();
     for (int j = 0; j < VD; j++) col[j] = 0;
     for (int i = 0; i <= D; i++)
     {
       ReplayEntry r = replay[replay_index*(D+1)+i];
+      const float *val = current[r.offset & shardMask] + (size_t)(r.offset >> shardBits)*VD;
       for (int j = 0; j < VD; j++)
       {
-        col[j] += r.weight*base[r.offset + j];
+        col[j] += r.weight*val[j];
       }
     }
   }
@@ -436,10 +586,17 @@ public:
   /* Performs a Gaussian blur along each projected axis in the hyperplane. */
   void blur()
   {
-    // Prepare arrays
-    float *newValue = new float[VD*hashTables[0].size()];
-    float *oldValue = hashTables[0].getValues();
-    float *hashTableBase = oldValue;
+    HashTablePermutohedral<D,VD> *tables = shards ? shards : hashTables;
+    const int nTables = shards ? nShards : 1;
+
+    // Prepare arrays. the tables' values and the kept buffers take turns,
+    // the result stays wherever it ends up and slice() reads it from there.
+    for (int s = 0; s < nTables; s++)
+    {
+      blurValues[s] = reserve_array(blurValues[s], blurSize[s], (size_t)VD*tables[s].size());
+      current[s] = tables[s].getValues();
+      next[s] = blurValues[s];
+    }
 
     float zero[VD];
     for (int k = 0; k < VD; k++) zero[k] = 0;
@@ -447,74 +604,111 @@ public:
     // For each of d+1 axes,
     for (int j = 0; j <= D; j++)
     {
+      for (int s = 0; s < nTables; s++)
+      {
+        const short *keys = tables[s].getKeys();
+        const float *oldValue = current[s];
+        float *newValue = next[s];
+        const int filled = tables[s].size();
 #ifdef _OPENMP
-      #pragma omp parallel for shared(j, oldValue, newValue, hashTableBase, zero)
+        #pragma omp parallel for schedule(static)
 #endif
-      // For each vertex in the lattice,
-      for (int i = 0; i < hashTables[0].size(); i++)   // blur point i in dimension j
-      {
-        const short *key    = hashTables[0].getKeys() + i*(D); // keys to current vertex
-        short neighbor1[D+1];
-        short neighbor2[D+1];
-        for (int k = 0; k < D; k++)
+        // For each vertex in the lattice,
+        for (int i = 0; i < filled; i++)   // blur point i in dimension j
         {
-          neighbor1[k] = key[k] + 1;
-          neighbor2[k] = key[k] - 1;
+          const short *key    = keys + i*(D); // keys to current vertex
+          short neighbor1[D+1];
+          short neighbor2[D+1];
+          for (int k = 0; k < D; k++)
+          {
+            neighbor1[k] = key[k] + 1;
+            neighbor2[k] = key[k] - 1;
+          }
+          neighbor1[j] = key[j] - D;
+          neighbor2[j] = key[j] + D; // keys to the neighbors along the given axis.
+
+          const float *oldVal = oldValue + i*VD;
+          float *newVal = newValue + i*VD;
+
+          const float *vm1 = vertex(tables, neighbor1, zero); // look up first neighbor
+          const float *vp1 = vertex(tables, neighbor2, zero); // look up second neighbor
+
+          // Mix values of the three vertices
+          for (int k = 0; k < VD; k++)
+            newVal[k] = (0.25f*vm1[k] + 0.5f*oldVal[k] + 0.25f*vp1[k]);
         }
-        neighbor1[j] = key[j] - D;
-        neighbor2[j] = key[j] + D; // keys to the neighbors along the given axis.
-
-        float *oldVal = oldValue + i*VD;
-        float *newVal = newValue + i*VD;
-
-        float *vm1, *vp1;
-
-        vm1 = hashTables[0].lookup(neighbor1, false); // look up first neighbor
-        if (vm1) vm1 = vm1 - hashTableBase + oldValue;
-        else vm1 = zero;
-
-        vp1 = hashTables[0].lookup(neighbor2, false); // look up second neighbor
-        if (vp1) vp1 = vp1 - hashTableBase + oldValue;
-        else vp1 = zero;
-
-        // Mix values of the three vertices
-        for (int k = 0; k < VD; k++)
-          newVal[k] = (0.25f*vm1[k] + 0.5f*oldVal[k] + 0.25f*vp1[k]);
       }
-      float *tmp = newValue;
-      newValue = oldValue;
-      oldValue = tmp;
-      // the freshest data is now in oldValue, and newValue is ready to be written over
-    }
-
-    // depending where we ended up, we may have to copy data
-    if (oldValue != hashTableBase)
-    {
-      memcpy(hashTableBase, oldValue, hashTables[0].size()*VD*sizeof(float));
-      delete[] oldValue;
-    }
-    else
-    {
-      delete[] newValue;
+      // the freshest data is now in current, and next is ready to be written over
+      for (int s = 0; s < nTables; s++)
+      {
+        float *tmp = next[s];
+        next[s] = current[s];
+        current[s] = tmp;
+      }
     }
   }
 
 private:
 
+  // the vertices of the shards are spread over the tables by the top bits of their hash
+  int shardOf(const short *key)
+  {
+    if (!shardBits) return 0;
+    return hashTables[0].hash(key) >> (8*sizeof(size_t) - shardBits);
+  }
+
+  // the current values of the vertex at key, zero if it is not in the lattice
+  const float *vertex(HashTablePermutohedral<D,VD> *tables, const short *key, const float *zero)
+  {
+    const int s = shards ? shardOf(key) : 0;
+    const float *val = tables[s].lookup(key, false);
+    if (!val) return zero;
+    return current[s] + (val - tables[s].getValues());
+  }
+
+  // grows a to at least n elements, the contents are not kept
+  template <typename T> static T *reserve_array(T *a, size_t &size, size_t n)
+  {
+    if (a && n <= size) return a;
+    delete[] a;
+    size = n > 0 ? n : 1;
+    return new T[size];
+  }
+
   int nData;
   int nThreads;
+  int nShards, shardBits;
+  unsigned int shardMask;
   const float *scaleFactor;
   const int *canonical;
 
-  // slicing is done by replaying splatting (ie storing the sparse matrix)
+  // slicing is done by replaying splatting (ie storing the sparse matrix).
+  // offset is the index of the vertex in its table, shifted up by shardBits,
+  // with the number of the table in the low bits.
   struct ReplayEntry
   {
-    int table;
-    int offset;
+    unsigned int offset;
     float weight;
   } *replay;
+  size_t replaySize;
 
+  // the tables the threads splat into
   HashTablePermutohedral<D,VD> *hashTables;
+
+  // the merged lattice, NULL for a single thread which uses hashTables[0]
+  HashTablePermutohedral<D,VD> *shards;
+
+  // merge bookkeeping for every thread's table: vertices sorted by shard, their
+  // index in the shard, and where every shard starts in the sorted order.
+  int **order;
+  unsigned int **remap;
+  size_t *mergeSize;
+  int *shardStart;
+
+  // the values of the vertices of every table during and after the blur
+  float **current, **next;
+  float **blurValues;
+  size_t *blurSize;
 };
 
 #endif
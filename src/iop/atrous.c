@@ -461,7 +461,8 @@ process (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, voi
   const int width = roi_out->width;
   const int height = roi_out->height;
 
-  tmp = (float *)dt_alloc_align(64, sizeof(float)*4*width*height);
+  // all buffers come from the pipe's scratch arena, they are reused by the next run:
+  tmp = (float *)dt_dev_pixelpipe_scratch_get(&piece->pipe->scratch, 0, sizeof(float)*4*width*height);
   if(tmp == NULL)
   {
     fprintf(stderr, "[atrous] failed to allocate coarse buffer!\n");
@@ -470,7 +471,7 @@ process (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, voi
 
   for(int k=0; k<max_scale; k++)
   {
-    detail[k] = (float *)dt_alloc_align(64, sizeof(float)*4*width*height);
+    detail[k] = (float *)dt_dev_pixelpipe_scratch_get(&piece->pipe->scratch, k+1, sizeof(float)*4*width*height);
     if(detail[k] == NULL)
     {
       fprintf(stderr, "[atrous] failed to allocate one of the detail buffers!\n");
@@ -483,6 +484,8 @@ process (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, voi
 
   for(int scale=0; scale<max_scale; scale++)
   {
+    // every scale is a pass over the whole image, stop here if the output became obsolete.
+    if(dt_dev_pixelpipe_piece_cancelled(piece)) goto error;
     eaw_decompose (buf2, buf1, detail[scale], scale, sharp[scale], width, height);
     if(scale == 0) buf1 = (float *)o;  // now switch to (float *)o for buffer ping-pong between buf1 and buf2
     float *buf3 = buf2;
@@ -492,6 +495,7 @@ process (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, voi
 
   for(int scale=max_scale-1; scale>=0; scale--)
   {
+    if(dt_dev_pixelpipe_piece_cancelled(piece)) goto error;
     eaw_synthesize (buf2, buf1, detail[scale], thrs[scale], boost[scale], width, height);
     float *buf3 = buf2;
     buf2 = buf1;
@@ -499,17 +503,12 @@ process (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, voi
   }
   /* due to symmetric processing, output will be left in (float *)o */
 
-  for(int k=0; k<max_scale; k++) free(detail[k]);
-  free(tmp);
-
   if(piece->pipe->mask_display)
     dt_iop_alpha_copy(i, o, width, height);
 
   return;
 
 error:
-  for(int k=0; k<max_scale; k++) if(detail[k] != NULL) free(detail[k]);
-  if(tmp != NULL) free(tmp);
   return;
 }
 
@@ -568,6 +567,9 @@ process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem
   {
     const int scale = s;
 
+    // output became obsolete in the meantime?
+    if(dt_dev_pixelpipe_piece_cancelled(piece)) goto error;
+
     if(s & 1)
     {
       dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 0, sizeof(cl_mem), (void *)&dev_tmp);
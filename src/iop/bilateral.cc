@@ -61,6 +61,8 @@ extern "C"
   typedef struct dt_iop_bilateral_data_t
   {
     float sigma[5];
+    // kept between runs of the pipe, so its hash tables don't have to grow again
+    PermutohedralLattice<5,4> *lattice;
   }
   dt_iop_bilateral_data_t;
 
@@ -188,7 +190,11 @@ extern "C"
     else
     {
       for(int k=0; k<5; k++) sigma[k] = 1.0f/sigma[k];
-      PermutohedralLattice<5,4> lattice(roi_in->width*roi_in->height, omp_get_max_threads());
+      const int size = roi_in->width*roi_in->height;
+      const size_t vertices = PermutohedralLattice<5,4>::estimate(roi_in->width, roi_in->height, fminf(sigma[0], sigma[1]));
+      if(data->lattice) data->lattice->reset(size, vertices);
+      else data->lattice = new PermutohedralLattice<5,4>(size, omp_get_max_threads(), vertices);
+      PermutohedralLattice<5,4> &lattice = *data->lattice;
 
       // splat into the lattice
 #ifdef _OPENMP
@@ -263,11 +269,13 @@ extern "C"
   void init_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
   {
     piece->data = malloc(sizeof(dt_iop_bilateral_data_t));
+    ((dt_iop_bilateral_data_t *)piece->data)->lattice = NULL;
     self->commit_params(self, self->default_params, pipe, piece);
   }
 
   void cleanup_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
   {
+    delete ((dt_iop_bilateral_data_t *)piece->data)->lattice;
     free(piece->data);
   }
 
@@ -20,6 +20,7 @@
 #endif
 #include "common/darktable.h"
 #include "common/colorspaces.h"
+#include "common/clahe.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
 #include "control/control.h"
@@ -35,14 +36,27 @@
 
 #define CLIP(x) ((x<0)?0.0:(x>1.0)?1.0:x)
 
-#define ROUND_POSISTIVE(f) ((unsigned int)((f)+0.5))
+DT_MODULE(2)
 
-DT_MODULE(1)
+typedef enum dt_iop_rlce_mode_t
+{
+  DT_IOP_RLCE_EXACT = 0, // sliding window histogram per pixel
+  DT_IOP_RLCE_TILED = 1  // interpolated per-tile luts
+}
+dt_iop_rlce_mode_t;
+
+typedef struct dt_iop_rlce_params1_t
+{
+  double radius;
+  double slope;
+}
+dt_iop_rlce_params1_t;
 
 typedef struct dt_iop_rlce_params_t
 {
   double radius;
   double slope;
+  int mode;
 }
 dt_iop_rlce_params_t;
 
@@ -51,6 +65,8 @@ typedef struct dt_iop_rlce_gui_data_t
   GtkVBox   *vbox1,  *vbox2;
   GtkWidget  *label1,*label2;
   GtkDarktableSlider *scale1,*scale2;       // radie pixels, slope
+  GtkWidget *label3;
+  GtkComboBox *mode;
 }
 dt_iop_rlce_gui_data_t;
 
@@ -58,6 +74,7 @@ typedef struct dt_iop_rlce_data_t
 {
   double radius;
   double slope;
+  int mode;
 }
 dt_iop_rlce_data_t;
 
@@ -77,6 +94,23 @@ int flags()
   return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_DEPRECATED;
 }
 
+int
+legacy_params (dt_iop_module_t *self, const void *const old_params, const int old_version, void *new_params, const int new_version)
+{
+  if(old_version == 1 && new_version == 2)
+  {
+    const dt_iop_rlce_params1_t *old = old_params;
+    dt_iop_rlce_params_t *new = new_params;
+    memset(new, 0, sizeof(dt_iop_rlce_params_t));
+    new->radius = old->radius;
+    new->slope = old->slope;
+    // keep the look of old edits:
+    new->mode = DT_IOP_RLCE_EXACT;
+    return 0;
+  }
+  return 1;
+}
+
 void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
 {
   dt_iop_rlce_data_t *data = (dt_iop_rlce_data_t *)piece->data;
@@ -105,133 +139,20 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
 
   // Params
   const int rad=data->radius*roi_in->scale/piece->iscale;
-
-  const int bins=256;
   const float slope=data->slope;
 
   // CLAHE
-#ifdef _OPENMP
-  #pragma omp parallel for default(none) schedule(static) shared(luminance,roi_in,roi_out,ivoid,ovoid)
-#endif
-  for(int j=0; j<roi_out->height; j++)
-  {
-    int yMin = fmax( 0, j - rad );
-    int yMax = fmin( roi_in->height, j + rad + 1 );
-    int h = yMax - yMin;
-
-    int xMin0 = fmax( 0, 0-rad );
-    int xMax0 = fmin( roi_in->width - 1, rad );
-
-    int hist[bins+1];
-    int clippedhist[bins+1];
-    float dest[roi_out->width];
+  float *dest = (float *)dt_alloc_align(64, (size_t)roi_out->width*roi_out->height*sizeof(float));
+  if(data->mode == DT_IOP_RLCE_TILED)
+    dt_clahe_tiled(luminance, dest, roi_out->width, roi_out->height, rad, slope);
+  else
+    dt_clahe_exact(luminance, dest, roi_out->width, roi_out->height, rad, slope);
 
-    /* initially fill histogram */
-    memset(hist,0,(bins+1)*sizeof(int));
-    for ( int yi = yMin; yi < yMax; ++yi )
-      for ( int xi = xMin0; xi < xMax0; ++xi )
-        ++hist[ ROUND_POSISTIVE(luminance[yi*roi_in->width+xi] * (float)bins) ];
-
-    // Destination row
-    memset(dest,0,roi_out->width*sizeof(float));
-    float *ld=dest;
-
-    for(int i=0; i<roi_out->width; i++)
-    {
-
-      int v = ROUND_POSISTIVE(luminance[j*roi_in->width+i] * (float)bins);
-
-      int xMin = fmax( 0, i - rad );
-      int xMax = i + rad + 1;
-      int w = fmin( roi_in->width, xMax ) - xMin;
-      int n = h * w;
-
-      int limit = ( int )( slope * n /  bins + 0.5f );
-
-      /* remove left behind values from histogram */
-      if ( xMin > 0 )
-      {
-        int xMin1 = xMin - 1;
-        for ( int yi = yMin; yi < yMax; ++yi )
-          --hist[  ROUND_POSISTIVE(luminance[yi*roi_in->width+xMin1] * (float)bins) ];
-      }
-
-      /* add newly included values to histogram */
-      if ( xMax <= roi_in->width )
-      {
-        int xMax1 = xMax - 1;
-        for ( int yi = yMin; yi < yMax; ++yi )
-          ++hist[  ROUND_POSISTIVE(luminance[yi*roi_in->width+xMax1] * (float)bins) ];
-      }
-
-      /* clip histogram and redistribute clipped entries */
-      memcpy(clippedhist,hist,(bins+1)*sizeof(int));
-      int ce = 0, ceb=0;
-      do
-      {
-        ceb = ce;
-        ce = 0;
-        for ( int b = 0; b <= bins; b++ )
-        {
-          int d = clippedhist[ b ] - limit;
-          if ( d > 0 )
-          {
-            ce += d;
-            clippedhist[ b ] = limit;
-          }
-        }
-
-        int d = (ce / (float) ( bins + 1 ));
-        int m = ce % ( bins + 1 );
-        for ( int h = 0; h <= bins; h++)
-          clippedhist[ h ] += d;
-
-        if ( m != 0 )
-        {
-          int s = bins / (float)m;
-          for ( int h = 0; h <= bins; h += s )
-            ++clippedhist[ h ];
-        }
-      }
-      while ( ce != ceb);
-
-      /* build cdf of clipped histogram */
-      int hMin = bins;
-      for ( int h = 0; h < hMin; h++ )
-        if ( clippedhist[ h ] != 0 ) hMin = h;
-
-      int cdf = 0;
-      for ( int h = hMin; h <= v; h++ )
-        cdf += clippedhist[ h ];
-
-      int cdfMax = cdf;
-      for ( int h = v + 1; h <= bins; h++ )
-        cdfMax += clippedhist[ h ];
-
-      int cdfMin = clippedhist[ hMin ];
-
-      *ld=( cdf - cdfMin ) / ( float )( cdfMax - cdfMin );
-
-      ld++;
-    }
-
-    // Apply row
-    float *in = ((float *)ivoid) + j*roi_out->width*ch;
-    float *out = ((float *)ovoid) + j*roi_out->width*ch;
-    for(int r=0; r<roi_out->width; r++)
-    {
-      float H, S, L;
-      rgb2hsl(in,&H,&S,&L);
-      //hsl2rgb(out,H,S,( L / dest[r] ) * (L-lsmin) + lsmin );
-      hsl2rgb(out,H,S,dest[r] );
-      out += ch;
-      in += ch;
-      ld++;
-    }
-
-  }
+  // Apply: replace lightness, keep hue and saturation
+  dt_clahe_apply((const float *)ivoid, (float *)ovoid, dest, roi_out->width, roi_out->height);
 
   // Cleanup
+  free(dest);
   free(luminance);
 
 }
@@ -256,6 +177,16 @@ slope_callback (GtkDarktableSlider *slider, gpointer user_data)
   dt_dev_add_history_item(darktable.develop, self, TRUE);
 }
 
+static void
+mode_callback (GtkComboBox *combo, gpointer user_data)
+{
+  dt_iop_module_t *self = (dt_iop_module_t *)user_data;
+  if(self->dt->gui->reset) return;
+  dt_iop_rlce_params_t *p = (dt_iop_rlce_params_t *)self->params;
+  p->mode = gtk_combo_box_get_active(combo);
+  dt_dev_add_history_item(darktable.develop, self, TRUE);
+}
+
 
 
 void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -268,6 +199,7 @@ void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pi
   dt_iop_rlce_data_t *d = (dt_iop_rlce_data_t *)piece->data;
   d->radius = p->radius;
   d->slope = p->slope;
+  d->mode = p->mode;
 #endif
 }
 
@@ -301,6 +233,7 @@ void gui_update(struct dt_iop_module_t *self)
   dt_iop_rlce_params_t *p = (dt_iop_rlce_params_t *)module->params;
   dtgtk_slider_set_value(g->scale1, p->radius);
   dtgtk_slider_set_value(g->scale2, p->slope);
+  gtk_combo_box_set_active(g->mode, p->mode);
 }
 
 void init(dt_iop_module_t *module)
@@ -311,10 +244,11 @@ void init(dt_iop_module_t *module)
   module->priority = 925; // module order created by iop_dependencies.py, do not edit!
   module->params_size = sizeof(dt_iop_rlce_params_t);
   module->gui_data = NULL;
-  dt_iop_rlce_params_t tmp = (dt_iop_rlce_params_t)
-  {
-    64,1.25
-  };
+  dt_iop_rlce_params_t tmp;
+  memset(&tmp, 0, sizeof(dt_iop_rlce_params_t));
+  tmp.radius = 64;
+  tmp.slope = 1.25;
+  tmp.mode = DT_IOP_RLCE_TILED;
   memcpy(module->params, &tmp, sizeof(dt_iop_rlce_params_t));
   memcpy(module->default_params, &tmp, sizeof(dt_iop_rlce_params_t));
 }
@@ -343,6 +277,8 @@ void gui_init(struct dt_iop_module_t *self)
   gtk_box_pack_start(GTK_BOX(g->vbox1), g->label1, TRUE, TRUE, 0);
   g->label2 = dtgtk_reset_label_new(_("amount"), self, &p->slope, sizeof(float));
   gtk_box_pack_start(GTK_BOX(g->vbox1), g->label2, TRUE, TRUE, 0);
+  g->label3 = dtgtk_reset_label_new(_("mode"), self, &p->mode, sizeof(int));
+  gtk_box_pack_start(GTK_BOX(g->vbox1), g->label3, TRUE, TRUE, 0);
 
   g->scale1 = DTGTK_SLIDER(dtgtk_slider_new_with_range(DARKTABLE_SLIDER_BAR,0.0, 256.0, 1.0, p->radius, 0));
   g->scale2 = DTGTK_SLIDER(dtgtk_slider_new_with_range(DARKTABLE_SLIDER_BAR,1.0, 3.0, 0.05, p->slope, 2));
@@ -350,13 +286,21 @@ void gui_init(struct dt_iop_module_t *self)
 
   gtk_box_pack_start(GTK_BOX(g->vbox2), GTK_WIDGET(g->scale1), TRUE, TRUE, 0);
   gtk_box_pack_start(GTK_BOX(g->vbox2), GTK_WIDGET(g->scale2), TRUE, TRUE, 0);
+  g->mode = GTK_COMBO_BOX(gtk_combo_box_new_text());
+  gtk_combo_box_append_text(g->mode, _("exact"));
+  gtk_combo_box_append_text(g->mode, _("tiled (fast)"));
+  gtk_combo_box_set_active(g->mode, p->mode);
+  gtk_box_pack_start(GTK_BOX(g->vbox2), GTK_WIDGET(g->mode), TRUE, TRUE, 0);
   g_object_set(G_OBJECT(g->scale1), "tooltip-text", _("size of features to preserve"), (char *)NULL);
   g_object_set(G_OBJECT(g->scale2), "tooltip-text", _("strength of the effect"), (char *)NULL);
+  g_object_set(G_OBJECT(g->mode), "tooltip-text", _("exact is slow for large radii, tiled interpolates between per-tile curves"), (char *)NULL);
 
   g_signal_connect (G_OBJECT (g->scale1), "value-changed",
                     G_CALLBACK (radius_callback), self);
   g_signal_connect (G_OBJECT (g->scale2), "value-changed",
                     G_CALLBACK (slope_callback), self);
+  g_signal_connect (G_OBJECT (g->mode), "changed",
+                    G_CALLBACK (mode_callback), self);
 }
 
 void gui_cleanup(struct dt_iop_module_t *self)
@@ -34,6 +34,9 @@
 #include "common/imageio_jpeg.h"
 #include "external/adobe_coeff.c"
 #include <xmmintrin.h>
+#if defined(DT_HAVE_AVX2_TARGET) || defined(DT_HAVE_AVX512_TARGET)
+#include <immintrin.h>
+#endif
 #include <stdlib.h>
 #include <math.h>
 #include <assert.h>
@@ -64,7 +67,7 @@ groups ()
 int
 flags ()
 {
-  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE;
+  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_COMMIT_PER_IMAGE;
 }
 
 void
@@ -219,6 +222,192 @@ dt_XYZ_to_Lab_SSE(const __m128 XYZ)
   return _mm_mul_ps(coef,_mm_sub_ps(_mm_shuffle_ps(f,f,_MM_SHUFFLE(3,1,0,1)),_mm_shuffle_ps(f,f,_MM_SHUFFLE(3,2,1,3))));
 }
 
+/* input lut (or extrapolation) and blue gamut mapping for one pixel. stays scalar,
+   the row functions below only differ in how many pixels go through the matrix and
+   the Lab conversion at once. */
+static inline __attribute__((always_inline)) void
+_colorin_cam(const dt_iop_colorin_data_t *const d, const float *const buf_in, const int map_blues, float *cam)
+{
+  // memcpy(cam, buf_in, sizeof(float)*3);
+  // avoid calling this for linear profiles (marked with negative entries), assures unbounded
+  // color management without extrapolation.
+  for(int i=0; i<3; i++) cam[i] = (d->lut[i][0] >= 0.0f) ?
+                                    ((buf_in[i] < 1.0f) ? lerp_lut(d->lut[i], buf_in[i])
+                                     : dt_iop_eval_exp(d->unbounded_coeffs[i], buf_in[i]))
+                                      : buf_in[i];
+
+  const float YY = cam[0]+cam[1]+cam[2];
+  if(map_blues && YY > 0.0f)
+  {
+    // manual gamut mapping. these values cause trouble when converting back from Lab to sRGB.
+    // deeply saturated blues turn into purple fringes, so dampen them before conversion.
+    // this is off for non-raw images, which don't seem to have this problem.
+    // might be caused by too loose clipping bounds during highlight clipping?
+    const float zz = cam[2]/YY;
+    // lower amount and higher bound_z make the effect smaller.
+    // the effect is weakened the darker input values are, saturating at bound_Y
+    const float bound_z = 0.5f, bound_Y = 0.8f;
+    const float amount = 0.11f;
+    if (zz > bound_z)
+    {
+      const float t = (zz - bound_z)/(1.0f-bound_z) * fminf(1.0f, YY/bound_Y);
+      cam[1] += t*amount;
+      cam[2] -= t*amount;
+    }
+  }
+}
+
+typedef void (_colorin_row_func)(const dt_iop_colorin_data_t *const d, const float *buf_in, float *buf_out, const int width, const int ch, const int map_blues);
+
+static void
+_colorin_row_sse(const dt_iop_colorin_data_t *const d, const float *buf_in, float *buf_out, const int width, const int ch, const int map_blues)
+{
+  const float *const mat = d->cmatrix;
+  float cam[3];
+  const __m128 m0 = _mm_set_ps(0.0f,mat[6],mat[3],mat[0]);
+  const __m128 m1 = _mm_set_ps(0.0f,mat[7],mat[4],mat[1]);
+  const __m128 m2 = _mm_set_ps(0.0f,mat[8],mat[5],mat[2]);
+
+  for(int i=0; i<width; i++, buf_in+=ch, buf_out+=ch )
+  {
+    _colorin_cam(d, buf_in, map_blues, cam);
+
+#if 0
+    __attribute__((aligned(16))) float XYZ[4];
+    _mm_store_ps(XYZ,_mm_add_ps(_mm_add_ps( _mm_mul_ps(m0,_mm_set1_ps(cam[0])), _mm_mul_ps(m1,_mm_set1_ps(cam[1]))), _mm_mul_ps(m2,_mm_set1_ps(cam[2]))));
+    dt_XYZ_to_Lab(XYZ, buf_out);
+#endif
+    __m128 xyz = _mm_add_ps(_mm_add_ps( _mm_mul_ps(m0,_mm_set1_ps(cam[0])), _mm_mul_ps(m1,_mm_set1_ps(cam[1]))), _mm_mul_ps(m2,_mm_set1_ps(cam[2])));
+    _mm_stream_ps(buf_out,dt_XYZ_to_Lab_SSE(xyz));
+  }
+}
+
+#ifdef DT_HAVE_AVX2_TARGET
+static inline DT_TARGET_AVX2 __m256
+lab_f_m_avx2(const __m256 x)
+{
+  const __m256 epsilon = _mm256_set1_ps(216.0f/24389.0f);
+  const __m256 kappa   = _mm256_set1_ps(24389.0f/27.0f);
+
+  const __m256 a = _mm256_castsi256_ps(_mm256_add_epi32(_mm256_cvtps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(_mm256_castps_si256(x)),_mm256_set1_ps(3.0f))),_mm256_set1_epi32(709921077)));
+  const __m256 a3 = _mm256_mul_ps(_mm256_mul_ps(a,a),a);
+  const __m256 res_big = _mm256_div_ps(_mm256_mul_ps(a,_mm256_add_ps(a3,_mm256_add_ps(x,x))),_mm256_add_ps(_mm256_add_ps(a3,a3),x));
+
+  const __m256 res_small = _mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(kappa,x),_mm256_set1_ps(16.0f)),_mm256_set1_ps(116.0f));
+
+  const __m256 mask = _mm256_cmp_ps(x,epsilon,_CMP_GT_OS);
+  return _mm256_or_ps(_mm256_and_ps(mask,res_big),_mm256_andnot_ps(mask,res_small));
+}
+
+static inline DT_TARGET_AVX2 __m256
+dt_XYZ_to_Lab_avx2(const __m256 XYZ)
+{
+  const __m256 d50_inv  = _mm256_set_ps(0.0f, 1.0f/0.8249f, 1.0f, 1.0f/0.9642f, 0.0f, 1.0f/0.8249f, 1.0f, 1.0f/0.9642f);
+  const __m256 coef = _mm256_set_ps(0.0f,200.0f,500.0f,116.0f,0.0f,200.0f,500.0f,116.0f);
+  const __m256 f = lab_f_m_avx2(_mm256_mul_ps(XYZ,d50_inv));
+  // shuffles work per 128 bit lane, so this is the same as the sse version for both pixels
+  return _mm256_mul_ps(coef,_mm256_sub_ps(_mm256_shuffle_ps(f,f,_MM_SHUFFLE(3,1,0,1)),_mm256_shuffle_ps(f,f,_MM_SHUFFLE(3,2,1,3))));
+}
+
+static inline DT_TARGET_AVX2 __m256
+_colorin_pair(const float *const c0, const float *const c1)
+{
+  return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(*c0)), _mm_set1_ps(*c1), 1);
+}
+
+/* two pixels per ymm register. the output rows are only 16 byte aligned, so the
+   two halves get streamed separately. */
+static DT_TARGET_AVX2 void
+_colorin_row_avx2(const dt_iop_colorin_data_t *const d, const float *buf_in, float *buf_out, const int width, const int ch, const int map_blues)
+{
+  const float *const mat = d->cmatrix;
+  float cam0[3], cam1[3];
+  const __m128 n0 = _mm_set_ps(0.0f,mat[6],mat[3],mat[0]);
+  const __m128 n1 = _mm_set_ps(0.0f,mat[7],mat[4],mat[1]);
+  const __m128 n2 = _mm_set_ps(0.0f,mat[8],mat[5],mat[2]);
+  const __m256 m0 = _mm256_insertf128_ps(_mm256_castps128_ps256(n0), n0, 1);
+  const __m256 m1 = _mm256_insertf128_ps(_mm256_castps128_ps256(n1), n1, 1);
+  const __m256 m2 = _mm256_insertf128_ps(_mm256_castps128_ps256(n2), n2, 1);
+
+  int i=0;
+  for(; i+2<=width; i+=2, buf_in+=2*ch, buf_out+=2*ch)
+  {
+    _colorin_cam(d, buf_in, map_blues, cam0);
+    _colorin_cam(d, buf_in+ch, map_blues, cam1);
+
+    const __m256 xyz = _mm256_fmadd_ps(m2,_colorin_pair(cam0+2,cam1+2), _mm256_fmadd_ps(m1,_colorin_pair(cam0+1,cam1+1), _mm256_mul_ps(m0,_colorin_pair(cam0+0,cam1+0))));
+    const __m256 Lab = dt_XYZ_to_Lab_avx2(xyz);
+    _mm_stream_ps(buf_out, _mm256_castps256_ps128(Lab));
+    _mm_stream_ps(buf_out+ch, _mm256_extractf128_ps(Lab, 1));
+  }
+  if(i < width) _colorin_row_sse(d, buf_in, buf_out, width-i, ch, map_blues);
+}
+#else
+#define _colorin_row_avx2 NULL
+#endif
+
+#ifdef DT_HAVE_AVX512_TARGET
+static inline DT_TARGET_AVX512 __m512
+lab_f_m_avx512(const __m512 x)
+{
+  const __m512 epsilon = _mm512_set1_ps(216.0f/24389.0f);
+  const __m512 kappa   = _mm512_set1_ps(24389.0f/27.0f);
+
+  const __m512 a = _mm512_castsi512_ps(_mm512_add_epi32(_mm512_cvtps_epi32(_mm512_div_ps(_mm512_cvtepi32_ps(_mm512_castps_si512(x)),_mm512_set1_ps(3.0f))),_mm512_set1_epi32(709921077)));
+  const __m512 a3 = _mm512_mul_ps(_mm512_mul_ps(a,a),a);
+  const __m512 res_big = _mm512_div_ps(_mm512_mul_ps(a,_mm512_add_ps(a3,_mm512_add_ps(x,x))),_mm512_add_ps(_mm512_add_ps(a3,a3),x));
+
+  const __m512 res_small = _mm512_div_ps(_mm512_add_ps(_mm512_mul_ps(kappa,x),_mm512_set1_ps(16.0f)),_mm512_set1_ps(116.0f));
+
+  const __mmask16 mask = _mm512_cmp_ps_mask(x,epsilon,_CMP_GT_OS);
+  return _mm512_mask_blend_ps(mask,res_small,res_big);
+}
+
+static inline DT_TARGET_AVX512 __m512
+dt_XYZ_to_Lab_avx512(const __m512 XYZ)
+{
+  const __m512 d50_inv  = _mm512_broadcast_f32x4(_mm_set_ps(0.0f, 1.0f/0.8249f, 1.0f, 1.0f/0.9642f));
+  const __m512 coef = _mm512_broadcast_f32x4(_mm_set_ps(0.0f,200.0f,500.0f,116.0f));
+  const __m512 f = lab_f_m_avx512(_mm512_mul_ps(XYZ,d50_inv));
+  // shuffles work per 128 bit lane, so this is the same as the sse version for all four pixels
+  return _mm512_mul_ps(coef,_mm512_sub_ps(_mm512_shuffle_ps(f,f,_MM_SHUFFLE(3,1,0,1)),_mm512_shuffle_ps(f,f,_MM_SHUFFLE(3,2,1,3))));
+}
+
+static inline DT_TARGET_AVX512 __m512
+_colorin_quad(const float cam[4][3], const int k)
+{
+  return _mm512_set_ps(cam[3][k], cam[3][k], cam[3][k], cam[3][k], cam[2][k], cam[2][k], cam[2][k], cam[2][k],
+                       cam[1][k], cam[1][k], cam[1][k], cam[1][k], cam[0][k], cam[0][k], cam[0][k], cam[0][k]);
+}
+
+/* four pixels per zmm register, streamed out one 128 bit lane at a time like the avx2 version. */
+static DT_TARGET_AVX512 void
+_colorin_row_avx512(const dt_iop_colorin_data_t *const d, const float *buf_in, float *buf_out, const int width, const int ch, const int map_blues)
+{
+  const float *const mat = d->cmatrix;
+  float cam[4][3];
+  const __m512 m0 = _mm512_broadcast_f32x4(_mm_set_ps(0.0f,mat[6],mat[3],mat[0]));
+  const __m512 m1 = _mm512_broadcast_f32x4(_mm_set_ps(0.0f,mat[7],mat[4],mat[1]));
+  const __m512 m2 = _mm512_broadcast_f32x4(_mm_set_ps(0.0f,mat[8],mat[5],mat[2]));
+
+  int i=0;
+  for(; i+4<=width; i+=4, buf_in+=4*ch, buf_out+=4*ch)
+  {
+    for(int k=0; k<4; k++) _colorin_cam(d, buf_in+k*ch, map_blues, cam[k]);
+
+    const __m512 xyz = _mm512_fmadd_ps(m2,_colorin_quad(cam,2), _mm512_fmadd_ps(m1,_colorin_quad(cam,1), _mm512_mul_ps(m0,_colorin_quad(cam,0))));
+    const __m512 Lab = dt_XYZ_to_Lab_avx512(xyz);
+    _mm_stream_ps(buf_out, _mm512_extractf32x4_ps(Lab, 0));
+    _mm_stream_ps(buf_out+ch, _mm512_extractf32x4_ps(Lab, 1));
+    _mm_stream_ps(buf_out+2*ch, _mm512_extractf32x4_ps(Lab, 2));
+    _mm_stream_ps(buf_out+3*ch, _mm512_extractf32x4_ps(Lab, 3));
+  }
+  if(i < width) _colorin_row_sse(d, buf_in, buf_out, width-i, ch, map_blues);
+}
+#else
+#define _colorin_row_avx512 NULL
+#endif
+
 void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
 {
   const dt_iop_colorin_data_t *const d = (dt_iop_colorin_data_t *)piece->data;
@@ -231,58 +420,15 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   if(mat[0] != -666.0f)
   {
     // only color matrix. use our optimized fast path!
+    _colorin_row_func *const row = dt_cpu_dispatch(_colorin_row_sse, _colorin_row_avx2, _colorin_row_avx512);
 #ifdef _OPENMP
     #pragma omp parallel for default(none) shared(roi_in,roi_out, out, in) schedule(static)
 #endif
     for(int j=0; j<roi_out->height; j++)
     {
-
-      float *buf_in  = in + ch*roi_in->width *j;
+      const float *buf_in  = in + ch*roi_in->width *j;
       float *buf_out = out + ch*roi_out->width*j;
-      float cam[3];
-      const __m128 m0 = _mm_set_ps(0.0f,mat[6],mat[3],mat[0]);
-      const __m128 m1 = _mm_set_ps(0.0f,mat[7],mat[4],mat[1]);
-      const __m128 m2 = _mm_set_ps(0.0f,mat[8],mat[5],mat[2]);
-
-      for(int i=0; i<roi_out->width; i++, buf_in+=ch, buf_out+=ch )
-      {
-
-        // memcpy(cam, buf_in, sizeof(float)*3);
-        // avoid calling this for linear profiles (marked with negative entries), assures unbounded
-        // color management without extrapolation.
-        for(int i=0; i<3; i++) cam[i] = (d->lut[i][0] >= 0.0f) ?
-                                          ((buf_in[i] < 1.0f) ? lerp_lut(d->lut[i], buf_in[i])
-                                           : dt_iop_eval_exp(d->unbounded_coeffs[i], buf_in[i]))
-                                            : buf_in[i];
-
-        const float YY = cam[0]+cam[1]+cam[2];
-        if(map_blues && YY > 0.0f)
-        {
-          // manual gamut mapping. these values cause trouble when converting back from Lab to sRGB.
-          // deeply saturated blues turn into purple fringes, so dampen them before conversion.
-          // this is off for non-raw images, which don't seem to have this problem.
-          // might be caused by too loose clipping bounds during highlight clipping?
-          const float zz = cam[2]/YY;
-          // lower amount and higher bound_z make the effect smaller.
-          // the effect is weakened the darker input values are, saturating at bound_Y
-          const float bound_z = 0.5f, bound_Y = 0.8f;
-          const float amount = 0.11f;
-          if (zz > bound_z)
-          {
-            const float t = (zz - bound_z)/(1.0f-bound_z) * fminf(1.0f, YY/bound_Y);
-            cam[1] += t*amount;
-            cam[2] -= t*amount;
-          }
-        }
-
-#if 0
-        __attribute__((aligned(16))) float XYZ[4];
-        _mm_store_ps(XYZ,_mm_add_ps(_mm_add_ps( _mm_mul_ps(m0,_mm_set1_ps(cam[0])), _mm_mul_ps(m1,_mm_set1_ps(cam[1]))), _mm_mul_ps(m2,_mm_set1_ps(cam[2]))));
-        dt_XYZ_to_Lab(XYZ, buf_out);
-#endif
-        __m128 xyz = _mm_add_ps(_mm_add_ps( _mm_mul_ps(m0,_mm_set1_ps(cam[0])), _mm_mul_ps(m1,_mm_set1_ps(cam[1]))), _mm_mul_ps(m2,_mm_set1_ps(cam[2])));
-        _mm_stream_ps(buf_out,dt_XYZ_to_Lab_SSE(xyz));
-      }
+      row(d, buf_in, buf_out, roi_out->width, ch, map_blues);
     }
     _mm_sfence();
   }
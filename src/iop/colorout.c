@@ -30,6 +30,9 @@
 #include "common/opencl.h"
 
 #include <xmmintrin.h>
+#if defined(DT_HAVE_AVX2_TARGET) || defined(DT_HAVE_AVX512_TARGET)
+#include <immintrin.h>
+#endif
 #include <stdlib.h>
 #include <math.h>
 #include <assert.h>
@@ -376,6 +379,137 @@ dt_Lab_to_XYZ_SSE(const __m128 Lab)
   return _mm_mul_ps(d50,lab_f_inv_m(_mm_add_ps(_mm_add_ps(f,_mm_shuffle_ps(f,f,_MM_SHUFFLE(1,1,3,1))),offset)));
 }
 
+typedef void (_colorout_row_func)(const dt_iop_colorout_data_t *const d, const float *in, float *out, const int width, const int ch);
+
+static void
+_colorout_row_sse(const dt_iop_colorout_data_t *const d, const float *in, float *out, const int width, const int ch)
+{
+  const __m128 m0 = _mm_set_ps(0.0f,d->cmatrix[6],d->cmatrix[3],d->cmatrix[0]);
+  const __m128 m1 = _mm_set_ps(0.0f,d->cmatrix[7],d->cmatrix[4],d->cmatrix[1]);
+  const __m128 m2 = _mm_set_ps(0.0f,d->cmatrix[8],d->cmatrix[5],d->cmatrix[2]);
+
+  for(int i=0; i<width; i++, in+=ch, out+=ch )
+  {
+    const __m128 xyz = dt_Lab_to_XYZ_SSE(_mm_load_ps(in));
+    const __m128 t = _mm_add_ps(_mm_mul_ps(m0,_mm_shuffle_ps(xyz,xyz,_MM_SHUFFLE(0,0,0,0))),_mm_add_ps(_mm_mul_ps(m1,_mm_shuffle_ps(xyz,xyz,_MM_SHUFFLE(1,1,1,1))),_mm_mul_ps(m2,_mm_shuffle_ps(xyz,xyz,_MM_SHUFFLE(2,2,2,2)))));
+
+    _mm_stream_ps(out,t);
+  }
+}
+
+#ifdef DT_HAVE_AVX2_TARGET
+static inline DT_TARGET_AVX2 __m256
+lab_f_inv_m_avx2(const __m256 x)
+{
+  const __m256 epsilon = _mm256_set1_ps(0.20689655172413796f); // cbrtf(216.0f/24389.0f);
+  const __m256 kappa_rcp_x16   = _mm256_set1_ps(16.0f*27.0f/24389.0f);
+  const __m256 kappa_rcp_x116   = _mm256_set1_ps(116.0f*27.0f/24389.0f);
+
+  const __m256 res_big   = _mm256_mul_ps(_mm256_mul_ps(x,x),x);
+  const __m256 res_small = _mm256_fmsub_ps(kappa_rcp_x116,x,kappa_rcp_x16);
+
+  const __m256 mask = _mm256_cmp_ps(x,epsilon,_CMP_GT_OS);
+  return _mm256_or_ps(_mm256_and_ps(mask,res_big),_mm256_andnot_ps(mask,res_small));
+}
+
+static inline DT_TARGET_AVX2 __m256
+dt_Lab_to_XYZ_avx2(const __m256 Lab)
+{
+  const __m256 d50    = _mm256_set_ps(0.0f, 0.8249f, 1.0f, 0.9642f, 0.0f, 0.8249f, 1.0f, 0.9642f);
+  const __m256 coef   = _mm256_set_ps(0.0f,-1.0f/200.0f,1.0f/116.0f,1.0f/500.0f,0.0f,-1.0f/200.0f,1.0f/116.0f,1.0f/500.0f);
+  const __m256 offset = _mm256_set1_ps(0.137931034f);
+
+  // shuffles work per 128 bit lane, so this is the same as the sse version for both pixels
+  const __m256 f = _mm256_mul_ps(_mm256_shuffle_ps(Lab,Lab,_MM_SHUFFLE(0,2,0,1)),coef);
+
+  return _mm256_mul_ps(d50,lab_f_inv_m_avx2(_mm256_add_ps(_mm256_add_ps(f,_mm256_shuffle_ps(f,f,_MM_SHUFFLE(1,1,3,1))),offset)));
+}
+
+/* two pixels per ymm register, the matrix is applied with fused mul+add. rows are
+   only 16 byte aligned, so the halves are loaded and streamed separately. */
+static DT_TARGET_AVX2 void
+_colorout_row_avx2(const dt_iop_colorout_data_t *const d, const float *in, float *out, const int width, const int ch)
+{
+  const __m128 n0 = _mm_set_ps(0.0f,d->cmatrix[6],d->cmatrix[3],d->cmatrix[0]);
+  const __m128 n1 = _mm_set_ps(0.0f,d->cmatrix[7],d->cmatrix[4],d->cmatrix[1]);
+  const __m128 n2 = _mm_set_ps(0.0f,d->cmatrix[8],d->cmatrix[5],d->cmatrix[2]);
+  const __m256 m0 = _mm256_insertf128_ps(_mm256_castps128_ps256(n0), n0, 1);
+  const __m256 m1 = _mm256_insertf128_ps(_mm256_castps128_ps256(n1), n1, 1);
+  const __m256 m2 = _mm256_insertf128_ps(_mm256_castps128_ps256(n2), n2, 1);
+
+  int i=0;
+  for(; i+2<=width; i+=2, in+=2*ch, out+=2*ch)
+  {
+    const __m256 Lab = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_load_ps(in)), _mm_load_ps(in+ch), 1);
+    const __m256 xyz = dt_Lab_to_XYZ_avx2(Lab);
+    const __m256 t = _mm256_fmadd_ps(m0,_mm256_shuffle_ps(xyz,xyz,_MM_SHUFFLE(0,0,0,0)),_mm256_fmadd_ps(m1,_mm256_shuffle_ps(xyz,xyz,_MM_SHUFFLE(1,1,1,1)),_mm256_mul_ps(m2,_mm256_shuffle_ps(xyz,xyz,_MM_SHUFFLE(2,2,2,2)))));
+
+    _mm_stream_ps(out, _mm256_castps256_ps128(t));
+    _mm_stream_ps(out+ch, _mm256_extractf128_ps(t, 1));
+  }
+  if(i < width) _colorout_row_sse(d, in, out, width-i, ch);
+}
+#else
+#define _colorout_row_avx2 NULL
+#endif
+
+#ifdef DT_HAVE_AVX512_TARGET
+static inline DT_TARGET_AVX512 __m512
+lab_f_inv_m_avx512(const __m512 x)
+{
+  const __m512 epsilon = _mm512_set1_ps(0.20689655172413796f); // cbrtf(216.0f/24389.0f);
+  const __m512 kappa_rcp_x16   = _mm512_set1_ps(16.0f*27.0f/24389.0f);
+  const __m512 kappa_rcp_x116   = _mm512_set1_ps(116.0f*27.0f/24389.0f);
+
+  const __m512 res_big   = _mm512_mul_ps(_mm512_mul_ps(x,x),x);
+  const __m512 res_small = _mm512_fmsub_ps(kappa_rcp_x116,x,kappa_rcp_x16);
+
+  const __mmask16 mask = _mm512_cmp_ps_mask(x,epsilon,_CMP_GT_OS);
+  return _mm512_mask_blend_ps(mask,res_small,res_big);
+}
+
+static inline DT_TARGET_AVX512 __m512
+dt_Lab_to_XYZ_avx512(const __m512 Lab)
+{
+  const __m512 d50    = _mm512_broadcast_f32x4(_mm_set_ps(0.0f, 0.8249f, 1.0f, 0.9642f));
+  const __m512 coef   = _mm512_broadcast_f32x4(_mm_set_ps(0.0f,-1.0f/200.0f,1.0f/116.0f,1.0f/500.0f));
+  const __m512 offset = _mm512_set1_ps(0.137931034f);
+
+  // shuffles work per 128 bit lane, so this is the same as the sse version for all four pixels
+  const __m512 f = _mm512_mul_ps(_mm512_shuffle_ps(Lab,Lab,_MM_SHUFFLE(0,2,0,1)),coef);
+
+  return _mm512_mul_ps(d50,lab_f_inv_m_avx512(_mm512_add_ps(_mm512_add_ps(f,_mm512_shuffle_ps(f,f,_MM_SHUFFLE(1,1,3,1))),offset)));
+}
+
+/* four pixels per zmm register, loaded and streamed one 128 bit lane at a time like the avx2 version. */
+static DT_TARGET_AVX512 void
+_colorout_row_avx512(const dt_iop_colorout_data_t *const d, const float *in, float *out, const int width, const int ch)
+{
+  const __m512 m0 = _mm512_broadcast_f32x4(_mm_set_ps(0.0f,d->cmatrix[6],d->cmatrix[3],d->cmatrix[0]));
+  const __m512 m1 = _mm512_broadcast_f32x4(_mm_set_ps(0.0f,d->cmatrix[7],d->cmatrix[4],d->cmatrix[1]));
+  const __m512 m2 = _mm512_broadcast_f32x4(_mm_set_ps(0.0f,d->cmatrix[8],d->cmatrix[5],d->cmatrix[2]));
+
+  int i=0;
+  for(; i+4<=width; i+=4, in+=4*ch, out+=4*ch)
+  {
+    __m512 Lab = _mm512_castps128_ps512(_mm_load_ps(in));
+    Lab = _mm512_insertf32x4(Lab, _mm_load_ps(in+ch), 1);
+    Lab = _mm512_insertf32x4(Lab, _mm_load_ps(in+2*ch), 2);
+    Lab = _mm512_insertf32x4(Lab, _mm_load_ps(in+3*ch), 3);
+    const __m512 xyz = dt_Lab_to_XYZ_avx512(Lab);
+    const __m512 t = _mm512_fmadd_ps(m0,_mm512_shuffle_ps(xyz,xyz,_MM_SHUFFLE(0,0,0,0)),_mm512_fmadd_ps(m1,_mm512_shuffle_ps(xyz,xyz,_MM_SHUFFLE(1,1,1,1)),_mm512_mul_ps(m2,_mm512_shuffle_ps(xyz,xyz,_MM_SHUFFLE(2,2,2,2)))));
+
+    _mm_stream_ps(out, _mm512_extractf32x4_ps(t, 0));
+    _mm_stream_ps(out+ch, _mm512_extractf32x4_ps(t, 1));
+    _mm_stream_ps(out+2*ch, _mm512_extractf32x4_ps(t, 2));
+    _mm_stream_ps(out+3*ch, _mm512_extractf32x4_ps(t, 3));
+  }
+  if(i < width) _colorout_row_sse(d, in, out, width-i, ch);
+}
+#else
+#define _colorout_row_avx512 NULL
+#endif
+
 void
 process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
 {
@@ -387,25 +521,16 @@ process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoi
   {
     //fprintf(stderr,"Using cmatrix codepath\n");
     // convert to rgb using matrix
+    _colorout_row_func *const row = dt_cpu_dispatch(_colorout_row_sse, _colorout_row_avx2, _colorout_row_avx512);
 #ifdef _OPENMP
     #pragma omp parallel for schedule(static) default(none) shared(roi_in,roi_out, ivoid, ovoid)
 #endif
     for(int j=0; j<roi_out->height; j++)
     {
 
-      float *in  = (float*)ivoid + ch*roi_in->width *j;
+      const float *in  = (const float*)ivoid + ch*roi_in->width *j;
       float *out = (float*)ovoid + ch*roi_out->width*j;
-      const __m128 m0 = _mm_set_ps(0.0f,d->cmatrix[6],d->cmatrix[3],d->cmatrix[0]);
-      const __m128 m1 = _mm_set_ps(0.0f,d->cmatrix[7],d->cmatrix[4],d->cmatrix[1]);
-      const __m128 m2 = _mm_set_ps(0.0f,d->cmatrix[8],d->cmatrix[5],d->cmatrix[2]);
-
-      for(int i=0; i<roi_out->width; i++, in+=ch, out+=ch )
-      {
-        const __m128 xyz = dt_Lab_to_XYZ_SSE(_mm_load_ps(in));
-        const __m128 t = _mm_add_ps(_mm_mul_ps(m0,_mm_shuffle_ps(xyz,xyz,_MM_SHUFFLE(0,0,0,0))),_mm_add_ps(_mm_mul_ps(m1,_mm_shuffle_ps(xyz,xyz,_MM_SHUFFLE(1,1,1,1))),_mm_mul_ps(m2,_mm_shuffle_ps(xyz,xyz,_MM_SHUFFLE(2,2,2,2)))));
-
-        _mm_stream_ps(out,t);
-      }
+      row(d, in, out, roi_out->width, ch);
     }
     _mm_sfence();
     // apply profile
@@ -818,9 +818,17 @@ void process(
 
   const int max_scale = 3;
 
+  // detail buffers come from the pipe's scratch arena, they are reused by the next run:
   float *buf[max_scale+2];
   for(int k=0;k<=max_scale;k++)
-    buf[k] = dt_alloc_align(64, 4*sizeof(float)*roi_in->width*roi_in->height);
+  {
+    buf[k] = dt_dev_pixelpipe_scratch_get(&piece->pipe->scratch, k, 4*sizeof(float)*roi_in->width*roi_in->height);
+    if(!buf[k])
+    {
+      fprintf(stderr, "[denoiseprofile] failed to allocate wavelet buffers!\n");
+      return;
+    }
+  }
   buf[max_scale+1] = (float *)ovoid;
 
   const float wb[3] = {
@@ -855,12 +863,15 @@ void process(
 
   for(int scale=0; scale<max_scale; scale++)
   {
+    // every scale is a pass over the whole image, stop here if the output became obsolete.
+    if(dt_dev_pixelpipe_piece_cancelled(piece)) return;
     eaw_decompose (buf[scale+2], cur, buf[scale], scale, 0.0f, width, height);
     cur = buf[scale+2];
   }
 
   for(int scale=max_scale-1; scale>=0; scale--)
   {
+    if(dt_dev_pixelpipe_piece_cancelled(piece)) return;
     const float sigma = sigma_n/pow(sqrtf(2.0), scale);
     // determine thrs as bayesshrink
     // TODO: parallelize!
@@ -894,9 +905,6 @@ void process(
 
   backtransform((float *)ovoid, width, height, aa, bb);
 
-  for(int k=0;k<=max_scale;k++)
-    free(buf[k]);
-
   if(piece->pipe->mask_display)
     dt_iop_alpha_copy(ivoid, ovoid, width, height);
 }
@@ -946,6 +954,13 @@ void process(
   {
     for(int ki=-K; ki<=K; ki++)
     {
+      // every shift is a pass over the whole image, stop here if the output became obsolete.
+      if(dt_dev_pixelpipe_piece_cancelled(piece))
+      {
+        free(Sa);
+        free(in);
+        return;
+      }
       // TODO: adaptive K tests here!
       // TODO: expf eval for real bilateral experience :)
 
@@ -1007,7 +1007,7 @@ static gboolean dt_iop_densitycurve_expose(GtkWidget *widget, GdkEventExpose *ev
   if(hist_max > 0)
   {
     cairo_save(cr);
-    cairo_scale(cr, width/63.0, -(height-5)/(float)hist_max);
+    cairo_scale(cr, width/(DT_HISTOGRAM_BINS-1.0), -(height-5)/(float)hist_max);
     cairo_set_source_rgba(cr, .2, .2, .2, 0.5);
     dt_gui_histogram_draw_8(cr, hist, 3);
     cairo_restore(cr);
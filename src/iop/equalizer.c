@@ -82,15 +82,25 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   const int numl_cap = MIN(DT_IOP_EQUALIZER_MAX_LEVEL-l1+1.5, numl);
   // printf("level range in %d %d: %f %f, cap: %d\n", 1, d->num_levels, l1, lm, numl_cap);
 
-  // TODO: fixed alloc for data piece at capped resolution?
+  // weight buffers live in the pipe's scratch arena, so repeated runs don't allocate:
   float **tmp = (float **)malloc(sizeof(float *)*numl_cap);
   for(int k=1; k<numl_cap; k++)
   {
     const int wd = (int)(1 + (width>>(k-1))), ht = (int)(1 + (height>>(k-1)));
-    tmp[k] = (float *)malloc(sizeof(float)*wd*ht);
+    tmp[k] = (float *)dt_dev_pixelpipe_scratch_get(&piece->pipe->scratch, k-1, sizeof(float)*wd*ht);
+    if(!tmp[k])
+    {
+      fprintf(stderr, "[equalizer] failed to allocate weight buffers!\n");
+      free(tmp);
+      return;
+    }
   }
 
-  for(int level=1; level<numl_cap; level++) dt_iop_equalizer_wtf(out, tmp, level, width, height);
+  for(int level=1; level<numl_cap; level++)
+  {
+    if(dt_dev_pixelpipe_piece_cancelled(piece)) { free(tmp); return; }
+    dt_iop_equalizer_wtf(out, tmp, level, width, height);
+  }
 
 #if 0
   // printf("transformed\n");
@@ -149,9 +159,12 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
     }
   }
   // printf("applied\n");
-  for(int level=numl_cap-1; level>0; level--) dt_iop_equalizer_iwtf(out, tmp, level, width, height);
+  for(int level=numl_cap-1; level>0; level--)
+  {
+    if(dt_dev_pixelpipe_piece_cancelled(piece)) { free(tmp); return; }
+    dt_iop_equalizer_iwtf(out, tmp, level, width, height);
+  }
 
-  for(int k=1; k<numl_cap; k++) free(tmp[k]);
   free(tmp);
   // printf("thread %d finished equalizer", (int)pthread_self());
   // if(piece->iscale != 1.0) printf(" for preview\n");
@@ -242,6 +242,9 @@ process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem
   for(int j = -K; j <= 0; j++)
     for(int i = -K; i <= K; i++)
     {
+      // output became obsolete in the meantime?
+      if(dt_dev_pixelpipe_piece_cancelled(piece)) goto error;
+
       int q[2] = { i, j};
 
       dt_opencl_set_kernel_arg(devid, gd->kernel_nlmeans_dist, 0, sizeof(cl_mem), (void *)&dev_in);
@@ -378,6 +381,12 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   {
     for(int ki=-K; ki<=K; ki++)
     {
+      // every shift is a pass over the whole image, stop here if the output became obsolete.
+      if(dt_dev_pixelpipe_piece_cancelled(piece))
+      {
+        free(Sa);
+        return;
+      }
       int inited_slide = 0;
       // don't construct summed area tables but use sliding window! (applies to cpu version res < 1k only, or else we will add up errors)
       // do this in parallel with a little threading overhead. could parallelize the outer loops with a bit more memory
@@ -24,6 +24,7 @@
 #include "gui/gtk.h"
 #include <gtk/gtk.h>
 #include <stdlib.h>
+#include <float.h>
 
 #define EPSILON -0.00001
 
@@ -78,31 +79,61 @@ operation_tags_filter ()
   return IOP_TAG_DISTORT;
 }
 
-// FIXME: doesn't work if source is outside of ROI
+// the sources of the spots in roi_out may be outside of it, ask for them, too.
+void modify_roi_in(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_out, dt_iop_roi_t *roi_in)
+{
+  dt_iop_spots_params_t *d = (dt_iop_spots_params_t *)piece->data;
+  *roi_in = *roi_out;
+  const float scale = 1.0f/roi_in->scale;
+  int x0 = roi_out->x, y0 = roi_out->y, x1 = roi_out->x + roi_out->width, y1 = roi_out->y + roi_out->height;
+  for(int i=0; i<d->num_spots; i++)
+  {
+    // one more pixel for the rounding in process()
+    const int x  = (d->spot[i].x *piece->buf_in.width)/scale;
+    const int y  = (d->spot[i].y *piece->buf_in.height)/scale;
+    const int xc = (d->spot[i].xc*piece->buf_in.width)/scale;
+    const int yc = (d->spot[i].yc*piece->buf_in.height)/scale;
+    const int rad = d->spot[i].radius * MIN(piece->buf_in.width, piece->buf_in.height)/scale + 1;
+    if(x + rad < roi_out->x || x - rad >= roi_out->x + roi_out->width ||
+       y + rad < roi_out->y || y - rad >= roi_out->y + roi_out->height) continue;
+    x0 = MIN(x0, xc - rad);
+    y0 = MIN(y0, yc - rad);
+    x1 = MAX(x1, xc + rad + 1);
+    y1 = MAX(y1, yc + rad + 1);
+  }
+  // but not beyond the image:
+  roi_in->x = MIN(roi_out->x, MAX(0, x0));
+  roi_in->y = MIN(roi_out->y, MAX(0, y0));
+  roi_in->width  = MAX(roi_out->x + roi_out->width,  MIN((int)(piece->buf_in.width /scale), x1)) - roi_in->x;
+  roi_in->height = MAX(roi_out->y + roi_out->height, MIN((int)(piece->buf_in.height/scale), y1)) - roi_in->y;
+}
+
 void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
 {
   dt_iop_spots_params_t *d = (dt_iop_spots_params_t *)piece->data;
   // const float scale = piece->iscale/roi_in->scale;
   const float scale = 1.0f/roi_in->scale;
   const int ch = piece->colors;
-  // we don't modify most of the image:
-  memcpy(o, i, sizeof(float)*roi_in->width*roi_in->height*ch);
-
   const float *in = (float *)i;
   float *out = (float *)o;
+  // we don't modify most of the image, roi_out is somewhere in roi_in:
+  const int dx = roi_out->x - roi_in->x, dy = roi_out->y - roi_in->y;
+  for(int j=0; j<roi_out->height; j++)
+    memcpy(out + (size_t)ch*roi_out->width*j, in + (size_t)ch*(roi_in->width*(j+dy) + dx), sizeof(float)*ch*roi_out->width);
+
   // .. just a few spots:
   for(int i=0; i<d->num_spots; i++)
   {
-    // convert from world space:
-    const int x  = (d->spot[i].x *piece->buf_in.width)/scale - roi_in->x;
-    const int y  = (d->spot[i].y *piece->buf_in.height)/scale - roi_in->y;
+    // convert from world space, the spot to roi_out, its source to roi_in:
+    const int x  = (d->spot[i].x *piece->buf_in.width)/scale - roi_out->x;
+    const int y  = (d->spot[i].y *piece->buf_in.height)/scale - roi_out->y;
     const int xc = (d->spot[i].xc*piece->buf_in.width)/scale - roi_in->x;
     const int yc = (d->spot[i].yc*piece->buf_in.height)/scale - roi_in->y;
     const int rad = d->spot[i].radius * MIN(piece->buf_in.width, piece->buf_in.height)/scale;
     const int um = MIN(rad, MIN(x, xc));
-    const int uM = MIN(rad, MIN(roi_in->width-1-xc, roi_in->width-1-x));
+    const int uM = MIN(rad, MIN(roi_in->width-1-xc, roi_out->width-1-x));
     const int vm = MIN(rad, MIN(y, yc));
-    const int vM = MIN(rad, MIN(roi_in->height-1-yc, roi_in->height-1-y));
+    const int vM = MIN(rad, MIN(roi_in->height-1-yc, roi_out->height-1-y));
     float filter[2*rad + 1];
     // for(int k=-rad; k<=rad; k++) filter[rad + k] = expf(-k*k*2.f/(rad*rad));
     if(rad > 0)
@@ -128,6 +159,33 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   }
 }
 
+// grows box by the area spot s paints over, relative to the image.
+static void _spot_box(const spot_t *s, const dt_dev_pixelpipe_iop_t *piece, float *box)
+{
+  const float rad = s->radius * MIN(piece->buf_in.width, piece->buf_in.height);
+  box[0] = fminf(box[0], s->x - rad/piece->buf_in.width);
+  box[1] = fminf(box[1], s->y - rad/piece->buf_in.height);
+  box[2] = fmaxf(box[2], s->x + rad/piece->buf_in.width);
+  box[3] = fmaxf(box[3], s->y + rad/piece->buf_in.height);
+}
+
+// only the spots which were added, removed or changed need to be redone, where they were and where they are now.
+int dirty_region(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const dt_iop_params_t *old_params, const dt_iop_params_t *new_params, float *box)
+{
+  const dt_iop_spots_params_t *p0 = (const dt_iop_spots_params_t *)old_params;
+  const dt_iop_spots_params_t *p1 = (const dt_iop_spots_params_t *)new_params;
+  box[0] = box[1] =  FLT_MAX;
+  box[2] = box[3] = -FLT_MAX;
+  for(int i=0; i<MAX(p0->num_spots, p1->num_spots); i++)
+  {
+    const int in0 = i < p0->num_spots, in1 = i < p1->num_spots;
+    if(in0 && in1 && !memcmp(p0->spot + i, p1->spot + i, sizeof(spot_t))) continue;
+    if(in0) _spot_box(p0->spot + i, piece, box);
+    if(in1) _spot_box(p1->spot + i, piece, box);
+  }
+  return 1;
+}
+
 /** init, cleanup, commit to pipeline */
 void init(dt_iop_module_t *module)
 {
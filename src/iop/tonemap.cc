@@ -69,6 +69,8 @@ extern "C"
   typedef struct dt_iop_tonemapping_data_t
   {
     float contrast,Fsize;
+    // kept between runs of the pipe, so its hash tables don't have to grow again
+    PermutohedralLattice<3,2> *lattice;
   }
   dt_iop_tonemapping_data_t;
 
@@ -127,7 +129,10 @@ extern "C"
     if(inv_sigma_s<3.0) inv_sigma_s=3.0;
     inv_sigma_s = 1.0/inv_sigma_s;
 
-    PermutohedralLattice<3,2> lattice(size, omp_get_max_threads());
+    const size_t vertices = PermutohedralLattice<3,2>::estimate(width, height, inv_sigma_s);
+    if(data->lattice) data->lattice->reset(size, vertices);
+    else data->lattice = new PermutohedralLattice<3,2>(size, omp_get_max_threads(), vertices);
+    PermutohedralLattice<3,2> &lattice = *data->lattice;
 
     // Build I=log(L)
     // and splat into the lattice
@@ -245,11 +250,13 @@ extern "C"
   void init_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
   {
     piece->data = malloc(sizeof(dt_iop_tonemapping_data_t));
+    ((dt_iop_tonemapping_data_t *)piece->data)->lattice = NULL;
     self->commit_params(self, self->default_params, pipe, piece);
   }
 
   void cleanup_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
   {
+    delete ((dt_iop_tonemapping_data_t *)piece->data)->lattice;
     free(piece->data);
   }
 
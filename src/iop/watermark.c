@@ -34,6 +34,7 @@
 #include "gui/gtk.h"
 #include <gtk/gtk.h>
 #include <inttypes.h>
+#include <xmmintrin.h>
 
 #include <librsvg/rsvg.h>
 // ugh, ugly hack. why do people break stuff all the time?
@@ -77,6 +78,40 @@ typedef struct dt_iop_watermark_data_t
 }
 dt_iop_watermark_data_t;
 
+/** rasterization of the watermark at one scale, in coordinates of the scaled full image */
+typedef struct dt_iop_watermark_tile_t
+{
+  guint8 *buf;
+  int x, y, width, height, stride;
+  float scale, ox, oy;
+}
+dt_iop_watermark_tile_t;
+
+#define DT_IOP_WATERMARK_CACHE_SIZE 4
+#define DT_IOP_WATERMARK_CACHE_TILES 2
+
+/** parsed watermark, keyed by the svg document after variable substitution */
+typedef struct dt_iop_watermark_cache_t
+{
+  gchar *svgdoc;
+  RsvgHandle *svg;
+  RsvgDimensionData dimension;
+  uint64_t last_used;
+  // typically one for the preview and one for the full pipe
+  dt_iop_watermark_tile_t tile[DT_IOP_WATERMARK_CACHE_TILES];
+  int last_tile;
+}
+dt_iop_watermark_cache_t;
+
+typedef struct dt_iop_watermark_global_data_t
+{
+  /** protects the cache, shared by all pipes (and export threads) */
+  dt_pthread_mutex_t lock;
+  uint64_t clock;
+  dt_iop_watermark_cache_t cache[DT_IOP_WATERMARK_CACHE_SIZE];
+}
+dt_iop_watermark_global_data_t;
+
 typedef struct dt_iop_watermark_gui_data_t
 {
   GtkComboBox *combobox1;		                                             // watermark
@@ -536,34 +571,151 @@ static gchar * _watermark_get_svgdoc( dt_iop_module_t *self, dt_iop_watermark_da
 }
 
 
-void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+static void _watermark_tile_free(dt_iop_watermark_tile_t *t)
 {
-  dt_iop_watermark_data_t *data = (dt_iop_watermark_data_t *)piece->data;
-  float *in  = (float *)ivoid;
-  float *out = (float *)ovoid;
-  const int ch = piece->colors;
+  g_free(t->buf);
+  memset(t, 0, sizeof(dt_iop_watermark_tile_t));
+}
 
-  /* Load svg if not loaded */
-  gchar *svgdoc = _watermark_get_svgdoc (self, data, &piece->pipe->image);
-  if (!svgdoc)
+static void _watermark_cache_free(dt_iop_watermark_cache_t *c)
+{
+  for(int k=0; k<DT_IOP_WATERMARK_CACHE_TILES; k++)
+    _watermark_tile_free(c->tile + k);
+  if(c->svg) g_object_unref(c->svg);
+  g_free(c->svgdoc);
+  memset(c, 0, sizeof(dt_iop_watermark_cache_t));
+}
+
+/** find the parsed handle for svgdoc, or parse it into the least recently used slot.
+    takes ownership of svgdoc. has to be called with gd->lock held. */
+static dt_iop_watermark_cache_t *_watermark_cache_get(dt_iop_watermark_global_data_t *gd, gchar *svgdoc)
+{
+  dt_iop_watermark_cache_t *c = gd->cache;
+  for(int k=0; k<DT_IOP_WATERMARK_CACHE_SIZE; k++)
   {
-    memcpy(ovoid, ivoid, sizeof(float)*ch*roi_out->width*roi_out->height);
-    return;
+    if(gd->cache[k].svgdoc && !strcmp(gd->cache[k].svgdoc, svgdoc))
+    {
+      g_free(svgdoc);
+      gd->cache[k].last_used = ++gd->clock;
+      return gd->cache + k;
+    }
+    if(gd->cache[k].last_used < c->last_used) c = gd->cache + k;
   }
 
+  _watermark_cache_free(c);
+
   /* create the rsvghandle from parsed svg data */
   GError *error = NULL;
   RsvgHandle *svg = rsvg_handle_new_from_data ((const guint8 *)svgdoc,strlen (svgdoc),&error);
-  g_free (svgdoc);
   if (!svg || error)
   {
-    memcpy(ovoid, ivoid, sizeof(float)*ch*roi_out->width*roi_out->height);
+    if(svg) g_object_unref(svg);
+    if(error) g_error_free(error);
+    g_free(svgdoc);
+    return NULL;
+  }
+
+  c->svgdoc = svgdoc;
+  c->svg = svg;
+  c->last_used = ++gd->clock;
+  c->last_tile = -1;
+
+  /* get the dimension of svg */
+  rsvg_handle_get_dimensions (svg,&c->dimension);
+  return c;
+}
+
+/** return the watermark rendered at the given scale and offset, clipped to the
+    scaled full image of size iw x ih. only the bounding box gets rasterized.
+    has to be called with gd->lock held. */
+static const dt_iop_watermark_tile_t *_watermark_tile_get(dt_iop_watermark_cache_t *c, const float scale, const float ox, const float oy, const float iw, const float ih)
+{
+  for(int k=0; k<DT_IOP_WATERMARK_CACHE_TILES; k++)
+  {
+    const dt_iop_watermark_tile_t *t = c->tile + k;
+    if(t->buf && t->scale == scale && t->ox == ox && t->oy == oy)
+    {
+      c->last_tile = k;
+      return t;
+    }
+  }
+
+  const int x0 = MAX(0, floorf(ox));
+  const int y0 = MAX(0, floorf(oy));
+  const int x1 = MIN(ceilf(iw), ceilf(ox + c->dimension.width*scale));
+  const int y1 = MIN(ceilf(ih), ceilf(oy + c->dimension.height*scale));
+  if(x1 <= x0 || y1 <= y0) return NULL;
+
+  // replace the tile which was not used last
+  c->last_tile = (c->last_tile + 1) % DT_IOP_WATERMARK_CACHE_TILES;
+  dt_iop_watermark_tile_t *t = c->tile + c->last_tile;
+  _watermark_tile_free(t);
+
+  t->x = x0;
+  t->y = y0;
+  t->width = x1 - x0;
+  t->height = y1 - y0;
+  t->stride = cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32,t->width);
+
+  /* create cairo memory surface */
+  guint8 *image = (guint8 *)g_malloc0 (t->stride*t->height);
+  cairo_surface_t *surface = cairo_image_surface_create_for_data (image,CAIRO_FORMAT_ARGB32,t->width,t->height,t->stride);
+  if (cairo_surface_status(surface)!=	CAIRO_STATUS_SUCCESS)
+  {
+    cairo_surface_destroy (surface);
+    g_free (image);
+    return NULL;
+  }
+
+  /* create cairo context and setup transformation/scale. the tile origin is an
+     integer pixel position, so this rasterizes exactly like the full frame did. */
+  cairo_t *cr = cairo_create (surface);
+  cairo_translate (cr,ox-x0,oy-y0);
+  cairo_scale (cr,scale,scale);
+
+  /* render svg into surface*/
+  dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+  rsvg_handle_render_cairo (c->svg,cr);
+  dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+
+  /* ensure that all operations on surface finishing up */
+  cairo_surface_flush (surface);
+  cairo_destroy (cr);
+  cairo_surface_destroy (surface);
+
+  t->buf = image;
+  t->scale = scale;
+  t->ox = ox;
+  t->oy = oy;
+  return t;
+}
+
+void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  dt_iop_watermark_data_t *data = (dt_iop_watermark_data_t *)piece->data;
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)self->data;
+  const int ch = piece->colors;
+
+  /* outside of the watermark the output is just the input */
+  memcpy(ovoid, ivoid, sizeof(float)*ch*roi_out->width*roi_out->height);
+
+  /* Load svg if not loaded */
+  gchar *svgdoc = _watermark_get_svgdoc (self, data, &piece->pipe->image);
+  if (!svgdoc) return;
+
+  /* the cache entries and tiles are only valid while we hold the lock, so only the
+     lookup and rasterization happen under it, the composite works on a private copy */
+  dt_pthread_mutex_lock(&gd->lock);
+
+  dt_iop_watermark_cache_t *c = _watermark_cache_get(gd, svgdoc);
+  if (!c)
+  {
+    dt_pthread_mutex_unlock(&gd->lock);
     return;
   }
 
   /* get the dimension of svg */
-  RsvgDimensionData dimension;
-  rsvg_handle_get_dimensions (svg,&dimension);
+  const RsvgDimensionData dimension = c->dimension;
 
   /* calculate aligment of watermark */
   const float iw=piece->buf_in.width*roi_out->scale;
@@ -577,24 +729,6 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
 
   scale *= (data->scale/100.0);
 
-  /* setup stride for performance */
-  int stride = cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32,roi_out->width);
-
-  /* create cairo memory surface */
-  guint8 *image= (guint8 *)g_malloc (stride*roi_out->height);
-  memset (image,0,stride*roi_out->height);
-  cairo_surface_t *surface = cairo_image_surface_create_for_data (image,CAIRO_FORMAT_ARGB32,roi_out->width,roi_out->height,stride);
-  if (cairo_surface_status(surface)!=	CAIRO_STATUS_SUCCESS)
-  {
-//   fprintf(stderr,"Cairo surface error: %s\n",cairo_status_to_string(cairo_surface_status(surface)));
-    g_free (image);
-    memcpy(ovoid, ivoid, sizeof(float)*ch*roi_out->width*roi_out->height);
-    return;
-  }
-
-  /* create cairo context and setup transformation/scale */
-  cairo_t *cr = cairo_create (surface);
-
   float ty=0,tx=0;
   if( data->alignment >=0 && data->alignment <3) // Align to verttop
     ty=0;
@@ -610,51 +744,57 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   else if( data->alignment == 2 ||  data->alignment == 5 || data->alignment==8 )
     tx=iw-(dimension.width*scale);
 
-  /* translate to position */
-  cairo_translate (cr,-roi_in->x,-roi_in->y);
-  cairo_translate (cr,tx,ty);
-
-  /* scale */
-  cairo_scale (cr,scale,scale);
-
-  /* translate x and y offset */
-  cairo_translate (cr,data->xoffset*iw/roi_out->scale,data->yoffset*ih/roi_out->scale);
-
-  /* render svg into surface*/
-  dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
-  rsvg_handle_render_cairo (svg,cr);
-  dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
-
-  /* ensure that all operations on surface finishing up */
-  cairo_surface_flush (surface);
-
-  /* render surface on output */
-  guint8 *sd = image;
-  float opacity = data->opacity/100.0;
-  /*
-  #ifdef _OPENMP
-  	#pragma omp parallel for default(none) shared(roi_out, in, out,sd,opacity) schedule(static)
-  #endif
-  */
-  for(int j=0; j<roi_out->height; j++) for(int i=0; i<roi_out->width; i++)
-    {
-      float alpha = (sd[3]/255.0)*opacity;
-      out[0] = ((1.0-alpha)*in[0]) + (alpha*(sd[2]/255.0));
-      out[1] = ((1.0-alpha)*in[1]) + (alpha*(sd[1]/255.0));
-      out[2] = ((1.0-alpha)*in[2]) + (alpha*(sd[0]/255.0));
-      out[3] = in[3];
+  /* position of the svg origin in the scaled full image, including x and y offset */
+  const float ox = tx + scale*(data->xoffset*iw/roi_out->scale);
+  const float oy = ty + scale*(data->yoffset*ih/roi_out->scale);
+
+  const dt_iop_watermark_tile_t *t = _watermark_tile_get(c, scale, ox, oy, iw, ih);
+
+  /* intersect the watermark with the region of interest */
+  const int x0 = t ? MAX(t->x, roi_out->x) : 0;
+  const int y0 = t ? MAX(t->y, roi_out->y) : 0;
+  const int x1 = t ? MIN(t->x + t->width, roi_out->x + roi_out->width) : 0;
+  const int y1 = t ? MIN(t->y + t->height, roi_out->y + roi_out->height) : 0;
+
+  /* copy the part of the tile we need, other pipes and export threads may replace it as soon as we let go */
+  const int width = x1 - x0;
+  guint8 *buf = (x1 > x0 && y1 > y0) ? (guint8 *)g_malloc((size_t)4*width*(y1 - y0)) : NULL;
+  if(buf)
+    for(int j=y0; j<y1; j++)
+      memcpy(buf + (size_t)4*width*(j - y0), t->buf + (size_t)t->stride*(j - t->y) + 4*(x0 - t->x), (size_t)4*width);
+
+  dt_pthread_mutex_unlock(&gd->lock);
+  if(!buf) return;
+
+  /* render tile on output */
+  const float opacity = data->opacity/100.0;
+  // weight of the tile's alpha channel, zero in the last lane so that out[3] = in[3]
+  const __m128 w = _mm_set_ps(0.0f, opacity/255.0f, opacity/255.0f, opacity/255.0f);
+  const __m128 norm = _mm_set1_ps(1.0f/255.0f);
+  const __m128 one = _mm_set1_ps(1.0f);
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(roi_out, ivoid, ovoid, buf) schedule(static)
+#endif
+  for(int j=y0; j<y1; j++)
+  {
+    const guint8 *sd = buf + (size_t)4*width*(j - y0);
+    const float *in  = (const float *)ivoid + (size_t)ch*(roi_out->width*(j - roi_out->y) + x0 - roi_out->x);
+    float *out = (float *)ovoid + (size_t)ch*(roi_out->width*(j - roi_out->y) + x0 - roi_out->x);
+    for(int i=x0; i<x1; i++)
+    {
+      // cairo stores BGRA in memory
+      const __m128 s = _mm_set_ps(sd[3], sd[0], sd[1], sd[2]);
+      const __m128 alpha = _mm_mul_ps(_mm_shuffle_ps(s, s, _MM_SHUFFLE(3,3,3,3)), w);
+      const __m128 pix = _mm_load_ps(in);
+      _mm_store_ps(out, _mm_add_ps(_mm_mul_ps(_mm_sub_ps(one, alpha), pix), _mm_mul_ps(alpha, _mm_mul_ps(s, norm))));
 
       out+=ch;
       in+=ch;
       sd+=4;
     }
+  }
 
-
-  /* clean up */
-  cairo_surface_destroy (surface);
-  g_object_unref (svg);
-  g_free (image);
-
+  g_free(buf);
 }
 
 static void
@@ -861,6 +1001,24 @@ void gui_update(struct dt_iop_module_t *self)
   _combo_box_set_active_text( g->combobox1, p->filename );
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)malloc(sizeof(dt_iop_watermark_global_data_t));
+  memset(gd, 0, sizeof(dt_iop_watermark_global_data_t));
+  dt_pthread_mutex_init(&gd->lock, NULL);
+  module->data = gd;
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)module->data;
+  for(int k=0; k<DT_IOP_WATERMARK_CACHE_SIZE; k++)
+    _watermark_cache_free(gd->cache + k);
+  dt_pthread_mutex_destroy(&gd->lock);
+  free(module->data);
+  module->data = NULL;
+}
+
 void init(dt_iop_module_t *module)
 {
   module->params = malloc(sizeof(dt_iop_watermark_params_t));
@@ -21,6 +21,7 @@
 #include "control/control.h"
 #include "control/conf.h"
 #include "common/image_cache.h"
+#include "common/histogram.h"
 #include "develop/develop.h"
 #include "libs/lib.h"
 #include "gui/gtk.h"
@@ -37,7 +38,8 @@ typedef struct dt_lib_histogram_t
   int32_t button_down_x, button_down_y;
   int32_t highlight;
   gboolean red, green, blue;
-  float mode_x, mode_w, red_x, green_x, blue_x;
+  dt_histogram_scope_t scope;
+  float scope_x, mode_x, mode_w, red_x, green_x, blue_x;
   float color_w, button_h, button_y, button_spacing;
 }
 dt_lib_histogram_t;
@@ -92,6 +94,8 @@ void gui_init(dt_lib_module_t *self)
   d->red = dt_conf_get_bool("plugins/darkroom/histogram/show_red");
   d->green = dt_conf_get_bool("plugins/darkroom/histogram/show_green");
   d->blue = dt_conf_get_bool("plugins/darkroom/histogram/show_blue");
+  d->scope = CLAMP(dt_conf_get_int("plugins/darkroom/histogram/scope"), 0, DT_HISTOGRAM_SCOPE_LAST-1);
+  dt_histogram_scopes_set_scope(darktable.develop->scopes, d->scope);
 
   /* create drawingarea */
   self->widget = gtk_drawing_area_new();
@@ -126,8 +130,8 @@ void gui_init(dt_lib_module_t *self)
   int panel_width = dt_conf_get_int("panel_width");
   gtk_widget_set_size_request(self->widget, -1, panel_width*.5);
 
-  /* connect to preview pipe finished  signal */
-  dt_control_signal_connect(darktable.signals,DT_SIGNAL_DEVELOP_PREVIEW_PIPE_FINISHED, G_CALLBACK(_lib_histogram_change_callback), self);
+  /* the scopes are computed after the preview pipe has finished, redraw when they are in */
+  dt_control_signal_connect(darktable.signals,DT_SIGNAL_DEVELOP_HISTOGRAM_UPDATED, G_CALLBACK(_lib_histogram_change_callback), self);
 
 
 }
@@ -172,14 +176,141 @@ static void _draw_mode_toggle(cairo_t *cr, float x, float y, float width, float
   cairo_stroke(cr);
 }
 
+static void _draw_scope_toggle(cairo_t *cr, float x, float y, float width, float height, dt_histogram_scope_t scope)
+{
+  float border = MIN(width*.1, height*.1);
+  cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.4);
+  cairo_rectangle(cr, x+border, y+border, width-2.0*border, height-2.0*border);
+  cairo_fill_preserve(cr);
+  cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.5);
+  cairo_set_line_width(cr, border);
+  cairo_stroke(cr);
+  cairo_set_source_rgba(cr, 1.0, 1.0, 1.0, 0.5);
+  // icon of the scope that a click switches to
+  switch((scope+1) % DT_HISTOGRAM_SCOPE_LAST)
+  {
+    case DT_HISTOGRAM_SCOPE_WAVEFORM:
+      for(int k=0; k<3; k++)
+      {
+        cairo_move_to(cr, x+(2.0+k)*border + k*0.2*width, y+height-2.0*border);
+        cairo_line_to(cr, x+(2.0+k)*border + k*0.2*width, y+(2.0+2*k)*border);
+      }
+      break;
+    case DT_HISTOGRAM_SCOPE_VECTORSCOPE:
+      cairo_arc(cr, x+0.5*width, y+0.5*height, 0.5*MIN(width, height) - 2.0*border, 0, 2.0*M_PI);
+      break;
+    default:
+      cairo_move_to(cr, x+2.0*border, y+height-2.0*border);
+      cairo_curve_to(cr, x+0.5*width, y-height, x+0.5*width, y+height, x+width-2.0*border, y+height-2.0*border);
+      break;
+  }
+  cairo_stroke(cr);
+}
+
+static inline uint8_t _scope_intensity(const uint32_t count, const float scale, const gboolean linear)
+{
+  const float v = linear ? count*scale : logf(1.0f + count)*scale;
+  return CLAMP(255.0f*v, 0.0f, 255.0f);
+}
+
+/* waveform: one column per bucket of image columns, value up, the channels added up */
+static void _draw_waveform(cairo_t *cr, const uint32_t *wave, const int wave_width, const uint32_t wave_max,
+                           float width, float height, const dt_lib_histogram_t *d, const gboolean linear)
+{
+  if(wave_width <= 0 || wave_max == 0) return;
+  const int wave_height = DT_HISTOGRAM_WAVEFORM_HEIGHT;
+  const size_t plane = (size_t)wave_width*wave_height;
+  const float scale = linear ? 1.0f/wave_max : 1.0f/logf(1.0f + wave_max);
+  const gboolean show[3] = { d->red, d->green, d->blue };
+
+  cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, wave_width, wave_height);
+  uint8_t *buf = cairo_image_surface_get_data(surface);
+  const int stride = cairo_image_surface_get_stride(surface);
+  for(int j=0; j<wave_height; j++)
+    for(int i=0; i<wave_width; i++)
+    {
+      uint32_t *px = (uint32_t *)(buf + j*stride) + i;
+      uint8_t c[3];
+      for(int k=0; k<3; k++)
+        c[k] = show[k] ? _scope_intensity(wave[k*plane + (size_t)j*wave_width + i], scale, linear) : 0;
+      // premultiplied: the alpha is the brightest channel
+      const uint8_t a = MAX(MAX(c[0], c[1]), c[2]);
+      *px = ((uint32_t)a << 24) | ((uint32_t)c[0] << 16) | ((uint32_t)c[1] << 8) | c[2];
+    }
+  cairo_surface_mark_dirty(surface);
+
+  cairo_save(cr);
+  cairo_scale(cr, width/wave_width, height/wave_height);
+  cairo_set_source_surface(cr, surface, 0, 0);
+  cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+  cairo_paint(cr);
+  cairo_restore(cr);
+  cairo_surface_destroy(surface);
+}
+
+/* vectorscope: Cb/Cr plane, each bin tinted with the hue it stands for */
+static void _draw_vectorscope(cairo_t *cr, const uint32_t *scope, const uint32_t scope_max,
+                              float width, float height, const gboolean linear)
+{
+  if(scope_max == 0) return;
+  const int size = DT_HISTOGRAM_VECTORSCOPE_SIZE;
+  const float scale = linear ? 1.0f/scope_max : 1.0f/logf(1.0f + scope_max);
+
+  cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, size, size);
+  uint8_t *buf = cairo_image_surface_get_data(surface);
+  const int stride = cairo_image_surface_get_stride(surface);
+  for(int j=0; j<size; j++)
+    for(int i=0; i<size; i++)
+    {
+      const float Cb = (i + 0.5f)/size - 0.5f, Cr = 0.5f - (j + 0.5f)/size;
+      const float Y = 0.6f;
+      const float R = CLAMP(Y + 1.5748f*Cr, 0.0f, 1.0f);
+      const float B = CLAMP(Y + 1.8556f*Cb, 0.0f, 1.0f);
+      const float G = CLAMP((Y - 0.2126f*R - 0.0722f*B)/0.7152f, 0.0f, 1.0f);
+      const uint8_t a = _scope_intensity(scope[j*size + i], scale, linear);
+      uint32_t *px = (uint32_t *)(buf + j*stride) + i;
+      *px = ((uint32_t)a << 24) | ((uint32_t)(R*a) << 16) | ((uint32_t)(G*a) << 8) | (uint32_t)(B*a);
+    }
+  cairo_surface_mark_dirty(surface);
+
+  const float side = MIN(width, height);
+  cairo_save(cr);
+  cairo_translate(cr, 0.5*(width - side), 0.5*(height - side));
+  // graticule: the outer circle is the largest possible chroma
+  cairo_set_source_rgba(cr, 0.1, 0.1, 0.1, 0.8);
+  cairo_set_line_width(cr, 0.5);
+  cairo_arc(cr, 0.5*side, 0.5*side, 0.5*side, 0, 2.0*M_PI);
+  cairo_move_to(cr, 0.5*side, 0);
+  cairo_line_to(cr, 0.5*side, side);
+  cairo_move_to(cr, 0, 0.5*side);
+  cairo_line_to(cr, side, 0.5*side);
+  cairo_stroke(cr);
+  cairo_scale(cr, side/size, side/size);
+  cairo_set_source_surface(cr, surface, 0, 0);
+  cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+  cairo_paint(cr);
+  cairo_restore(cr);
+  cairo_surface_destroy(surface);
+}
+
 static gboolean _lib_histogram_expose_callback(GtkWidget *widget, GdkEventExpose *event, gpointer user_data)
 {
   dt_lib_module_t *self = (dt_lib_module_t *)user_data;
   dt_lib_histogram_t *d = (dt_lib_histogram_t *)self->data;
 
   dt_develop_t *dev = darktable.develop;
-  float *hist = dev->histogram;
-  float hist_max = dev->histogram_linear?dev->histogram_max:logf(1.0 + dev->histogram_max);
+  dt_histogram_scopes_t *scopes = dev->scopes;
+  float hist[4*DT_HISTOGRAM_BINS];
+  float hist_max = -1;
+  if(scopes)
+  {
+    // the worker may be publishing new results, take a copy of the histogram
+    dt_pthread_mutex_lock(&scopes->lock);
+    memcpy(hist, scopes->histogram, sizeof(hist));
+    hist_max = scopes->histogram_max;
+    dt_pthread_mutex_unlock(&scopes->lock);
+  }
+  hist_max = dev->histogram_linear?hist_max:logf(1.0 + hist_max);
   const int inset = DT_HIST_INSET;
   int width = widget->allocation.width, height = widget->allocation.height;
   cairo_surface_t *cst = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
@@ -201,6 +332,7 @@ static gboolean _lib_histogram_expose_callback(GtkWidget *widget, GdkEventExpose
     d->button_y = d->button_spacing;
     d->mode_w = d->color_w;
     d->mode_x = width - 3*(d->color_w+d->button_spacing) - (d->mode_w+d->button_spacing);
+    d->scope_x = d->mode_x - (d->mode_w+d->button_spacing);
     d->red_x = width - 3*(d->color_w+d->button_spacing);
     d->green_x = width - 2*(d->color_w+d->button_spacing);
     d->blue_x = width - (d->color_w+d->button_spacing);
@@ -249,12 +381,24 @@ static gboolean _lib_histogram_expose_callback(GtkWidget *widget, GdkEventExpose
   cairo_set_source_rgb (cr, .1, .1, .1);
   dt_draw_grid(cr, 4, 0, 0, width, height);
 
-  if(hist_max > 0)
+  if(scopes && d->scope == DT_HISTOGRAM_SCOPE_WAVEFORM)
+  {
+    dt_pthread_mutex_lock(&scopes->lock);
+    _draw_waveform(cr, scopes->waveform, scopes->waveform_width, scopes->waveform_max, width, height, d, dev->histogram_linear);
+    dt_pthread_mutex_unlock(&scopes->lock);
+  }
+  else if(scopes && d->scope == DT_HISTOGRAM_SCOPE_VECTORSCOPE)
+  {
+    dt_pthread_mutex_lock(&scopes->lock);
+    _draw_vectorscope(cr, scopes->vectorscope, scopes->vectorscope_max, width, height, dev->histogram_linear);
+    dt_pthread_mutex_unlock(&scopes->lock);
+  }
+  else if(hist_max > 0)
   {
     cairo_save(cr);
     // cairo_set_antialias(cr, CAIRO_ANTIALIAS_NONE);
     cairo_translate(cr, 0, height);
-    cairo_scale(cr, width/63.0, -(height-10)/hist_max);
+    cairo_scale(cr, width/(DT_HISTOGRAM_BINS-1.0), -(height-10)/hist_max);
     cairo_set_operator(cr, CAIRO_OPERATOR_ADD);
     // cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
     cairo_set_line_width(cr, 1.);
@@ -295,6 +439,7 @@ static gboolean _lib_histogram_expose_callback(GtkWidget *widget, GdkEventExpose
   // buttons to control the display of the histogram: linear/log, r, g, b
   if(d->highlight != 0)
   {
+    _draw_scope_toggle(cr, d->scope_x, d->button_y, d->mode_w, d->button_h, d->scope);
     _draw_mode_toggle(cr, d->mode_x, d->button_y, d->mode_w, d->button_h, darktable.develop->histogram_linear);
     cairo_set_source_rgba(cr, 1.0, 0.0, 0.0, 0.4);
     _draw_color_toggle(cr, d->red_x, d->button_y, d->color_w, d->button_h, d->red);
@@ -345,6 +490,14 @@ static gboolean _lib_histogram_motion_notify_callback(GtkWidget *widget, GdkEven
 
 
     if(pos < 0 || pos > 1.0);
+    else if(x > d->scope_x && x < d->scope_x+d->mode_w && y > d->button_y && y < d->button_y + d->button_h)
+    {
+      d->highlight = 7;
+      const dt_histogram_scope_t next = (d->scope+1) % DT_HISTOGRAM_SCOPE_LAST;
+      g_object_set(G_OBJECT(widget), "tooltip-text",
+                   next == DT_HISTOGRAM_SCOPE_WAVEFORM ? _("show waveform") :
+                   next == DT_HISTOGRAM_SCOPE_VECTORSCOPE ? _("show vectorscope") : _("show histogram"), (char *)NULL);
+    }
     else if(x > d->mode_x && x < d->mode_x+d->mode_w && y > d->button_y && y < d->button_y + d->button_h)
     {
       d->highlight = 3;
@@ -399,7 +552,13 @@ static gboolean _lib_histogram_button_press_callback(GtkWidget *widget, GdkEvent
   }
   else
   {
-    if(d->highlight == 3) // mode button
+    if(d->highlight == 7) // scope button
+    {
+      d->scope = (d->scope+1) % DT_HISTOGRAM_SCOPE_LAST;
+      dt_conf_set_int("plugins/darkroom/histogram/scope", d->scope);
+      dt_histogram_scopes_set_scope(darktable.develop->scopes, d->scope);
+    }
+    else if(d->highlight == 3) // mode button
     {
       darktable.develop->histogram_linear = !darktable.develop->histogram_linear;
       dt_conf_set_string("plugins/darkroom/histogram/mode", darktable.develop->histogram_linear?"linear":"logarithmic");
@@ -210,6 +210,7 @@ static void write_metadata(dt_lib_module_t *self)
   gchar *creator     = gtk_combo_box_get_active_text(GTK_COMBO_BOX(d->creator));
   gchar *publisher   = gtk_combo_box_get_active_text(GTK_COMBO_BOX(d->publisher));
 
+  dt_database_start_transaction(darktable.db);
   if(title != NULL && (d->multi_title == FALSE || gtk_combo_box_get_active(GTK_COMBO_BOX(d->title)) != 0))
     dt_metadata_set(-1, "Xmp.dc.title", title);
   if(description != NULL && (d->multi_description == FALSE || gtk_combo_box_get_active(GTK_COMBO_BOX(d->description)) != 0))
@@ -220,6 +221,7 @@ static void write_metadata(dt_lib_module_t *self)
     dt_metadata_set(-1, "Xmp.dc.creator", creator);
   if(publisher != NULL && (d->multi_publisher == FALSE || gtk_combo_box_get_active(GTK_COMBO_BOX(d->publisher)) != 0))
     dt_metadata_set(-1, "Xmp.dc.publisher", publisher);
+  dt_database_release_transaction(darktable.db);
 
   if(title != NULL)
     g_free(title);
@@ -471,6 +473,7 @@ int set_params(dt_lib_module_t *self, const void *params, int size)
 
   if(size != strlen(title) + strlen(description) + strlen(rights) + strlen(creator) + strlen(publisher) + 5) return 1;
 
+  dt_database_start_transaction(darktable.db);
   if(title != NULL && title[0] != '\0')
     dt_metadata_set(-1, "Xmp.dc.title", title);
   if(description != NULL && description[0] != '\0')
@@ -481,6 +484,7 @@ int set_params(dt_lib_module_t *self, const void *params, int size)
     dt_metadata_set(-1, "Xmp.dc.creator", creator);
   if(publisher != NULL && publisher[0] != '\0')
     dt_metadata_set(-1, "Xmp.dc.publisher", publisher);
+  dt_database_release_transaction(darktable.db);
 
   dt_image_synch_xmp(-1);
   update(self, FALSE);
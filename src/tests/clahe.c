@@ -0,0 +1,101 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2010 Henrik Andersson.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// define dt alloc, so we don't need to include the rest of dt:
+#define dt_alloc_align(A, B) malloc(B)
+
+// benchmark of the tiled local contrast (clahe) against the exact sliding window version.
+// usage: ./clahe [width height radius slope]
+#include "common/clahe.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <sys/time.h>
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
+
+static double
+get_time()
+{
+  struct timeval time;
+  gettimeofday(&time, NULL);
+  return time.tv_sec + time.tv_usec*1e-6;
+}
+
+int main(int argc, char *argv[])
+{
+  const int width  = argc > 1 ? atol(argv[1]) : 3000;
+  const int height = argc > 2 ? atol(argv[2]) : 2000;
+  const int rad    = argc > 3 ? atol(argv[3]) : 64;
+  const float slope = argc > 4 ? atof(argv[4]) : 1.25f;
+
+  // something with structure on several scales, plus a bit of noise:
+  float *lum = (float *)malloc(sizeof(float)*width*height);
+  float *exact = (float *)malloc(sizeof(float)*width*height);
+  float *tiled = (float *)malloc(sizeof(float)*width*height);
+  uint32_t seed = 1;
+  for(int j=0; j<height; j++) for(int i=0; i<width; i++)
+  {
+    const float x = i/(float)width, y = j/(float)height;
+    const float v = 0.5f + 0.25f*sinf(13.0f*x)*cosf(7.0f*y) + 0.15f*sinf(97.0f*x*y) + 0.05f*((seed = seed*1664525u + 1013904223u)/4294967296.0f - 0.5f);
+    lum[j*width+i] = fminf(fmaxf(v*y + 0.1f*(1.0f-y), 0.0f), 1.0f);
+  }
+
+  double start = get_time();
+  dt_clahe_exact(lum, exact, width, height, rad, slope);
+  const double t_exact = get_time() - start;
+  start = get_time();
+  dt_clahe_tiled(lum, tiled, width, height, rad, slope);
+  const double t_tiled = get_time() - start;
+
+  // the shared apply pass, on a grey rgba version of the input:
+  float *rgba = (float *)dt_alloc_align(16, sizeof(float)*4*width*height);
+  for(size_t k=0; k<(size_t)width*height; k++)
+    for(int c=0; c<4; c++) rgba[4*k+c] = lum[k]*(0.8f + 0.1f*c);
+  start = get_time();
+  dt_clahe_apply(rgba, rgba, tiled, width, height);
+  const double t_apply = get_time() - start;
+  free(rgba);
+
+  double sum = 0.0, sum2 = 0.0, max = 0.0;
+  for(size_t k=0; k<(size_t)width*height; k++)
+  {
+    const double d = fabs(exact[k] - tiled[k]);
+    sum += d;
+    sum2 += d*d;
+    if(d > max) max = d;
+  }
+  const double mse = sum2/((double)width*height);
+
+#ifdef _OPENMP
+  fprintf(stderr, "[clahe] %d threads\n", omp_get_max_threads());
+#endif
+  fprintf(stderr, "[clahe] %dx%d radius %d slope %.2f\n", width, height, rad, slope);
+  fprintf(stderr, "[clahe] exact %.3f s, tiled %.3f s, speedup %.1fx\n", t_exact, t_tiled, t_exact/t_tiled);
+  fprintf(stderr, "[clahe] apply %.3f s\n", t_apply);
+  fprintf(stderr, "[clahe] lightness difference: mean %.4f max %.4f psnr %.1f dB\n",
+          sum/((double)width*height), max, mse > 0.0 ? 10.0*log10(1.0/mse) : INFINITY);
+
+  free(lum);
+  free(exact);
+  free(tiled);
+  exit(0);
+}
@@ -0,0 +1,242 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2012 johannes hanika.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// benchmark of bulk tagging in the library database: every image gets a tag with the
+// statements of dt_tag_attach(), the way it used to go (prepare and finalize every statement,
+// each one its own transaction) against cached statements in one transaction, with the
+// default journal and with the write-ahead log. prints statements per second. also checks that a
+// failed commit is rolled back.
+// usage: ./database [images]
+
+#define _XOPEN_SOURCE 700
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+// define what database.c needs from dt, so we don't need to include the rest of it:
+#define DARKTABLE_H
+#define DT_CONTROL_H
+#define DT_USER_CONFIG_H
+#include "common/dtpthread.h"
+#define DT_MAX_PATH_LEN 4096
+#define DT_DEBUG_SQL 0
+typedef struct darktable_t
+{
+  struct dt_database_t *db;
+}
+darktable_t;
+static darktable_t darktable;
+static char tmpdir[DT_MAX_PATH_LEN];
+static int wal = 0;
+#define dt_print(a, ...)
+static void dt_loc_get_user_config_dir(char *dir, size_t len) { snprintf(dir, len, "%s", tmpdir); }
+static void dt_loc_get_user_cache_dir(char *dir, size_t len) { snprintf(dir, len, "%s", tmpdir); }
+static void dt_loc_get_datadir(char *dir, size_t len) { snprintf(dir, len, "%s", tmpdir); }
+static gchar *dt_conf_get_string(const char *name) { return NULL; }
+static void dt_conf_set_string(const char *name, const char *value) {}
+static int dt_conf_get_bool(const char *name) { return !strcmp(name, "database_wal") && wal; }
+#include "common/database.c"
+
+static double
+get_time()
+{
+  struct timeval time;
+  gettimeofday(&time, NULL);
+  return time.tv_sec + time.tv_usec*1e-6;
+}
+
+#define SQL_ATTACH "INSERT OR REPLACE INTO tagged_images (imgid, tagid) VALUES (?1, ?2)"
+#define SQL_COUNT "UPDATE tagxtag SET count = count + 1 WHERE " \
+                  "(id1 = ?1 AND id2 IN (SELECT tagid FROM tagged_images WHERE imgid = ?2)) " \
+                  "OR " \
+                  "(id2 = ?1 AND id1 IN (SELECT tagid FROM tagged_images WHERE imgid = ?2))"
+
+// a library with the tag tables of control.c, n images with three tags each, and a fourth one to attach.
+static dt_database_t *
+open_library(const char *filename, const int n)
+{
+  unlink(filename);
+  dt_database_t *db = dt_database_init((char *)filename);
+  sqlite3 *h = dt_database_get(db);
+  sqlite3_exec(h, "create table tags (id integer primary key, name varchar, icon blob, "
+               "description varchar, flags integer)", NULL, NULL, NULL);
+  sqlite3_exec(h, "create table tagxtag (id1 integer, id2 integer, count integer, "
+               "primary key(id1, id2))", NULL, NULL, NULL);
+  sqlite3_exec(h, "create table tagged_images (imgid integer, tagid integer, "
+               "primary key(imgid, tagid))", NULL, NULL, NULL);
+  dt_database_start_transaction(db);
+  for(int t=1; t<=4; t++)
+  {
+    char query[256];
+    snprintf(query, sizeof(query), "insert into tags (id, name) values (%d, 'tag %d')", t, t);
+    sqlite3_exec(h, query, NULL, NULL, NULL);
+    for(int u=1; u<t; u++)
+    {
+      snprintf(query, sizeof(query), "insert into tagxtag values (%d, %d, 0)", u, t);
+      sqlite3_exec(h, query, NULL, NULL, NULL);
+    }
+  }
+  sqlite3_stmt *stmt = dt_database_get_statement(db, "insert into tagged_images values (?1, ?2)");
+  for(int k=1; k<=n; k++) for(int t=1; t<=3; t++)
+  {
+    sqlite3_bind_int(stmt, 1, k);
+    sqlite3_bind_int(stmt, 2, t);
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+  }
+  dt_database_release_statement(db, stmt);
+  dt_database_release_transaction(db);
+  return db;
+}
+
+static void
+step(sqlite3_stmt *stmt, const int tagid, const int imgid)
+{
+  sqlite3_bind_int(stmt, 1, tagid);
+  sqlite3_bind_int(stmt, 2, imgid);
+  sqlite3_step(stmt);
+}
+
+// the previous version: prepare, step and finalize per statement, every one committed on its own.
+static double
+attach_uncached(dt_database_t *db, const int n)
+{
+  sqlite3 *h = dt_database_get(db);
+  const double start = get_time();
+  for(int k=1; k<=n; k++)
+  {
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(h, SQL_ATTACH, -1, &stmt, NULL);
+    sqlite3_bind_int(stmt, 1, k);
+    sqlite3_bind_int(stmt, 2, 4);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    sqlite3_prepare_v2(h, SQL_COUNT, -1, &stmt, NULL);
+    step(stmt, 4, k);
+    sqlite3_finalize(stmt);
+  }
+  return get_time() - start;
+}
+
+// what dt_tag_attach() does now, inside a transaction like dt_tag_attach_list():
+static double
+attach_cached(dt_database_t *db, const int n)
+{
+  const double start = get_time();
+  dt_database_start_transaction(db);
+  for(int k=1; k<=n; k++)
+  {
+    sqlite3_stmt *stmt = dt_database_get_statement(db, SQL_ATTACH);
+    sqlite3_bind_int(stmt, 1, k);
+    sqlite3_bind_int(stmt, 2, 4);
+    sqlite3_step(stmt);
+    dt_database_release_statement(db, stmt);
+    stmt = dt_database_get_statement(db, SQL_COUNT);
+    step(stmt, 4, k);
+    dt_database_release_statement(db, stmt);
+  }
+  dt_database_release_transaction(db);
+  return get_time() - start;
+}
+
+// number of images with the new tag and the sum of the counts in tagxtag, to compare the runs.
+static void
+check(dt_database_t *db, int *tagged, int *count)
+{
+  sqlite3_stmt *stmt = dt_database_get_statement(db, "select count(*) from tagged_images where tagid = 4");
+  sqlite3_step(stmt);
+  *tagged = sqlite3_column_int(stmt, 0);
+  dt_database_release_statement(db, stmt);
+  stmt = dt_database_get_statement(db, "select sum(count) from tagxtag");
+  sqlite3_step(stmt);
+  *count = sqlite3_column_int(stmt, 0);
+  dt_database_release_statement(db, stmt);
+}
+
+// a commit that fails has to be rolled back, not leave the connection inside the transaction.
+static int
+check_failed_commit(const char *filename)
+{
+  unlink(filename);
+  dt_database_t *db = dt_database_init((char *)filename);
+  sqlite3 *h = dt_database_get(db);
+  sqlite3_exec(h, "pragma foreign_keys = on", NULL, NULL, NULL);
+  sqlite3_exec(h, "create table parent (id integer primary key)", NULL, NULL, NULL);
+  sqlite3_exec(h, "create table child (id integer references parent(id) deferrable initially deferred)",
+               NULL, NULL, NULL);
+  dt_database_start_transaction(db);
+  sqlite3_exec(h, "insert into child values (1)", NULL, NULL, NULL);
+  const int failed = dt_database_release_transaction(db);
+  const int autocommit = sqlite3_get_autocommit(h);
+  int rows = -1;
+  sqlite3_stmt *stmt = dt_database_get_statement(db, "select count(*) from child");
+  if(sqlite3_step(stmt) == SQLITE_ROW) rows = sqlite3_column_int(stmt, 0);
+  dt_database_release_statement(db, stmt);
+  dt_database_destroy(db);
+  unlink(filename);
+  if(!failed || !autocommit || rows != 0)
+  {
+    fprintf(stderr, "FAILED: commit of a broken transaction: failed %d, autocommit %d, rows %d\n",
+            failed, autocommit, rows);
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  const int n = argc > 1 ? atol(argv[1]) : 10000;
+  snprintf(tmpdir, sizeof(tmpdir), "/tmp/dt-database-XXXXXX");
+  if(!mkdtemp(tmpdir)) return 1;
+  char filename[DT_MAX_PATH_LEN+16];
+  snprintf(filename, sizeof(filename), "%s/library.db", tmpdir);
+  fprintf(stderr, "tagging %d images, 2 statements each\n", n);
+
+  const char *name[3] = { "prepare per statement, autocommit", "cached statements, one transaction",
+                          "cached statements, one transaction, wal" };
+  int tagged[3], count[3];
+  for(int r=0; r<3; r++)
+  {
+    wal = r == 2;
+    darktable.db = open_library(filename, n);
+    const double t = r ? attach_cached(darktable.db, n) : attach_uncached(darktable.db, n);
+    check(darktable.db, tagged + r, count + r);
+    dt_database_destroy(darktable.db);
+    fprintf(stderr, "%-42s %.3fs, %8.0f statements/s\n", name[r], t, 2*n/t);
+  }
+
+  int fail = check_failed_commit(filename);
+
+  char wal_file[DT_MAX_PATH_LEN+32];
+  snprintf(wal_file, sizeof(wal_file), "%s-wal", filename);
+  unlink(wal_file);
+  unlink(filename);
+  rmdir(tmpdir);
+
+  for(int r=0; r<3; r++)
+    fail |= tagged[r] != n || count[r] != 3*n;
+  if(fail) fprintf(stderr, "FAILED: tagged %d %d %d, counts %d %d %d, expected %d and %d\n",
+                   tagged[0], tagged[1], tagged[2], count[0], count[1], count[2], n, 3*n);
+  return fail;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,197 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2012 johannes hanika.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// checks the film roll watch on a temporary folder: the thread only starts with the first watch,
+// a burst of new files ends up in one rescan job with all the names, hidden files and folders
+// are left out, and nothing is reported once the watch is removed.
+// usage: ./fswatch
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <glib.h>
+
+// define what fswatch.c needs from dt, so we don't need to include the rest of it:
+#define HAVE_INOTIFY
+#define DARKTABLE_H
+#define __DEBUG_H__
+#define DT_IMAGE_H
+#define DT_CONTROL_H
+#define DT_CONTROL_JOBS_FILM_H
+#define DARKTABLE_DEVELOP_H
+#include "common/dtpthread.h"
+#define DT_MAX_PATH_LEN 4096
+#define dt_print(a, ...)
+typedef struct dt_control_t { int running; } dt_control_t;
+typedef struct dt_image_t { int id; int force_reimport; } dt_image_t;
+typedef struct dt_develop_t { dt_image_t *image; } dt_develop_t;
+typedef struct dt_job_t { int id; GHashTable *names; } dt_job_t;
+static dt_control_t control = { 1 };
+static struct { dt_control_t *control; dt_develop_t *develop; void *db; } darktable = { &control, NULL, NULL };
+static char folder[DT_MAX_PATH_LEN];
+static double dt_get_wtime()
+{
+  struct timeval time;
+  gettimeofday(&time, NULL);
+  return time.tv_sec - 1290608000 + (1.0/1000000.0)*time.tv_usec;
+}
+static void dt_dev_raw_reload(dt_develop_t *dev) {}
+static void dt_image_full_path(const int imgid, char *pathname, int len) {}
+
+// the folder of the film roll is the only thing looked up in the database:
+typedef struct sqlite3_stmt sqlite3_stmt;
+#define SQLITE_ROW 100
+#define SQLITE_DONE 101
+#define DT_DEBUG_SQLITE3_PREPARE_V2(a, b, c, d, e) do { *(d) = (sqlite3_stmt *)folder; } while(0)
+#define DT_DEBUG_SQLITE3_BIND_INT(a, b, c)
+#define dt_database_get(a) NULL
+static int stepped = 0;
+static int sqlite3_step(sqlite3_stmt *stmt) { return stepped++ ? SQLITE_DONE : SQLITE_ROW; }
+static const unsigned char *sqlite3_column_text(sqlite3_stmt *stmt, int col) { return (const unsigned char *)folder; }
+static int sqlite3_finalize(sqlite3_stmt *stmt) { stepped = 0; return 0; }
+
+// the rescan jobs are kept here instead of being run:
+static int jobs = 0;
+static GHashTable *names = NULL;
+static void dt_film_rescan_init(dt_job_t *job, const int id, GHashTable *n)
+{
+  job->id = id;
+  job->names = n;
+}
+static int dt_control_add_job(dt_control_t *control, dt_job_t *job)
+{
+  jobs++;
+  if(names) g_hash_table_destroy(names);
+  names = job->names;
+  return 0;
+}
+
+#include "common/fswatch.c"
+
+static void
+touch(const char *name)
+{
+  char filename[DT_MAX_PATH_LEN+64];
+  snprintf(filename, sizeof(filename), "%s/%s", folder, name);
+  FILE *f = fopen(filename, "wb");
+  if(f)
+  {
+    fputs("x", f);
+    fclose(f);
+  }
+}
+
+static void
+rm(const char *name)
+{
+  char filename[DT_MAX_PATH_LEN+64];
+  snprintf(filename, sizeof(filename), "%s/%s", folder, name);
+  unlink(filename);
+}
+
+// waits for the debounce to pass and the thread to hand on what it has.
+static void
+quiet()
+{
+  usleep(1000000 * (DT_FSWATCH_DEBOUNCE + 1.0));
+}
+
+int main(int argc, char *argv[])
+{
+  snprintf(folder, sizeof(folder), "/tmp/dt-fswatch-XXXXXX");
+  if(!mkdtemp(folder)) return 1;
+  int fail = 0;
+
+  const dt_fswatch_t *fswatch = dt_fswatch_new();
+  if(!fswatch) return 1;
+  if(fswatch->running)
+  {
+    fprintf(stderr, "FAILED: thread running without a watch\n");
+    fail = 1;
+  }
+  dt_fswatch_add(fswatch, DT_FSWATCH_FILMROLL, GINT_TO_POINTER(7));
+  dt_fswatch_add(fswatch, DT_FSWATCH_FILMROLL, GINT_TO_POINTER(7));
+  if(!fswatch->running || g_list_length(fswatch->items) != 1)
+  {
+    fprintf(stderr, "FAILED: one watch should start the thread, running %d, %d watches\n",
+            fswatch->running, g_list_length(fswatch->items));
+    fail = 1;
+  }
+
+  // copying a card: a burst of files, one of them gone again, a sidecar, and things to ignore.
+  char name[64];
+  for(int k=0; k<20; k++)
+  {
+    snprintf(name, sizeof(name), "IMG_%04d.CR2", k);
+    touch(name);
+    usleep(20000);
+  }
+  rm("IMG_0003.CR2");
+  touch("IMG_0004.CR2.xmp");
+  touch(".hidden");
+  char sub[DT_MAX_PATH_LEN+8];
+  snprintf(sub, sizeof(sub), "%s/sub", folder);
+  mkdir(sub, 0700);
+  quiet();
+  if(jobs != 1 || !names || g_hash_table_size(names) != 21 || !g_hash_table_lookup(names, "IMG_0003.CR2") ||
+     !g_hash_table_lookup(names, "IMG_0004.CR2.xmp") || g_hash_table_lookup(names, ".hidden") ||
+     g_hash_table_lookup(names, "sub"))
+  {
+    fprintf(stderr, "FAILED: burst of files: %d jobs, %d names\n", jobs, names ? g_hash_table_size(names) : 0);
+    fail = 1;
+  }
+
+  rm("IMG_0005.CR2");
+  quiet();
+  if(jobs != 2 || !names || g_hash_table_size(names) != 1 || !g_hash_table_lookup(names, "IMG_0005.CR2"))
+  {
+    fprintf(stderr, "FAILED: removed file: %d jobs\n", jobs);
+    fail = 1;
+  }
+
+  dt_fswatch_remove(fswatch, DT_FSWATCH_FILMROLL, GINT_TO_POINTER(7));
+  rm("IMG_0006.CR2");
+  quiet();
+  if(jobs != 2)
+  {
+    fprintf(stderr, "FAILED: %d jobs after the watch was removed\n", jobs);
+    fail = 1;
+  }
+  dt_fswatch_destroy(fswatch);
+  if(names) g_hash_table_destroy(names);
+
+  for(int k=0; k<20; k++)
+  {
+    snprintf(name, sizeof(name), "IMG_%04d.CR2", k);
+    rm(name);
+  }
+  rm("IMG_0004.CR2.xmp");
+  rm(".hidden");
+  rmdir(sub);
+  rmdir(folder);
+  return fail;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,463 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2012 johannes hanika.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// benchmark of the recursive gaussian in common/gaussian.c, blocks of columns and rows
+// against the previous version, which went one column (and one row) per iteration.
+// usage: ./gaussian [width height sigma runs]
+
+#define _XOPEN_SOURCE 600
+#include <stdlib.h>
+#include <string.h>
+
+// define what gaussian.c needs from dt, so we don't need to include the rest of it:
+#define DT_OPENCL_H
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+static inline void *dt_alloc_align(size_t alignment, size_t size)
+{
+  void *ptr = NULL;
+  if(posix_memalign(&ptr, alignment, size)) return NULL;
+  return ptr;
+}
+#ifdef _OPENMP
+#  include <omp.h>
+static inline int dt_get_num_threads() { return omp_get_num_procs(); }
+#else
+static inline int dt_get_num_threads() { return 1; }
+#endif
+#include "common/gaussian.c"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+static double
+get_time()
+{
+  struct timeval time;
+  gettimeofday(&time, NULL);
+  return time.tv_sec + time.tv_usec*1e-6;
+}
+
+// the previous version, column by column:
+static void
+ref_gaussian_blur(
+    dt_gaussian_t *g,
+    float    *in,
+    float    *out)
+{
+
+  const int width = g->width;
+  const int height = g->height;
+  const int ch = g->channels;
+
+  float a0, a1, a2, a3, b1, b2, coefp, coefn;
+
+  compute_gauss_params(g->sigma, g->order, &a0, &a1, &a2, &a3, &b1, &b2, &coefp, &coefn);
+
+  float *temp = g->buf;
+
+  float *Labmax = g->max;
+  float *Labmin = g->min;
+
+  // vertical blur column by column
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(in,out,temp,Labmin,Labmax,a0,a1,a2,a3,b1,b2,coefp,coefn) schedule(static)
+#endif
+  for(int i=0; i<width; i++)
+  {
+    float xp[ch];
+    float yb[ch];
+    float yp[ch];
+    float xc[ch];
+    float yc[ch];
+    float xn[ch];
+    float xa[ch];
+    float yn[ch];
+    float ya[ch];
+
+    // forward filter
+    for(int k=0; k<ch; k++)
+    {
+      xp[k] = CLAMPF(in[i*ch+k], Labmin[k], Labmax[k]);
+      yb[k] = xp[k] * coefp;
+      yp[k] = yb[k];
+      xc[k] = yc[k] = xn[k] = xa[k] = yn[k] = ya[k] = 0.0f;
+    }
+ 
+    for(int j=0; j<height; j++)
+    {
+      int offset = (i + j * width)*ch;
+
+      for(int k=0; k<ch; k++)
+      {
+        xc[k] = CLAMPF(in[offset+k], Labmin[k], Labmax[k]);
+        yc[k] = (a0 * xc[k]) + (a1 * xp[k]) - (b1 * yp[k]) - (b2 * yb[k]);
+
+        temp[offset+k] = yc[k];
+
+        xp[k] = xc[k];
+        yb[k] = yp[k];
+        yp[k] = yc[k];
+      }
+    }
+
+    // backward filter
+    for(int k=0; k<ch; k++)
+    {
+      xn[k] = CLAMPF(in[((height - 1) * width + i)*ch+k], Labmin[k], Labmax[k]);
+      xa[k] = xn[k];
+      yn[k] = xn[k] * coefn;
+      ya[k] = yn[k];
+    }
+
+    for(int j=height - 1; j > -1; j--)
+    {
+      int offset = (i + j * width)*ch;
+
+      for(int k=0; k<ch; k++)
+      {      
+        xc[k] = CLAMPF(in[offset+k], Labmin[k], Labmax[k]);
+
+        yc[k] = (a2 * xn[k]) + (a3 * xa[k]) - (b1 * yn[k]) - (b2 * ya[k]);
+
+        xa[k] = xn[k]; 
+        xn[k] = xc[k]; 
+        ya[k] = yn[k]; 
+        yn[k] = yc[k];
+
+        temp[offset+k] += yc[k];
+      }
+    }
+  }
+
+  // horizontal blur line by line
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(out,temp,Labmin,Labmax,a0,a1,a2,a3,b1,b2,coefp,coefn) schedule(static)
+#endif
+  for(int j=0; j<height; j++)
+  {
+    float xp[ch];
+    float yb[ch];
+    float yp[ch];
+    float xc[ch];
+    float yc[ch];
+    float xn[ch];
+    float xa[ch];
+    float yn[ch];
+    float ya[ch];
+
+    // forward filter
+    for(int k=0; k<ch; k++)
+    {
+      xp[k] = CLAMPF(temp[j*width*ch+k], Labmin[k], Labmax[k]);
+      yb[k] = xp[k] * coefp;
+      yp[k] = yb[k];
+      xc[k] = yc[k] = xn[k] = xa[k] = yn[k] = ya[k] = 0.0f;
+    }
+ 
+    for(int i=0; i<width; i++)
+    {
+      int offset = (i + j * width)*ch;
+
+      for(int k=0; k<ch; k++)
+      {
+        xc[k] = CLAMPF(temp[offset+k], Labmin[k], Labmax[k]);
+        yc[k] = (a0 * xc[k]) + (a1 * xp[k]) - (b1 * yp[k]) - (b2 * yb[k]);
+
+        out[offset+k] = yc[k];
+
+        xp[k] = xc[k];
+        yb[k] = yp[k];
+        yp[k] = yc[k];
+      }
+    }
+
+    // backward filter
+    for(int k=0; k<ch; k++)
+    {
+      xn[k] = CLAMPF(temp[((j + 1)*width - 1)*ch + k], Labmin[k], Labmax[k]);
+      xa[k] = xn[k];
+      yn[k] = xn[k] * coefn;
+      ya[k] = yn[k];
+    }
+
+    for(int i=width - 1; i > -1; i--)
+    {
+      int offset = (i + j * width)*ch;
+
+      for(int k=0; k<ch; k++)
+      {      
+        xc[k] = CLAMPF(temp[offset+k], Labmin[k], Labmax[k]);
+
+        yc[k] = (a2 * xn[k]) + (a3 * xa[k]) - (b1 * yn[k]) - (b2 * ya[k]);
+
+        xa[k] = xn[k]; 
+        xn[k] = xc[k]; 
+        ya[k] = yn[k]; 
+        yn[k] = yc[k];
+
+        out[offset+k] += yc[k];
+      }
+    }
+  }
+}
+
+
+
+static void
+ref_gaussian_blur_4c(
+    dt_gaussian_t *g,
+    float    *in,
+    float    *out)
+{
+
+  const int width = g->width;
+  const int height = g->height;
+  const int ch = 4;
+
+  assert(g->channels == 4);
+
+  float a0, a1, a2, a3, b1, b2, coefp, coefn;
+
+  compute_gauss_params(g->sigma, g->order, &a0, &a1, &a2, &a3, &b1, &b2, &coefp, &coefn);
+
+  const __m128 Labmax = _mm_set_ps(g->max[3], g->max[2], g->max[1], g->max[0]);
+  const __m128 Labmin = _mm_set_ps(g->min[3], g->min[2], g->min[1], g->min[0]);
+
+  float *temp = g->buf;
+
+
+  // vertical blur column by column
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(in,out,temp,a0,a1,a2,a3,b1,b2,coefp,coefn) schedule(static)
+#endif
+  for(int i=0; i<width; i++)
+  {
+    __m128 xp = _mm_setzero_ps();
+    __m128 yb = _mm_setzero_ps();
+    __m128 yp = _mm_setzero_ps();
+    __m128 xc = _mm_setzero_ps();
+    __m128 yc = _mm_setzero_ps();
+    __m128 xn = _mm_setzero_ps();
+    __m128 xa = _mm_setzero_ps();
+    __m128 yn = _mm_setzero_ps();
+    __m128 ya = _mm_setzero_ps();
+
+    // forward filter
+    xp = MMCLAMPPS(_mm_load_ps(in+i*ch), Labmin, Labmax);
+    yb = _mm_mul_ps(_mm_set_ps1(coefp), xp);
+    yp = yb;
+
+ 
+    for(int j=0; j<height; j++)
+    {
+      int offset = (i + j * width)*ch;
+
+      xc = MMCLAMPPS(_mm_load_ps(in+offset), Labmin, Labmax);
+
+
+      yc = _mm_add_ps(_mm_mul_ps(xc, _mm_set_ps1(a0)),
+           _mm_sub_ps(_mm_mul_ps(xp, _mm_set_ps1(a1)),
+           _mm_add_ps(_mm_mul_ps(yp, _mm_set_ps1(b1)), _mm_mul_ps(yb, _mm_set_ps1(b2)))));
+
+      _mm_store_ps(temp+offset, yc);
+
+      xp = xc;
+      yb = yp;
+      yp = yc;
+
+    }
+
+    // backward filter
+    xn = MMCLAMPPS(_mm_load_ps(in+((height - 1) * width + i)*ch), Labmin, Labmax);
+    xa = xn;
+    yn = _mm_mul_ps(_mm_set_ps1(coefn), xn);
+    ya = yn;
+
+    for(int j=height - 1; j > -1; j--)
+    {
+      int offset = (i + j * width)*ch;
+
+      xc = MMCLAMPPS(_mm_load_ps(in+offset), Labmin, Labmax);
+
+      yc = _mm_add_ps(_mm_mul_ps(xn, _mm_set_ps1(a2)),
+           _mm_sub_ps(_mm_mul_ps(xa, _mm_set_ps1(a3)),
+           _mm_add_ps(_mm_mul_ps(yn, _mm_set_ps1(b1)), _mm_mul_ps(ya, _mm_set_ps1(b2)))));
+
+
+      xa = xn; 
+      xn = xc; 
+      ya = yn; 
+      yn = yc;
+
+      _mm_store_ps(temp+offset, _mm_add_ps(_mm_load_ps(temp+offset), yc));
+    }
+  }
+
+  // horizontal blur line by line
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(out,temp,a0,a1,a2,a3,b1,b2,coefp,coefn) schedule(static)
+#endif
+  for(int j=0; j<height; j++)
+  {
+    __m128 xp = _mm_setzero_ps();
+    __m128 yb = _mm_setzero_ps();
+    __m128 yp = _mm_setzero_ps();
+    __m128 xc = _mm_setzero_ps();
+    __m128 yc = _mm_setzero_ps();
+    __m128 xn = _mm_setzero_ps();
+    __m128 xa = _mm_setzero_ps();
+    __m128 yn = _mm_setzero_ps();
+    __m128 ya = _mm_setzero_ps();
+
+    // forward filter
+    xp = MMCLAMPPS(_mm_load_ps(temp+j*width*ch), Labmin, Labmax);
+    yb = _mm_mul_ps(_mm_set_ps1(coefp), xp);
+    yp = yb;
+
+ 
+    for(int i=0; i<width; i++)
+    {
+      int offset = (i + j * width)*ch;
+
+      xc = MMCLAMPPS(_mm_load_ps(temp+offset), Labmin, Labmax);
+
+      yc = _mm_add_ps(_mm_mul_ps(xc, _mm_set_ps1(a0)),
+           _mm_sub_ps(_mm_mul_ps(xp, _mm_set_ps1(a1)),
+           _mm_add_ps(_mm_mul_ps(yp, _mm_set_ps1(b1)), _mm_mul_ps(yb, _mm_set_ps1(b2)))));
+
+      _mm_store_ps(out+offset, yc);
+
+      xp = xc;
+      yb = yp;
+      yp = yc;
+    }
+
+    // backward filter
+    xn = MMCLAMPPS(_mm_load_ps(temp+((j + 1)*width - 1)*ch), Labmin, Labmax);
+    xa = xn;
+    yn = _mm_mul_ps(_mm_set_ps1(coefn), xn);
+    ya = yn;
+
+
+    for(int i=width - 1; i > -1; i--)
+    {
+      int offset = (i + j * width)*ch;
+
+      xc = MMCLAMPPS(_mm_load_ps(temp+offset), Labmin, Labmax);
+
+      yc = _mm_add_ps(_mm_mul_ps(xn, _mm_set_ps1(a2)),
+           _mm_sub_ps(_mm_mul_ps(xa, _mm_set_ps1(a3)),
+           _mm_add_ps(_mm_mul_ps(yn, _mm_set_ps1(b1)), _mm_mul_ps(ya, _mm_set_ps1(b2)))));
+
+
+      xa = xn; 
+      xn = xc; 
+      ya = yn; 
+      yn = yc;
+
+      _mm_store_ps(out+offset, _mm_add_ps(_mm_load_ps(out+offset), yc));
+    }
+  }
+}
+
+
+static float
+max_diff(const float *a, const float *b, const size_t n)
+{
+  float m = 0.0f;
+  for(size_t k=0; k<n; k++) m = fmaxf(m, fabsf(a[k] - b[k]));
+  return m;
+}
+
+static int
+bench(const int width, const int height, const int ch, const float sigma, const int runs)
+{
+  const size_t n = (size_t)width*height*ch;
+  float *in  = (float *)dt_alloc_align(64, sizeof(float)*n);
+  float *ref = (float *)dt_alloc_align(64, sizeof(float)*n);
+  float *out = (float *)dt_alloc_align(64, sizeof(float)*n);
+  // something with structure on several scales, plus a bit of noise:
+  uint32_t seed = 1;
+  for(int j=0; j<height; j++) for(int i=0; i<width; i++) for(int c=0; c<ch; c++)
+  {
+    const float x = i/(float)width, y = j/(float)height;
+    in[((size_t)j*width+i)*ch+c] = 50.0f + 40.0f*sinf(13.0f*x + c)*cosf(7.0f*y) + 10.0f*sinf(97.0f*x*y)
+                                   + ((seed = seed*1664525u + 1013904223u)/4294967296.0f - 0.5f);
+  }
+  const float max[4] = { 100.0f, 100.0f, 100.0f, 1.0f };
+  const float min[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+  dt_gaussian_t *g = dt_gaussian_init(width, height, ch, max, min, sigma, DT_IOP_GAUSSIAN_ZERO);
+  if(!g) return 1;
+
+  double start = get_time();
+  for(int r=0; r<runs; r++)
+  {
+    if(ch == 4) ref_gaussian_blur_4c(g, in, ref);
+    else ref_gaussian_blur(g, in, ref);
+  }
+  const double t_ref = (get_time() - start)/runs;
+  start = get_time();
+  for(int r=0; r<runs; r++)
+  {
+    if(ch == 4) dt_gaussian_blur_4c(g, in, out);
+    else dt_gaussian_blur(g, in, out);
+  }
+  const double t_new = (get_time() - start)/runs;
+  const float diff = max_diff(ref, out, n);
+  fprintf(stderr, "%dx%d, %d channel%s, sigma %g: previous %.3fs, blocked %.3fs (%.2fx), max difference %g\n",
+          width, height, ch, ch > 1 ? "s" : "", sigma, t_ref, t_new, t_ref/t_new, diff);
+
+  // the blend mask is blurred in place
+  if(ch == 1)
+  {
+    memcpy(out, in, sizeof(float)*n);
+    dt_gaussian_blur(g, out, out);
+  }
+  const float diff_inplace = ch == 1 ? max_diff(ref, out, n) : 0.0f;
+
+  dt_gaussian_free(g);
+  free(in);
+  free(ref);
+  free(out);
+  // values are up to 100, the sums only run in a different order
+  return diff > 1e-3f || diff_inplace > 1e-3f;
+}
+
+int main(int argc, char *argv[])
+{
+  const int width  = argc > 1 ? atol(argv[1]) : 6000;
+  const int height = argc > 2 ? atol(argv[2]) : 4000;
+  const float sigma = argc > 3 ? atof(argv[3]) : 20.0f;
+  const int runs = argc > 4 ? atol(argv[4]) : 3;
+
+  int fail = 0;
+  fail |= bench(width, height, 1, sigma, runs);
+  fail |= bench(width, height, 4, sigma, runs);
+  // odd sizes, for the columns and rows left over
+  fail |= bench(width/7*2+3, height/7*2+1, 1, sigma, 1);
+  fail |= bench(width/7*2+3, height/7*2+1, 4, sigma, 1);
+  fail |= bench(width/7*2+3, height/7*2+1, 3, sigma, 1);
+  if(fail) fprintf(stderr, "FAILED: results differ\n");
+  return fail;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
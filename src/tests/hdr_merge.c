@@ -0,0 +1,199 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2012 johannes hanika.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// test of the hdr merge in common/hdr_merge.c on synthetic brackets: a scene with a known
+// radiance over 16 stops is shot at a few exposure times, the frames are merged one at a
+// time and the result has to be proportional to the radiance wherever one of the frames
+// saw it unclipped. also compares against the previous version of the merge, which cleared
+// the sums first and searched the saturation level serially, and prints the timings.
+// usage: ./hdr_merge [width height frames]
+
+#define _XOPEN_SOURCE 600
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// define what hdr_merge.c needs from dt, so we don't need to include the rest of it:
+#define DARKTABLE_H
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define CLAMPS(A, L, H) ((A) > (L) ? ((A) < (H) ? (A) : (H)) : (L))
+static inline void *dt_alloc_align(size_t alignment, size_t size)
+{
+  void *ptr = NULL;
+  if(posix_memalign(&ptr, alignment, size)) return NULL;
+  return ptr;
+}
+#include "common/hdr_merge.c"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+static double
+get_time()
+{
+  struct timeval time;
+  gettimeofday(&time, NULL);
+  return time.tv_sec + time.tv_usec*1e-6;
+}
+
+// radiance of the scene: 16 stops from left to right, a bit of structure from top to bottom.
+static float
+radiance(const int x, const int y, const int wd)
+{
+  return exp2f(-6.0f + 16.0f*x/(float)wd) * (1.0f + 0.25f*sinf(y*0.05f));
+}
+
+// one frame with exposure time exp, 4 stops apart, the longest one clipping most of the scene.
+static void
+shoot(uint16_t *frame, const int wd, const int ht, const float exp)
+{
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static)
+#endif
+  for(int j=0; j<ht; j++) for(int i=0; i<wd; i++)
+  {
+    const float v = radiance(i, j, wd) * exp * 16.0f;
+    frame[(size_t)j*wd+i] = v > 65535.0f ? 65535 : (uint16_t)(v + 0.5f);
+  }
+}
+
+// the same calibration as the merge hdr job does from the exif data: f/8 at 50mm, iso 100.
+static void
+calibrate(const float exp, float *photoncnt, float *cal)
+{
+  const float rad = .5f * 50.0f/8.0f;
+  const float aperture = M_PI * rad * rad;
+  const float iso = 100.0f;
+  *cal = 100.0f/(aperture*exp*iso);
+  *photoncnt = 100.0f*aperture*exp/iso;
+}
+
+// the previous version, as it was in dt_control_merge_hdr_job_run():
+static void
+ref_merge_add(float *pixels, float *weight, float *whitelevel, const uint16_t *in, const int wd, const int ht,
+              const float photoncnt, const float cal)
+{
+  uint16_t saturation = 0;
+  for(int k=0; k<wd*ht; k++)
+    saturation = MAX(saturation, in[k]);
+  *whitelevel = fmaxf(*whitelevel, saturation*cal);
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static)
+#endif
+  for(int k=0; k<wd*ht; k++)
+  {
+    float w = envelope(in[k]/(float)saturation) * photoncnt;
+    if(w < 1e-3f && in[k] < saturation/3) w = 1e-3f;
+    pixels[k] += w * in[k] * cal;
+    weight[k] += w;
+  }
+}
+
+static void
+ref_merge_finish(float *pixels, const float *weight, const float whitelevel, const int wd, const int ht)
+{
+  for(int k=0; k<wd*ht; k++)
+  {
+    if(weight[k] < 1e-3f) pixels[k] = 1.f;
+    else pixels[k] = fmaxf(0.0f, pixels[k]/(whitelevel*weight[k]));
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  const int wd = argc > 2 ? atol(argv[1]) : 4000;
+  const int ht = argc > 2 ? atol(argv[2]) : 3000;
+  const int frames = argc > 3 ? atol(argv[3]) : 3;
+  const size_t npixels = (size_t)wd*ht;
+  fprintf(stderr, "merging %d frames of %dx%d\n", frames, wd, ht);
+
+  // the frames are shot one after the other into the same buffer, the merge never sees more than one.
+  uint16_t *frame = (uint16_t *)dt_alloc_align(64, sizeof(uint16_t)*npixels);
+  float *ref_pixels = (float *)dt_alloc_align(64, sizeof(float)*npixels);
+  float *ref_weight = (float *)dt_alloc_align(64, sizeof(float)*npixels);
+  float ref_whitelevel = 0.0f;
+  double start = get_time();
+  dt_hdr_merge_t *m = dt_hdr_merge_init(wd, ht);
+  double t_merge = get_time() - start;
+  if(!frame || !ref_pixels || !ref_weight || !m) return 1;
+  start = get_time();
+  memset(ref_pixels, 0, sizeof(float)*npixels);
+  memset(ref_weight, 0, sizeof(float)*npixels);
+  double t_ref = get_time() - start;
+
+  for(int f=0; f<frames; f++)
+  {
+    const float exp = exp2f(-4.0f*f);
+    float photoncnt, cal;
+    calibrate(exp, &photoncnt, &cal);
+    shoot(frame, wd, ht, exp);
+    start = get_time();
+    ref_merge_add(ref_pixels, ref_weight, &ref_whitelevel, frame, wd, ht, photoncnt, cal);
+    t_ref += get_time() - start;
+    start = get_time();
+    dt_hdr_merge_add(m, frame, photoncnt, cal);
+    t_merge += get_time() - start;
+  }
+  start = get_time();
+  ref_merge_finish(ref_pixels, ref_weight, ref_whitelevel, wd, ht);
+  t_ref += get_time() - start;
+  start = get_time();
+  const float *out = dt_hdr_merge_finish(m);
+  t_merge += get_time() - start;
+
+  // the result has to match the previous version,
+  float max_diff = 0.0f;
+  for(size_t k=0; k<npixels; k++)
+    max_diff = fmaxf(max_diff, fabsf(out[k] - ref_pixels[k])/fmaxf(ref_pixels[k], 1e-6f));
+
+  // and be proportional to the radiance where the shortest exposure is not clipped and the
+  // longest one is well above the black level. the middle of the first row calibrates.
+  const float scale = out[wd/2] / radiance(wd/2, 0, wd);
+  const float shortest = 16.0f*exp2f(-4.0f*(frames-1));
+  float max_err = 0.0f;
+  int checked = 0;
+  for(int j=0; j<ht; j++) for(int i=0; i<wd; i++)
+  {
+    const float l = radiance(i, j, wd);
+    if(l*16.0f < 64.0f || l*shortest > 0.9f*65535.0f) continue;
+    max_err = fmaxf(max_err, fabsf(out[(size_t)j*wd+i]/(scale*l) - 1.0f));
+    checked++;
+  }
+
+  fprintf(stderr, "previous version                     %.3fs\n", t_ref);
+  fprintf(stderr, "row blocks, first frame initializes  %.3fs\n", t_merge);
+  fprintf(stderr, "peak memory of the merge             %.1f MB + one frame of %.1f MB\n",
+          2.0*sizeof(float)*npixels/(1<<20), (double)sizeof(uint16_t)*npixels/(1<<20));
+  fprintf(stderr, "max relative difference to previous  %g\n", max_diff);
+  fprintf(stderr, "max relative error in radiance       %g (%d pixels)\n", max_err, checked);
+
+  const int fail = max_diff > 1e-5f || max_err > 0.02f || checked == 0;
+  if(fail) fprintf(stderr, "FAILED\n");
+
+  dt_hdr_merge_cleanup(m);
+  free(frame);
+  free(ref_pixels);
+  free(ref_weight);
+  return fail;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
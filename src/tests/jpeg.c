@@ -0,0 +1,203 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2012 johannes hanika.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// benchmark of decoding jpegs for thumbnails, as _init_8() in the mipmap cache does it:
+// the full image against the scaled idct of dt_imageio_jpeg_scale_to(). prints images per
+// second for the jpegs in a folder, or for a few synthetic 3000x2000 ones if none is given,
+// and checks that the scaled decode covers the thumbnail and looks like the full one.
+// usage: ./jpeg [folder [width height]]
+
+#define _XOPEN_SOURCE 700
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <math.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+// define what imageio_jpeg.c needs from dt, so we don't need to include the rest of it:
+#define DT_EXIF_H
+#define DT_IMAGE_IO_H
+#define DT_COLORSPACES_H
+#define DT_IMAGE_H
+#define DT_MIPMAP_CACHE_H
+#define CLAMPS(A, L, H) ((A) > (L) ? ((A) < (H) ? (A) : (H)) : (L))
+typedef struct dt_image_t { int width, height, bpp, exif_inited; } dt_image_t;
+typedef void *dt_mipmap_cache_allocator_t;
+typedef enum dt_imageio_retval_t { DT_IMAGEIO_OK = 0, DT_IMAGEIO_FILE_CORRUPTED, DT_IMAGEIO_CACHE_FULL } dt_imageio_retval_t;
+typedef enum dt_mipmap_size_t { DT_MIPMAP_FULL } dt_mipmap_size_t;
+typedef void *cmsHPROFILE;
+static int dt_exif_read(dt_image_t *img, const char *filename) { (void)img; (void)filename; return 0; }
+static int dt_image_orientation(const dt_image_t *img) { (void)img; return 0; }
+static void *dt_mipmap_cache_alloc(dt_image_t *img, dt_mipmap_size_t size, dt_mipmap_cache_allocator_t a)
+{
+  (void)img; (void)size; (void)a;
+  return NULL;
+}
+static void dt_imageio_flip_buffers_ui8_to_float(float *out, const uint8_t *in, const float black, const float white,
+    const int ch, const int wd, const int ht, const int fwd, const int fht, const int stride, const int orientation)
+{
+  (void)out; (void)in; (void)black; (void)white; (void)ch; (void)wd; (void)ht; (void)fwd; (void)fht; (void)stride;
+  (void)orientation;
+}
+static cmsHPROFILE dt_colorspaces_create_output_profile(const int imgid) { (void)imgid; return NULL; }
+static void dt_colorspaces_cleanup_profile(cmsHPROFILE p) { (void)p; }
+static int cmsSaveProfileToMem(cmsHPROFILE p, void *mem, uint32_t *len) { (void)p; (void)mem; *len = 0; return 0; }
+#include "common/imageio_jpeg.c"
+
+static double
+get_time()
+{
+  struct timeval time;
+  gettimeofday(&time, NULL);
+  return time.tv_sec + time.tv_usec*1e-6;
+}
+
+// a few photo-like test images: smooth gradients with some texture, quality 95 as cameras do.
+static int
+write_samples(const char *dir, const int n)
+{
+  const int wd = 3000, ht = 2000;
+  uint8_t *img = (uint8_t *)malloc(4*wd*ht);
+  for(int s=0; s<n; s++)
+  {
+    for(int j=0; j<ht; j++) for(int i=0; i<wd; i++)
+    {
+      const float tex = 20.0f*sinf(0.07f*i*(s+1))*sinf(0.05f*j);
+      img[4*(j*wd+i)+0] = CLAMPS(255.0f*i/wd + tex, 0, 255);
+      img[4*(j*wd+i)+1] = CLAMPS(255.0f*j/ht + tex, 0, 255);
+      img[4*(j*wd+i)+2] = CLAMPS(128.0f + 64.0f*s - tex, 0, 255);
+    }
+    char filename[1100];
+    snprintf(filename, sizeof(filename), "%s/sample-%d.jpg", dir, s);
+    if(dt_imageio_jpeg_write(filename, img, wd, ht, 95, NULL, 0)) return 1;
+  }
+  free(img);
+  return 0;
+}
+
+// decodes one file, at full size or scaled to cover wd x ht. returns the buffer, NULL on failure.
+static uint8_t *
+decode(const char *filename, const int wd, const int ht, const int scaled, int *width, int *height)
+{
+  dt_imageio_jpeg_t jpg;
+  if(dt_imageio_jpeg_read_header(filename, &jpg)) return NULL;
+  if(scaled) dt_imageio_jpeg_scale_to(&jpg, wd, ht);
+  uint8_t *buf = (uint8_t *)malloc(4*jpg.width*jpg.height);
+  if(dt_imageio_jpeg_read(&jpg, buf))
+  {
+    free(buf);
+    return NULL;
+  }
+  *width = jpg.width;
+  *height = jpg.height;
+  return buf;
+}
+
+// mean absolute difference of the green channel of the scaled decode against box filtered full size.
+static float
+compare(const uint8_t *full, const int fw, const int fh, const uint8_t *scaled, const int sw, const int sh)
+{
+  const int f = fw/sw;
+  double diff = 0.0;
+  for(int j=0; j<sh && (j+1)*f<=fh; j++) for(int i=0; i<sw && (i+1)*f<=fw; i++)
+  {
+    float sum = 0.0f;
+    for(int jj=0; jj<f; jj++) for(int ii=0; ii<f; ii++)
+      sum += full[4*((j*f+jj)*fw+i*f+ii)+1];
+    diff += fabsf(sum/(f*f) - scaled[4*(j*sw+i)+1]);
+  }
+  return diff/(sw*sh);
+}
+
+int main(int argc, char *argv[])
+{
+  const int wd = argc > 3 ? atol(argv[2]) : 400;
+  const int ht = argc > 3 ? atol(argv[3]) : 300;
+  char dir[1024];
+  int samples = 0;
+  if(argc > 1) snprintf(dir, sizeof(dir), "%s", argv[1]);
+  else
+  {
+    snprintf(dir, sizeof(dir), "/tmp/dt-jpeg-XXXXXX");
+    if(!mkdtemp(dir) || write_samples(dir, 4)) return 1;
+    samples = 4;
+  }
+
+  DIR *d = opendir(dir);
+  if(!d) return 1;
+  struct dirent *e;
+  int images = 0, fail = 0;
+  double t_full = 0.0, t_scaled = 0.0, mpx_full = 0.0, mpx_scaled = 0.0, max_diff = 0.0;
+  while((e = readdir(d)))
+  {
+    const char *c = e->d_name + strlen(e->d_name);
+    while(*c != '.' && c > e->d_name) c--;
+    if(strcasecmp(c, ".jpg") && strcasecmp(c, ".jpeg")) continue;
+    char filename[2048];
+    snprintf(filename, sizeof(filename), "%s/%s", dir, e->d_name);
+
+    int fw = 0, fh = 0, sw = 0, sh = 0;
+    double start = get_time();
+    uint8_t *full = decode(filename, wd, ht, 0, &fw, &fh);
+    t_full += get_time() - start;
+    start = get_time();
+    uint8_t *scaled = decode(filename, wd, ht, 1, &sw, &sh);
+    t_scaled += get_time() - start;
+    if(!full || !scaled)
+    {
+      fprintf(stderr, "could not decode `%s'\n", filename);
+      fail = 1;
+    }
+    else
+    {
+      // the thumbnail must not get any smaller than it was from the full size image.
+      if(sw < wd && sh < ht && (sw < fw || sh < fh))
+      {
+        fprintf(stderr, "`%s' scaled to %dx%d, doesn't cover %dx%d\n", filename, sw, sh, wd, ht);
+        fail = 1;
+      }
+      max_diff = fmax(max_diff, compare(full, fw, fh, scaled, sw, sh));
+      mpx_full += fw*fh*1e-6;
+      mpx_scaled += sw*sh*1e-6;
+      images++;
+    }
+    free(full);
+    free(scaled);
+    if(samples) unlink(filename);
+  }
+  closedir(d);
+  if(samples) rmdir(dir);
+
+  if(!images) return 1;
+  fprintf(stderr, "%d jpegs, thumbnails of %dx%d\n", images, wd, ht);
+  fprintf(stderr, "full size decode   %.3fs, %6.1f images/s, %.1f megapixels\n", t_full, images/t_full, mpx_full);
+  fprintf(stderr, "scaled idct        %.3fs, %6.1f images/s, %.1f megapixels\n", t_scaled, images/t_scaled, mpx_scaled);
+  fprintf(stderr, "max mean difference to the box filtered full size %.2f\n", max_diff);
+  // a few levels at most, the scaled idct averages much like a box filter.
+  fail |= max_diff > 4.0;
+  if(fail) fprintf(stderr, "FAILED\n");
+  return fail;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,217 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2012 johannes hanika.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// benchmark of the permutohedral lattice as bilateral.cc and tonemap.cc use it:
+// a fresh lattice per run (as it used to be) against one that is reset and reused,
+// and the threaded splat and merge against a single thread, which adds up in one table.
+// usage: ./permutohedral [width height sigma_s runs]
+#include "iop/Permutohedral.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <sys/time.h>
+#ifdef _OPENMP
+#  include <omp.h>
+#else
+#  define omp_get_max_threads() 1
+#  define omp_get_thread_num() 0
+#endif
+
+static double
+get_time()
+{
+  struct timeval time;
+  gettimeofday(&time, NULL);
+  return time.tv_sec + time.tv_usec*1e-6;
+}
+
+// the lattice part of bilateral.cc, isigma are the inverse sigmas.
+static void
+bilateral(PermutohedralLattice<5,4> &lattice, const int threads, const float *in, float *out,
+          const int width, const int height, const float *isigma)
+{
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(threads)
+#endif
+  for(int j=0; j<height; j++)
+  {
+    const float *i4 = in + 4*(size_t)j*width;
+    const int thread = omp_get_thread_num();
+    int index = j*width;
+    for(int i=0; i<width; i++, index++, i4+=4)
+    {
+      float pos[5] = {i*isigma[0], j*isigma[1], i4[0]*isigma[2], i4[1]*isigma[3], i4[2]*isigma[4]};
+      float val[4] = {i4[0], i4[1], i4[2], 1.0};
+      lattice.splat(pos, val, index, thread);
+    }
+  }
+  lattice.merge_splat_threads();
+  lattice.blur();
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for(int j=0; j<height; j++)
+  {
+    float *o4 = out + 4*(size_t)j*width;
+    int index = j*width;
+    for(int i=0; i<width; i++, index++, o4+=4)
+    {
+      float val[4];
+      lattice.slice(val, index);
+      for(int k=0; k<3; k++) o4[k] = val[k]/val[3];
+    }
+  }
+}
+
+// the lattice part of tonemap.cc, on the log of the luminance.
+static void
+tonemap(PermutohedralLattice<3,2> &lattice, const int threads, const float *in, float *out,
+        const int width, const int height, const float inv_sigma_s)
+{
+  const float inv_sigma_r = 1.0/0.4;
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(threads)
+#endif
+  for(int j=0; j<height; j++)
+  {
+    const float *i4 = in + 4*(size_t)j*width;
+    const int thread = omp_get_thread_num();
+    int index = j*width;
+    for(int i=0; i<width; i++, index++, i4+=4)
+    {
+      const float L = logf(fmaxf(0.2126*i4[0] + 0.7152*i4[1] + 0.0722*i4[2], 1e-6f));
+      float pos[3] = {i*inv_sigma_s, j*inv_sigma_s, L*inv_sigma_r};
+      float val[2] = {L, 1.0};
+      lattice.splat(pos, val, index, thread);
+    }
+  }
+  lattice.merge_splat_threads();
+  lattice.blur();
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for(int j=0; j<height; j++)
+  {
+    int index = j*width;
+    for(int i=0; i<width; i++, index++)
+    {
+      float val[2];
+      lattice.slice(val, index);
+      out[(size_t)j*width + i] = val[0]/val[1];
+    }
+  }
+}
+
+static float
+max_diff(const float *a, const float *b, const size_t n)
+{
+  float m = 0.0f;
+  for(size_t k=0; k<n; k++) m = fmaxf(m, fabsf(a[k] - b[k]));
+  return m;
+}
+
+int main(int argc, char *argv[])
+{
+  const int width  = argc > 1 ? atol(argv[1]) : 3000;
+  const int height = argc > 2 ? atol(argv[2]) : 2000;
+  const float sigma_s = argc > 3 ? atof(argv[3]) : 25.0f;
+  const int runs = argc > 4 ? atol(argv[4]) : 5;
+  const int threads = omp_get_max_threads();
+  const size_t n = (size_t)width*height;
+
+  // something with structure on several scales, plus a bit of noise:
+  float *in = (float *)malloc(sizeof(float)*4*n);
+  uint32_t seed = 1;
+  for(int j=0; j<height; j++) for(int i=0; i<width; i++)
+  {
+    const float x = i/(float)width, y = j/(float)height;
+    const float v = 0.5f + 0.25f*sinf(13.0f*x)*cosf(7.0f*y) + 0.15f*sinf(97.0f*x*y);
+    for(int c=0; c<3; c++)
+      in[4*((size_t)j*width+i)+c] = fminf(fmaxf(v*(0.7f + 0.15f*c) + 0.03f*((seed = seed*1664525u + 1013904223u)/4294967296.0f - 0.5f), 0.0f), 1.0f);
+    in[4*((size_t)j*width+i)+3] = 0.0f;
+  }
+  float *ref = (float *)calloc(4*n, sizeof(float));
+  float *out = (float *)calloc(4*n, sizeof(float));
+  const float isigma[5] = {1.0f/sigma_s, 1.0f/sigma_s, 1.0f/0.1f, 1.0f/0.1f, 1.0f/0.1f};
+  const float inv_sigma_s = 1.0f/sigma_s;
+  fprintf(stderr, "%dx%d, sigma_s %g, %d threads, %d runs\n", width, height, sigma_s, threads, runs);
+
+  // bilateral: one thread is the plain algorithm, every vertex in a single table.
+  {
+    PermutohedralLattice<5,4> single(n, 1);
+    bilateral(single, 1, in, ref, width, height, isigma);
+  }
+  double start = get_time();
+  for(int r=0; r<runs; r++)
+  {
+    PermutohedralLattice<5,4> fresh(n, threads);
+    bilateral(fresh, threads, in, out, width, height, isigma);
+  }
+  const double t_fresh = (get_time() - start)/runs;
+  const float d_fresh = max_diff(ref, out, 4*n);
+  PermutohedralLattice<5,4> lattice(n, threads, PermutohedralLattice<5,4>::estimate(width, height, isigma[0]));
+  start = get_time();
+  for(int r=0; r<runs; r++)
+  {
+    lattice.reset(n, PermutohedralLattice<5,4>::estimate(width, height, isigma[0]));
+    bilateral(lattice, threads, in, out, width, height, isigma);
+  }
+  const double t_reused = (get_time() - start)/runs;
+  const float d_reused = max_diff(ref, out, 4*n);
+  fprintf(stderr, "bilateral: fresh %.3fs, reused %.3fs, max difference to a single thread %g / %g\n",
+          t_fresh, t_reused, d_fresh, d_reused);
+  int fail = d_fresh > 1e-4f || d_reused > 1e-4f;
+
+  // tonemap, the same on the 3d lattice:
+  {
+    PermutohedralLattice<3,2> single(n, 1);
+    tonemap(single, 1, in, ref, width, height, inv_sigma_s);
+  }
+  start = get_time();
+  for(int r=0; r<runs; r++)
+  {
+    PermutohedralLattice<3,2> fresh(n, threads);
+    tonemap(fresh, threads, in, out, width, height, inv_sigma_s);
+  }
+  const double t_fresh3 = (get_time() - start)/runs;
+  const float d_fresh3 = max_diff(ref, out, n);
+  PermutohedralLattice<3,2> lattice3(n, threads, PermutohedralLattice<3,2>::estimate(width, height, inv_sigma_s));
+  start = get_time();
+  for(int r=0; r<runs; r++)
+  {
+    lattice3.reset(n, PermutohedralLattice<3,2>::estimate(width, height, inv_sigma_s));
+    tonemap(lattice3, threads, in, out, width, height, inv_sigma_s);
+  }
+  const double t_reused3 = (get_time() - start)/runs;
+  const float d_reused3 = max_diff(ref, out, n);
+  fprintf(stderr, "tonemap:   fresh %.3fs, reused %.3fs, max difference to a single thread %g / %g\n",
+          t_fresh3, t_reused3, d_fresh3, d_reused3);
+  fail |= d_fresh3 > 1e-4f || d_reused3 > 1e-4f;
+
+  free(in);
+  free(ref);
+  free(out);
+  if(fail) fprintf(stderr, "FAILED: results differ\n");
+  return fail;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -170,7 +170,17 @@ void expose(dt_view_t *self, cairo_t *cri, int32_t width_i, int32_t height_i, in
     dt_view_set_scrollbar(self, zx+.5-boxw*.5, 1.0, boxw, zy+.5-boxh*.5, 1.0, boxh);
   }
 
-  if(!dev->image_dirty && dev->pipe->input_timestamp >= dev->preview_pipe->input_timestamp)
+  const int draw_image = !dev->image_dirty && dev->pipe->input_timestamp >= dev->preview_pipe->input_timestamp;
+  // the full pipe's render in progress, but only if it's for the roi on screen. keeps the mutex locked if so.
+  int draw_progressive = 0;
+  if(!draw_image && !closeup && !(dev->pipe->changed & DT_DEV_PIPE_ZOOMED))
+  {
+    dt_pthread_mutex_lock(&dev->pipe->backbuf_mutex);
+    draw_progressive = dt_dev_progressive_current(dev, zoom, zoom_x, zoom_y);
+    if(!draw_progressive) dt_pthread_mutex_unlock(&dev->pipe->backbuf_mutex);
+  }
+
+  if(draw_image)
   {
     // draw image
     mutex = &dev->pipe->backbuf_mutex;
@@ -204,6 +214,25 @@ void expose(dt_view_t *self, cairo_t *cri, int32_t width_i, int32_t height_i, in
     dt_pthread_mutex_unlock(mutex);
     image_surface_imgid = dev->image_storage.id;
   }
+  else if(draw_progressive)
+  {
+    // draw the full pipe's render in progress, it's in the same place as the final image.
+    mutex = &dev->pipe->backbuf_mutex;
+    wd = dev->progressive.width;
+    ht = dev->progressive.height;
+    stride = cairo_format_stride_for_width (CAIRO_FORMAT_RGB24, wd);
+    surface = cairo_image_surface_create_for_data (dev->progressive.buf, CAIRO_FORMAT_RGB24, wd, ht, stride);
+    cairo_set_source_rgb (cr, .2, .2, .2);
+    cairo_paint(cr);
+    cairo_translate(cr, .5f*(width-wd), .5f*(height-ht));
+    cairo_rectangle(cr, 0, 0, wd, ht);
+    cairo_set_source_surface (cr, surface, 0, 0);
+    cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_FAST);
+    cairo_fill(cr);
+    cairo_surface_destroy (surface);
+    dt_pthread_mutex_unlock(mutex);
+    image_surface_imgid = dev->image_storage.id;
+  }
   else if(!dev->preview_dirty)
   {
     // draw preview
@@ -30,8 +30,49 @@
 
 #include "osm-gps-map.h"
 
+#include <float.h>
+#include <math.h>
+
 DT_MODULE(1)
 
+/* leaves of the spatial index hold at most this many images */
+#define DT_MAP_INDEX_LEAF_SIZE 16
+#define DT_MAP_INDEX_MAX_DEPTH 24
+
+/* a geotagged image, x and y are web mercator coordinates normalized to [0,1] */
+typedef struct dt_map_point_t
+{
+  gint imgid;
+  double x, y;
+} dt_map_point_t;
+
+/* quadtree node over a range of the (reordered) point array. every node knows its
+   tight bounding box, its image count and the centroid, so a whole subtree can be
+   turned into a single cluster without visiting its points. */
+typedef struct dt_map_node_t
+{
+  double min_x, min_y, max_x, max_y;
+  double cx, cy;
+  gint begin, end;
+  gint child[4];
+} dt_map_node_t;
+
+typedef struct dt_map_index_t
+{
+  dt_map_point_t *points;
+  gint num_points;
+  dt_map_node_t *nodes;
+  gint num_nodes, alloc_nodes;
+  gboolean valid;
+} dt_map_index_t;
+
+/* one screen cell of the clustering grid */
+typedef struct dt_map_cell_t
+{
+  gint count;
+  gint imgid; // the image if count == 1
+  double sx, sy;
+} dt_map_cell_t;
 
 typedef struct dt_map_t
 {
@@ -41,6 +82,8 @@ typedef struct dt_map_t
   GSList *images;
   gint selected_image;
   gboolean start_drag;
+  gint max_images_drawn;
+  dt_map_index_t index;
   struct
   {
     sqlite3_stmt *main_query;
@@ -49,7 +92,7 @@ typedef struct dt_map_t
 
 typedef struct dt_map_image_t
 {
-  gint imgid;
+  gint imgid; // 0 for cluster markers
   OsmGpsMapImage *image;
   gint width, height;
 } dt_map_image_t;
@@ -142,19 +185,15 @@ void init(dt_view_t *self)
     g_signal_connect(GTK_WIDGET(lib->map), "drag-failed", G_CALLBACK(_view_map_dnd_failed_callback), self);
   }
 
-  /* build the query string */
-  int max_images_drawn = dt_conf_get_int("plugins/map/max_images_drawn");
-  if(max_images_drawn == 0)
-    max_images_drawn = 100;
-  char *geo_query = g_strdup_printf("select * from (select id from images where \
-                              longitude >= ?1 and longitude <= ?2 and latitude <= ?3 and latitude >= ?4 \
-                              and longitude not NULL and latitude not NULL order by abs(latitude - ?5), abs(longitude - ?6) \
-                              limit 0, %d) order by id", max_images_drawn);
+  /* the number of thumbnails, everything else is drawn as cluster markers */
+  lib->max_images_drawn = dt_conf_get_int("plugins/map/max_images_drawn");
+  if(lib->max_images_drawn == 0)
+    lib->max_images_drawn = 100;
 
-  /* prepare the main query statement */
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), geo_query, -1, &lib->statements.main_query, NULL);
-
-  g_free(geo_query);
+  /* prepare the main query statement, it feeds the spatial index */
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "select id, longitude, latitude from images where longitude not NULL and latitude not NULL",
+                              -1, &lib->statements.main_query, NULL);
 }
 
 void cleanup(dt_view_t *self)
@@ -162,6 +201,9 @@ void cleanup(dt_view_t *self)
   dt_map_t *lib = (dt_map_t *)self->data;
   if(darktable.gui)
     g_object_unref(G_OBJECT(lib->osd));
+  sqlite3_finalize(lib->statements.main_query);
+  free(lib->index.points);
+  free(lib->index.nodes);
   free(self->data);
 }
 
@@ -320,6 +362,279 @@ static gboolean _view_map_redraw(gpointer user_data)
   return FALSE; // remove the function again
 }
 
+static inline double _view_map_lon_to_x(const double lon)
+{
+  return (lon + 180.0) / 360.0;
+}
+
+static inline double _view_map_lat_to_y(const double lat)
+{
+  // web mercator is cut off at about 85 degrees, like the map tiles
+  const double l = CLAMP(lat, -85.05112878, 85.05112878) * M_PI / 180.0;
+  return 0.5 - log(tan(l) + 1.0 / cos(l)) / (2.0 * M_PI);
+}
+
+static inline double _view_map_x_to_lon(const double x)
+{
+  return x * 360.0 - 180.0;
+}
+
+static inline double _view_map_y_to_lat(const double y)
+{
+  return atan(sinh(M_PI * (1.0 - 2.0 * y))) * 180.0 / M_PI;
+}
+
+static gint _view_map_index_partition(dt_map_point_t *p, gint begin, gint end, const int axis_y, const double split)
+{
+  gint i = begin, j = end;
+  while(i < j)
+  {
+    const double v = axis_y ? p[i].y : p[i].x;
+    if(v < split)
+      i++;
+    else
+    {
+      j--;
+      const dt_map_point_t tmp = p[i];
+      p[i] = p[j];
+      p[j] = tmp;
+    }
+  }
+  return i;
+}
+
+/* build the subtree for the points [begin,end), which lie in the square at x0,y0 of the given size */
+static gint _view_map_index_build(dt_map_index_t *idx, gint begin, gint end, double x0, double y0, double size, int depth)
+{
+  if(idx->num_nodes == idx->alloc_nodes)
+  {
+    idx->alloc_nodes = MAX(64, 2*idx->alloc_nodes);
+    idx->nodes = (dt_map_node_t *)realloc(idx->nodes, sizeof(dt_map_node_t)*idx->alloc_nodes);
+  }
+  const gint n = idx->num_nodes++;
+  dt_map_node_t *node = idx->nodes + n;
+
+  node->begin = begin;
+  node->end = end;
+  node->min_x = node->min_y = DBL_MAX;
+  node->max_x = node->max_y = -DBL_MAX;
+  node->cx = node->cy = 0.0;
+  for(int k=0; k<4; k++) node->child[k] = -1;
+  for(gint i=begin; i<end; i++)
+  {
+    const dt_map_point_t *p = idx->points + i;
+    node->min_x = MIN(node->min_x, p->x);
+    node->max_x = MAX(node->max_x, p->x);
+    node->min_y = MIN(node->min_y, p->y);
+    node->max_y = MAX(node->max_y, p->y);
+    node->cx += p->x;
+    node->cy += p->y;
+  }
+  node->cx /= end - begin;
+  node->cy /= end - begin;
+
+  if(end - begin <= DT_MAP_INDEX_LEAF_SIZE || depth >= DT_MAP_INDEX_MAX_DEPTH)
+    return n;
+
+  // split into quadrants: first by y, then both halves by x
+  const double h = 0.5*size;
+  const gint mid = _view_map_index_partition(idx->points, begin, end, 1, y0 + h);
+  const gint b[5] = { begin,
+                      _view_map_index_partition(idx->points, begin, mid, 0, x0 + h),
+                      mid,
+                      _view_map_index_partition(idx->points, mid, end, 0, x0 + h),
+                      end
+                    };
+  for(int k=0; k<4; k++)
+  {
+    if(b[k+1] == b[k]) continue;
+    // the recursion may move the node array, don't keep a pointer across it
+    const gint c = _view_map_index_build(idx, b[k], b[k+1], x0 + (k&1)*h, y0 + (k>>1)*h, h, depth+1);
+    idx->nodes[n].child[k] = c;
+  }
+  return n;
+}
+
+/* (re)load all geotagged images into the spatial index if it has been invalidated */
+static void _view_map_index_update(dt_map_t *lib)
+{
+  dt_map_index_t *idx = &lib->index;
+  if(idx->valid) return;
+
+  gint alloc_points = MAX(idx->num_points, 1024);
+  idx->points = (dt_map_point_t *)realloc(idx->points, sizeof(dt_map_point_t)*alloc_points);
+  idx->num_points = 0;
+  idx->num_nodes = 0;
+
+  DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
+  while(sqlite3_step(lib->statements.main_query) == SQLITE_ROW)
+  {
+    if(idx->num_points == alloc_points)
+    {
+      alloc_points *= 2;
+      idx->points = (dt_map_point_t *)realloc(idx->points, sizeof(dt_map_point_t)*alloc_points);
+    }
+    dt_map_point_t *p = idx->points + idx->num_points++;
+    p->imgid = sqlite3_column_int(lib->statements.main_query, 0);
+    p->x = _view_map_lon_to_x(sqlite3_column_double(lib->statements.main_query, 1));
+    p->y = _view_map_lat_to_y(sqlite3_column_double(lib->statements.main_query, 2));
+  }
+
+  if(idx->num_points > 0)
+    _view_map_index_build(idx, 0, idx->num_points, 0.0, 0.0, 1.0, 0);
+  idx->valid = TRUE;
+
+  dt_print(DT_DEBUG_PERF, "[map] indexed %d geotagged images in %d nodes\n", idx->num_points, idx->num_nodes);
+}
+
+typedef struct dt_map_grid_t
+{
+  dt_map_cell_t *cells;
+  gint cols, rows;
+  double x0, y0, x1, y1; // visible area in mercator coordinates
+  double scale;          // screen pixels per mercator unit
+  double cell;           // cell size in screen pixels
+} dt_map_grid_t;
+
+static void _view_map_grid_add(dt_map_grid_t *g, const double x, const double y, const gint count, const gint imgid)
+{
+  const double px = (x - g->x0)*g->scale, py = (y - g->y0)*g->scale;
+  if(px < 0.0 || py < 0.0) return;
+  const int cx = px / g->cell, cy = py / g->cell;
+  if(cx >= g->cols || cy >= g->rows) return;
+  dt_map_cell_t *c = g->cells + cy*g->cols + cx;
+  if(c->count == 0) c->imgid = imgid;
+  c->count += count;
+  c->sx += count*x;
+  c->sy += count*y;
+}
+
+/* collect the images of a subtree into the grid. subtrees that are small on screen
+   go in as a whole, only the ones spread over several cells are descended into. */
+static void _view_map_grid_add_node(const dt_map_index_t *idx, dt_map_grid_t *g, const gint n)
+{
+  const dt_map_node_t *node = idx->nodes + n;
+  if(node->max_x < g->x0 || node->min_x > g->x1 || node->max_y < g->y0 || node->min_y > g->y1)
+    return;
+
+  const double extent = MAX(node->max_x - node->min_x, node->max_y - node->min_y)*g->scale;
+  if(extent < 0.5*g->cell)
+  {
+    _view_map_grid_add(g, node->cx, node->cy, node->end - node->begin, idx->points[node->begin].imgid);
+    return;
+  }
+
+  gboolean leaf = TRUE;
+  for(int k=0; k<4; k++)
+  {
+    if(node->child[k] < 0) continue;
+    leaf = FALSE;
+    _view_map_grid_add_node(idx, g, node->child[k]);
+  }
+  if(leaf)
+    for(gint i=node->begin; i<node->end; i++)
+      _view_map_grid_add(g, idx->points[i].x, idx->points[i].y, 1, idx->points[i].imgid);
+}
+
+/* round marker with the number of images it stands for */
+static GdkPixbuf *_view_map_cluster_pixbuf(const gint count)
+{
+  char text[16];
+  snprintf(text, sizeof(text), "%d", count);
+  const int size = 20 + 4*(int)log10(count);
+
+  cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, size, size);
+  cairo_t *cr = cairo_create(surface);
+  cairo_arc(cr, 0.5*size, 0.5*size, 0.5*size - 1.0, 0.0, 2.0*M_PI);
+  cairo_set_source_rgba(cr, 0.15, 0.15, 0.15, 0.8);
+  cairo_fill_preserve(cr);
+  cairo_set_line_width(cr, 1.5);
+  cairo_set_source_rgb(cr, 0.9, 0.9, 0.9);
+  cairo_stroke(cr);
+
+  cairo_text_extents_t te;
+  cairo_select_font_face(cr, "sans-serif", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+  cairo_set_font_size(cr, count < 1000 ? 0.5*size : 0.4*size);
+  cairo_text_extents(cr, text, &te);
+  cairo_move_to(cr, 0.5*size - te.width/2 - te.x_bearing, 0.5*size - te.height/2 - te.y_bearing);
+  cairo_show_text(cr, text);
+  cairo_destroy(cr);
+  cairo_surface_flush(surface);
+
+  // cairo gives premultiplied native endian argb, gdk wants straight rgba bytes
+  GdkPixbuf *pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, size, size);
+  const uint8_t *src = cairo_image_surface_get_data(surface);
+  const int src_stride = cairo_image_surface_get_stride(surface);
+  uint8_t *dst = gdk_pixbuf_get_pixels(pixbuf);
+  const int dst_stride = gdk_pixbuf_get_rowstride(pixbuf);
+  for(int j=0; j<size; j++)
+    for(int i=0; i<size; i++)
+    {
+      const uint32_t p = ((const uint32_t *)(src + j*src_stride))[i];
+      const uint32_t a = p >> 24;
+      uint8_t *d = dst + j*dst_stride + 4*i;
+      d[0] = a ? (((p >> 16) & 0xff)*255 + a/2)/a : 0;
+      d[1] = a ? (((p >>  8) & 0xff)*255 + a/2)/a : 0;
+      d[2] = a ? (( p        & 0xff)*255 + a/2)/a : 0;
+      d[3] = a;
+    }
+  cairo_surface_destroy(surface);
+  return pixbuf;
+}
+
+/* thumbnail with a small border to put on the map, NULL if the mipmap isn't available (yet) */
+static GdkPixbuf *_view_map_image_pixbuf(const gint imgid, const int ts, const dt_mipmap_get_flags_t flags, gint *width, gint *height)
+{
+  GdkPixbuf *source = NULL, *scaled = NULL;
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, ts, ts);
+  dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, mip, flags);
+
+  if(buf.buf)
+  {
+    uint8_t *scratchmem = dt_mipmap_cache_alloc_scratchmem(darktable.mipmap_cache);
+    uint8_t *buf_decompressed = dt_mipmap_cache_decompress(&buf, scratchmem);
+
+    uint8_t *rgbbuf = (uint8_t*)malloc((buf.width+2)*(buf.height+2)*3);
+    if(!rgbbuf) goto map_pixbuf_failure;
+    memset(rgbbuf, 64, (buf.width+2)*(buf.height+2)*3);
+    for(int i=1; i<=buf.height; i++)
+      for(int j=1; j<=buf.width; j++)
+        for(int k=0; k<3; k++)
+          rgbbuf[(i*(buf.width+2)+j)*3+k] = buf_decompressed[((i-1)*buf.width+j-1)*4+2-k];
+
+    int w=ts, h=ts;
+    if(buf.width < buf.height) w = (buf.width*ts)/buf.height; // portrait
+    else                       h = (buf.height*ts)/buf.width; // landscape
+
+    source = gdk_pixbuf_new_from_data(rgbbuf, GDK_COLORSPACE_RGB, FALSE, 8, (buf.width+2), (buf.height+2), (buf.width+2)*3, NULL, NULL);
+    if(source)
+      scaled = gdk_pixbuf_scale_simple(source, w, h, GDK_INTERP_HYPER);
+    *width = w;
+    *height = h;
+
+map_pixbuf_failure:
+    if(source)
+      g_object_unref(source);
+    if(rgbbuf)
+      free(rgbbuf);
+  }
+  dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+  return scaled;
+}
+
+typedef struct dt_map_single_t
+{
+  double dist;
+  gint cell;
+} dt_map_single_t;
+
+static int _view_map_single_cmp(const void *a, const void *b)
+{
+  const double da = ((const dt_map_single_t *)a)->dist, db = ((const dt_map_single_t *)b)->dist;
+  return (da > db) - (da < db);
+}
+
 static void _view_map_changed_callback(OsmGpsMap *map, dt_view_t *self)
 {
   dt_map_t *lib = (dt_map_t *)self->data;
@@ -352,18 +667,6 @@ static void _view_map_changed_callback(OsmGpsMap *map, dt_view_t *self)
   dt_conf_set_float("plugins/map/latitude", center_lat);
   dt_conf_set_int("plugins/map/zoom", zoom);
 
-  /* let's reset and reuse the main_query statement */
-  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
-  DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
-
-  /* bind bounding box coords for the main query */
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 1, bb_0_lon - west_border);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 2, bb_1_lon);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 3, bb_0_lat);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 4, bb_1_lat - south_border);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 5, center_lat);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 6, center_lon);
-
   /* remove the old images */
   osm_gps_map_image_remove_all(map);
   if(lib->images)
@@ -373,65 +676,80 @@ static void _view_map_changed_callback(OsmGpsMap *map, dt_view_t *self)
     lib->images = NULL;
   }
 
-  /* add  all images to the map */
-  gboolean needs_redraw = FALSE;
-  dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, ts, ts);
-  while(sqlite3_step(lib->statements.main_query) == SQLITE_ROW)
+  _view_map_index_update(lib);
+  if(lib->index.num_nodes == 0) return;
+
+  /* cluster everything visible on a grid of thumbnail sized screen cells */
+  dt_map_grid_t grid;
+  grid.x0 = _view_map_lon_to_x(bb_0_lon - west_border);
+  grid.x1 = _view_map_lon_to_x(bb_1_lon);
+  grid.y0 = _view_map_lat_to_y(bb_0_lat);
+  grid.y1 = _view_map_lat_to_y(bb_1_lat - south_border);
+  grid.scale = ldexp(256.0, zoom);
+  grid.cell = ts;
+  grid.cols = (grid.x1 - grid.x0)*grid.scale/grid.cell + 1;
+  grid.rows = (grid.y1 - grid.y0)*grid.scale/grid.cell + 1;
+  // the view crosses the date line or is degenerate, don't bother
+  if(grid.cols <= 0 || grid.rows <= 0 || grid.cols > 1024 || grid.rows > 1024) return;
+  grid.cells = (dt_map_cell_t *)calloc(grid.cols*grid.rows, sizeof(dt_map_cell_t));
+  _view_map_grid_add_node(&lib->index, &grid, 0);
+
+  /* the single images closest to the center get thumbnails, all the others a marker */
+  const double center_x = _view_map_lon_to_x(center_lon), center_y = _view_map_lat_to_y(center_lat);
+  dt_map_single_t *singles = (dt_map_single_t *)malloc(sizeof(dt_map_single_t)*grid.cols*grid.rows);
+  int num_singles = 0;
+  for(int k=0; k<grid.cols*grid.rows; k++)
   {
-    int imgid = sqlite3_column_int(lib->statements.main_query, 0);
-    dt_mipmap_buffer_t buf;
-    dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, mip, DT_MIPMAP_BEST_EFFORT);
+    const dt_map_cell_t *c = grid.cells + k;
+    if(c->count != 1) continue;
+    singles[num_singles].dist = (c->sx - center_x)*(c->sx - center_x) + (c->sy - center_y)*(c->sy - center_y);
+    singles[num_singles++].cell = k;
+  }
+  qsort(singles, num_singles, sizeof(dt_map_single_t), _view_map_single_cmp);
 
-    if(buf.buf)
+  gboolean needs_redraw = FALSE;
+  for(int s=0; s<MIN(num_singles, lib->max_images_drawn); s++)
+  {
+    dt_map_cell_t *c = grid.cells + singles[s].cell;
+    gint w = 0, h = 0;
+    GdkPixbuf *scaled = _view_map_image_pixbuf(c->imgid, ts, DT_MIPMAP_BEST_EFFORT, &w, &h);
+    if(!scaled)
+    {
+      needs_redraw = TRUE;
+      continue; // gets a marker below for now
+    }
+    //TODO: add back the arrow on the left lower corner of the image, pointing to the location
+    const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, c->imgid);
+    if(cimg)
     {
-      GdkPixbuf *source = NULL, *scaled = NULL;
-      uint8_t *scratchmem = dt_mipmap_cache_alloc_scratchmem(darktable.mipmap_cache);
-      uint8_t *buf_decompressed = dt_mipmap_cache_decompress(&buf, scratchmem);
-
-      uint8_t *rgbbuf = (uint8_t*)malloc((buf.width+2)*(buf.height+2)*3);
-      if(!rgbbuf) goto map_changed_failure;
-      memset(rgbbuf, 64, (buf.width+2)*(buf.height+2)*3);
-      for(int i=1; i<=buf.height; i++)
-        for(int j=1; j<=buf.width; j++)
-          for(int k=0; k<3; k++)
-            rgbbuf[(i*(buf.width+2)+j)*3+k] = buf_decompressed[((i-1)*buf.width+j-1)*4+2-k];
-
-      int w=ts, h=ts;
-      if(buf.width < buf.height) w = (buf.width*ts)/buf.height; // portrait
-      else                       h = (buf.height*ts)/buf.width; // landscape
-
-      source = gdk_pixbuf_new_from_data(rgbbuf, GDK_COLORSPACE_RGB, FALSE, 8, (buf.width+2), (buf.height+2), (buf.width+2)*3, NULL, NULL);
-      if(!source) goto map_changed_failure;
-      scaled = gdk_pixbuf_scale_simple(source, w, h, GDK_INTERP_HYPER);
-      if(!scaled) goto map_changed_failure;
-      //TODO: add back the arrow on the left lower corner of the image, pointing to the location
-      const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, imgid);
-      if(!cimg) goto map_changed_failure;
       dt_map_image_t *entry = (dt_map_image_t*)malloc(sizeof(dt_map_image_t));
-      if(!entry)
-      {
-        dt_image_cache_read_release(darktable.image_cache, cimg);
-        goto map_changed_failure;
-      }
-      entry->imgid = imgid;
+      entry->imgid = c->imgid;
       entry->image = osm_gps_map_image_add_with_alignment(map, cimg->latitude, cimg->longitude, scaled, 0, 1);
       entry->width = w;
       entry->height = h;
       lib->images = g_slist_prepend(lib->images, entry);
       dt_image_cache_read_release(darktable.image_cache, cimg);
-
-map_changed_failure:
-      if(source)
-        g_object_unref(source);
-      if(scaled)
-        g_object_unref(scaled);
-      if(rgbbuf)
-        free(rgbbuf);
+      c->count = 0; // done
     }
-    else
-      needs_redraw = TRUE;
-    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    g_object_unref(scaled);
+  }
+  free(singles);
+
+  for(int k=0; k<grid.cols*grid.rows; k++)
+  {
+    const dt_map_cell_t *c = grid.cells + k;
+    if(c->count == 0) continue;
+    GdkPixbuf *marker = _view_map_cluster_pixbuf(c->count);
+    dt_map_image_t *entry = (dt_map_image_t*)malloc(sizeof(dt_map_image_t));
+    entry->imgid = 0;
+    entry->image = osm_gps_map_image_add_with_alignment(map, _view_map_y_to_lat(c->sy / c->count),
+                   _view_map_x_to_lon(c->sx / c->count), marker, 0.5, 0.5);
+    entry->width = gdk_pixbuf_get_width(marker);
+    entry->height = gdk_pixbuf_get_height(marker);
+    lib->images = g_slist_prepend(lib->images, entry);
+    g_object_unref(marker);
   }
+  free(grid.cells);
 
   // not exactly thread safe, but should be good enough for updating the display
   static int timeout_event_source = 0;
@@ -449,6 +767,7 @@ static int _view_map_get_img_at_pos(dt_view_t *self, double x, double y)
   for(iter = lib->images; iter != NULL; iter = iter->next)
   {
     dt_map_image_t *entry = (dt_map_image_t*)iter->data;
+    if(entry->imgid == 0) continue; // cluster marker
     OsmGpsMapImage *image = entry->image;
     OsmGpsMapPoint *pt = (OsmGpsMapPoint*)osm_gps_map_image_get_point(image);
     gint img_x=0, img_y=0;
@@ -481,44 +800,15 @@ static gboolean _view_map_motion_notify_callback(GtkWidget *w, GdkEventMotion *e
     lib->start_drag = FALSE;
     GtkTargetList *targets = gtk_target_list_new(target_list_all, n_targets_all);
 
-    dt_mipmap_buffer_t buf;
-    dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, ts, ts);
-    dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, lib->selected_image, mip, DT_MIPMAP_BLOCKING);
-
-    if(buf.buf)
+    gint width = 0, height = 0;
+    GdkPixbuf *scaled = _view_map_image_pixbuf(lib->selected_image, ts, DT_MIPMAP_BLOCKING, &width, &height);
+    if(scaled)
     {
-      GdkPixbuf *scaled = NULL, *source = NULL;
-      uint8_t *scratchmem = dt_mipmap_cache_alloc_scratchmem(darktable.mipmap_cache);
-      uint8_t *buf_decompressed = dt_mipmap_cache_decompress(&buf, scratchmem);
-
-      uint8_t *rgbbuf = (uint8_t*)malloc((buf.width+2)*(buf.height+2)*3);
-      if(!rgbbuf) goto map_motion_failure;
-      memset(rgbbuf, 64, (buf.width+2)*(buf.height+2)*3);
-      for(int i=1; i<=buf.height; i++)
-        for(int j=1; j<=buf.width; j++)
-          for(int k=0; k<3; k++)
-            rgbbuf[(i*(buf.width+2)+j)*3+k] = buf_decompressed[((i-1)*buf.width+j-1)*4+2-k];
-
-      int w=ts, h=ts;
-      if(buf.width < buf.height) w = (buf.width*ts)/buf.height; // portrait
-      else                       h = (buf.height*ts)/buf.width; // landscape
-
-      source = gdk_pixbuf_new_from_data(rgbbuf, GDK_COLORSPACE_RGB, FALSE, 8, (buf.width+2), (buf.height+2), (buf.width+2)*3, NULL, NULL);
-      scaled = gdk_pixbuf_scale_simple(source, w, h, GDK_INTERP_HYPER);
       GdkDragContext * context = gtk_drag_begin(GTK_WIDGET(lib->map), targets, GDK_ACTION_COPY, 1, (GdkEvent*)e);
       gtk_drag_set_icon_pixbuf(context, scaled, 0, 0);
-
-map_motion_failure:
-      if(source)
-        g_object_unref(source);
-      if(scaled)
-        g_object_unref(scaled);
-      if(rgbbuf)
-        free(rgbbuf);
+      g_object_unref(scaled);
     }
 
-    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
-
     gtk_target_list_unref(targets);
     return TRUE;
   }
@@ -572,6 +862,9 @@ void enter(dt_view_t *self)
   lib->selected_image = 0;
   lib->start_drag = FALSE;
 
+  /* images might have been (un)tagged or removed elsewhere, rebuild the index on the next redraw */
+  lib->index.valid = FALSE;
+
   /* replace center widget */
   GtkWidget *parent = gtk_widget_get_parent(dt_ui_center(darktable.gui->ui));
   gtk_widget_hide(dt_ui_center(darktable.gui->ui));
@@ -750,7 +1043,10 @@ drag_and_drop_received(GtkWidget *widget, GdkDragContext *context, gint x, gint
   }
   gtk_drag_finish(context, success, FALSE, time);
   if(success)
+  {
+    lib->index.valid = FALSE;
     g_signal_emit_by_name(lib->map, "changed");
+  }
 }
 
 static void